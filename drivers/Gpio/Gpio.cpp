@@ -71,7 +71,7 @@ void Gpio::toggle() {
  * @brief Initialize interruopt and attach interrupt funtion to the gpio pin
  * 
  */
-void Gpio::attachInterrupt(gpio_num_t gpio_pin, gpio_isr_t handler){
+void Gpio::attachInterrupt(gpio_num_t gpio_pin, gpio_isr_t handler, void* arg){
     gpio_install_isr_service(0);
-    gpio_isr_handler_add(gpio_pin, handler, NULL);
+    gpio_isr_handler_add(gpio_pin, handler, arg);
 }
\ No newline at end of file
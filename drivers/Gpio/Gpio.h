@@ -50,9 +50,11 @@ public:
 
     /**
      * @brief attach interrupt
-     * 
+     * @param gpio_pin The GPIO pin number.
+     * @param handler The ISR handler.
+     * @param arg Argument passed to the handler.
      */
-    void attachInterrupt(gpio_num_t gpio_pin, gpio_isr_t handler);
+    void attachInterrupt(gpio_num_t gpio_pin, gpio_isr_t handler, void* arg = NULL);
 
 private:
     gpio_num_t pin_;          // GPIO pin number
@@ -1,44 +1,46 @@
 #include "Modbus.h"
+#include "ModbusDeadband.h"
 #include "esp_log.h"
 #include "modbus_params.h"
 static const char *TAG = "ModbusRTU";
 
 
-// Modbus parameter descriptors for three devices
-mb_parameter_descriptor_t device_parameters[] = {
-    // Device 1
-    { CID_DEV_NAME1, STR("Device name 1"), STR("__"), MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 0, 8,
+// Parameters of a climate sensor. The slave address is filled in by the
+// profile of each slave; CIDs number the parameters of the type.
+const mb_parameter_descriptor_t climate_sensor_params[] = {
+    { CLIMATE_PARAM_NAME, STR("Device name"), STR("__"), 0, MB_PARAM_HOLDING, CLIMATE_REG_NAME, 8,
                     0, PARAM_TYPE_ASCII, PARAM_SIZE_ASCII, OPTS( 0, 0, 0 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_DEV_STATUS1, STR("Device status 1"), STR("--"), MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 8, 1,
+    { CLIMATE_PARAM_STATUS, STR("Device status"), STR("--"), 0, MB_PARAM_HOLDING, CLIMATE_REG_STATUS, 1,
                     0, PARAM_TYPE_U16, PARAM_SIZE_U16, OPTS( 0, 0, 0 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_HUMIDITY_DATA_1, STR("Humidity 1"), STR("%"), MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 9, 2,
+    { CLIMATE_PARAM_HUMIDITY, STR("Humidity"), STR("%"), 0, MB_PARAM_HOLDING, CLIMATE_REG_HUMIDITY, 2,
                     0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( 0, 100, 1 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_TEMP_DATA_1, STR("Temperature 1"), STR("C"), MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 11, 2,
+    { CLIMATE_PARAM_TEMPERATURE, STR("Temperature"), STR("C"), 0, MB_PARAM_HOLDING, CLIMATE_REG_TEMPERATURE, 2,
                     0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( -20, 50, 1 ), PAR_PERMS_READ_WRITE_TRIGGER },
+};
 
-    // Device 2
-    { CID_DEV_NAME2, STR("Device name 2"), STR("__"), MB_DEVICE_ADDR2, MB_PARAM_HOLDING, 0, 8,
-                    0, PARAM_TYPE_ASCII, PARAM_SIZE_ASCII, OPTS( 0, 0, 0 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_DEV_STATUS2, STR("Device status 2"), STR("--"), MB_DEVICE_ADDR2, MB_PARAM_HOLDING, 8, 1,
-                    0, PARAM_TYPE_U16, PARAM_SIZE_U16, OPTS( 0, 0, 0 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_HUMIDITY_DATA_2, STR("Humidity 2"), STR("%"), MB_DEVICE_ADDR2, MB_PARAM_HOLDING, 9, 2,
-                    0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( 0, 100, 1 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_TEMP_DATA_2, STR("Temperature 2"), STR("C"), MB_DEVICE_ADDR2, MB_PARAM_HOLDING, 11, 2,
-                    0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( -20, 50, 1 ), PAR_PERMS_READ_WRITE_TRIGGER },
+// Report-by-exception deadbands of the parameters above, within their OPTS ranges.
+// Status words pass on every change; each CID is reported at least every 5 minutes.
+const mb_deadband_t climate_sensor_deadbands[] = {
+    DEADBAND_STATUS(CLIMATE_PARAM_STATUS, 300000),
+    DEADBAND(CLIMATE_PARAM_HUMIDITY, 0.5, 0, 300000),
+    DEADBAND(CLIMATE_PARAM_TEMPERATURE, 0.1, 0, 300000),
+};
 
-    // Device 3
-    { CID_DEV_NAME3, STR("Device name 3"), STR("__"), MB_DEVICE_ADDR3, MB_PARAM_HOLDING, 0, 8,
-                    0, PARAM_TYPE_ASCII, PARAM_SIZE_ASCII, OPTS( 0, 0, 0 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_DEV_STATUS3, STR("Device status 3"), STR("--"), MB_DEVICE_ADDR3, MB_PARAM_HOLDING, 8, 1,
-                    0, PARAM_TYPE_U16, PARAM_SIZE_U16, OPTS( 0, 0, 0 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_HUMIDITY_DATA_3, STR("Humidity 3"), STR("%"), MB_DEVICE_ADDR3, MB_PARAM_HOLDING, 9, 2,
-                    0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( 0, 100, 1 ), PAR_PERMS_READ_WRITE_TRIGGER },
-    { CID_TEMP_DATA_3, STR("Temperature 3"), STR("C"), MB_DEVICE_ADDR3, MB_PARAM_HOLDING, 11, 2,
-                    0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( -20, 50, 1 ), PAR_PERMS_READ_WRITE_TRIGGER },
+const mb_device_type_t device_types[] = {
+    { DEVICE_TYPE_CLIMATE, "climate", climate_sensor_params, CLIMATE_NUM_PARAMS,
+      climate_sensor_deadbands, sizeof(climate_sensor_deadbands) / sizeof(climate_sensor_deadbands[0]) },
+};
+
+const size_t num_device_types = sizeof(device_types) / sizeof(device_types[0]);
+
+// Three climate sensors polled every second, the second one on segment 1 when there is one
+const mb_profile_slave_t default_slaves[] = {
+    { MB_DEVICE_ADDR1, DEVICE_TYPE_CLIMATE, 0, 1, 1000, 100 },
+    { MB_DEVICE_ADDR2, DEVICE_TYPE_CLIMATE, 1, 1, 1000, 100 },
+    { MB_DEVICE_ADDR3, DEVICE_TYPE_CLIMATE, 0, 1, 1000, 100 },
 };
 
-// Calculate number of parameters in the table
-uint16_t num_device_parameters = (sizeof(device_parameters) / sizeof(device_parameters[0]));
+const size_t num_default_slaves = sizeof(default_slaves) / sizeof(default_slaves[0]);
 
 
 
@@ -77,6 +79,7 @@ ModbusRTU::ModbusRTU(uint8_t slave_id, uart_port_t uart_port, uint32_t baudrate,
     this->tx_pin = tx_pin;
     this->rx_pin = rx_pin;
     this->rts_pin = rts_pin;
+    this->master_handler = nullptr;
 
     // Set up modbus parameters
     this->comm_info.port = uart_port;
@@ -123,8 +126,9 @@ bool ModbusRTU::init() {
         return false;
     }
 
-    // Set parameter descriptor table
-    err = mbc_master_set_descriptor(device_parameters, num_device_parameters);
+    // Set parameter descriptor table: the parameters of one climate sensor, the
+    // requests themselves are sent raw to the slave they are meant for
+    err = mbc_master_set_descriptor(climate_sensor_params, CLIMATE_NUM_PARAMS);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set parameter descriptor table: %s", esp_err_to_name(err));
         return false;
@@ -10,6 +10,8 @@
 
 #include "driver/uart.h"
 #include "mbcontroller.h"
+#include "ModbusRegisterMap.h"
+#include "ModbusProfiles.h"
 
 #define MB_PORT_NUM     (CONFIG_MB_UART_PORT_NUM)   // Number of UART port used for Modbus connection
 #define MB_DEV_SPEED    (CONFIG_MB_UART_BAUD_RATE)  // The communication speed of the UART
@@ -17,9 +19,6 @@
 // Note: Some pins on target chip cannot be assigned for UART communication.
 // See UART documentation for selected board and target to configure pins using Kconfig.
 
-// The number of parameters that intended to be used in the particular control process
-#define MASTER_MAX_CIDS num_device_parameters
-
 // Number of reading of parameters from slave
 #define MASTER_MAX_RETRY 30
 
@@ -43,20 +42,18 @@
 #define OPTS(min_val, max_val, step_val) { .opt1 = min_val, .opt2 = max_val, .opt3 = step_val }
 
 
-// Enumeration of all supported CIDs for device
+// Device types known to the gateway
 enum {
-    CID_DEV_NAME1 = 0,
-    CID_DEV_STATUS1,
-    CID_HUMIDITY_DATA_1,
-    CID_TEMP_DATA_1,
-    CID_DEV_NAME2,
-    CID_DEV_STATUS2,
-    CID_HUMIDITY_DATA_2,
-    CID_TEMP_DATA_2,
-    CID_DEV_NAME3,
-    CID_DEV_STATUS3,
-    CID_HUMIDITY_DATA_3,
-    CID_TEMP_DATA_3
+    DEVICE_TYPE_CLIMATE = 1,
+};
+
+// Parameters of a climate sensor, the CIDs of its type
+enum {
+    CLIMATE_PARAM_NAME = 0,
+    CLIMATE_PARAM_STATUS,
+    CLIMATE_PARAM_HUMIDITY,
+    CLIMATE_PARAM_TEMPERATURE,
+    CLIMATE_NUM_PARAMS
 };
 
 /**
@@ -80,8 +77,28 @@ enum {
     MB_DEVICE_ADDR3,
 };
 
+// Holding registers of the climate sensors, the same on every device
+enum {
+    CLIMATE_REG_NAME = 0,           // ASCII, 8 registers
+    CLIMATE_REG_STATUS = 8,         // U16
+    CLIMATE_REG_HUMIDITY = 9,       // Float, %RH
+    CLIMATE_REG_TEMPERATURE = 11,   // Float, degrees C
+};
+
+// Status, humidity and temperature of a climate sensor, floats high word first
+typedef ModbusRegisterMap<ModbusField<uint16_t, CLIMATE_REG_STATUS>,
+                          ModbusField<float, CLIMATE_REG_HUMIDITY, MB_ORDER_ABCD>,
+                          ModbusField<float, CLIMATE_REG_TEMPERATURE, MB_ORDER_ABCD>> ClimateSensorMap;
+
+extern const mb_parameter_descriptor_t climate_sensor_params[];
+extern const mb_deadband_t climate_sensor_deadbands[];
+
+extern const mb_device_type_t device_types[];
+extern const size_t num_device_types;
 
-extern mb_parameter_descriptor_t device_parameters[];
+// Slaves polled when NVS holds no profile blob
+extern const mb_profile_slave_t default_slaves[];
+extern const size_t num_default_slaves;
 
 class ModbusRTU : public ModbusInterface {
 private:
@@ -0,0 +1,339 @@
+#include "ModbusBus.h"
+#include "Modbus.h"
+#include "esp_log.h"
+
+#include <string.h>
+
+static const char *TAG = "ModbusBus";
+
+#if !MB_BUS_NATIVE_RTU
+// esp-modbus has one global master controller, a second bus would silently take it over
+static ModbusBus* s_controller_owner = nullptr;
+#endif
+
+ModbusBus::ModbusBus(uart_port_t uart_port, uint32_t baudrate, uart_parity_t parity, mb_mode_type_t mode, int tx_pin, int rx_pin, int rts_pin)
+    : uart_port(uart_port), comm_info(), master_handler(nullptr), tx_pin(tx_pin), rx_pin(rx_pin), rts_pin(rts_pin),
+#if MB_BUS_NATIVE_RTU
+      rtu(uart_port, baudrate, parity, tx_pin, rx_pin, rts_pin),
+#endif
+      request_queue(nullptr), task_handle(nullptr), next_batch(0), dead_batch(0), dead_slaves() {
+    this->comm_info.port = uart_port;
+    this->comm_info.mode = mode;
+    this->comm_info.baudrate = baudrate;
+    this->comm_info.parity = parity;
+}
+
+ModbusBus::~ModbusBus() {
+    if (task_handle != nullptr) {
+        // A request without a function code stops the bus task once the queue drains.
+        // As with transact, the wait is on a semaphore of its own, not the caller's notification.
+        ModbusRequest stop = {};
+        stop.result = ESP_ERR_NOT_FINISHED;
+        stop.done = xSemaphoreCreateBinary();
+        ModbusRequest* pending = &stop;
+        xQueueSend(request_queue, &pending, portMAX_DELAY);
+        if (stop.done != nullptr) {
+            xSemaphoreTake(stop.done, portMAX_DELAY);
+            vSemaphoreDelete(stop.done);
+        } else {
+            // No memory for the semaphore: poll until the bus task lets go of the request
+            while (__atomic_load_n(&stop.result, __ATOMIC_ACQUIRE) == ESP_ERR_NOT_FINISHED) {
+                vTaskDelay(1);
+            }
+        }
+        task_handle = nullptr;
+    }
+    if (request_queue != nullptr) {
+        vQueueDelete(request_queue);
+        request_queue = nullptr;
+    }
+#if !MB_BUS_NATIVE_RTU
+    if (master_handler != nullptr) {
+        mbc_master_destroy();
+        s_controller_owner = nullptr;
+    }
+#endif
+    master_handler = nullptr;
+}
+
+bool ModbusBus::init(BaseType_t core_id, UBaseType_t priority) {
+    if (master_handler != nullptr) {
+        ESP_LOGW(TAG, "Modbus bus already initialized");
+        return true;
+    }
+
+#if MB_BUS_NATIVE_RTU
+    if (comm_info.mode != MB_MODE_RTU) {
+        ESP_LOGE(TAG, "The native master only speaks RTU");
+        return false;
+    }
+    if (!rtu.init()) {
+        return false;
+    }
+    master_handler = &rtu;
+#else
+    if (s_controller_owner != nullptr) {
+        ESP_LOGE(TAG, "esp-modbus already runs the bus on UART%d, UART%d needs MB_BUS_NATIVE_RTU",
+                 (int)s_controller_owner->uart_port, (int)uart_port);
+        return false;
+    }
+
+    // Initialize Modbus controller
+    esp_err_t err = mbc_master_init(MB_PORT_SERIAL_MASTER, &master_handler);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize Modbus controller: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    // Configure Modbus communication parameters
+    err = mbc_master_setup((void*)&comm_info);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to setup Modbus communication: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    // Set UART pins
+    err = uart_set_pin(uart_port, tx_pin, rx_pin, rts_pin, UART_PIN_NO_CHANGE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set UART pins: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    // Start Modbus controller
+    err = mbc_master_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start Modbus controller: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    // The controller checks a descriptor table with CIDs numbering its entries;
+    // every request of the bus goes out raw, so one device type is enough
+    err = mbc_master_set_descriptor(climate_sensor_params, CLIMATE_NUM_PARAMS);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set parameter descriptor table: %s", esp_err_to_name(err));
+        return false;
+    }
+    s_controller_owner = this;
+#endif
+
+    request_queue = xQueueCreate(MB_BUS_QUEUE_LENGTH, sizeof(ModbusRequest*));
+    if (request_queue == nullptr) {
+        ESP_LOGE(TAG, "Failed to create bus request queue");
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(busTask, "mbBusTask", MB_BUS_TASK_STACK, this, priority, &task_handle,
+                                core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create bus task");
+        task_handle = nullptr;
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Modbus bus on UART%d initialized successfully (%s)", (int)uart_port,
+             MB_BUS_NATIVE_RTU ? "native RTU" : "esp-modbus");
+    return true;
+}
+
+esp_err_t ModbusBus::execute(const ModbusRequest* request) {
+#if MB_BUS_NATIVE_RTU
+    return rtu.transact(request->slave_id, request->command, request->address, request->quantity, request->data);
+#else
+    mb_param_request_t param = {};
+    param.slave_addr = request->slave_id;
+    param.command = request->command;
+    param.reg_start = request->address;
+    param.reg_size = request->quantity;
+    return mbc_master_send_request(&param, request->data);
+#endif
+}
+
+void ModbusBus::busTask(void* arg) {
+    ModbusBus* bus = static_cast<ModbusBus*>(arg);
+    ModbusRequest* req;
+
+    while (1) {
+        if (xQueueReceive(bus->request_queue, &req, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+        if (req->command == 0) {
+            // Stop request from the destructor, the request is gone once it is released
+            SemaphoreHandle_t done = req->done;
+            __atomic_store_n(&req->result, ESP_OK, __ATOMIC_RELEASE);
+            if (done != nullptr) {
+                xSemaphoreGive(done);
+            }
+            break;
+        }
+
+        uint32_t word = req->slave_id / 32;
+        uint32_t bit = 1UL << (req->slave_id % 32);
+        esp_err_t result;
+        if (req->batch != 0 && req->batch == bus->dead_batch && (bus->dead_slaves[word] & bit)) {
+            result = ESP_ERR_TIMEOUT;
+        } else {
+            result = bus->execute(req);
+            if (result == ESP_ERR_TIMEOUT && req->batch != 0) {
+                if (bus->dead_batch != req->batch) {
+                    bus->dead_batch = req->batch;
+                    memset(bus->dead_slaves, 0, sizeof(bus->dead_slaves));
+                }
+                bus->dead_slaves[word] |= bit;
+            }
+        }
+
+        // The request belongs to the submitter again after the notification, or
+        // once the result is set for a submitter that polls it without callback
+        TaskHandle_t notify = req->notify;
+        SemaphoreHandle_t done = req->done;
+        modbus_request_cb_t callback = req->callback;
+        void* callback_arg = req->arg;
+        __atomic_store_n(&req->result, result, __ATOMIC_RELEASE);
+        if (callback != nullptr) {
+            callback(req, callback_arg);
+        }
+        if (notify != nullptr) {
+            xTaskNotifyGive(notify);
+        }
+        if (done != nullptr) {
+            xSemaphoreGive(done);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t ModbusBus::submit(ModbusRequest* request, TickType_t ticks) {
+    // A request on its own is never part of a batch, whatever it carried before
+    request->batch = 0;
+    request->done = nullptr;
+    return enqueue(request, ticks);
+}
+
+esp_err_t ModbusBus::enqueue(ModbusRequest* request, TickType_t ticks) {
+    if (task_handle == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    request->result = ESP_ERR_NOT_FINISHED;
+    if (xQueueSend(request_queue, &request, ticks) != pdPASS) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ModbusBus::transact(uint8_t slave_id, uint8_t command, uint16_t address, uint16_t quantity, void* data) {
+    ModbusRequest req = {};
+    req.slave_id = slave_id;
+    req.command = command;
+    req.address = address;
+    req.quantity = quantity;
+    req.data = data;
+
+    // The caller's task notification may be given by anyone, the request's own semaphore only by the bus
+    req.done = xSemaphoreCreateBinary();
+    if (req.done == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = enqueue(&req, portMAX_DELAY);
+    if (err == ESP_OK) {
+        xSemaphoreTake(req.done, portMAX_DELAY);
+        err = req.result;
+    }
+    vSemaphoreDelete(req.done);
+    return err;
+}
+
+esp_err_t ModbusBus::transact(ModbusRequest* requests, size_t count) {
+    if (task_handle == nullptr) {
+        for (size_t i = 0; i < count; i++) {
+            requests[i].result = ESP_ERR_INVALID_STATE;
+        }
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Batch ids only tell consecutive batches apart, 0 is no batch
+    uint32_t batch = __atomic_add_fetch(&next_batch, 1, __ATOMIC_RELAXED);
+    if (batch == 0) {
+        batch = __atomic_add_fetch(&next_batch, 1, __ATOMIC_RELAXED);
+    }
+    // Counts the completions; the caller's task notification may be given by
+    // anyone, and the requests must not go out of scope before the bus is done
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(count, 0);
+    if (done == nullptr) {
+        for (size_t i = 0; i < count; i++) {
+            requests[i].result = ESP_ERR_NO_MEM;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Keep the queue topped up while earlier requests complete
+    size_t submitted = 0;
+    size_t completed = 0;
+    while (completed < count) {
+        while (submitted < count) {
+            ModbusRequest* req = &requests[submitted];
+            req->batch = batch;
+            req->notify = nullptr;
+            req->done = done;
+            if (enqueue(req, submitted == completed ? portMAX_DELAY : 0) != ESP_OK) {
+                break;
+            }
+            submitted++;
+        }
+        xSemaphoreTake(done, portMAX_DELAY);
+        completed++;
+    }
+    vSemaphoreDelete(done);
+
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < count; i++) {
+        if (requests[i].result != ESP_OK) {
+            result = requests[i].result;
+        }
+    }
+    return result;
+}
+
+bool ModbusSlave::request(uint8_t command, uint16_t address, uint16_t quantity, void* data, const char* what) {
+    esp_err_t err = bus->transact(slave_id, command, address, quantity, data);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to %s on slave %d: %s", what, slave_id, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool ModbusSlave::readHoldingRegisters(uint16_t address, uint16_t quantity, uint16_t* response) {
+    return request(MB_FUNC_READ_HOLDING_REGISTER, address, quantity, response, "read holding registers");
+}
+
+bool ModbusSlave::writeSingleRegister(uint16_t address, uint16_t value) {
+    return request(MB_FUNC_WRITE_SINGLE_REGISTER, address, 1, &value, "write single register");
+}
+
+bool ModbusSlave::writeMultipleRegisters(uint16_t address, uint16_t quantity, uint16_t* values) {
+    return request(MB_FUNC_WRITE_MULTIPLE_REGISTERS, address, quantity, values, "write multiple registers");
+}
+
+bool ModbusSlave::readCoils(uint16_t address, uint16_t quantity, uint8_t* response) {
+    return request(MB_FUNC_READ_COILS, address, quantity, response, "read coils");
+}
+
+bool ModbusSlave::writeSingleCoil(uint16_t address, bool value) {
+    uint8_t coil_value = value ? 0xFF : 0x00;
+    return request(MB_FUNC_WRITE_SINGLE_COIL, address, 1, &coil_value, "write single coil");
+}
+
+bool ModbusSlave::writeMultipleCoils(uint16_t address, uint16_t quantity, uint8_t* values) {
+    return request(MB_FUNC_WRITE_MULTIPLE_COILS, address, quantity, values, "write multiple coils");
+}
+
+bool ModbusSlave::submit(ModbusRequest* request) {
+    request->slave_id = slave_id;
+    return bus->submit(request) == ESP_OK;
+}
+
+bool ModbusSlave::transact(ModbusRequest* requests, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        requests[i].slave_id = slave_id;
+    }
+    return bus->transact(requests, count) == ESP_OK;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file ModbusBus.h
+ * @brief Shared Modbus RTU master for one RS-485 segment.
+ *
+ * ModbusBus owns the UART and the master, and sets them up exactly once. The
+ * master is the esp-modbus controller, a single global instance, or with
+ * MB_BUS_NATIVE_RTU the in-tree ModbusRtuMaster, which runs each transaction
+ * directly on the bus task. Slaves on the segment are reached through
+ * ModbusSlave handles, which only carry the bus pointer and the slave address.
+ * Every request from every handle goes through the bus request queue and is
+ * executed by the bus task one at a time.
+ *
+ * On ModbusRtuMaster every UART can carry a bus of its own, each with its own
+ * bus task; esp-modbus drives a single controller and so a single bus.
+ *
+ * Requests can be submitted without waiting (submit, ModbusRequest): the
+ * queue holds up to MB_BUS_QUEUE_LENGTH of them, and the bus task puts the
+ * next one on the wire as soon as the previous one has completed, while the
+ * submitter decodes or stores earlier responses. The blocking calls are a
+ * submit followed by a wait for the completion.
+ */
+#pragma once
+
+#include "../../interface/ModbusInterface.h"
+#include <cstdint>
+#include <cstddef>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+#include "mbcontroller.h"
+
+#include "ModbusRtuMaster.h"
+
+// 1 to run the bus on ModbusRtuMaster instead of the esp-modbus controller
+#ifndef MB_BUS_NATIVE_RTU
+#define MB_BUS_NATIVE_RTU       0
+#endif
+
+// Requests in flight per bus, queued behind the one on the wire, before submitters block
+#define MB_BUS_QUEUE_LENGTH     16
+
+#define MB_BUS_TASK_STACK       4096
+#define MB_BUS_TASK_PRIORITY    6
+
+class ModbusBus {
+public:
+    ModbusBus(uart_port_t uart_port,
+              uint32_t baudrate,
+              uart_parity_t parity,
+              mb_mode_type_t mode,
+              int tx_pin,
+              int rx_pin,
+              int rts_pin);
+
+    ~ModbusBus();
+
+    /**
+     * @brief Set up the controller and start the bus task.
+     *
+     * With esp-modbus only one bus can be set up, its controller is global.
+     *
+     * @param core_id Core the bus task is pinned to, tskNO_AFFINITY to let it run on either.
+     */
+    bool init(BaseType_t core_id = tskNO_AFFINITY, UBaseType_t priority = MB_BUS_TASK_PRIORITY);
+
+    /**
+     * @brief Execute one request on the bus and wait for it to finish.
+     *
+     * Blocks the calling task until the bus task has run the request. The
+     * hand-back goes through a semaphore of the request, so notifications
+     * given to the caller by others do not end the wait.
+     *
+     * @param slave_id Slave address.
+     * @param command Modbus function code.
+     * @param address First register, coil or input.
+     * @param quantity Number of registers, coils or inputs.
+     * @param data Response buffer for reads, values for writes.
+     * @return ESP_OK, or the error of the transaction (esp-modbus codes on both backends).
+     */
+    esp_err_t transact(uint8_t slave_id, uint8_t command, uint16_t address, uint16_t quantity, void* data);
+
+    /**
+     * @brief Queue a request for the bus task and return.
+     *
+     * The request completes on the bus task: its result is set, its callback
+     * runs there, then its notify task is notified.
+     *
+     * @param ticks How long to wait for room in the queue.
+     * @return ESP_OK once queued, ESP_ERR_TIMEOUT if the queue stayed full,
+     *         ESP_ERR_INVALID_STATE before init().
+     */
+    esp_err_t submit(ModbusRequest* request, TickType_t ticks = portMAX_DELAY);
+
+    /**
+     * @brief Run a list of requests back to back and wait for all of them.
+     *
+     * Each request carries its slave address and gets its own result. Once a
+     * slave has timed out, its later requests in the list complete with
+     * ESP_ERR_TIMEOUT without going on the wire: a slave that did not answer
+     * once will not answer the next request either.
+     *
+     * @return ESP_OK when every request succeeded, the error of the last failed one otherwise.
+     */
+    esp_err_t transact(ModbusRequest* requests, size_t count);
+
+#if MB_BUS_NATIVE_RTU
+    // Counters of the RTU engine, read them while the bus is idle
+    void getRtuStats(mb_rtu_stats_t* stats) const { rtu.getStats(stats); }
+#endif
+
+    uart_port_t getPort() const { return uart_port; }
+
+private:
+    static void busTask(void* arg);
+    esp_err_t enqueue(ModbusRequest* request, TickType_t ticks);
+    esp_err_t execute(const ModbusRequest* request);
+
+    uart_port_t uart_port;
+    mb_communication_info_t comm_info;
+    void* master_handler;
+    int tx_pin;
+    int rx_pin;
+    int rts_pin;
+#if MB_BUS_NATIVE_RTU
+    ModbusRtuMaster rtu;
+#endif
+
+    QueueHandle_t request_queue;       // ModbusRequest pointers
+    TaskHandle_t task_handle;
+    uint32_t next_batch;
+
+    // Slaves that timed out in the batch on the wire, owned by the bus task
+    uint32_t dead_batch;
+    uint32_t dead_slaves[8];
+};
+
+/**
+ * @brief Handle for one slave on a shared ModbusBus.
+ */
+class ModbusSlave : public ModbusInterface {
+public:
+    ModbusSlave(ModbusBus* bus, uint8_t slave_id) : bus(bus), slave_id(slave_id) {}
+
+    uint8_t getSlaveId() const { return slave_id; }
+
+    // Interface implementations
+    bool readHoldingRegisters(uint16_t address, uint16_t quantity, uint16_t* response) override;
+    bool writeSingleRegister(uint16_t address, uint16_t value) override;
+    bool writeMultipleRegisters(uint16_t address, uint16_t quantity, uint16_t* values) override;
+
+    bool readCoils(uint16_t address, uint16_t quantity, uint8_t* response) override;
+    bool writeSingleCoil(uint16_t address, bool value) override;
+    bool writeMultipleCoils(uint16_t address, uint16_t quantity, uint8_t* values) override;
+
+    // Queued on the bus, for this slave
+    bool submit(ModbusRequest* request) override;
+    bool transact(ModbusRequest* requests, size_t count) override;
+
+private:
+    bool request(uint8_t command, uint16_t address, uint16_t quantity, void* data, const char* what);
+
+    ModbusBus* bus;
+    uint8_t slave_id;
+};
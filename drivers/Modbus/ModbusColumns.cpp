@@ -0,0 +1,269 @@
+#include "ModbusColumns.h"
+#include "ModbusProfiles.h"
+#include "esp_log.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+static const char *TAG = "ModbusColumns";
+
+template <mb_byte_order_t Order, typename T>
+static void decodeRun(const uint16_t* regs, size_t count, T* values) {
+    for (size_t i = 0; i < count; i++) {
+        values[i] = ModbusField<T, 0, Order>::raw(&regs[2 * i]);
+    }
+}
+
+// One switch per run, the loops themselves have no branches
+template <typename T>
+static void decodeValues(const uint16_t* regs, size_t count, mb_byte_order_t order, T* values) {
+    switch (order) {
+        case MB_ORDER_CDAB: decodeRun<MB_ORDER_CDAB>(regs, count, values); break;
+        case MB_ORDER_BADC: decodeRun<MB_ORDER_BADC>(regs, count, values); break;
+        case MB_ORDER_DCBA: decodeRun<MB_ORDER_DCBA>(regs, count, values); break;
+        default:            decodeRun<MB_ORDER_ABCD>(regs, count, values); break;
+    }
+}
+
+// Compare into one byte per value, which vectorizes, then pack eight bytes at a
+// time into bits with a multiply (both targets are little endian)
+template <typename T>
+static size_t checkValues(const T* values, const T* min, const T* max, size_t count, uint32_t* valid) {
+    size_t num_valid = 0;
+    uint8_t in_range[32];
+    for (size_t first = 0; first < count; first += 32) {
+        size_t n = std::min<size_t>(32, count - first);
+        for (size_t i = 0; i < n; i++) {
+            T value = values[first + i];
+            in_range[i] = (value >= min[first + i]) & (value <= max[first + i]);
+        }
+        std::fill(in_range + n, in_range + 32, 0);
+
+        uint32_t bits = 0;
+        for (size_t byte = 0; byte < 4; byte++) {
+            uint64_t flags;
+            memcpy(&flags, &in_range[8 * byte], sizeof(flags));
+            bits |= (uint32_t)((flags * 0x0102040810204080ull) >> 56) << (8 * byte);
+        }
+        valid[first / 32] = bits;
+        num_valid += __builtin_popcount(bits);
+    }
+    return num_valid;
+}
+
+// Set count bits of a bitmap from bit first on
+static void setBits(uint32_t* bitmap, size_t first, size_t count) {
+    while (count > 0) {
+        size_t shift = first % 32;
+        size_t n = std::min<size_t>(32 - shift, count);
+        uint32_t mask = n == 32 ? UINT32_MAX : ((1u << n) - 1) << shift;
+        bitmap[first / 32] |= mask;
+        first += n;
+        count -= n;
+    }
+}
+
+void mbDecodeFloats(const uint16_t* regs, size_t count, mb_byte_order_t order, float* values) {
+    decodeValues(regs, count, order, values);
+}
+
+void mbDecodeInt32(const uint16_t* regs, size_t count, mb_byte_order_t order, int32_t* values) {
+    decodeValues(regs, count, order, values);
+}
+
+void mbDecodeUint32(const uint16_t* regs, size_t count, mb_byte_order_t order, uint32_t* values) {
+    decodeValues(regs, count, order, values);
+}
+
+size_t mbCheckRange(const float* values, const float* min, const float* max, size_t count, uint32_t* valid) {
+    return checkValues(values, min, max, count, valid);
+}
+
+size_t mbCheckRange(const int32_t* values, const int32_t* min, const int32_t* max, size_t count, uint32_t* valid) {
+    return checkValues(values, min, max, count, valid);
+}
+
+size_t mbCheckRange(const uint32_t* values, const uint32_t* min, const uint32_t* max, size_t count,
+                    uint32_t* valid) {
+    return checkValues(values, min, max, count, valid);
+}
+
+static bool hasLimits(const mb_parameter_descriptor_t* param) {
+    return param->param_opts.min != 0 || param->param_opts.max != 0;
+}
+
+static mb_column_type_t columnOf(const mb_parameter_descriptor_t* param) {
+    if (param->param_type == PARAM_TYPE_FLOAT) {
+        return MB_COLUMN_FLOAT;
+    }
+    return param->param_opts.min < 0 ? MB_COLUMN_I32 : MB_COLUMN_U32;
+}
+
+static bool isColumnParam(const mb_parameter_descriptor_t* param) {
+    return (param->access & PAR_PERMS_READ) && param->mb_size == 2 &&
+           (param->param_type == PARAM_TYPE_FLOAT || param->param_type == PARAM_TYPE_U32) &&
+           (param->mb_param_type == MB_PARAM_HOLDING || param->mb_param_type == MB_PARAM_INPUT);
+}
+
+ModbusColumns::ModbusColumns(mb_byte_order_t order) : order(order), slave_addr(0), stats() {}
+
+void ModbusColumns::clear(uint8_t slave_addr) {
+    this->slave_addr = slave_addr;
+    runs.clear();
+    for (Column& column : columns) {
+        column.cids.clear();
+    }
+    floats.clear();
+    float_min.clear();
+    float_max.clear();
+    int32s.clear();
+    int32_min.clear();
+    int32_max.clear();
+    uint32s.clear();
+    uint32_min.clear();
+    uint32_max.clear();
+}
+
+bool ModbusColumns::build(const mb_parameter_descriptor_t* params, uint16_t num_params, uint8_t slave_addr) {
+    clear(slave_addr);
+    std::vector<Item> selected;
+    for (uint16_t i = 0; i < num_params; i++) {
+        if (params[i].mb_slave_addr == slave_addr && isColumnParam(&params[i])) {
+            selected.push_back(Item{&params[i], params[i].cid});
+        }
+    }
+    return setup(selected);
+}
+
+bool ModbusColumns::build(const ModbusProfiles& profiles, uint8_t slave_addr) {
+    clear(slave_addr);
+    const mb_device_type_t* type = profiles.getType(slave_addr);
+    if (type == nullptr) {
+        ESP_LOGE(TAG, "Slave %d has no profile", slave_addr);
+        return false;
+    }
+    // The type's descriptors carry no address and number their parameters from 0
+    std::vector<Item> selected;
+    for (uint8_t p = 0; p < type->num_params; p++) {
+        if (isColumnParam(&type->params[p])) {
+            selected.push_back(Item{&type->params[p], profiles.getCid(slave_addr, p)});
+        }
+    }
+    return setup(selected);
+}
+
+bool ModbusColumns::setup(std::vector<Item>& selected) {
+    if (selected.empty()) {
+        ESP_LOGE(TAG, "Slave %d has no 32-bit parameters", slave_addr);
+        return false;
+    }
+    std::sort(selected.begin(), selected.end(), [](const Item& a, const Item& b) {
+        if (a.param->mb_param_type != b.param->mb_param_type) return a.param->mb_param_type < b.param->mb_param_type;
+        return a.param->mb_reg_start < b.param->mb_reg_start;
+    });
+
+    // Neighbours in the same column and register type join the previous run
+    for (const Item& item : selected) {
+        const mb_parameter_descriptor_t* param = item.param;
+        mb_column_type_t type = columnOf(param);
+        Column& column = columns[type];
+        Run* last = runs.empty() ? nullptr : &runs.back();
+        if (last != nullptr && last->column == type && last->reg_type == param->mb_param_type &&
+            (uint32_t)last->reg_start + 2 * last->count == param->mb_reg_start) {
+            last->count++;
+        } else {
+            runs.push_back(Run{type, param->mb_param_type, param->mb_reg_start, 1, column.cids.size()});
+        }
+        column.cids.push_back(item.cid);
+
+        bool limited = hasLimits(param);
+        switch (type) {
+            case MB_COLUMN_FLOAT:
+                float_min.push_back(limited ? (float)param->param_opts.min : -INFINITY);
+                float_max.push_back(limited ? (float)param->param_opts.max : INFINITY);
+                break;
+            case MB_COLUMN_I32:
+                int32_min.push_back(param->param_opts.min);
+                int32_max.push_back(param->param_opts.max);
+                break;
+            default:
+                uint32_min.push_back(limited ? (uint32_t)param->param_opts.min : 0);
+                uint32_max.push_back(limited ? (uint32_t)param->param_opts.max : UINT32_MAX);
+                break;
+        }
+    }
+
+    floats.assign(float_min.size(), 0.0f);
+    int32s.assign(int32_min.size(), 0);
+    uint32s.assign(uint32_min.size(), 0);
+    for (Column& column : columns) {
+        column.valid.assign(MB_COLUMN_BITMAP_WORDS(column.cids.size()), 0);
+        column.present.assign(column.valid.size(), 0);
+    }
+    ESP_LOGI(TAG, "Slave %d: %u floats, %u int32, %u uint32 in %u runs", slave_addr, (unsigned)floats.size(),
+             (unsigned)int32s.size(), (unsigned)uint32s.size(), (unsigned)runs.size());
+    return true;
+}
+
+void ModbusColumns::convert(const Run& run, const uint16_t* regs, size_t row, size_t count) {
+    switch (run.column) {
+        case MB_COLUMN_FLOAT: mbDecodeFloats(regs, count, order, &floats[row]); break;
+        case MB_COLUMN_I32:   mbDecodeInt32(regs, count, order, &int32s[row]); break;
+        default:              mbDecodeUint32(regs, count, order, &uint32s[row]); break;
+    }
+    setBits(columns[run.column].present.data(), row, count);
+}
+
+size_t ModbusColumns::decode(const ModbusReadPlan& plan) {
+    for (Column& column : columns) {
+        std::fill(column.present.begin(), column.present.end(), 0);
+    }
+
+    for (const Run& run : runs) {
+        const uint16_t* regs = plan.getRegisters(slave_addr, run.reg_type, run.reg_start, 2 * run.count);
+        if (regs != nullptr) {
+            convert(run, regs, run.row, run.count);
+            stats.runs++;
+            continue;
+        }
+        // The plan may have cut the run into two blocks, take its values one by one
+        bool split = false;
+        for (size_t i = 0; i < run.count; i++) {
+            regs = plan.getRegisters(slave_addr, run.reg_type, (uint16_t)(run.reg_start + 2 * i), 2);
+            if (regs != nullptr) {
+                convert(run, regs, run.row + i, 1);
+                split = true;
+            }
+        }
+        stats.split_runs += split;
+    }
+
+    // Values whose block had no valid data are flagged along with NaNs and values out of range
+    size_t num_valid = 0;
+    size_t total = 0;
+    for (int type = 0; type < MB_COLUMN_COUNT; type++) {
+        Column& column = columns[type];
+        size_t count = column.cids.size();
+        switch (type) {
+            case MB_COLUMN_FLOAT:
+                mbCheckRange(floats.data(), float_min.data(), float_max.data(), count, column.valid.data());
+                break;
+            case MB_COLUMN_I32:
+                mbCheckRange(int32s.data(), int32_min.data(), int32_max.data(), count, column.valid.data());
+                break;
+            default:
+                mbCheckRange(uint32s.data(), uint32_min.data(), uint32_max.data(), count, column.valid.data());
+                break;
+        }
+        for (size_t word = 0; word < column.valid.size(); word++) {
+            column.valid[word] &= column.present[word];
+            num_valid += __builtin_popcount(column.valid[word]);
+        }
+        total += count;
+    }
+    stats.decodes++;
+    stats.invalid = (uint32_t)(total - num_valid);
+    return num_valid;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file ModbusColumns.h
+ * @brief Batch decode of the 32-bit parameters of a slave into typed columns.
+ *
+ * Energy meters and similar devices expose dozens of floats or counters in one
+ * register block. Instead of converting one register pair after the other,
+ * ModbusColumns groups the 32-bit parameters of a slave into runs of
+ * neighbouring registers and converts every run in one pass from the read
+ * plan's buffer into a column: floats (PARAM_TYPE_FLOAT), signed integers
+ * (PARAM_TYPE_U32 with a negative OPTS minimum, the descriptor has no signed
+ * 32-bit type) and unsigned integers (PARAM_TYPE_U32).
+ *
+ * Each column has a validity bitmap, bit (row % 32) of word (row / 32). A bit
+ * is cleared when the value is NaN, lies outside the OPTS limits of its
+ * descriptor (no limit when min and max are both 0) or its block has no valid
+ * data.
+ *
+ * The kernels below do the work on plain buffers. They are loops over the
+ * ModbusField conversion of one byte order with no branch per value, which the
+ * compiler unrolls and vectorizes where the target has vector shuffles. The
+ * range check compares into bytes and packs them eight at a time. There is no
+ * hand-written PIE path for the ESP32-S3: ESP-IDF has no intrinsics for it.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mbcontroller.h"
+#include "ModbusReadPlan.h"
+#include "ModbusRegisterMap.h"
+
+typedef enum {
+    MB_COLUMN_FLOAT,
+    MB_COLUMN_I32,
+    MB_COLUMN_U32,
+    MB_COLUMN_COUNT,
+} mb_column_type_t;
+
+// Words of a validity bitmap for count values
+#define MB_COLUMN_BITMAP_WORDS(count) (((count) + 31) / 32)
+
+// Convert count 32-bit values, two registers each in the given order
+void mbDecodeFloats(const uint16_t* regs, size_t count, mb_byte_order_t order, float* values);
+void mbDecodeInt32(const uint16_t* regs, size_t count, mb_byte_order_t order, int32_t* values);
+void mbDecodeUint32(const uint16_t* regs, size_t count, mb_byte_order_t order, uint32_t* values);
+
+/**
+ * @brief Validity bitmap of count values against per-value limits.
+ *
+ * Sets bit i when min[i] <= values[i] <= max[i], NaN is never valid.
+ *
+ * @return Number of valid values.
+ */
+size_t mbCheckRange(const float* values, const float* min, const float* max, size_t count, uint32_t* valid);
+size_t mbCheckRange(const int32_t* values, const int32_t* min, const int32_t* max, size_t count, uint32_t* valid);
+size_t mbCheckRange(const uint32_t* values, const uint32_t* min, const uint32_t* max, size_t count,
+                    uint32_t* valid);
+
+typedef struct {
+    uint32_t decodes;           // decode() calls
+    uint32_t runs;              // Runs converted in one pass
+    uint32_t split_runs;        // Runs spread over two blocks, converted per value
+    uint32_t invalid;           // Values flagged in the last decode()
+} mb_columns_stats_t;
+
+class ModbusProfiles;
+
+class ModbusColumns {
+public:
+    explicit ModbusColumns(mb_byte_order_t order = MB_ORDER_ABCD);
+
+    /**
+     * @brief Set up the columns for the 32-bit parameters of one slave.
+     *
+     * Parameters of two registers with type PARAM_TYPE_FLOAT or PARAM_TYPE_U32
+     * are taken in register order; the rows of a column follow that order.
+     *
+     * @return false if the slave has no such parameter.
+     */
+    bool build(const mb_parameter_descriptor_t* params, uint16_t num_params, uint8_t slave_addr);
+
+    // Same over the type of a profiled slave, with the CIDs of the profiles
+    bool build(const ModbusProfiles& profiles, uint8_t slave_addr);
+
+    /**
+     * @brief Decode every column from the last read of the plan.
+     *
+     * @return Number of valid values over all columns.
+     */
+    size_t decode(const ModbusReadPlan& plan);
+
+    size_t getCount(mb_column_type_t type) const { return columns[type].cids.size(); }
+    const uint16_t* getCids(mb_column_type_t type) const { return columns[type].cids.data(); }
+    const uint32_t* getValidity(mb_column_type_t type) const { return columns[type].valid.data(); }
+
+    const float* getFloats() const { return floats.data(); }
+    const int32_t* getInt32() const { return int32s.data(); }
+    const uint32_t* getUint32() const { return uint32s.data(); }
+
+    bool isValid(mb_column_type_t type, size_t row) const {
+        return (columns[type].valid[row / 32] >> (row % 32)) & 0x01;
+    }
+
+    void getStats(mb_columns_stats_t* stats) const { *stats = this->stats; }
+
+private:
+    // A 32-bit parameter of the slave while the columns are built
+    struct Item {
+        const mb_parameter_descriptor_t* param;
+        uint16_t cid;
+    };
+
+    // Neighbouring parameters of one column and register type
+    struct Run {
+        mb_column_type_t column;
+        mb_param_type_t reg_type;
+        uint16_t reg_start;
+        uint16_t count;         // Values, two registers each
+        size_t row;             // First row in the column
+    };
+
+    struct Column {
+        std::vector<uint16_t> cids;
+        std::vector<uint32_t> valid;
+        std::vector<uint32_t> present;      // Rows whose block had valid data
+    };
+
+    void clear(uint8_t slave_addr);
+    bool setup(std::vector<Item>& selected);
+    void convert(const Run& run, const uint16_t* regs, size_t row, size_t count);
+
+    mb_byte_order_t order;
+    uint8_t slave_addr;
+    std::vector<Run> runs;
+    Column columns[MB_COLUMN_COUNT];
+
+    std::vector<float> floats;
+    std::vector<float> float_min;
+    std::vector<float> float_max;
+    std::vector<int32_t> int32s;
+    std::vector<int32_t> int32_min;
+    std::vector<int32_t> int32_max;
+    std::vector<uint32_t> uint32s;
+    std::vector<uint32_t> uint32_min;
+    std::vector<uint32_t> uint32_max;
+
+    mb_columns_stats_t stats;
+};
@@ -0,0 +1,86 @@
+#include "ModbusDeadband.h"
+#include "ModbusProfiles.h"
+#include "esp_log.h"
+
+#include <math.h>
+
+static const char *TAG = "ModbusDeadband";
+
+ModbusDeadband::ModbusDeadband() : states(), stats() {}
+
+bool ModbusDeadband::init(const mb_deadband_t* table, size_t count, size_t num_cids) {
+    states.assign(num_cids, State());
+    for (size_t i = 0; i < count; i++) {
+        const mb_deadband_t* entry = &table[i];
+        if (entry->cid >= num_cids || !(entry->absolute >= 0) || !(entry->percent >= 0)) {
+            ESP_LOGE(TAG, "Invalid deadband for CID %u", (unsigned)entry->cid);
+            states.assign(num_cids, State());
+            return false;
+        }
+        State* state = &states[entry->cid];
+        state->configured = true;
+        state->absolute = entry->absolute;
+        state->percent = entry->percent;
+        state->heartbeat_ms = entry->heartbeat_ms;
+    }
+    return true;
+}
+
+bool ModbusDeadband::init(const ModbusProfiles& profiles) {
+    // The deadbands of a type name its parameters, move them to the CIDs of each slave
+    std::vector<mb_deadband_t> table;
+    for (size_t i = 0; i < profiles.getNumSlaves(); i++) {
+        uint8_t slave_addr = profiles.getSlave(i).slave_addr;
+        const mb_device_type_t* type = profiles.getType(slave_addr);
+        for (uint8_t d = 0; d < type->num_deadbands; d++) {
+            mb_deadband_t entry = type->deadbands[d];
+            entry.cid = profiles.getCid(slave_addr, (uint8_t)entry.cid);
+            table.push_back(entry);
+        }
+    }
+    return init(table.data(), table.size(), profiles.getNumCids());
+}
+
+bool ModbusDeadband::filter(const uint16_t* cids, const float* values, size_t count, int64_t now_ms) {
+    bool report = false;
+    bool heartbeat = false;
+    bool status_change = false;
+    for (size_t i = 0; i < count; i++) {
+        if (cids[i] >= states.size() || !states[cids[i]].configured || !states[cids[i]].reported) {
+            report = true;
+            continue;
+        }
+        const State* state = &states[cids[i]];
+        float delta = fabsf(values[i] - state->value);
+        float threshold = fmaxf(state->absolute, state->percent / 100.0f * fabsf(state->value));
+        bool changed;
+        if (isnan(values[i]) || isnan(state->value)) {
+            // A reading that turns into NaN or back is a change, NaN again is not
+            changed = isnan(values[i]) != isnan(state->value);
+        } else {
+            changed = threshold == 0 ? values[i] != state->value : delta > threshold;
+        }
+        if (changed) {
+            report = true;
+            status_change = status_change || (state->absolute == 0 && state->percent == 0);
+        } else if (state->heartbeat_ms > 0 && now_ms - state->reported_ms >= (int64_t)state->heartbeat_ms) {
+            heartbeat = true;
+        }
+    }
+
+    if (!report && !heartbeat) {
+        stats.suppressed++;
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (cids[i] < states.size()) {
+            states[cids[i]].reported = true;
+            states[cids[i]].value = values[i];
+            states[cids[i]].reported_ms = now_ms;
+        }
+    }
+    stats.reported++;
+    stats.heartbeats += report ? 0 : 1;
+    stats.status_changes += status_change ? 1 : 0;
+    return true;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file ModbusDeadband.h
+ * @brief Report-by-exception filter on the CIDs of the descriptor table or device profiles.
+ *
+ * Each configured CID has a deadband: a sample is only worth reporting when
+ * it differs from the value last reported by more than the absolute
+ * threshold or the percentage of that value, whichever is larger. With
+ * both at 0, as for status words (DEADBAND_STATUS), any change is reported.
+ * A heartbeat reports the CID anyway once it has been quiet for that long,
+ * so the backend can tell a steady reading from a dead gateway.
+ *
+ * The gateway asks about the CIDs that make up one record together, for the
+ * raw records on their way to the flash log; rollups are made of every
+ * sample. If any CID is due, the whole record is reported and becomes the
+ * reference of every CID in it; otherwise the record is dropped. CIDs
+ * without an entry in the table are always reported. Call it from one task.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef struct {
+    uint16_t cid;
+    float absolute;             // Smallest change reported, engineering units
+    float percent;              // Smallest change reported, % of the last reported value
+    uint32_t heartbeat_ms;      // Report anyway after this long, 0 for never
+} mb_deadband_t;
+
+#define DEADBAND(cid_val, abs_val, pct_val, heartbeat_val) \
+    { .cid = cid_val, .absolute = abs_val, .percent = pct_val, .heartbeat_ms = heartbeat_val }
+
+// Status and bit-field registers: every change goes through
+#define DEADBAND_STATUS(cid_val, heartbeat_val)     DEADBAND(cid_val, 0, 0, heartbeat_val)
+
+typedef struct {
+    uint32_t reported;          // Records let through
+    uint32_t suppressed;        // Records dropped inside the deadband
+    uint32_t heartbeats;        // Records let through only because a heartbeat was due
+    uint32_t status_changes;    // Records let through by a change of a status CID
+} mb_deadband_stats_t;
+
+class ModbusProfiles;
+
+class ModbusDeadband {
+public:
+    ModbusDeadband();
+
+    /**
+     * @brief Take the deadbands of the CIDs below num_cids.
+     *
+     * @return false if an entry names a CID out of range or a negative threshold.
+     */
+    bool init(const mb_deadband_t* table, size_t count, size_t num_cids);
+
+    // Take the deadbands of the device types, once for every slave of the profiles
+    bool init(const ModbusProfiles& profiles);
+
+    /**
+     * @brief Decide whether a record made of these CIDs is reported.
+     *
+     * @return true if any CID changed past its deadband, was never reported,
+     *         has no deadband or is due for a heartbeat. The values then
+     *         become the reference of their CIDs.
+     */
+    bool filter(const uint16_t* cids, const float* values, size_t count, int64_t now_ms);
+
+    void getStats(mb_deadband_stats_t* stats) const { *stats = this->stats; }
+
+private:
+    struct State {
+        bool configured;
+        bool reported;
+        float absolute;
+        float percent;
+        uint32_t heartbeat_ms;
+        float value;            // Last reported value
+        int64_t reported_ms;
+    };
+
+    std::vector<State> states;
+    mb_deadband_stats_t stats;
+};
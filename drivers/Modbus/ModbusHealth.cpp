@@ -0,0 +1,55 @@
+#include "ModbusHealth.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "ModbusHealth";
+
+ModbusSlaveHealth::ModbusSlaveHealth(uint8_t slave_id, uint8_t failure_threshold, uint32_t backoff_min_ms, uint32_t backoff_max_ms)
+    : slave_id(slave_id), failure_threshold(failure_threshold > 0 ? failure_threshold : 1),
+      backoff_min_ms(backoff_min_ms), backoff_max_ms(backoff_max_ms < backoff_min_ms ? backoff_min_ms : backoff_max_ms),
+      state(MB_BREAKER_CLOSED), consecutive_failures(0), backoff_ms(0), probe_at_us(0), skipped(0) {
+}
+
+bool ModbusSlaveHealth::allowRequest() {
+    if (state != MB_BREAKER_OPEN) {
+        return true;
+    }
+    if (esp_timer_get_time() >= probe_at_us) {
+        state = MB_BREAKER_HALF_OPEN;
+        return true;
+    }
+    skipped++;
+    return false;
+}
+
+void ModbusSlaveHealth::recordResult(esp_err_t err) {
+    // An exception response still proves the slave is on the bus
+    bool answered = (err == ESP_OK || err == ESP_ERR_NOT_SUPPORTED);
+
+    if (answered) {
+        if (state != MB_BREAKER_CLOSED) {
+            ESP_LOGI(TAG, "Slave %d answers again after %u failures", slave_id, (unsigned)consecutive_failures);
+        }
+        state = MB_BREAKER_CLOSED;
+        consecutive_failures = 0;
+        backoff_ms = 0;
+        return;
+    }
+
+    consecutive_failures++;
+    if (state == MB_BREAKER_HALF_OPEN) {
+        // Failed probe, back off further
+        backoff_ms = backoff_ms * 2 > backoff_max_ms ? backoff_max_ms : backoff_ms * 2;
+        open(esp_timer_get_time());
+    } else if (state == MB_BREAKER_CLOSED && consecutive_failures >= failure_threshold) {
+        backoff_ms = backoff_min_ms;
+        open(esp_timer_get_time());
+    }
+}
+
+void ModbusSlaveHealth::open(int64_t now) {
+    state = MB_BREAKER_OPEN;
+    probe_at_us = now + (int64_t)backoff_ms * 1000;
+    ESP_LOGW(TAG, "Slave %d not answering (%u failures), next probe in %u ms",
+             slave_id, (unsigned)consecutive_failures, (unsigned)backoff_ms);
+}
@@ -0,0 +1,68 @@
+/**
+ * @file ModbusHealth.h
+ * @brief Per-slave circuit breaker for dead or unplugged Modbus slaves.
+ *
+ * The breaker is closed while a slave answers. After a number of consecutive
+ * failures it opens, and the poller skips the slave instead of waiting out the
+ * response timeout every cycle. Once the backoff has run out the breaker is
+ * half-open and lets a single probe through: an answer closes it straight
+ * away, another failure reopens it with the backoff doubled, up to a limit.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+// Consecutive failures before a slave is taken off the bus
+#define MB_HEALTH_FAILURE_THRESHOLD     3
+
+// Probe backoff, doubled after every failed probe
+#define MB_HEALTH_BACKOFF_MIN_MS        2000
+#define MB_HEALTH_BACKOFF_MAX_MS        60000
+
+typedef enum {
+    MB_BREAKER_CLOSED = 0,      // Slave is polled normally
+    MB_BREAKER_OPEN,            // Slave is skipped until the backoff runs out
+    MB_BREAKER_HALF_OPEN        // Next request is a probe
+} mb_breaker_state_t;
+
+class ModbusSlaveHealth {
+public:
+    ModbusSlaveHealth(uint8_t slave_id = 0,
+                      uint8_t failure_threshold = MB_HEALTH_FAILURE_THRESHOLD,
+                      uint32_t backoff_min_ms = MB_HEALTH_BACKOFF_MIN_MS,
+                      uint32_t backoff_max_ms = MB_HEALTH_BACKOFF_MAX_MS);
+
+    // Whether the slave should be polled now, opens the way for a probe once the backoff ran out
+    bool allowRequest();
+
+    /**
+     * @brief Feed the result of a poll.
+     *
+     * Any answer counts as alive, an exception response included. Timeouts,
+     * CRC errors and other bus failures count as failures.
+     */
+    void recordResult(esp_err_t err);
+
+    mb_breaker_state_t getState() const { return state; }
+    uint8_t getSlaveId() const { return slave_id; }
+    uint32_t getConsecutiveFailures() const { return consecutive_failures; }
+
+    // Polls skipped while the breaker was open
+    uint32_t getSkipped() const { return skipped; }
+
+private:
+    void open(int64_t now);
+
+    uint8_t slave_id;
+    uint8_t failure_threshold;
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+
+    mb_breaker_state_t state;
+    uint32_t consecutive_failures;
+    uint32_t backoff_ms;
+    int64_t probe_at_us;
+    uint32_t skipped;
+};
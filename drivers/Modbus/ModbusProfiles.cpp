@@ -0,0 +1,203 @@
+#include "ModbusProfiles.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char *TAG = "ModbusProfiles";
+
+#define NO_ENTRY 0xFF
+
+static uint16_t getU16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putU16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void putU32(uint8_t* p, uint32_t value) {
+    putU16(p, (uint16_t)value);
+    putU16(p + 2, (uint16_t)(value >> 16));
+}
+
+ModbusProfiles::ModbusProfiles(const mb_device_type_t* types, size_t num_types)
+    : types(types), num_types(num_types), slaves(), num_cids(0) {
+    memset(index, NO_ENTRY, sizeof(index));
+}
+
+esp_err_t ModbusProfiles::setSlaves(const mb_profile_slave_t* config, size_t count) {
+    std::vector<Slave> entries;
+    entries.reserve(count);
+    uint32_t cids = 0;
+    for (size_t i = 0; i < count; i++) {
+        const mb_profile_slave_t& slave = config[i];
+        size_t type = 0;
+        while (type < num_types && types[type].type_id != slave.type_id) {
+            type++;
+        }
+        if (slave.slave_addr < 1 || slave.slave_addr > MB_PROFILE_MAX_SLAVE_ADDR || type == num_types) {
+            ESP_LOGE(TAG, "Slave %d: invalid address or unknown type %d", slave.slave_addr, slave.type_id);
+            return ESP_ERR_INVALID_ARG;
+        }
+        // The scheduler takes no zero period, and a slave a period late skips the release anyway
+        if (slave.period_ms == 0 || slave.jitter_ms > slave.period_ms) {
+            ESP_LOGE(TAG, "Slave %d: period %u ms with jitter %u ms", slave.slave_addr, slave.period_ms,
+                     slave.jitter_ms);
+            return ESP_ERR_INVALID_ARG;
+        }
+        entries.push_back(Slave{slave, 0, (uint8_t)type});
+        cids += types[type].num_params;
+    }
+    if (cids >= MB_PROFILE_NO_CID) {
+        ESP_LOGE(TAG, "%u CIDs, more than a CID can number", (unsigned)cids);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // CIDs go out in address order, so a CID is found by bisecting the bases
+    std::sort(entries.begin(), entries.end(), [](const Slave& a, const Slave& b) {
+        return a.config.slave_addr < b.config.slave_addr;
+    });
+    uint16_t base = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i > 0 && entries[i].config.slave_addr == entries[i - 1].config.slave_addr) {
+            ESP_LOGE(TAG, "Slave %d configured twice", entries[i].config.slave_addr);
+            return ESP_ERR_INVALID_ARG;
+        }
+        entries[i].cid_base = base;
+        base += types[entries[i].type].num_params;
+    }
+
+    slaves.swap(entries);
+    slaves.shrink_to_fit();
+    memset(index, NO_ENTRY, sizeof(index));
+    for (size_t i = 0; i < slaves.size(); i++) {
+        index[slaves[i].config.slave_addr] = (uint8_t)i;
+    }
+    num_cids = base;
+    ESP_LOGI(TAG, "%u slaves, %u CIDs", (unsigned)slaves.size(), (unsigned)num_cids);
+    return ESP_OK;
+}
+
+esp_err_t ModbusProfiles::load(const uint8_t* blob, size_t size) {
+    if (blob == nullptr || size < MB_PROFILE_BLOB_HEADER || getU32(blob) != MB_PROFILE_BLOB_MAGIC) {
+        ESP_LOGE(TAG, "Not a profile blob");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (blob[4] != MB_PROFILE_BLOB_VERSION) {
+        ESP_LOGE(TAG, "Profile blob version %d, expected %d", blob[4], MB_PROFILE_BLOB_VERSION);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    size_t count = getU16(&blob[6]);
+    if (size != MB_PROFILE_BLOB_SIZE(count)) {
+        ESP_LOGE(TAG, "Profile blob of %u bytes for %u slaves", (unsigned)size, (unsigned)count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t* entry = blob + MB_PROFILE_BLOB_HEADER;
+    if (esp_rom_crc32_le(0, entry, (uint32_t)(count * MB_PROFILE_BLOB_ENTRY)) != getU32(&blob[8])) {
+        ESP_LOGE(TAG, "Profile blob CRC mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    std::vector<mb_profile_slave_t> config(count);
+    for (size_t i = 0; i < count; i++, entry += MB_PROFILE_BLOB_ENTRY) {
+        config[i].slave_addr = entry[0];
+        config[i].type_id = entry[1];
+        config[i].segment = entry[2];
+        config[i].priority = entry[3];
+        config[i].period_ms = getU16(&entry[4]);
+        config[i].jitter_ms = getU16(&entry[6]);
+    }
+    return setSlaves(config.data(), config.size());
+}
+
+esp_err_t ModbusProfiles::loadFromNvs(const char* name_space, const char* key) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(name_space, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    size_t size = 0;
+    err = nvs_get_blob(handle, key, nullptr, &size);
+    std::vector<uint8_t> blob(size);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(handle, key, blob.data(), &size);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return load(blob.data(), size);
+}
+
+size_t ModbusProfiles::serialize(const mb_profile_slave_t* slaves, size_t count, uint8_t* blob, size_t size) {
+    if (count > UINT16_MAX || size < MB_PROFILE_BLOB_SIZE(count)) {
+        return 0;
+    }
+    uint8_t* entry = blob + MB_PROFILE_BLOB_HEADER;
+    for (size_t i = 0; i < count; i++, entry += MB_PROFILE_BLOB_ENTRY) {
+        entry[0] = slaves[i].slave_addr;
+        entry[1] = slaves[i].type_id;
+        entry[2] = slaves[i].segment;
+        entry[3] = slaves[i].priority;
+        putU16(&entry[4], slaves[i].period_ms);
+        putU16(&entry[6], slaves[i].jitter_ms);
+    }
+    putU32(&blob[0], MB_PROFILE_BLOB_MAGIC);
+    blob[4] = MB_PROFILE_BLOB_VERSION;
+    blob[5] = 0;
+    putU16(&blob[6], (uint16_t)count);
+    putU32(&blob[8], esp_rom_crc32_le(0, blob + MB_PROFILE_BLOB_HEADER, (uint32_t)(count * MB_PROFILE_BLOB_ENTRY)));
+    return MB_PROFILE_BLOB_SIZE(count);
+}
+
+const mb_profile_slave_t* ModbusProfiles::findSlave(uint8_t slave_addr) const {
+    if (slave_addr > MB_PROFILE_MAX_SLAVE_ADDR || index[slave_addr] == NO_ENTRY) {
+        return nullptr;
+    }
+    return &slaves[index[slave_addr]].config;
+}
+
+const mb_device_type_t* ModbusProfiles::getType(uint8_t slave_addr) const {
+    if (slave_addr > MB_PROFILE_MAX_SLAVE_ADDR || index[slave_addr] == NO_ENTRY) {
+        return nullptr;
+    }
+    return &types[slaves[index[slave_addr]].type];
+}
+
+uint16_t ModbusProfiles::getCid(uint8_t slave_addr, uint8_t param) const {
+    if (slave_addr > MB_PROFILE_MAX_SLAVE_ADDR || index[slave_addr] == NO_ENTRY) {
+        return MB_PROFILE_NO_CID;
+    }
+    const Slave& slave = slaves[index[slave_addr]];
+    if (param >= types[slave.type].num_params) {
+        return MB_PROFILE_NO_CID;
+    }
+    return (uint16_t)(slave.cid_base + param);
+}
+
+const mb_parameter_descriptor_t* ModbusProfiles::findCid(uint16_t cid, uint8_t* slave_addr) const {
+    if (cid >= num_cids) {
+        return nullptr;
+    }
+    // Last slave whose first CID is not above cid
+    auto it = std::upper_bound(slaves.begin(), slaves.end(), cid, [](uint16_t value, const Slave& slave) {
+        return value < slave.cid_base;
+    });
+    const Slave& slave = *(it - 1);
+    if (slave_addr != nullptr) {
+        *slave_addr = slave.config.slave_addr;
+    }
+    return &types[slave.type].params[cid - slave.cid_base];
+}
+
+size_t ModbusProfiles::getMemoryUsage() const {
+    return sizeof(*this) + slaves.capacity() * sizeof(Slave);
+}
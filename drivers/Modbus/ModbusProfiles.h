@@ -0,0 +1,122 @@
+/**
+ * @file ModbusProfiles.h
+ * @brief Slaves of the gateway as instances of device types, loaded from a config blob.
+ *
+ * A device type holds the descriptors and deadbands of one kind of device
+ * once, with CIDs that number its parameters (0 for the first) and no slave
+ * address. The configuration only says which type answers at which address,
+ * on which segment and how often it is polled: 8 bytes per slave in the blob
+ * (NVS, or a file) and 12 in memory, next to a 248-byte index by address.
+ *
+ * CIDs of the gateway are handed out in address order, each slave taking as
+ * many as its type has parameters. A CID resolves to its slave and the shared
+ * descriptor of its type, and a slave and parameter to a CID, without a
+ * descriptor table per slave.
+ *
+ * Blob layout, little endian:
+ *
+ *   uint32 magic "MBPF", uint8 version, uint8 reserved, uint16 slave count,
+ *   uint32 CRC-32 of the entries, then per slave: uint8 address, uint8 type id,
+ *   uint8 segment, uint8 priority, uint16 period_ms, uint16 jitter_ms.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esp_err.h"
+#include "mbcontroller.h"
+#include "ModbusDeadband.h"
+
+#define MB_PROFILE_MAX_SLAVE_ADDR   247
+#define MB_PROFILE_NO_CID           0xFFFF
+
+#define MB_PROFILE_BLOB_MAGIC       0x4650424Du     // "MBPF"
+#define MB_PROFILE_BLOB_VERSION     1
+#define MB_PROFILE_BLOB_HEADER      12
+#define MB_PROFILE_BLOB_ENTRY       8
+#define MB_PROFILE_BLOB_SIZE(count) (MB_PROFILE_BLOB_HEADER + (count) * MB_PROFILE_BLOB_ENTRY)
+
+// Where the gateway keeps its profile blob
+#define MB_PROFILE_NVS_NAMESPACE    "modbus"
+#define MB_PROFILE_NVS_KEY          "profiles"
+
+typedef struct {
+    uint8_t type_id;
+    const char* name;
+    const mb_parameter_descriptor_t* params;    // CIDs number the parameters of the type
+    uint8_t num_params;
+    const mb_deadband_t* deadbands;             // CIDs of the type as well
+    uint8_t num_deadbands;
+} mb_device_type_t;
+
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t type_id;
+    uint8_t segment;
+    uint8_t priority;           // Higher is polled first when several slaves are due
+    uint16_t period_ms;
+    uint16_t jitter_ms;
+} mb_profile_slave_t;
+
+class ModbusProfiles {
+public:
+    ModbusProfiles(const mb_device_type_t* types, size_t num_types);
+
+    /**
+     * @brief Take a list of slaves, replacing the current one.
+     *
+     * @return ESP_OK; ESP_ERR_INVALID_ARG for an address outside 1..247, an
+     *         address given twice, an unknown type id, a period of 0 or a
+     *         jitter longer than the period.
+     */
+    esp_err_t setSlaves(const mb_profile_slave_t* slaves, size_t count);
+
+    /**
+     * @brief Take the slaves of a config blob.
+     *
+     * @return ESP_OK; ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_VERSION or
+     *         ESP_ERR_INVALID_CRC for a blob that is cut, of another format or
+     *         corrupt; the errors of setSlaves() for its contents.
+     */
+    esp_err_t load(const uint8_t* blob, size_t size);
+
+    // Load the blob stored under key in an NVS namespace, nvs_flash_init() must have run
+    esp_err_t loadFromNvs(const char* name_space, const char* key);
+
+    // Write the blob of a list of slaves, returns its size or 0 if it does not fit
+    static size_t serialize(const mb_profile_slave_t* slaves, size_t count, uint8_t* blob, size_t size);
+
+    size_t getNumSlaves() const { return slaves.size(); }
+    const mb_profile_slave_t& getSlave(size_t index) const { return slaves[index].config; }
+
+    // Entry of a slave address, nullptr if it is not configured
+    const mb_profile_slave_t* findSlave(uint8_t slave_addr) const;
+    const mb_device_type_t* getType(uint8_t slave_addr) const;
+
+    // CIDs handed out over all slaves
+    uint16_t getNumCids() const { return num_cids; }
+
+    // CID of parameter param of a slave, MB_PROFILE_NO_CID if there is none
+    uint16_t getCid(uint8_t slave_addr, uint8_t param) const;
+
+    // Shared descriptor of a CID and the slave it belongs to, nullptr for an unknown CID
+    const mb_parameter_descriptor_t* findCid(uint16_t cid, uint8_t* slave_addr) const;
+
+    // Bytes taken by the configuration, the type tables are not counted
+    size_t getMemoryUsage() const;
+
+private:
+    struct Slave {
+        mb_profile_slave_t config;
+        uint16_t cid_base;      // CID of the first parameter
+        uint8_t type;           // Index into types
+    };
+
+    const mb_device_type_t* types;
+    size_t num_types;
+    std::vector<Slave> slaves;                  // By address
+    uint8_t index[MB_PROFILE_MAX_SLAVE_ADDR + 1];   // Address to entry, 0xFF if none
+    uint16_t num_cids;
+};
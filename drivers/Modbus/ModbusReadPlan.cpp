@@ -0,0 +1,259 @@
+#include "ModbusReadPlan.h"
+#include "ModbusBus.h"
+#include "Modbus.h"
+#include "ModbusProfiles.h"
+#include "esp_log.h"
+
+#include <algorithm>
+
+static const char *TAG = "ModbusReadPlan";
+
+static bool isBitType(mb_param_type_t type) {
+    return type == MB_PARAM_COIL || type == MB_PARAM_DISCRETE;
+}
+
+static uint8_t readCommand(mb_param_type_t type) {
+    switch (type) {
+        case MB_PARAM_HOLDING:  return MB_FUNC_READ_HOLDING_REGISTER;
+        case MB_PARAM_INPUT:    return MB_FUNC_READ_INPUT_REGISTER;
+        case MB_PARAM_COIL:     return MB_FUNC_READ_COILS;
+        case MB_PARAM_DISCRETE: return MB_FUNC_READ_DISCRETE_INPUTS;
+        default:                return 0;
+    }
+}
+
+ModbusReadPlan::ModbusReadPlan(uint16_t max_gap, uint16_t max_registers)
+    : params(nullptr), profiles(nullptr), max_gap(max_gap),
+      max_registers(std::min<uint16_t>(max_registers, MB_PLAN_MAX_REGISTERS)), num_planned(0) {
+}
+
+static bool isReadable(const mb_parameter_descriptor_t& param) {
+    return (param.access & PAR_PERMS_READ) && param.mb_size > 0 && readCommand(param.mb_param_type) != 0;
+}
+
+static bool inList(const uint8_t* slaves, size_t num_slaves, uint8_t slave_addr) {
+    return slaves == nullptr || std::find(slaves, slaves + num_slaves, slave_addr) != slaves + num_slaves;
+}
+
+void ModbusReadPlan::clear(size_t num_slots) {
+    blocks.clear();
+    slots.assign(num_slots, Slot{-1, 0});
+    data.clear();
+    requests.clear();
+    num_planned = 0;
+    params = nullptr;
+    profiles = nullptr;
+}
+
+bool ModbusReadPlan::build(const mb_parameter_descriptor_t* params, uint16_t num_params, const uint8_t* slaves,
+                           size_t num_slaves) {
+    clear(num_params);
+    if (params == nullptr || num_params == 0) {
+        ESP_LOGE(TAG, "Empty descriptor table");
+        return false;
+    }
+    this->params = params;
+
+    std::vector<Item> items;
+    items.reserve(num_params);
+    for (uint16_t i = 0; i < num_params; i++) {
+        if (inList(slaves, num_slaves, params[i].mb_slave_addr) && isReadable(params[i])) {
+            items.push_back(Item{&params[i], params[i].cid, i, params[i].mb_slave_addr});
+        }
+    }
+    return plan(items);
+}
+
+bool ModbusReadPlan::build(const ModbusProfiles& profiles, const uint8_t* slaves, size_t num_slaves) {
+    clear(profiles.getNumCids());
+    if (profiles.getNumSlaves() == 0) {
+        ESP_LOGE(TAG, "No slaves configured");
+        return false;
+    }
+    this->profiles = &profiles;
+
+    // The CIDs of the profiles number the slots
+    std::vector<Item> items;
+    for (size_t i = 0; i < profiles.getNumSlaves(); i++) {
+        uint8_t slave_addr = profiles.getSlave(i).slave_addr;
+        const mb_device_type_t* type = profiles.getType(slave_addr);
+        if (!inList(slaves, num_slaves, slave_addr)) {
+            continue;
+        }
+        for (uint8_t p = 0; p < type->num_params; p++) {
+            if (isReadable(type->params[p])) {
+                uint16_t cid = profiles.getCid(slave_addr, p);
+                items.push_back(Item{&type->params[p], cid, cid, slave_addr});
+            }
+        }
+    }
+    return plan(items);
+}
+
+bool ModbusReadPlan::plan(std::vector<Item>& items) {
+    // Group by slave and register type, then walk each group in address order
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+        const mb_parameter_descriptor_t& pa = *a.param;
+        const mb_parameter_descriptor_t& pb = *b.param;
+        if (a.slave_addr != b.slave_addr) return a.slave_addr < b.slave_addr;
+        if (pa.mb_param_type != pb.mb_param_type) return pa.mb_param_type < pb.mb_param_type;
+        if (pa.mb_reg_start != pb.mb_reg_start) return pa.mb_reg_start < pb.mb_reg_start;
+        return pa.mb_size > pb.mb_size;
+    });
+
+    for (const Item& item : items) {
+        const mb_parameter_descriptor_t& param = *item.param;
+        uint32_t limit = isBitType(param.mb_param_type) ? MB_PLAN_MAX_BITS : max_registers;
+        if (param.mb_size > limit) {
+            ESP_LOGE(TAG, "CID #%u spans %u registers, more than one request can read",
+                     (unsigned)item.cid, (unsigned)param.mb_size);
+            blocks.clear();
+            return false;
+        }
+
+        uint32_t param_end = (uint32_t)param.mb_reg_start + param.mb_size;
+        bool merged = false;
+        if (!blocks.empty()) {
+            ModbusReadBlock& block = blocks.back();
+            uint32_t block_end = (uint32_t)block.reg_start + block.reg_size;
+            if (block.slave_addr == item.slave_addr && block.param_type == param.mb_param_type &&
+                param.mb_reg_start <= block_end + max_gap &&
+                std::max(block_end, param_end) - block.reg_start <= limit) {
+                block.reg_size = (uint16_t)(std::max(block_end, param_end) - block.reg_start);
+                block.num_params++;
+                merged = true;
+            }
+        }
+        if (!merged) {
+            ModbusReadBlock block = {};
+            block.slave_addr = item.slave_addr;
+            block.param_type = param.mb_param_type;
+            block.command = readCommand(param.mb_param_type);
+            block.reg_start = param.mb_reg_start;
+            block.reg_size = param.mb_size;
+            block.num_params = 1;
+            block.valid = false;
+            blocks.push_back(block);
+        }
+
+        slots[item.slot].block = (int16_t)(blocks.size() - 1);
+        slots[item.slot].offset = param.mb_reg_start - blocks.back().reg_start;
+        num_planned++;
+    }
+
+    // Bit blocks are packed eight to a byte, as they come off the wire
+    size_t words = 0;
+    for (ModbusReadBlock& block : blocks) {
+        block.data_offset = words;
+        words += isBitType(block.param_type) ? (block.reg_size + 15) / 16 : block.reg_size;
+    }
+    data.assign(words, 0);
+
+    // One request per block, pointing at its slice of the buffer, for readSlave()
+    requests.assign(blocks.size(), ModbusRequest{});
+    for (size_t i = 0; i < blocks.size(); i++) {
+        requests[i].slave_id = blocks[i].slave_addr;
+        requests[i].command = blocks[i].command;
+        requests[i].address = blocks[i].reg_start;
+        requests[i].quantity = blocks[i].reg_size;
+        requests[i].data = &data[blocks[i].data_offset];
+    }
+
+    ESP_LOGI(TAG, "%u CIDs planned into %u requests (gap fill %u)",
+             (unsigned)num_planned, (unsigned)blocks.size(), (unsigned)max_gap);
+    return !blocks.empty();
+}
+
+esp_err_t ModbusReadPlan::readBlock(ModbusBus* bus, size_t index) {
+    ModbusReadBlock& block = blocks[index];
+    esp_err_t err = bus->transact(block.slave_addr, block.command, block.reg_start, block.reg_size,
+                                  &data[block.data_offset]);
+    block.valid = (err == ESP_OK);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read %u registers at %u from slave %d: %s", (unsigned)block.reg_size,
+                 (unsigned)block.reg_start, block.slave_addr, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t ModbusReadPlan::readSlave(ModbusBus* bus, uint8_t slave_addr) {
+    // The blocks of a slave are next to each other, they go out as one batch
+    size_t first = 0;
+    while (first < blocks.size() && blocks[first].slave_addr != slave_addr) {
+        first++;
+    }
+    size_t last = first;
+    while (last < blocks.size() && blocks[last].slave_addr == slave_addr) {
+        last++;
+    }
+    if (first == last) {
+        return ESP_OK;
+    }
+
+    esp_err_t result = bus->transact(&requests[first], last - first);
+    for (size_t i = first; i < last; i++) {
+        esp_err_t err = requests[i].result;
+        blocks[i].valid = (err == ESP_OK);
+        if (err != ESP_OK && !(err == ESP_ERR_TIMEOUT && i > first && requests[i - 1].result == ESP_ERR_TIMEOUT)) {
+            ESP_LOGE(TAG, "Failed to read %u registers at %u from slave %d: %s", (unsigned)blocks[i].reg_size,
+                     (unsigned)blocks[i].reg_start, slave_addr, esp_err_to_name(err));
+        }
+    }
+    return result;
+}
+
+const ModbusReadPlan::Slot* ModbusReadPlan::findSlot(uint16_t cid) const {
+    if (profiles != nullptr) {
+        return cid < slots.size() ? &slots[cid] : nullptr;
+    }
+    // CIDs normally number the table entries, fall back to a scan otherwise
+    if (cid < slots.size() && params[cid].cid == cid) {
+        return &slots[cid];
+    }
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (params[i].cid == cid) {
+            return &slots[i];
+        }
+    }
+    return nullptr;
+}
+
+const uint16_t* ModbusReadPlan::getRegisters(uint16_t cid) const {
+    const Slot* slot = findSlot(cid);
+    if (slot == nullptr || slot->block < 0) {
+        return nullptr;
+    }
+    const ModbusReadBlock& block = blocks[slot->block];
+    if (!block.valid || isBitType(block.param_type)) {
+        return nullptr;
+    }
+    return &data[block.data_offset + slot->offset];
+}
+
+const uint16_t* ModbusReadPlan::getRegisters(uint8_t slave_addr, mb_param_type_t param_type, uint16_t reg_start,
+                                             uint16_t reg_size) const {
+    if (isBitType(param_type)) {
+        return nullptr;
+    }
+    for (const ModbusReadBlock& block : blocks) {
+        if (block.slave_addr == slave_addr && block.param_type == param_type && block.reg_start <= reg_start &&
+            (uint32_t)reg_start + reg_size <= (uint32_t)block.reg_start + block.reg_size) {
+            return block.valid ? &data[block.data_offset + (reg_start - block.reg_start)] : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+bool ModbusReadPlan::getBit(uint16_t cid, bool* value) const {
+    const Slot* slot = findSlot(cid);
+    if (slot == nullptr || slot->block < 0) {
+        return false;
+    }
+    const ModbusReadBlock& block = blocks[slot->block];
+    if (!block.valid || !isBitType(block.param_type)) {
+        return false;
+    }
+    const uint8_t* bits = reinterpret_cast<const uint8_t*>(&data[block.data_offset]);
+    *value = (bits[slot->offset / 8] >> (slot->offset % 8)) & 0x01;
+    return true;
+}
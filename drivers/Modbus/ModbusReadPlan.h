@@ -0,0 +1,142 @@
+/**
+ * @file ModbusReadPlan.h
+ * @brief Coalesces the readable CIDs of a descriptor table into block reads.
+ *
+ * The plan groups the parameters of a descriptor table per slave and register
+ * type, sorts them by address and merges neighbours into one request while the
+ * request stays within the Modbus PDU limit (125 registers, 2000 coils or
+ * discrete inputs) and the unused registers between two parameters do not
+ * exceed the gap-fill threshold. Reading a few unused registers is cheaper on
+ * the wire than the turnaround and framing of an extra transaction.
+ *
+ * Every block owns a slice of the plan's data buffer. After a block has been
+ * read, the value of each of its parameters is found through its CID.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "mbcontroller.h"
+#include "../../interface/ModbusInterface.h"
+
+class ModbusBus;
+class ModbusProfiles;
+
+// Modbus PDU limits for a single read request
+#define MB_PLAN_MAX_REGISTERS   125
+#define MB_PLAN_MAX_BITS        2000
+
+// Unused registers (or bits) that may be read to join two parameters
+#define MB_PLAN_DEFAULT_GAP     10
+
+struct ModbusReadBlock {
+    uint8_t slave_addr;
+    mb_param_type_t param_type;
+    uint8_t command;            // Modbus read function code
+    uint16_t reg_start;
+    uint16_t reg_size;          // Registers, or bits for coils and discrete inputs
+    uint16_t num_params;        // Parameters served by this block
+    size_t data_offset;         // First word of the block in the plan buffer
+    bool valid;                 // Last read of the block succeeded
+};
+
+class ModbusReadPlan {
+public:
+    explicit ModbusReadPlan(uint16_t max_gap = MB_PLAN_DEFAULT_GAP,
+                            uint16_t max_registers = MB_PLAN_MAX_REGISTERS);
+
+    /**
+     * @brief Build the plan from a descriptor table.
+     *
+     * Parameters without read permission or with a zero size are left out,
+     * and with a slave list those of the slaves not in it, e.g. the slaves on
+     * other segments. The table must stay valid while the plan is in use.
+     *
+     * @return false if nothing is left to read or a parameter exceeds the request limit.
+     */
+    bool build(const mb_parameter_descriptor_t* params, uint16_t num_params, const uint8_t* slaves = nullptr,
+               size_t num_slaves = 0);
+
+    /**
+     * @brief Build the plan from the slaves of device profiles.
+     *
+     * Same as above, over the parameters of every configured slave's type;
+     * the CIDs are those of the profiles, which must outlive the plan.
+     */
+    bool build(const ModbusProfiles& profiles, const uint8_t* slaves = nullptr, size_t num_slaves = 0);
+
+    size_t getNumBlocks() const { return blocks.size(); }
+    const ModbusReadBlock& getBlock(size_t index) const { return blocks[index]; }
+
+    // Data of a block as it came off the wire, registers or packed bits
+    const uint16_t* getBlockData(size_t index) const { return &data[blocks[index].data_offset]; }
+
+    // Number of parameters the plan covers
+    size_t getNumParams() const { return num_planned; }
+
+    /**
+     * @brief Read every block of one slave through the bus.
+     *
+     * The blocks go to the bus as one batch, so the next request is on the
+     * wire as soon as the previous response is in. Once the slave has timed
+     * out, its remaining blocks are marked stale without being sent.
+     *
+     * @return ESP_OK when every block was read, the error of the last failed block otherwise.
+     */
+    esp_err_t readSlave(ModbusBus* bus, uint8_t slave_addr);
+
+    // Read one block and mark it valid or stale
+    esp_err_t readBlock(ModbusBus* bus, size_t index);
+
+    /**
+     * @brief Registers of a holding or input register parameter.
+     *
+     * @return Pointer to the first register of the CID, or nullptr if the CID
+     *         is not in the plan or its block has no valid data.
+     */
+    const uint16_t* getRegisters(uint16_t cid) const;
+
+    /**
+     * @brief Registers of a range of one slave, e.g. the span of a ModbusRegisterMap.
+     *
+     * @return Pointer to register reg_start, or nullptr if no block with valid
+     *         data covers the whole range.
+     */
+    const uint16_t* getRegisters(uint8_t slave_addr, mb_param_type_t param_type, uint16_t reg_start,
+                                 uint16_t reg_size) const;
+
+    // State of a coil or discrete input parameter, false if it has no valid data
+    bool getBit(uint16_t cid, bool* value) const;
+
+private:
+    // One per CID, or per table entry when built from a descriptor table
+    struct Slot {
+        int16_t block;          // -1 when the CID is not planned
+        uint16_t offset;        // Register or bit offset within the block
+    };
+
+    // A readable parameter while the plan is built
+    struct Item {
+        const mb_parameter_descriptor_t* param;
+        uint16_t cid;
+        uint16_t slot;
+        uint8_t slave_addr;
+    };
+
+    void clear(size_t num_slots);
+    bool plan(std::vector<Item>& items);
+    const Slot* findSlot(uint16_t cid) const;
+
+    const mb_parameter_descriptor_t* params;    // Descriptor table, or
+    const ModbusProfiles* profiles;             // the profiles the plan was built from
+
+    uint16_t max_gap;
+    uint16_t max_registers;
+    size_t num_planned;
+    std::vector<ModbusReadBlock> blocks;
+    std::vector<Slot> slots;
+    std::vector<uint16_t> data;
+    std::vector<ModbusRequest> requests;    // One per block, same order
+};
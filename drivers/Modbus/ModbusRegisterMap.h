@@ -0,0 +1,123 @@
+/**
+ * @file ModbusRegisterMap.h
+ * @brief Register layouts of a device profile, decoded by code generated at compile time.
+ *
+ * A ModbusField names the C type of a value, its first register, the order
+ * the device puts its bytes on the wire in, and a scale and offset applied
+ * after decoding. A ModbusRegisterMap lists the fields of one device profile
+ * and turns a block of registers into a tuple of their values. A field keeps
+ * its own type, so 32 and 64-bit counters come out exact; only a field with
+ * a scale or offset is a float.
+ *
+ * Everything about a field is a template parameter, so the decoder of a
+ * profile is a straight run of loads, byte swaps and multiplies with no switch
+ * on the parameter type, the byte order or the register offsets at run time.
+ * A map that does not fit one read request (125 registers) does not compile.
+ *
+ * Byte orders name the bytes of a 32-bit value from the most significant (A)
+ * as they come off the wire:
+ *
+ *   MB_ORDER_ABCD  high word first, big endian words (the Modbus convention)
+ *   MB_ORDER_CDAB  low word first, big endian words ("word swapped")
+ *   MB_ORDER_BADC  high word first, bytes swapped in each word
+ *   MB_ORDER_DCBA  low word first, bytes swapped in each word (little endian)
+ *
+ * 16-bit values only see the byte swap, 64-bit values the same word and byte
+ * order over four registers.
+ */
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+#include "ModbusReadPlan.h"
+
+typedef enum {
+    MB_ORDER_ABCD,
+    MB_ORDER_CDAB,
+    MB_ORDER_BADC,
+    MB_ORDER_DCBA,
+} mb_byte_order_t;
+
+namespace mb_register_map {
+
+// Unsigned word of the size of a field, the bits are gathered in it
+template <size_t Bytes> struct RawWord;
+template <> struct RawWord<2> { typedef uint16_t type; };
+template <> struct RawWord<4> { typedef uint32_t type; };
+template <> struct RawWord<8> { typedef uint64_t type; };
+
+}  // namespace mb_register_map
+
+template <typename T, uint16_t Reg, mb_byte_order_t Order = MB_ORDER_ABCD, float Scale = 1.0f, float Offset = 0.0f>
+struct ModbusField {
+    static_assert(std::is_arithmetic_v<T> && (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                  "A Modbus field is a 16, 32 or 64-bit integer or floating point value");
+
+    typedef T type;
+    // Type of the value in engineering units
+    typedef std::conditional_t<Scale == 1.0f && Offset == 0.0f, T, float> value_type;
+    static constexpr uint16_t reg = Reg;
+    static constexpr uint16_t words = sizeof(T) / 2;
+    static constexpr mb_byte_order_t order = Order;
+    static constexpr float scale = Scale;
+    static constexpr float offset = Offset;
+
+    // Value as the device sends it, regs points at register Reg
+    static T raw(const uint16_t* regs) {
+        typedef typename mb_register_map::RawWord<sizeof(T)>::type Raw;
+        constexpr bool word_swap = Order == MB_ORDER_CDAB || Order == MB_ORDER_DCBA;
+        constexpr bool byte_swap = Order == MB_ORDER_BADC || Order == MB_ORDER_DCBA;
+
+        Raw bits = 0;
+        for (size_t i = 0; i < words; i++) {
+            uint16_t word = regs[word_swap ? words - 1 - i : i];
+            if constexpr (byte_swap) {
+                word = (uint16_t)((word << 8) | (word >> 8));
+            }
+            bits = (Raw)(((uint64_t)bits << 16) | word);
+        }
+        return std::bit_cast<T>(bits);
+    }
+
+    // Value in engineering units, the raw value itself unless it is scaled
+    static value_type value(const uint16_t* regs) {
+        if constexpr (Scale == 1.0f && Offset == 0.0f) {
+            return raw(regs);
+        } else {
+            float result = (float)raw(regs);
+            if constexpr (Scale != 1.0f) {
+                result *= Scale;
+            }
+            if constexpr (Offset != 0.0f) {
+                result += Offset;
+            }
+            return result;
+        }
+    }
+};
+
+template <typename... Fields>
+struct ModbusRegisterMap {
+    static_assert(sizeof...(Fields) > 0, "A register map needs at least one field");
+
+    static constexpr size_t num_fields = sizeof...(Fields);
+
+    // Values of all fields in their order, each of its field's value_type
+    typedef std::tuple<typename Fields::value_type...> Values;
+
+    // Registers a poll has to read: from the lowest field to the end of the highest
+    static constexpr uint16_t start = std::min({Fields::reg...});
+    static constexpr uint16_t span = (uint16_t)(std::max({(uint32_t)Fields::reg + Fields::words...}) - start);
+
+    static_assert(span <= MB_PLAN_MAX_REGISTERS, "Register map does not fit one 125-register read");
+
+    // Values of all fields, regs points at register start
+    static Values decode(const uint16_t* regs) {
+        return Values(Fields::value(regs + (Fields::reg - start))...);
+    }
+};
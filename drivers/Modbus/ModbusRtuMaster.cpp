@@ -0,0 +1,301 @@
+#include "ModbusRtuMaster.h"
+#include "Modbus.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+static const char *TAG = "ModbusRtuMaster";
+
+// CRC16 of every byte value, reflected polynomial 0xA001
+static const uint16_t crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+uint16_t mbRtuCrc16(const uint8_t* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 8) ^ crc_table[(crc ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+size_t mbRtuBuildRequest(uint8_t slave_id, uint8_t command, uint16_t address, uint16_t quantity,
+                         const void* data, uint8_t* frame) {
+    const uint16_t* regs = static_cast<const uint16_t*>(data);
+    const uint8_t* bits = static_cast<const uint8_t*>(data);
+    size_t len;
+
+    frame[0] = slave_id;
+    frame[1] = command;
+    frame[2] = address >> 8;
+    frame[3] = address & 0xFF;
+    frame[4] = quantity >> 8;
+    frame[5] = quantity & 0xFF;
+    switch (command) {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS:
+            if (quantity < 1 || quantity > 2000) return 0;
+            len = 6;
+            break;
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER:
+            if (quantity < 1 || quantity > 125) return 0;
+            len = 6;
+            break;
+        case MB_FUNC_WRITE_SINGLE_COIL:
+            frame[4] = bits[0] ? 0xFF : 0x00;
+            frame[5] = 0x00;
+            len = 6;
+            break;
+        case MB_FUNC_WRITE_SINGLE_REGISTER:
+            frame[4] = regs[0] >> 8;
+            frame[5] = regs[0] & 0xFF;
+            len = 6;
+            break;
+        case MB_FUNC_WRITE_MULTIPLE_COILS:
+            if (quantity < 1 || quantity > 1968) return 0;
+            frame[6] = (uint8_t)((quantity + 7) / 8);
+            memcpy(&frame[7], bits, frame[6]);
+            len = 7 + frame[6];
+            break;
+        case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+            if (quantity < 1 || quantity > 123) return 0;
+            frame[6] = (uint8_t)(2 * quantity);
+            for (uint16_t i = 0; i < quantity; i++) {
+                frame[7 + 2 * i] = regs[i] >> 8;
+                frame[8 + 2 * i] = regs[i] & 0xFF;
+            }
+            len = 7 + frame[6];
+            break;
+        default:
+            return 0;
+    }
+    uint16_t crc = mbRtuCrc16(frame, len);
+    frame[len++] = crc & 0xFF;      // CRC goes out low byte first
+    frame[len++] = crc >> 8;
+    return len;
+}
+
+size_t mbRtuResponseLength(const uint8_t* frame, size_t have) {
+    if (have < 2) return 0;
+    if (frame[1] & 0x80) return 5;
+    switch (frame[1]) {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS:
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER:
+            return have < 3 ? 0 : 5 + (size_t)frame[2];
+        default:
+            return 8;
+    }
+}
+
+int64_t mbRtuCharTimeUs(size_t n, uint32_t baudrate, bool parity) {
+    if (baudrate == 0) return 0;
+    return (int64_t)n * (parity ? 11 : 10) * 1000000 / baudrate;
+}
+
+int64_t mbRtuFrameGapUs(uint32_t baudrate, bool parity) {
+    if (baudrate > 19200) return 1750;
+    return mbRtuCharTimeUs(7, baudrate, parity) / 2;
+}
+
+ModbusRtuMaster::ModbusRtuMaster(uart_port_t uart_port, uint32_t baudrate, uart_parity_t parity, int tx_pin, int rx_pin, int rts_pin)
+    : uart_port(uart_port), baudrate(baudrate), parity(parity), tx_pin(tx_pin), rx_pin(rx_pin), rts_pin(rts_pin),
+      installed(false), frame_gap_us(mbRtuFrameGapUs(baudrate, parity != UART_PARITY_DISABLE)), idle_since_us(0),
+      stats() {}
+
+ModbusRtuMaster::~ModbusRtuMaster() {
+    if (installed) {
+        uart_driver_delete(uart_port);
+        installed = false;
+    }
+}
+
+bool ModbusRtuMaster::init() {
+    esp_err_t err = ESP_OK;
+
+    if (installed) {
+        ESP_LOGW(TAG, "RTU master already initialized");
+        return true;
+    }
+
+    uart_config_t config = {};
+    config.baud_rate = (int)baudrate;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = parity;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    err = uart_driver_install(uart_port, MB_RTU_RX_BUFFER, MB_RTU_TX_BUFFER, 0, NULL, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install UART driver: %s", esp_err_to_name(err));
+        return false;
+    }
+    installed = true;
+
+    err = uart_param_config(uart_port, &config);
+    if (err == ESP_OK) {
+        err = uart_set_pin(uart_port, tx_pin, rx_pin, rts_pin, UART_PIN_NO_CHANGE);
+    }
+    if (err == ESP_OK) {
+        err = uart_set_mode(uart_port, UART_MODE_RS485_HALF_DUPLEX);
+    }
+    if (err == ESP_OK) {
+        // RX timeout in character times: hand over the frame once T3.5 has passed
+        int64_t char_us = mbRtuCharTimeUs(1, baudrate, parity != UART_PARITY_DISABLE);
+        int64_t chars = char_us > 0 ? (frame_gap_us + char_us - 1) / char_us : 4;
+        err = uart_set_rx_timeout(uart_port, (uint8_t)(chars < 4 ? 4 : chars > 100 ? 100 : chars));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure UART%d: %s", (int)uart_port, esp_err_to_name(err));
+        return false;
+    }
+
+    idle_since_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "RTU master on UART%d at %u baud, T3.5 %d us", (int)uart_port, (unsigned)baudrate,
+             (int)frame_gap_us);
+    return true;
+}
+
+size_t ModbusRtuMaster::receive(uint8_t* buffer, size_t len, int64_t timeout_us) {
+    // Ticks round up, and the first one may be nearly over already
+    TickType_t ticks = (TickType_t)((timeout_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000)) + 1;
+    int n = uart_read_bytes(uart_port, buffer, (uint32_t)len, ticks);
+    return n > 0 ? (size_t)n : 0;
+}
+
+esp_err_t ModbusRtuMaster::transact(uint8_t slave_id, uint8_t command, uint16_t address, uint16_t quantity,
+                                    void* data, uint32_t timeout_ms) {
+    if (!installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t frame[MB_RTU_MAX_FRAME];
+    size_t len = mbRtuBuildRequest(slave_id, command, address, quantity, data, frame);
+    if (len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bool with_parity = parity != UART_PARITY_DISABLE;
+
+    // T3.5 after the previous frame, usually over by the time the next request comes
+    int64_t start = esp_timer_get_time();
+    while (start - idle_since_us < frame_gap_us) {
+        start = esp_timer_get_time();
+    }
+
+    uart_flush_input(uart_port);
+    uart_write_bytes(uart_port, frame, len);
+    uart_wait_tx_done(uart_port, pdMS_TO_TICKS(mbRtuCharTimeUs(len, baudrate, with_parity) / 1000 + 10));
+    stats.transactions++;
+    if (slave_id == 0) {
+        // Broadcast, nobody answers
+        idle_since_us = esp_timer_get_time();
+        return ESP_OK;
+    }
+
+    // Header within the response timeout, the rest as fast as the line allows
+    esp_err_t result = ESP_OK;
+    int64_t response_timeout_us = (int64_t)(timeout_ms > 0 ? timeout_ms : MB_RTU_RESPONSE_TIMEOUT_MS) * 1000;
+    size_t have = receive(frame, 3, response_timeout_us);
+    size_t expected = have == 3 ? mbRtuResponseLength(frame, have) : 0;
+    if (expected == 0) {
+        result = ESP_ERR_TIMEOUT;
+    } else if (expected > MB_RTU_MAX_FRAME) {
+        result = ESP_ERR_INVALID_RESPONSE;
+    } else {
+        size_t rest = expected - have;
+        have += receive(frame + have, rest, mbRtuCharTimeUs(rest, baudrate, with_parity) + frame_gap_us);
+        if (have < expected) {
+            result = ESP_ERR_TIMEOUT;
+        } else if (mbRtuCrc16(frame, expected - 2) != (uint16_t)(frame[expected - 2] | (frame[expected - 1] << 8))) {
+            result = ESP_ERR_INVALID_CRC;
+        } else if (frame[0] != slave_id || (frame[1] & 0x7F) != command) {
+            result = ESP_ERR_INVALID_RESPONSE;
+        } else if (frame[1] & 0x80) {
+            // Exception response, as esp-modbus reports it
+            result = ESP_ERR_NOT_SUPPORTED;
+        } else {
+            result = decode(command, quantity, frame, expected, data);
+        }
+    }
+    int64_t end = esp_timer_get_time();
+    // The driver hands over the tail of a frame at the RX timeout, so after a
+    // complete response the line has already been quiet for T3.5
+    idle_since_us = have == expected && expected > 0 ? end - frame_gap_us : end;
+
+    switch (result) {
+        case ESP_OK:
+        case ESP_ERR_NOT_SUPPORTED:
+            stats.exceptions += result == ESP_OK ? 0 : 1;
+            stats.latency_sum_us += end - start;
+            if (end - start > stats.latency_max_us) {
+                stats.latency_max_us = end - start;
+            }
+            break;
+        case ESP_ERR_TIMEOUT:
+            stats.timeouts++;
+            break;
+        case ESP_ERR_INVALID_CRC:
+            stats.crc_errors++;
+            break;
+        default:
+            stats.invalid++;
+            break;
+    }
+    return result;
+}
+
+esp_err_t ModbusRtuMaster::decode(uint8_t command, uint16_t quantity, const uint8_t* frame, size_t len, void* data) {
+    switch (command) {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS:
+            if (frame[2] != (quantity + 7) / 8) return ESP_ERR_INVALID_RESPONSE;
+            memcpy(data, &frame[3], frame[2]);
+            return ESP_OK;
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER: {
+            if (frame[2] != 2 * quantity) return ESP_ERR_INVALID_RESPONSE;
+            uint16_t* regs = static_cast<uint16_t*>(data);
+            for (uint16_t i = 0; i < quantity; i++) {
+                regs[i] = (uint16_t)((frame[3 + 2 * i] << 8) | frame[4 + 2 * i]);
+            }
+            return ESP_OK;
+        }
+        default:
+            // Writes echo the address and the value or quantity
+            return len == 8 ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+    }
+}
@@ -0,0 +1,123 @@
+/**
+ * @file ModbusRtuMaster.h
+ * @brief In-tree Modbus RTU master on a UART, an alternative to esp-modbus.
+ *
+ * The engine runs a transaction on the calling task: it builds the request
+ * frame, waits out the T3.5 silence after the previous frame, sends it and
+ * reads the response straight from the UART driver. There is no controller
+ * task, event group or parameter table in between, and every request can
+ * carry its own response timeout.
+ *
+ * The UART RX timeout is set to T3.5, so the driver hands over the tail of a
+ * frame once the line has been quiet that long rather than when its FIFO
+ * fills: the end of the frame and the silence the next request has to wait
+ * for come together. The length of a response is known from its header, so
+ * the transaction completes with its last byte; a response that stops short
+ * is dropped once the line has been quiet for longer than its remaining
+ * characters plus T3.5.
+ *
+ * The CRC is the table-driven Modbus CRC16. Data buffers follow
+ * mbc_master_send_request(): registers as host-order uint16_t, coils packed
+ * eight to a byte, so ModbusBus can use either backend.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/uart.h"
+#include "esp_err.h"
+
+// Largest RTU frame: address, 253-byte PDU, CRC
+#define MB_RTU_MAX_FRAME            256
+#define MB_RTU_MAX_PDU              253
+
+#define MB_RTU_RX_BUFFER            512
+#define MB_RTU_TX_BUFFER            0       // uart_write_bytes blocks until the frame is in the FIFO
+
+#ifdef CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND
+#define MB_RTU_RESPONSE_TIMEOUT_MS  CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND
+#else
+#define MB_RTU_RESPONSE_TIMEOUT_MS  150
+#endif
+
+// Modbus CRC16 (polynomial 0xA001, initial value 0xFFFF), from a 256-entry table
+uint16_t mbRtuCrc16(const uint8_t* data, size_t len);
+
+/**
+ * @brief Build a request frame with its CRC.
+ *
+ * @param data Values for writes, as for mbc_master_send_request(). Unused for reads.
+ * @return Frame length, 0 for an unknown function code or a quantity out of range.
+ */
+size_t mbRtuBuildRequest(uint8_t slave_id, uint8_t command, uint16_t address, uint16_t quantity,
+                         const void* data, uint8_t* frame);
+
+// Total length of a response frame once enough of it has arrived, 0 while unknown
+size_t mbRtuResponseLength(const uint8_t* frame, size_t have);
+
+// Line time of n characters (start, 8 data, optional parity and stop bits)
+int64_t mbRtuCharTimeUs(size_t n, uint32_t baudrate, bool parity);
+
+// The T3.5 silence that ends a frame, a fixed 1750 us above 19200 baud
+int64_t mbRtuFrameGapUs(uint32_t baudrate, bool parity);
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t timeouts;          // No response, or one that stopped short
+    uint32_t crc_errors;
+    uint32_t exceptions;        // Exception responses
+    uint32_t invalid;           // Responses from another slave, function or length
+    int64_t latency_sum_us;     // Start of the request to the last response byte, answered requests
+    int64_t latency_max_us;
+} mb_rtu_stats_t;
+
+class ModbusRtuMaster {
+public:
+    ModbusRtuMaster(uart_port_t uart_port,
+                    uint32_t baudrate,
+                    uart_parity_t parity,
+                    int tx_pin,
+                    int rx_pin,
+                    int rts_pin);
+
+    ~ModbusRtuMaster();
+
+    // Install the UART driver in RS-485 half-duplex mode, RTS drives the transceiver
+    bool init();
+
+    /**
+     * @brief Run one transaction on the bus.
+     *
+     * Not thread safe, one task owns the bus (the ModbusBus task).
+     *
+     * @param timeout_ms Response timeout of this request, 0 for MB_RTU_RESPONSE_TIMEOUT_MS.
+     * @return ESP_OK; ESP_ERR_TIMEOUT without a complete response; ESP_ERR_INVALID_CRC;
+     *         ESP_ERR_NOT_SUPPORTED for an exception response, as esp-modbus reports it;
+     *         ESP_ERR_INVALID_RESPONSE for a response that does not match the request;
+     *         ESP_ERR_INVALID_ARG for a request that cannot be framed.
+     */
+    esp_err_t transact(uint8_t slave_id, uint8_t command, uint16_t address, uint16_t quantity, void* data,
+                       uint32_t timeout_ms = 0);
+
+    void getStats(mb_rtu_stats_t* stats) const { *stats = this->stats; }
+
+private:
+    // Read exactly len bytes, giving up once nothing has come for the timeout
+    size_t receive(uint8_t* buffer, size_t len, int64_t timeout_us);
+    esp_err_t decode(uint8_t command, uint16_t quantity, const uint8_t* frame, size_t len, void* data);
+
+    uart_port_t uart_port;
+    uint32_t baudrate;
+    uart_parity_t parity;
+    int tx_pin;
+    int rx_pin;
+    int rts_pin;
+    bool installed;
+
+    int64_t frame_gap_us;
+    int64_t idle_since_us;      // End of the last frame on the line
+
+    mb_rtu_stats_t stats;
+};
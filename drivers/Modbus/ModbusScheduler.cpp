@@ -0,0 +1,106 @@
+#include "ModbusScheduler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "ModbusScheduler";
+
+ModbusScheduler::ModbusScheduler() {
+}
+
+int ModbusScheduler::addEntry(uint32_t period_ms, uint8_t priority, uint32_t jitter_ms, uint32_t offset_ms) {
+    if (period_ms == 0 || entries.size() >= MB_SCHED_MAX_ENTRIES) {
+        ESP_LOGE(TAG, "Cannot add schedule entry (period %u ms, %u entries)",
+                 (unsigned)period_ms, (unsigned)entries.size());
+        return -1;
+    }
+    Entry entry = {};
+    entry.period_us = (int64_t)period_ms * 1000;
+    entry.jitter_us = (int64_t)jitter_ms * 1000;
+    entry.offset_us = (int64_t)offset_ms * 1000;
+    entry.priority = priority;
+    entry.release_us = esp_timer_get_time() + entry.offset_us;
+    entry.started_us = -1;
+    entries.push_back(entry);
+    return (int)entries.size() - 1;
+}
+
+void ModbusScheduler::start() {
+    int64_t now = esp_timer_get_time();
+    for (Entry& entry : entries) {
+        entry.release_us = now + entry.offset_us;
+        entry.started_us = -1;
+    }
+}
+
+int ModbusScheduler::next(TickType_t* wait) {
+    int64_t now = esp_timer_get_time();
+    int best = -1;
+    int64_t earliest_release = INT64_MAX;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        if (entry.release_us > now) {
+            if (entry.release_us < earliest_release) {
+                earliest_release = entry.release_us;
+            }
+            continue;
+        }
+        if (best < 0) {
+            best = (int)i;
+            continue;
+        }
+        const Entry& current = entries[best];
+        if (entry.priority > current.priority ||
+            (entry.priority == current.priority &&
+             entry.release_us + entry.jitter_us < current.release_us + current.jitter_us)) {
+            best = (int)i;
+        }
+    }
+
+    if (best >= 0) {
+        Entry& entry = entries[best];
+        int64_t lateness = now - entry.release_us;
+        entry.started_us = now;
+        if (lateness > entry.jitter_us) {
+            entry.stats.late++;
+        }
+        if (lateness > entry.stats.lateness_max_us) {
+            entry.stats.lateness_max_us = lateness;
+        }
+        return best;
+    }
+
+    if (wait != nullptr) {
+        if (earliest_release == INT64_MAX) {
+            *wait = portMAX_DELAY;
+        } else {
+            // Round up so the task never wakes just before the release
+            int64_t tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+            int64_t ticks = (earliest_release - now + tick_us - 1) / tick_us;
+            *wait = (TickType_t)(ticks > 0 ? ticks : 1);
+        }
+    }
+    return -1;
+}
+
+void ModbusScheduler::complete(int index) {
+    if (index < 0 || (size_t)index >= entries.size()) {
+        return;
+    }
+    Entry& entry = entries[index];
+    int64_t now = esp_timer_get_time();
+
+    entry.stats.runs++;
+    if (entry.started_us >= 0 && now - entry.started_us > entry.stats.duration_max_us) {
+        entry.stats.duration_max_us = now - entry.started_us;
+    }
+    entry.started_us = -1;
+
+    entry.release_us += entry.period_us;
+    if (now - entry.release_us >= entry.period_us) {
+        // Behind by more than a period: drop the missed releases, keep the phase
+        int64_t missed = (now - entry.release_us) / entry.period_us;
+        entry.stats.skipped += (uint32_t)missed;
+        entry.release_us += missed * entry.period_us;
+    }
+}
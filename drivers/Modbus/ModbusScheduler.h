@@ -0,0 +1,80 @@
+/**
+ * @file ModbusScheduler.h
+ * @brief Deadline-based polling schedule for slaves or tag groups.
+ *
+ * Every entry has its own period, priority and jitter budget. An entry is due
+ * at its release time and should start within the jitter budget after it.
+ * When several entries are due, the one with the highest priority runs first,
+ * ties go to the earliest deadline. The poll task asks for the next entry,
+ * runs it and reports completion; when nothing is due it sleeps until the next
+ * release instead of a fixed cycle delay.
+ *
+ * Release times advance by whole periods from the first release, so an entry
+ * does not drift when its reads take varying time. An entry that falls more
+ * than a period behind skips the missed releases.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+
+// Entries the scheduler can hold, one for every address of a Modbus bus. The
+// table grows with the entries added, a segment's with its slave list.
+#define MB_SCHED_MAX_ENTRIES    247
+
+struct ModbusScheduleStats {
+    uint32_t runs;
+    uint32_t late;              // Started after release + jitter budget
+    uint32_t skipped;           // Releases dropped because the entry fell a period behind
+    int64_t lateness_max_us;    // Worst start delay after release
+    int64_t duration_max_us;    // Worst run time
+};
+
+class ModbusScheduler {
+public:
+    ModbusScheduler();
+
+    /**
+     * @brief Add an entry to the schedule.
+     *
+     * @param period_ms Poll period.
+     * @param priority Higher runs first when several entries are due.
+     * @param jitter_ms Allowed start delay after each release.
+     * @param offset_ms First release relative to start(), to spread entries apart.
+     * @return Entry index, or -1 if the schedule is full or the period is zero.
+     */
+    int addEntry(uint32_t period_ms, uint8_t priority, uint32_t jitter_ms, uint32_t offset_ms = 0);
+
+    // Set the first release of every entry relative to now
+    void start();
+
+    /**
+     * @brief Pick the entry to run now.
+     *
+     * @param wait Set to the ticks until the next release when nothing is due.
+     * @return Entry index, or -1 if no entry is due.
+     */
+    int next(TickType_t* wait);
+
+    // Mark the entry picked by next() as done and schedule its next release
+    void complete(int index);
+
+    size_t getNumEntries() const { return entries.size(); }
+    const ModbusScheduleStats& getStats(int index) const { return entries[index].stats; }
+
+private:
+    struct Entry {
+        int64_t period_us;
+        int64_t jitter_us;
+        int64_t offset_us;
+        int64_t release_us;
+        int64_t started_us;
+        uint8_t priority;
+        ModbusScheduleStats stats;
+    };
+
+    std::vector<Entry> entries;
+};
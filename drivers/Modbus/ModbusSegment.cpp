@@ -0,0 +1,119 @@
+#include "ModbusSegment.h"
+#include "ModbusShadow.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+
+static const char *TAG = "ModbusSegment";
+
+ModbusSegment::ModbusSegment(ModbusShadow* shadow, uart_port_t uart_port, uint32_t baudrate, int tx_pin, int rx_pin,
+                             int rts_pin)
+    : shadow(shadow), bus(uart_port, baudrate, UART_PARITY_DISABLE, MB_MODE_RTU, tx_pin, rx_pin, rts_pin), plan(),
+      scheduler(), slaves(), health(), core_id(tskNO_AFFINITY), priority(MB_SEGMENT_TASK_PRIORITY),
+      callback(nullptr), callback_arg(nullptr), task_handle(nullptr), stats() {}
+
+esp_err_t ModbusSegment::init(const mb_segment_config_t* config) {
+    if (config->slaves == nullptr || config->num_slaves == 0 || config->num_slaves > MB_SCHED_MAX_ENTRIES) {
+        ESP_LOGE(TAG, "UART%d: %u slaves, 1 to %d per segment", (int)bus.getPort(), (unsigned)config->num_slaves,
+                 MB_SCHED_MAX_ENTRIES);
+        return ESP_ERR_INVALID_ARG;
+    }
+    slaves.assign(config->slaves, config->slaves + config->num_slaves);
+    core_id = config->core_id;
+    priority = config->priority;
+
+    // Only the CIDs of this segment's slaves go into its plan
+    std::vector<uint8_t> addresses;
+    for (const mb_segment_slave_t& slave : slaves) {
+        addresses.push_back(slave.slave_addr);
+    }
+    bool planned = config->profiles != nullptr
+                       ? plan.build(*config->profiles, addresses.data(), addresses.size())
+                       : plan.build(config->params, config->num_params, addresses.data(), addresses.size());
+    if (!planned) {
+        ESP_LOGE(TAG, "UART%d: nothing to read from its slaves", (int)bus.getPort());
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Schedule entry i polls slaves[i], health[i] takes it off the bus while it is dead
+    health.clear();
+    for (const mb_segment_slave_t& slave : slaves) {
+        if (scheduler.addEntry(slave.period_ms, slave.priority, slave.jitter_ms) < 0) {
+            ESP_LOGE(TAG, "UART%d: slave %d cannot be scheduled every %u ms", (int)bus.getPort(), slave.slave_addr,
+                     (unsigned)slave.period_ms);
+            return ESP_ERR_INVALID_ARG;
+        }
+        health.push_back(ModbusSlaveHealth(slave.slave_addr));
+    }
+
+    // The bus task wakes the poll task, they share its core
+    if (!bus.init(core_id, priority + 1)) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "UART%d: %u slaves in %u requests per cycle", (int)bus.getPort(), (unsigned)slaves.size(),
+             (unsigned)plan.getNumBlocks());
+    return ESP_OK;
+}
+
+void ModbusSegment::setPollCallback(mb_segment_poll_cb_t callback, void* arg) {
+    this->callback = callback;
+    this->callback_arg = arg;
+}
+
+esp_err_t ModbusSegment::start() {
+    if (slaves.empty()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (task_handle != nullptr) {
+        return ESP_OK;
+    }
+    if (xTaskCreatePinnedToCore(pollTask, "mbSegmentTask", MB_SEGMENT_TASK_STACK, this, priority, &task_handle,
+                                core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create poll task");
+        task_handle = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void ModbusSegment::poll(size_t index) {
+    uint8_t slave_addr = slaves[index].slave_addr;
+    if (!health[index].allowRequest()) {
+        stats.skipped++;
+        return;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = plan.readSlave(&bus, slave_addr);
+    int64_t duration_us = esp_timer_get_time() - start_us;
+    health[index].recordResult(err);
+    stats.polls++;
+    stats.failures += err != ESP_OK;
+    stats.busy_us += duration_us;
+    stats.poll_max_us = std::max(stats.poll_max_us, duration_us);
+
+    if (shadow != nullptr) {
+        shadow->update(plan, slave_addr);
+    }
+    if (callback != nullptr) {
+        callback(this, slave_addr, err, callback_arg);
+    }
+}
+
+void ModbusSegment::pollTask(void* arg) {
+    ModbusSegment* segment = static_cast<ModbusSegment*>(arg);
+    segment->scheduler.start();
+
+    while (1) {
+        // Poll whichever slave is due next, sleep until a release otherwise
+        TickType_t wait = 0;
+        int index = segment->scheduler.next(&wait);
+        if (index < 0) {
+            vTaskDelay(wait);
+            continue;
+        }
+        segment->poll((size_t)index);
+        segment->scheduler.complete(index);
+    }
+}
@@ -0,0 +1,124 @@
+/**
+ * @file ModbusSegment.h
+ * @brief One RS-485 segment with its own bus, read plan, schedule and poll task.
+ *
+ * A segment owns a ModbusBus on one UART, the read plan of the CIDs of its
+ * slaves, a ModbusScheduler entry and a circuit breaker per slave, and a poll
+ * task that runs them. The poll task and the bus task are pinned to the same
+ * core. Segments share nothing but the register shadow, so the polls of a
+ * gateway with several segments overlap on the wire and a poll cycle takes as
+ * long as its busiest segment instead of all slaves one after the other.
+ *
+ * After a slave has been read, its blocks go into the shadow and the poll
+ * callback runs on the segment's task with the values in the plan. The
+ * callbacks of different segments run concurrently: whatever they hand the
+ * values on to must take more than one producer.
+ *
+ * esp-modbus drives a single controller, so a second segment needs
+ * MB_BUS_NATIVE_RTU.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#include "ModbusBus.h"
+#include "ModbusHealth.h"
+#include "ModbusReadPlan.h"
+#include "ModbusScheduler.h"
+
+class ModbusShadow;
+class ModbusSegment;
+class ModbusProfiles;
+
+#define MB_SEGMENT_TASK_STACK       4096
+#define MB_SEGMENT_TASK_PRIORITY    5       // The bus task runs one above
+
+typedef struct {
+    uint8_t slave_addr;
+    uint32_t period_ms;
+    uint8_t priority;                   // Higher is polled first when several slaves are due
+    uint32_t jitter_ms;
+} mb_segment_slave_t;
+
+typedef struct {
+    const mb_parameter_descriptor_t* params;    // Descriptor table, CIDs of other segments are left out
+    uint16_t num_params;
+    const ModbusProfiles* profiles;     // Or device profiles, which take the place of the table
+    const mb_segment_slave_t* slaves;
+    size_t num_slaves;
+    BaseType_t core_id;                 // Poll and bus task, tskNO_AFFINITY to let them float
+    UBaseType_t priority;               // Poll task
+} mb_segment_config_t;
+
+#define MB_SEGMENT_DEFAULT_CONFIG() {               \
+    .params = NULL,                                 \
+    .num_params = 0,                                \
+    .profiles = NULL,                               \
+    .slaves = NULL,                                 \
+    .num_slaves = 0,                                \
+    .core_id = tskNO_AFFINITY,                      \
+    .priority = MB_SEGMENT_TASK_PRIORITY,           \
+}
+
+typedef struct {
+    uint32_t polls;             // Slaves read
+    uint32_t failures;          // Polls with a block that failed
+    uint32_t skipped;           // Polls left out while the breaker of the slave was open
+    int64_t busy_us;            // Time spent reading
+    int64_t poll_max_us;        // Longest read of one slave
+} mb_segment_stats_t;
+
+// Runs on the segment's task after each read, the values are in segment->getPlan()
+typedef void (*mb_segment_poll_cb_t)(ModbusSegment* segment, uint8_t slave_addr, esp_err_t err, void* arg);
+
+class ModbusSegment {
+public:
+    ModbusSegment(ModbusShadow* shadow, uart_port_t uart_port, uint32_t baudrate, int tx_pin, int rx_pin,
+                  int rts_pin);
+
+    /**
+     * @brief Set up the bus and plan the reads of the segment's slaves.
+     *
+     * @return ESP_OK; ESP_ERR_INVALID_ARG for an empty or oversized slave list
+     *         or a slave the scheduler does not take (period 0);
+     *         ESP_ERR_NOT_FOUND if the table has nothing to read from them;
+     *         ESP_FAIL if the bus cannot be set up.
+     */
+    esp_err_t init(const mb_segment_config_t* config);
+
+    // Callback for every poll, before start()
+    void setPollCallback(mb_segment_poll_cb_t callback, void* arg);
+
+    // Start polling on the segment's task
+    esp_err_t start();
+
+    ModbusBus* getBus() { return &bus; }
+    const ModbusReadPlan& getPlan() const { return plan; }
+    uart_port_t getPort() const { return bus.getPort(); }
+
+    void getStats(mb_segment_stats_t* stats) const { *stats = this->stats; }
+
+private:
+    static void pollTask(void* arg);
+    void poll(size_t index);
+
+    ModbusShadow* shadow;
+    ModbusBus bus;
+    ModbusReadPlan plan;
+    ModbusScheduler scheduler;
+    std::vector<mb_segment_slave_t> slaves;
+    std::vector<ModbusSlaveHealth> health;      // One per slave, same order as the schedule
+    BaseType_t core_id;
+    UBaseType_t priority;
+    mb_segment_poll_cb_t callback;
+    void* callback_arg;
+    TaskHandle_t task_handle;
+
+    mb_segment_stats_t stats;
+};
@@ -0,0 +1,257 @@
+#include "ModbusShadow.h"
+#include "ModbusBus.h"
+#include "ModbusReadPlan.h"
+#include "Modbus.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <string.h>
+
+static const char *TAG = "ModbusShadow";
+
+static bool isBitType(mb_param_type_t type) {
+    return type == MB_PARAM_COIL || type == MB_PARAM_DISCRETE;
+}
+
+ModbusShadow::ModbusShadow()
+    : regions(), sequences(), registers(), mutex(nullptr), updates(0), failures(0), hits(0), expired(0),
+      misses(0), fallthroughs(0), retries(0) {}
+
+ModbusShadow::~ModbusShadow() {
+    if (mutex != nullptr) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+bool ModbusShadow::init(const ModbusReadPlan& plan) {
+    regions.clear();
+    registers.clear();
+    size_t total = 0;
+    for (size_t i = 0; i < plan.getNumBlocks(); i++) {
+        const ModbusReadBlock& block = plan.getBlock(i);
+        regions.push_back(Region{block.slave_addr, block.param_type, block.reg_start, block.reg_size, total});
+        total += block.reg_size;
+    }
+    if (regions.empty()) {
+        ESP_LOGE(TAG, "The read plan has no blocks");
+        return false;
+    }
+
+    // Lookups walk the regions of a slave and type in address order
+    std::sort(regions.begin(), regions.end(), [](const Region& a, const Region& b) {
+        if (a.slave_addr != b.slave_addr) return a.slave_addr < b.slave_addr;
+        if (a.type != b.type) return a.type < b.type;
+        return a.reg_start < b.reg_start;
+    });
+    std::vector<std::atomic<uint32_t>>(regions.size()).swap(sequences);
+    registers.assign(total, mb_shadow_register_t{0, 0, MB_SHADOW_EMPTY});
+
+    if (mutex == nullptr) {
+        mutex = xSemaphoreCreateMutex();
+        if (mutex == nullptr) {
+            ESP_LOGE(TAG, "Failed to create the shadow mutex");
+            return false;
+        }
+    }
+    ESP_LOGI(TAG, "%u registers and bits shadowed in %u blocks", (unsigned)total, (unsigned)regions.size());
+    return true;
+}
+
+template <typename Value>
+void ModbusShadow::write(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity, bool good,
+                         Value value) {
+    if (mutex == nullptr) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    uint32_t end = (uint32_t)address + quantity;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (size_t i = 0; i < regions.size(); i++) {
+        const Region& region = regions[i];
+        uint32_t region_end = (uint32_t)region.reg_start + region.reg_size;
+        if (region.slave_addr != slave_addr || region.type != type || region.reg_start >= end ||
+            address >= region_end) {
+            continue;
+        }
+        uint32_t begin = std::max<uint32_t>(address, region.reg_start);
+        uint32_t stop = std::min(end, region_end);
+
+        // Odd while the block is written, readers copy it again
+        std::atomic<uint32_t>& sequence = sequences[i];
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        mb_shadow_register_t* reg = &registers[region.first + (begin - region.reg_start)];
+        for (uint32_t point = begin; point < stop; point++, reg++) {
+            if (good) {
+                reg->value = value(point - address);
+                reg->updated_us = now_us;
+                reg->quality = MB_SHADOW_GOOD;
+            } else if (reg->quality == MB_SHADOW_GOOD) {
+                reg->quality = MB_SHADOW_STALE;
+            }
+        }
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+    if (good) {
+        updates++;
+    } else {
+        failures++;
+    }
+    xSemaphoreGive(mutex);
+}
+
+void ModbusShadow::store(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                         const uint16_t* values) {
+    write(slave_addr, type, address, quantity, values != nullptr, [values](uint32_t i) { return values[i]; });
+}
+
+void ModbusShadow::storeBits(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                             const uint8_t* bits) {
+    write(slave_addr, type, address, quantity, bits != nullptr,
+          [bits](uint32_t i) { return (uint16_t)((bits[i / 8] >> (i % 8)) & 0x01); });
+}
+
+void ModbusShadow::update(const ModbusReadPlan& plan, uint8_t slave_addr) {
+    for (size_t i = 0; i < plan.getNumBlocks(); i++) {
+        const ModbusReadBlock& block = plan.getBlock(i);
+        if (block.slave_addr != slave_addr) {
+            continue;
+        }
+        const uint16_t* data = block.valid ? plan.getBlockData(i) : nullptr;
+        if (isBitType(block.param_type)) {
+            storeBits(slave_addr, block.param_type, block.reg_start, block.reg_size,
+                      reinterpret_cast<const uint8_t*>(data));
+        } else {
+            store(slave_addr, block.param_type, block.reg_start, block.reg_size, data);
+        }
+    }
+}
+
+template <typename Visit>
+esp_err_t ModbusShadow::copy(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                             Visit visit) const {
+    uint32_t end = (uint32_t)address + quantity;
+    uint32_t covered = 0;
+    for (size_t i = 0; i < regions.size(); i++) {
+        const Region& region = regions[i];
+        uint32_t region_end = (uint32_t)region.reg_start + region.reg_size;
+        if (region.slave_addr != slave_addr || region.type != type || region.reg_start >= end ||
+            address >= region_end) {
+            continue;
+        }
+        uint32_t begin = std::max<uint32_t>(address, region.reg_start);
+        uint32_t stop = std::min(end, region_end);
+        const mb_shadow_register_t* source = &registers[region.first + (begin - region.reg_start)];
+
+        // Copy until the block was not written in the meantime
+        const std::atomic<uint32_t>& sequence = sequences[i];
+        for (int attempt = 1;; attempt++) {
+            uint32_t before = sequence.load(std::memory_order_acquire);
+            if ((before & 1) == 0) {
+                visit(begin - address, source, stop - begin);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == before) {
+                    break;
+                }
+            }
+            retries.fetch_add(1, std::memory_order_relaxed);
+            if (attempt % MB_SHADOW_SPIN_RETRIES == 0) {
+                // The writer may be preempted on this core, let it finish
+                vTaskDelay(1);
+            }
+        }
+        covered += stop - begin;
+    }
+    if (covered < quantity) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ModbusShadow::snapshot(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                                 mb_shadow_register_t* out) const {
+    return copy(slave_addr, type, address, quantity,
+                [out](uint32_t offset, const mb_shadow_register_t* points, uint32_t count) {
+                    std::copy(points, points + count, out + offset);
+                });
+}
+
+template <typename Put>
+esp_err_t ModbusShadow::readPoints(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                                   uint32_t max_age_ms, Put put) const {
+    int64_t oldest_us = esp_timer_get_time() - (int64_t)max_age_ms * 1000;
+    // A torn copy of a block is visited again at the same offset, only the last
+    // visit of each block counts
+    bool fresh = true;
+    bool block_fresh = true;
+    uint32_t block_offset = UINT32_MAX;
+    esp_err_t err = copy(slave_addr, type, address, quantity,
+                         [&](uint32_t offset, const mb_shadow_register_t* points, uint32_t count) {
+                             if (offset != block_offset) {
+                                 fresh = fresh && block_fresh;
+                                 block_offset = offset;
+                             }
+                             block_fresh = true;
+                             for (uint32_t i = 0; i < count; i++) {
+                                 put(offset + i, points[i].value);
+                                 block_fresh = block_fresh && points[i].quality == MB_SHADOW_GOOD &&
+                                               points[i].updated_us >= oldest_us;
+                             }
+                         });
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!fresh || !block_fresh) {
+        expired.fetch_add(1, std::memory_order_relaxed);
+        return ESP_ERR_INVALID_STATE;
+    }
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return ESP_OK;
+}
+
+esp_err_t ModbusShadow::read(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                             uint16_t* values, uint32_t max_age_ms) const {
+    return readPoints(slave_addr, type, address, quantity, max_age_ms,
+                      [values](uint32_t i, uint16_t value) { values[i] = value; });
+}
+
+esp_err_t ModbusShadow::readBits(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                                 uint8_t* bits, uint32_t max_age_ms) const {
+    memset(bits, 0, (quantity + 7) / 8);
+    return readPoints(slave_addr, type, address, quantity, max_age_ms, [bits](uint32_t i, uint16_t value) {
+        uint8_t mask = (uint8_t)(1 << (i % 8));
+        bits[i / 8] = value ? (bits[i / 8] | mask) : (bits[i / 8] & ~mask);
+    });
+}
+
+esp_err_t ModbusShadow::readThrough(ModbusBus* bus, uint8_t slave_addr, mb_param_type_t type, uint16_t address,
+                                    uint16_t quantity, uint16_t* values, uint32_t max_age_ms) {
+    esp_err_t err = read(slave_addr, type, address, quantity, values, max_age_ms);
+    if (err == ESP_OK) {
+        return err;
+    }
+    bool shadowed = err == ESP_ERR_INVALID_STATE;
+
+    uint8_t command = type == MB_PARAM_INPUT ? MB_FUNC_READ_INPUT_REGISTER : MB_FUNC_READ_HOLDING_REGISTER;
+    fallthroughs.fetch_add(1, std::memory_order_relaxed);
+    err = bus->transact(slave_addr, command, address, quantity, values);
+    if (shadowed) {
+        store(slave_addr, type, address, quantity, err == ESP_OK ? values : nullptr);
+    }
+    return err;
+}
+
+void ModbusShadow::getStats(mb_shadow_stats_t* stats) const {
+    stats->regions = (uint32_t)regions.size();
+    stats->registers = (uint32_t)registers.size();
+    stats->updates = updates;
+    stats->failures = failures;
+    stats->hits = hits.load(std::memory_order_relaxed);
+    stats->expired = expired.load(std::memory_order_relaxed);
+    stats->misses = misses.load(std::memory_order_relaxed);
+    stats->fallthroughs = fallthroughs.load(std::memory_order_relaxed);
+    stats->retries = retries.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,169 @@
+/**
+ * @file ModbusShadow.h
+ * @brief Shadow image of the polled registers, served to readers without a bus transaction.
+ *
+ * The shadow holds a copy of every block of a ModbusReadPlan, per slave:
+ * holding and input registers, and coils and discrete inputs one point per
+ * bit. The polling task stores each block after it has been read: the points
+ * of a block that answered take the new values and the time of the read,
+ * those of a block that failed keep their last values but lose their good
+ * quality.
+ *
+ * Readers on any task take a snapshot of a register range without a lock.
+ * Each block carries a sequence counter that is odd while the block is being
+ * written; a reader copies the block and tries again if the counter moved
+ * meanwhile. Writers (the poller and readThrough()) are serialised by a mutex
+ * among themselves only.
+ *
+ * A read states how old the values may be. readThrough() goes to the bus only
+ * when the shadow cannot serve the range within that age, and stores what the
+ * bus returned.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "mbcontroller.h"
+
+class ModbusBus;
+class ModbusReadPlan;
+
+// Snapshot attempts that find a block being written before the reader gives the writer a tick
+#define MB_SHADOW_SPIN_RETRIES  8
+
+typedef enum : uint8_t {
+    MB_SHADOW_EMPTY = 0,        // Never read
+    MB_SHADOW_GOOD,             // Value of the last read
+    MB_SHADOW_STALE,            // Last read failed, value of an earlier one
+} mb_shadow_quality_t;
+
+typedef struct {
+    int64_t updated_us;         // esp_timer time of the read the value came from
+    uint16_t value;             // Register, or 0/1 for a bit
+    uint8_t quality;            // mb_shadow_quality_t
+} mb_shadow_register_t;
+
+typedef struct {
+    uint32_t regions;           // Blocks shadowed
+    uint32_t registers;         // Registers and bits shadowed
+    uint32_t updates;           // Blocks stored from good reads
+    uint32_t failures;          // Blocks marked stale by failed reads
+    uint32_t hits;              // Reads served within their age
+    uint32_t expired;           // Reads the shadow could not serve within their age
+    uint32_t misses;            // Reads of registers that are not shadowed
+    uint32_t fallthroughs;      // Bus transactions made by readThrough()
+    uint32_t retries;           // Snapshots taken again because a block was written meanwhile
+} mb_shadow_stats_t;
+
+class ModbusShadow {
+public:
+    ModbusShadow();
+    ~ModbusShadow();
+
+    /**
+     * @brief Shadow the blocks of a plan.
+     *
+     * Call before any task reads the shadow; the plan may be rebuilt or
+     * dropped afterwards.
+     *
+     * @return false if the plan has no blocks or the mutex cannot be created.
+     */
+    bool init(const ModbusReadPlan& plan);
+
+    // Store the blocks of one slave after plan.readSlave()
+    void update(const ModbusReadPlan& plan, uint8_t slave_addr);
+
+    /**
+     * @brief Store a register range read from the bus.
+     *
+     * Registers of the range that are not shadowed are skipped.
+     *
+     * @param values The registers read, nullptr when the read failed.
+     */
+    void store(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+               const uint16_t* values);
+
+    // Store coils or discrete inputs, packed eight to a byte as on the wire; nullptr when the read failed
+    void storeBits(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                   const uint8_t* bits);
+
+    /**
+     * @brief Copy a register range with its timestamps and quality.
+     *
+     * The range may span several blocks; each block is copied consistently.
+     *
+     * @return ESP_OK, ESP_ERR_NOT_FOUND if a register of the range is not shadowed.
+     */
+    esp_err_t snapshot(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                       mb_shadow_register_t* out) const;
+
+    /**
+     * @brief Read register values from the shadow.
+     *
+     * @param max_age_ms Oldest value accepted.
+     * @return ESP_OK if every register is good and young enough;
+     *         ESP_ERR_INVALID_STATE if one is stale, empty or too old (the
+     *         values are copied anyway); ESP_ERR_NOT_FOUND if one is not shadowed.
+     */
+    esp_err_t read(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                   uint16_t* values, uint32_t max_age_ms) const;
+
+    // As read(), for coils or discrete inputs packed eight to a byte
+    esp_err_t readBits(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                       uint8_t* bits, uint32_t max_age_ms) const;
+
+    /**
+     * @brief Read register values, from the bus if the shadow cannot serve them.
+     *
+     * A range the shadow covers is stored after the bus read, good or failed.
+     *
+     * @return ESP_OK, or the error of the bus transaction.
+     */
+    esp_err_t readThrough(ModbusBus* bus, uint8_t slave_addr, mb_param_type_t type, uint16_t address,
+                          uint16_t quantity, uint16_t* values, uint32_t max_age_ms);
+
+    void getStats(mb_shadow_stats_t* stats) const;
+
+private:
+    struct Region {
+        uint8_t slave_addr;
+        mb_param_type_t type;
+        uint16_t reg_start;
+        uint16_t reg_size;
+        size_t first;           // First register in the register array
+    };
+
+    // Run visit(offset, points, count) on each block overlapping a range until the block was not written meanwhile
+    template <typename Visit>
+    esp_err_t copy(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                   Visit visit) const;
+
+    // Store into every block overlapping a range; value(i) gives point i of the range, no value when the read failed
+    template <typename Value>
+    void write(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity, bool good,
+               Value value);
+
+    // Values and freshness of a range, shared by read() and readBits()
+    template <typename Put>
+    esp_err_t readPoints(uint8_t slave_addr, mb_param_type_t type, uint16_t address, uint16_t quantity,
+                         uint32_t max_age_ms, Put put) const;
+
+    std::vector<Region> regions;
+    std::vector<std::atomic<uint32_t>> sequences;      // One per region, odd while it is written
+    std::vector<mb_shadow_register_t> registers;
+    SemaphoreHandle_t mutex;
+
+    uint32_t updates;
+    uint32_t failures;
+    mutable std::atomic<uint32_t> hits;
+    mutable std::atomic<uint32_t> expired;
+    mutable std::atomic<uint32_t> misses;
+    std::atomic<uint32_t> fallthroughs;
+    mutable std::atomic<uint32_t> retries;
+};
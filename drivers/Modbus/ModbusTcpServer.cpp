@@ -0,0 +1,451 @@
+#include "ModbusTcpServer.h"
+#include "ModbusBus.h"
+#include "ModbusShadow.h"
+#include "Modbus.h"
+#include "esp_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+static const char *TAG = "ModbusTcpServer";
+
+static uint16_t getU16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void putU16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)(value & 0xFF);
+}
+
+ModbusTcpServer::ModbusTcpServer(ModbusShadow* shadow)
+    : shadow(shadow), buses(), config(MB_TCP_SERVER_DEFAULT_CONFIG()), port(0), listen_fd(-1),
+      task_handle(nullptr), running(false), finished(false), clients(), stats() {
+    for (Client& client : clients) {
+        client.fd = -1;
+    }
+}
+
+void ModbusTcpServer::setBus(ModbusBus* bus) {
+    for (std::atomic<ModbusBus*>& slave_bus : buses) {
+        slave_bus.store(bus);
+    }
+}
+
+void ModbusTcpServer::setBus(ModbusBus* bus, uint8_t slave_addr) {
+    if (slave_addr <= MB_TCP_MAX_SLAVE_ADDR) {
+        buses[slave_addr].store(bus);
+    }
+}
+
+ModbusTcpServer::~ModbusTcpServer() {
+    stop();
+}
+
+esp_err_t ModbusTcpServer::init(const mb_tcp_server_config_t* config) {
+    if (config == nullptr || config->max_clients < 1 || config->max_clients > MB_TCP_MAX_CLIENTS ||
+        (config->units == nullptr && config->num_units > 0)) {
+        ESP_LOGE(TAG, "Invalid Modbus TCP server configuration");
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < config->num_units; i++) {
+        if (config->units[i].slave_addr < 1 || config->units[i].slave_addr > 247) {
+            ESP_LOGE(TAG, "Unit %u maps to invalid slave address %u", (unsigned)config->units[i].unit_id,
+                     (unsigned)config->units[i].slave_addr);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    this->config = *config;
+    return ESP_OK;
+}
+
+esp_err_t ModbusTcpServer::start() {
+    if (task_handle != nullptr) {
+        return ESP_OK;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_fd < 0) {
+        ESP_LOGE(TAG, "Failed to create the listening socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(config.port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, MB_TCP_MAX_CLIENTS) != 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %u: errno %d", (unsigned)config.port, errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return ESP_FAIL;
+    }
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len);
+    port = ntohs(addr.sin_port);
+
+    running = true;
+    finished = false;
+    if (xTaskCreate(serverTask, "mbTcpServer", MB_TCP_TASK_STACK, this, MB_TCP_TASK_PRIORITY,
+                    &task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the server task");
+        running = false;
+        task_handle = nullptr;
+        close(listen_fd);
+        listen_fd = -1;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Modbus TCP server listening on port %u", (unsigned)port);
+    return ESP_OK;
+}
+
+void ModbusTcpServer::stop() {
+    if (task_handle == nullptr) {
+        return;
+    }
+    running = false;
+    while (!finished) {
+        vTaskDelay(pdMS_TO_TICKS(MB_TCP_IDLE_POLL_MS));
+    }
+    task_handle = nullptr;
+}
+
+void ModbusTcpServer::serverTask(void* arg) {
+    ModbusTcpServer* server = static_cast<ModbusTcpServer*>(arg);
+    server->serve();
+    server->finished = true;
+    vTaskDelete(NULL);
+}
+
+void ModbusTcpServer::serve() {
+    while (running) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listen_fd, &readable);
+        int max_fd = listen_fd;
+        bool writes = false;
+        for (size_t i = 0; i < config.max_clients; i++) {
+            // A client with a write on the bus is not read until it is answered
+            if (clients[i].pending) {
+                writes = true;
+            } else if (clients[i].fd >= 0) {
+                FD_SET(clients[i].fd, &readable);
+                max_fd = clients[i].fd > max_fd ? clients[i].fd : max_fd;
+            }
+        }
+
+        struct timeval timeout = {};
+        timeout.tv_usec = (writes ? MB_TCP_WRITE_POLL_MS : MB_TCP_IDLE_POLL_MS) * 1000;
+        int ready = select(max_fd + 1, &readable, NULL, NULL, &timeout);
+        if (writes) {
+            completeWrites();
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        if (FD_ISSET(listen_fd, &readable)) {
+            acceptClient();
+        }
+        for (size_t i = 0; i < config.max_clients; i++) {
+            Client* client = &clients[i];
+            if (client->fd >= 0 && !client->pending && FD_ISSET(client->fd, &readable) && !receive(client)) {
+                closeClient(client);
+            }
+        }
+    }
+
+    // Requests on the bus point into the clients, wait for them
+    bool writes = true;
+    while (writes) {
+        completeWrites();
+        writes = false;
+        for (size_t i = 0; i < config.max_clients; i++) {
+            writes = writes || clients[i].pending;
+        }
+        if (writes) {
+            vTaskDelay(1);
+        }
+    }
+    for (size_t i = 0; i < config.max_clients; i++) {
+        closeClient(&clients[i]);
+    }
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+void ModbusTcpServer::acceptClient() {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    Client* client = nullptr;
+    for (size_t i = 0; i < config.max_clients && client == nullptr; i++) {
+        if (clients[i].fd < 0 && !clients[i].pending) {
+            client = &clients[i];
+        }
+    }
+    if (client == nullptr) {
+        ESP_LOGW(TAG, "Every client slot taken, connection refused");
+        stats.rejected++;
+        close(fd);
+        return;
+    }
+
+    // Requests and responses are single small segments, do not hold them back
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    client->fd = fd;
+    client->rx_len = 0;
+    stats.connections++;
+}
+
+void ModbusTcpServer::closeClient(Client* client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+    client->rx_len = 0;
+}
+
+bool ModbusTcpServer::receive(Client* client) {
+    ssize_t n = recv(client->fd, client->rx + client->rx_len, sizeof(client->rx) - client->rx_len, 0);
+    if (n == 0) {
+        return false;
+    }
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    client->rx_len += (size_t)n;
+    return process(client);
+}
+
+bool ModbusTcpServer::process(Client* client) {
+    size_t offset = 0;
+    while (client->fd >= 0 && !client->pending && client->rx_len - offset >= MB_TCP_MBAP_LENGTH) {
+        const uint8_t* adu = client->rx + offset;
+        uint16_t protocol = getU16(&adu[2]);
+        uint16_t length = getU16(&adu[4]);
+        if (protocol != 0 || length < 2 || length > MB_TCP_MAX_ADU - 6) {
+            stats.protocol_errors++;
+            return false;
+        }
+        size_t total = 6 + (size_t)length;
+        if (client->rx_len - offset < total) {
+            break;
+        }
+        handle(client, adu, total);
+        offset += total;
+    }
+    if (client->fd < 0) {
+        return false;
+    }
+    memmove(client->rx, client->rx + offset, client->rx_len - offset);
+    client->rx_len -= offset;
+    return true;
+}
+
+bool ModbusTcpServer::findSlave(uint8_t unit_id, uint8_t* slave_addr) const {
+    if (config.units == nullptr) {
+        *slave_addr = unit_id;
+        return unit_id >= 1 && unit_id <= 247;
+    }
+    for (size_t i = 0; i < config.num_units; i++) {
+        if (config.units[i].unit_id == unit_id) {
+            *slave_addr = config.units[i].slave_addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ModbusTcpServer::sendResponse(Client* client, const uint8_t* adu, const uint8_t* pdu, size_t pdu_len) {
+    if (client->fd < 0) {
+        return;
+    }
+    uint8_t frame[MB_TCP_MAX_ADU];
+    memcpy(frame, adu, 4);                      // Transaction and protocol id
+    putU16(&frame[4], (uint16_t)(pdu_len + 1));
+    frame[6] = adu[6];                          // Unit id
+    memcpy(&frame[MB_TCP_MBAP_LENGTH], pdu, pdu_len);
+
+    // The socket buffer takes a whole response unless the client stopped reading
+    size_t len = MB_TCP_MBAP_LENGTH + pdu_len;
+    if (send(client->fd, frame, len, 0) != (ssize_t)len) {
+        ESP_LOGW(TAG, "Client not reading its responses, connection closed");
+        closeClient(client);
+    }
+}
+
+void ModbusTcpServer::sendException(Client* client, const uint8_t* adu, uint8_t code) {
+    uint8_t pdu[2] = { (uint8_t)(adu[MB_TCP_MBAP_LENGTH] | 0x80), code };
+    stats.exceptions++;
+    sendResponse(client, adu, pdu, sizeof(pdu));
+}
+
+static uint8_t readException(esp_err_t err) {
+    return err == ESP_ERR_NOT_FOUND ? MB_EX_ILLEGAL_DATA_ADDRESS : MB_EX_GATEWAY_TARGET;
+}
+
+void ModbusTcpServer::handle(Client* client, const uint8_t* adu, size_t len) {
+    stats.requests++;
+    const uint8_t* pdu = adu + MB_TCP_MBAP_LENGTH;
+    size_t pdu_len = len - MB_TCP_MBAP_LENGTH;
+    uint8_t function = pdu[0];
+    uint8_t slave_addr;
+    if (!findSlave(adu[6], &slave_addr)) {
+        sendException(client, adu, MB_EX_GATEWAY_PATH);
+        return;
+    }
+    uint16_t address = pdu_len >= 5 ? getU16(&pdu[1]) : 0;
+    uint16_t quantity = pdu_len >= 5 ? getU16(&pdu[3]) : 0;
+    uint8_t response[2 + 250];
+
+    switch (function) {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS: {
+            if (pdu_len != 5 || quantity < 1 || quantity > 2000) {
+                sendException(client, adu, MB_EX_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            mb_param_type_t type = function == MB_FUNC_READ_COILS ? MB_PARAM_COIL : MB_PARAM_DISCRETE;
+            esp_err_t err = shadow->readBits(slave_addr, type, address, quantity, &response[2], config.max_age_ms);
+            if (err != ESP_OK) {
+                sendException(client, adu, readException(err));
+                return;
+            }
+            response[0] = function;
+            response[1] = (uint8_t)((quantity + 7) / 8);
+            stats.reads++;
+            sendResponse(client, adu, response, 2 + response[1]);
+            return;
+        }
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER: {
+            if (pdu_len != 5 || quantity < 1 || quantity > 125) {
+                sendException(client, adu, MB_EX_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            mb_param_type_t type = function == MB_FUNC_READ_HOLDING_REGISTER ? MB_PARAM_HOLDING : MB_PARAM_INPUT;
+            uint16_t regs[125];
+            esp_err_t err = shadow->read(slave_addr, type, address, quantity, regs, config.max_age_ms);
+            if (err != ESP_OK) {
+                sendException(client, adu, readException(err));
+                return;
+            }
+            response[0] = function;
+            response[1] = (uint8_t)(2 * quantity);
+            for (uint16_t i = 0; i < quantity; i++) {
+                putU16(&response[2 + 2 * i], regs[i]);
+            }
+            stats.reads++;
+            sendResponse(client, adu, response, 2 + response[1]);
+            return;
+        }
+        case MB_FUNC_WRITE_SINGLE_COIL:
+            // The value field is 0xFF00 or 0x0000, the bus takes the coil as one byte
+            if (pdu_len != 5 || (quantity != 0xFF00 && quantity != 0x0000)) {
+                sendException(client, adu, MB_EX_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            reinterpret_cast<uint8_t*>(client->data)[0] = quantity ? 0xFF : 0x00;
+            quantity = 1;
+            break;
+        case MB_FUNC_WRITE_SINGLE_REGISTER:
+            if (pdu_len != 5) {
+                sendException(client, adu, MB_EX_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            client->data[0] = quantity;
+            quantity = 1;
+            break;
+        case MB_FUNC_WRITE_MULTIPLE_COILS:
+            if (pdu_len < 6 || quantity < 1 || quantity > 1968 || pdu[5] != (quantity + 7) / 8 ||
+                pdu_len != 6 + (size_t)pdu[5]) {
+                sendException(client, adu, MB_EX_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            memcpy(client->data, &pdu[6], pdu[5]);
+            break;
+        case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+            if (pdu_len < 6 || quantity < 1 || quantity > 123 || pdu[5] != 2 * quantity ||
+                pdu_len != 6 + (size_t)pdu[5]) {
+                sendException(client, adu, MB_EX_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            for (uint16_t i = 0; i < quantity; i++) {
+                client->data[i] = getU16(&pdu[6 + 2 * i]);
+            }
+            break;
+        default:
+            sendException(client, adu, MB_EX_ILLEGAL_FUNCTION);
+            return;
+    }
+
+    // A write: queue it on the bus, the response echoes the first five PDU bytes
+    ModbusBus* target = slave_addr <= MB_TCP_MAX_SLAVE_ADDR ? buses[slave_addr].load() : nullptr;
+    if (target == nullptr) {
+        sendException(client, adu, MB_EX_GATEWAY_TARGET);
+        return;
+    }
+    ModbusRequest* request = &client->request;
+    *request = ModbusRequest{};
+    request->command = function;
+    request->address = address;
+    request->quantity = quantity;
+    request->data = client->data;
+    request->slave_id = slave_addr;
+    memcpy(client->reply, adu, MB_TCP_MBAP_LENGTH);
+    memcpy(&client->reply[MB_TCP_MBAP_LENGTH], pdu, 5);
+    client->pending = true;
+    if (target->submit(request, 0) != ESP_OK) {
+        client->pending = false;
+        sendException(client, adu, MB_EX_SLAVE_DEVICE_BUSY);
+    }
+}
+
+void ModbusTcpServer::completeWrites() {
+    for (size_t i = 0; i < config.max_clients; i++) {
+        Client* client = &clients[i];
+        if (!client->pending) {
+            continue;
+        }
+        ModbusRequest* request = &client->request;
+        esp_err_t result = __atomic_load_n(&request->result, __ATOMIC_ACQUIRE);
+        if (result == ESP_ERR_NOT_FINISHED) {
+            continue;
+        }
+        client->pending = false;
+
+        // The slave now holds the written values, so does the shadow
+        if (result == ESP_OK) {
+            if (request->command == MB_FUNC_WRITE_SINGLE_REGISTER || request->command == MB_FUNC_WRITE_MULTIPLE_REGISTERS) {
+                shadow->store(request->slave_id, MB_PARAM_HOLDING, request->address, request->quantity, client->data);
+            } else {
+                shadow->storeBits(request->slave_id, MB_PARAM_COIL, request->address, request->quantity,
+                                  reinterpret_cast<const uint8_t*>(client->data));
+            }
+            stats.writes++;
+            sendResponse(client, client->reply, &client->reply[MB_TCP_MBAP_LENGTH], 5);
+        } else {
+            ESP_LOGW(TAG, "Write to slave %u failed: %s", (unsigned)request->slave_id, esp_err_to_name(result));
+            sendException(client, client->reply,
+                          result == ESP_ERR_TIMEOUT ? MB_EX_GATEWAY_TARGET : MB_EX_SLAVE_DEVICE_FAILURE);
+        }
+        if (client->fd >= 0 && !process(client)) {
+            closeClient(client);
+        }
+    }
+}
+
+void ModbusTcpServer::getStats(mb_tcp_server_stats_t* stats) const {
+    *stats = this->stats;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file ModbusTcpServer.h
+ * @brief Modbus TCP server that makes the RS-485 slaves reachable from the network.
+ *
+ * Reads (0x01, 0x02, 0x03, 0x04) are answered from the ModbusShadow filled by
+ * the poller and never reach the serial bus, so any number of TCP clients can
+ * read at any rate without adding a frame to it. A range the shadow does not
+ * cover is answered with exception 0x02, one it cannot serve within max_age_ms
+ * (slave offline, value too old) with exception 0x0B.
+ *
+ * Writes (0x05, 0x06, 0x0F, 0x10) are submitted to the request queue of the
+ * ModbusBus the slave is wired to and answered once the slave has answered; the written values then go into
+ * the shadow as well. While a write of a client is on the bus, its next
+ * requests wait in its socket.
+ *
+ * The unit id of a request selects the slave through the unit table, or is
+ * the slave address when there is no table. Unknown units get exception 0x0A.
+ *
+ * One task serves every client with select() on BSD sockets (lwIP on the
+ * target, the host stack in the host build).
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "../../interface/ModbusInterface.h"
+
+class ModbusBus;
+class ModbusShadow;
+
+#define MB_TCP_PORT                 502
+#define MB_TCP_MAX_CLIENTS          4
+#define MB_TCP_MAX_AGE_MS           5000
+
+// Highest unicast slave address
+#define MB_TCP_MAX_SLAVE_ADDR       247
+
+// MBAP header and the largest PDU
+#define MB_TCP_MBAP_LENGTH          7
+#define MB_TCP_MAX_ADU              (MB_TCP_MBAP_LENGTH + 253)
+
+// select() timeout while writes are on the bus, and otherwise
+#define MB_TCP_WRITE_POLL_MS        2
+#define MB_TCP_IDLE_POLL_MS         100
+
+#define MB_TCP_TASK_STACK           4096
+#define MB_TCP_TASK_PRIORITY        4
+
+// Modbus exception codes
+#define MB_EX_ILLEGAL_FUNCTION      0x01
+#define MB_EX_ILLEGAL_DATA_ADDRESS  0x02
+#define MB_EX_ILLEGAL_DATA_VALUE    0x03
+#define MB_EX_SLAVE_DEVICE_FAILURE  0x04
+#define MB_EX_SLAVE_DEVICE_BUSY     0x06
+#define MB_EX_GATEWAY_PATH          0x0A
+#define MB_EX_GATEWAY_TARGET        0x0B
+
+typedef struct {
+    uint8_t unit_id;
+    uint8_t slave_addr;
+} mb_tcp_unit_t;
+
+typedef struct {
+    uint16_t port;                      // 0 for any free port
+    const mb_tcp_unit_t* units;         // NULL: the unit id is the slave address
+    size_t num_units;
+    uint32_t max_age_ms;                // Oldest shadow value served
+    size_t max_clients;                 // Up to MB_TCP_MAX_CLIENTS
+} mb_tcp_server_config_t;
+
+#define MB_TCP_SERVER_DEFAULT_CONFIG() {            \
+    .port = MB_TCP_PORT,                            \
+    .units = NULL,                                  \
+    .num_units = 0,                                 \
+    .max_age_ms = MB_TCP_MAX_AGE_MS,                \
+    .max_clients = MB_TCP_MAX_CLIENTS,              \
+}
+
+typedef struct {
+    uint32_t connections;
+    uint32_t rejected;          // Connections closed at once, every client slot taken
+    uint32_t requests;
+    uint32_t reads;             // Reads answered from the shadow
+    uint32_t writes;            // Writes answered after the bus
+    uint32_t exceptions;        // Exception responses, of reads and writes
+    uint32_t protocol_errors;   // Connections closed over a malformed frame
+} mb_tcp_server_stats_t;
+
+class ModbusTcpServer {
+public:
+    explicit ModbusTcpServer(ModbusShadow* shadow);
+    ~ModbusTcpServer();
+
+    esp_err_t init(const mb_tcp_server_config_t* config);
+
+    // Bus for the writes to every slave, they get exception 0x0B without one
+    void setBus(ModbusBus* bus);
+
+    // Bus for the writes to one slave, the segment it is wired to
+    void setBus(ModbusBus* bus, uint8_t slave_addr);
+
+    // Listen and start the server task, once the network stack is up
+    esp_err_t start();
+
+    // Close every connection and end the task
+    void stop();
+
+    // Port listened on, the one picked for port 0
+    uint16_t getPort() const { return port; }
+
+    void getStats(mb_tcp_server_stats_t* stats) const;
+
+private:
+    struct Client {
+        int fd;
+        size_t rx_len;
+        uint8_t rx[MB_TCP_MAX_ADU];
+        bool pending;               // A write on the bus, its response is in reply
+        ModbusRequest request;
+        uint16_t data[123];         // Write values, registers or packed coils
+        uint8_t reply[MB_TCP_MBAP_LENGTH + 5];
+    };
+
+    static void serverTask(void* arg);
+    void serve();
+    void acceptClient();
+    void closeClient(Client* client);
+
+    // Read from the socket and handle what came, false to drop the connection
+    bool receive(Client* client);
+
+    // Handle the complete frames in the receive buffer up to the next write
+    bool process(Client* client);
+    void handle(Client* client, const uint8_t* adu, size_t len);
+    void completeWrites();
+
+    bool findSlave(uint8_t unit_id, uint8_t* slave_addr) const;
+    void sendException(Client* client, const uint8_t* adu, uint8_t code);
+    void sendResponse(Client* client, const uint8_t* adu, const uint8_t* pdu, size_t pdu_len);
+
+    ModbusShadow* shadow;
+    std::atomic<ModbusBus*> buses[MB_TCP_MAX_SLAVE_ADDR + 1];      // Per slave address
+    mb_tcp_server_config_t config;
+    uint16_t port;
+    int listen_fd;
+    TaskHandle_t task_handle;
+    std::atomic<bool> running;
+    std::atomic<bool> finished;
+    Client clients[MB_TCP_MAX_CLIENTS];
+
+    mb_tcp_server_stats_t stats;
+};
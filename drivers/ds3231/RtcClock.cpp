@@ -0,0 +1,253 @@
+#include "RtcClock.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "RtcClock";
+
+// Longest wait for one seconds rollover
+#define ROLLOVER_TIMEOUT_MS 1500
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yoe = (unsigned)(year - era * 400);
+    const unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+RtcClock::RtcClock(DS3231* rtc, gpio_num_t sqw_pin, uint32_t resync_s)
+    : rtc(rtc), sqw(sqw_pin, GPIO_MODE_INPUT, true), sqw_pin(sqw_pin), resync_s(resync_s > 0 ? resync_s : 1),
+      task_handle(nullptr), anchor_mono_us(0), anchor_epoch_us(0),
+      drift_ref_mono_us(0), drift_ref_epoch_us(0), last_served_us(0), edge_mono_us(0),
+      synced(false), drift_known(false), stats() {
+    portMUX_INITIALIZE(&lock);
+}
+
+esp_err_t RtcClock::init() {
+    // Coarse anchor: the RTC only tells the current second, assume the middle of it
+    int64_t epoch_s = 0;
+    esp_err_t err = readEpoch(&epoch_s);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read RTC: %s", esp_err_to_name(err));
+        return err;
+    }
+    portENTER_CRITICAL(&lock);
+    anchor_mono_us = esp_timer_get_time();
+    anchor_epoch_us = epoch_s * 1000000 + 500000;
+    portEXIT_CRITICAL(&lock);
+
+    if (sqw_pin != GPIO_NUM_NC) {
+        err = rtc->enableSquareWave(true);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to enable SQW, polling the RTC instead: %s", esp_err_to_name(err));
+            sqw_pin = GPIO_NUM_NC;
+        } else {
+            // SQW is open drain, the seconds rollover is its falling edge
+            sqw.init();
+            gpio_set_intr_type(sqw_pin, GPIO_INTR_NEGEDGE);
+            sqw.attachInterrupt(sqw_pin, sqwIsr, this);
+        }
+    }
+
+    if (xTaskCreate(clockTask, "rtcClockTask", RTC_CLOCK_TASK_STACK, this, RTC_CLOCK_TASK_PRIORITY, &task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create clock task");
+        task_handle = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Clock started from RTC, %s", sqw_pin != GPIO_NUM_NC ? "disciplined on SQW" : "polling for resync");
+    return ESP_OK;
+}
+
+int64_t RtcClock::nowUs() {
+    int64_t mono = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    int64_t now = epochAt(mono);
+    if (now < last_served_us) {
+        now = last_served_us;
+    }
+    last_served_us = now;
+    portEXIT_CRITICAL(&lock);
+    return now;
+}
+
+bool RtcClock::isSynced() {
+    portENTER_CRITICAL(&lock);
+    bool result = synced;
+    portEXIT_CRITICAL(&lock);
+    return result;
+}
+
+void RtcClock::getStats(rtc_clock_stats_t* out) {
+    portENTER_CRITICAL(&lock);
+    *out = stats;
+    portEXIT_CRITICAL(&lock);
+}
+
+void RtcClock::toTm(int64_t epoch_ms, struct tm* time) {
+    time_t seconds = (time_t)(epoch_ms / 1000);
+    gmtime_r(&seconds, time);
+}
+
+int64_t RtcClock::epochAt(int64_t mono_us) const {
+    int64_t elapsed = mono_us - anchor_mono_us;
+    return anchor_epoch_us + elapsed + elapsed * stats.drift_ppb / 1000000000;
+}
+
+esp_err_t RtcClock::readEpoch(int64_t* epoch_s) {
+    struct tm time;
+    esp_err_t err = rtc->getTime(&time);
+    portENTER_CRITICAL(&lock);
+    stats.rtc_reads++;
+    portEXIT_CRITICAL(&lock);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // DS3231::getTime reports tm_year as the full year
+    int64_t days = daysFromCivil(time.tm_year, (unsigned)time.tm_mon + 1, (unsigned)time.tm_mday);
+    *epoch_s = days * 86400 + time.tm_hour * 3600 + time.tm_min * 60 + time.tm_sec;
+    return ESP_OK;
+}
+
+void IRAM_ATTR RtcClock::sqwIsr(void* arg) {
+    RtcClock* clock = static_cast<RtcClock*>(arg);
+    clock->edge_mono_us = esp_timer_get_time();
+    if (clock->task_handle != nullptr) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(clock->task_handle, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+esp_err_t RtcClock::waitForRollover(bool read_rtc, int64_t* edge_us, int64_t* edge_s) {
+    if (sqw_pin != GPIO_NUM_NC) {
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ROLLOVER_TIMEOUT_MS)) == 0) {
+            return ESP_ERR_TIMEOUT;
+        }
+        portENTER_CRITICAL(&lock);
+        *edge_us = edge_mono_us;
+        portEXIT_CRITICAL(&lock);
+
+        if (read_rtc) {
+            // Read right after the edge, the seconds register already shows the new second
+            esp_err_t err = readEpoch(edge_s);
+            if (err != ESP_OK) {
+                return err;
+            }
+            if (esp_timer_get_time() - *edge_us > 900000) {
+                // The read may already show the second after the edge
+                return ESP_ERR_INVALID_STATE;
+            }
+        } else {
+            // The clock is within half a second of the RTC, round to the second that just began
+            portENTER_CRITICAL(&lock);
+            *edge_s = (epochAt(*edge_us) + 500000) / 1000000;
+            portEXIT_CRITICAL(&lock);
+        }
+        return ESP_OK;
+    }
+
+    // No SQW: poll until the seconds register advances, the rollover lies between two reads
+    int64_t first_s = 0;
+    int64_t before = esp_timer_get_time();
+    esp_err_t err = readEpoch(&first_s);
+    if (err != ESP_OK) {
+        return err;
+    }
+    int64_t previous_mid = (before + esp_timer_get_time()) / 2;
+    TickType_t poll_ticks = pdMS_TO_TICKS(RTC_CLOCK_POLL_MS) > 0 ? pdMS_TO_TICKS(RTC_CLOCK_POLL_MS) : 1;
+
+    for (int waited = 0; waited < ROLLOVER_TIMEOUT_MS; waited += RTC_CLOCK_POLL_MS) {
+        vTaskDelay(poll_ticks);
+        int64_t seconds = 0;
+        before = esp_timer_get_time();
+        err = readEpoch(&seconds);
+        if (err != ESP_OK) {
+            return err;
+        }
+        int64_t mid = (before + esp_timer_get_time()) / 2;
+        if (seconds != first_s) {
+            *edge_us = (previous_mid + mid) / 2;
+            *edge_s = seconds;
+            return ESP_OK;
+        }
+        previous_mid = mid;
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+void RtcClock::discipline(int64_t edge_us, int64_t edge_s) {
+    int64_t truth = edge_s * 1000000;
+
+    portENTER_CRITICAL(&lock);
+    int64_t error = epochAt(edge_us) - truth;
+    if (synced) {
+        int64_t magnitude = error < 0 ? -error : error;
+        if (magnitude > stats.max_error_us) {
+            stats.max_error_us = magnitude;
+        }
+        // Rate of the RTC against esp_timer over a long enough span
+        int64_t mono_span = edge_us - drift_ref_mono_us;
+        if (mono_span >= (int64_t)RTC_CLOCK_DRIFT_SPAN_S * 1000000) {
+            int64_t true_span = truth - drift_ref_epoch_us;
+            int32_t measured = (int32_t)((true_span - mono_span) * 1000000000 / mono_span);
+            stats.drift_ppb = drift_known ? (3 * stats.drift_ppb + measured) / 4 : measured;
+            drift_known = true;
+            drift_ref_mono_us = edge_us;
+            drift_ref_epoch_us = truth;
+        }
+    } else {
+        drift_ref_mono_us = edge_us;
+        drift_ref_epoch_us = truth;
+    }
+    anchor_mono_us = edge_us;
+    anchor_epoch_us = truth;
+    stats.last_error_us = error;
+    stats.syncs++;
+    bool first = !synced;
+    synced = true;
+    portEXIT_CRITICAL(&lock);
+
+    if (first) {
+        ESP_LOGI(TAG, "Synced to RTC seconds rollover, boot estimate was off by %lld us", (long long)error);
+    }
+}
+
+void RtcClock::clockTask(void* arg) {
+    RtcClock* self = static_cast<RtcClock*>(arg);
+    int64_t last_read_us = 0;
+    bool have_read = false;
+
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        bool read_rtc = !have_read || now - last_read_us >= (int64_t)self->resync_s * 1000000;
+
+        int64_t edge_us = 0;
+        int64_t edge_s = 0;
+        esp_err_t err = self->waitForRollover(read_rtc, &edge_us, &edge_s);
+        if (err == ESP_OK) {
+            self->discipline(edge_us, edge_s);
+            if (read_rtc) {
+                last_read_us = edge_us;
+                have_read = true;
+            }
+        } else if (err != ESP_ERR_TIMEOUT) {
+            // A failed or late read skips this sync point, the next edge reads again
+            ESP_LOGW(TAG, "Failed to read RTC at the seconds rollover: %s", esp_err_to_name(err));
+        } else if (self->sqw_pin != GPIO_NUM_NC) {
+            ESP_LOGW(TAG, "No SQW edge from the RTC, polling it instead");
+            gpio_isr_handler_remove(self->sqw_pin);
+            self->sqw_pin = GPIO_NUM_NC;
+            continue;
+        } else {
+            ESP_LOGW(TAG, "RTC seconds did not advance");
+        }
+
+        // With SQW the next edge paces the loop, otherwise sleep until the next resync
+        if (self->sqw_pin == GPIO_NUM_NC) {
+            vTaskDelay(pdMS_TO_TICKS(self->resync_s * 1000));
+        }
+    }
+}
@@ -0,0 +1,111 @@
+/**
+ * @file RtcClock.h
+ * @brief Monotonic wall clock served from esp_timer and disciplined by the DS3231.
+ *
+ * The DS3231 is read once at boot. Timestamps are then computed from the
+ * esp_timer microsecond counter, so taking one costs no I2C transaction and
+ * has microsecond resolution instead of whole seconds.
+ *
+ * A low-priority task keeps the clock on the RTC. With the DS3231 SQW output
+ * wired to a GPIO, every falling edge (the instant the RTC seconds register
+ * advances) is timestamped in the ISR and used as a sync point, and the RTC is
+ * re-read over I2C only every resync period. Without SQW the task finds the
+ * seconds rollover by polling the RTC once per resync period.
+ *
+ * The rate of esp_timer against the RTC is tracked as a drift in parts per
+ * billion and applied between sync points. Served timestamps never go
+ * backwards: when a sync steps the clock back it holds until it catches up.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+
+#include "ds3231.h"
+#include "Gpio.h"
+
+// RTC read over I2C to re-anchor the seconds count
+#define RTC_CLOCK_RESYNC_S          600
+
+// Drift is measured over at least this long between sync points
+#define RTC_CLOCK_DRIFT_SPAN_S      60
+
+// Poll interval while looking for the seconds rollover without SQW
+#define RTC_CLOCK_POLL_MS           10
+
+#define RTC_CLOCK_TASK_STACK        3072
+#define RTC_CLOCK_TASK_PRIORITY     2
+
+typedef struct {
+    uint32_t syncs;             // Sync points applied
+    uint32_t rtc_reads;         // I2C reads of the RTC time
+    int64_t last_error_us;      // Clock minus RTC at the last sync point
+    int64_t max_error_us;       // Largest absolute error seen after the first sync
+    int32_t drift_ppb;          // RTC rate against esp_timer, positive when esp_timer runs slow
+} rtc_clock_stats_t;
+
+class RtcClock {
+public:
+    /**
+     * @param rtc Initialized DS3231, used only by the clock from now on.
+     * @param sqw_pin GPIO wired to the DS3231 INT/SQW output, GPIO_NUM_NC if not wired.
+     * @param resync_s Period of the I2C resync.
+     */
+    RtcClock(DS3231* rtc, gpio_num_t sqw_pin = GPIO_NUM_NC, uint32_t resync_s = RTC_CLOCK_RESYNC_S);
+
+    // Read the RTC once, set up SQW and start the discipline task
+    esp_err_t init();
+
+    // Microseconds since the Unix epoch (UTC)
+    int64_t nowUs();
+
+    // Milliseconds since the Unix epoch (UTC)
+    int64_t nowMs() { return nowUs() / 1000; }
+
+    // Whether a sync point on a seconds rollover has been applied yet
+    bool isSynced();
+
+    void getStats(rtc_clock_stats_t* stats);
+
+    // Calendar time (UTC) of an epoch timestamp in milliseconds
+    static void toTm(int64_t epoch_ms, struct tm* time);
+
+private:
+    static void IRAM_ATTR sqwIsr(void* arg);
+    static void clockTask(void* arg);
+
+    // Read the RTC as seconds since the epoch
+    esp_err_t readEpoch(int64_t* epoch_s);
+
+    // Find the next seconds rollover on SQW or by polling. ESP_ERR_TIMEOUT when no
+    // rollover was seen, another error when the RTC read at the rollover failed
+    esp_err_t waitForRollover(bool read_rtc, int64_t* edge_us, int64_t* edge_s);
+
+    void discipline(int64_t edge_us, int64_t edge_s);
+
+    // Clock value at an esp_timer time, call with the lock held
+    int64_t epochAt(int64_t mono_us) const;
+
+    DS3231* rtc;
+    Gpio sqw;
+    gpio_num_t sqw_pin;
+    uint32_t resync_s;
+    TaskHandle_t task_handle;
+
+    portMUX_TYPE lock;
+    int64_t anchor_mono_us;
+    int64_t anchor_epoch_us;
+    int64_t drift_ref_mono_us;
+    int64_t drift_ref_epoch_us;
+    int64_t last_served_us;
+    volatile int64_t edge_mono_us;
+    bool synced;
+    bool drift_known;
+    rtc_clock_stats_t stats;
+};
@@ -8,8 +8,6 @@
 #include "ds3231.h"
 
 #define CHECK_ARG(ARG) do { if (!ARG) return ESP_ERR_INVALID_ARG; } while (0)
-#include "DS3231.h"
-#include "esp_log.h"
 
 // Constructor
 DS3231::DS3231(I2CMaster* i2c_master, uint8_t address)
@@ -82,6 +80,22 @@ esp_err_t DS3231::getTime(struct tm* time) {
     return ESP_OK;
 }
 
+// Switch the INT/SQW pin between the 1 Hz square wave and alarm interrupts
+esp_err_t DS3231::enableSquareWave(bool enable) {
+    uint8_t reg = DS3231_ADDR_CONTROL;
+    uint8_t control;
+
+    esp_err_t res = i2c_master->read(address, &reg, 1, &control, 1);
+    if (res != ESP_OK) return res;
+
+    if (enable) {
+        control &= ~(DS3231_CTRL_ALARM_INTS | DS3231_CTRL_RATE_MASK);
+    } else {
+        control |= DS3231_CTRL_ALARM_INTS;
+    }
+    return i2c_master->write(address, &reg, 1, &control, 1);
+}
+
 // Get the raw temperature value
 esp_err_t DS3231::getRawTemperature(int16_t* temp) {
     if (!temp) return ESP_ERR_INVALID_ARG;
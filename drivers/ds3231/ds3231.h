@@ -25,6 +25,7 @@
 #define DS3231_CTRL_ALARM_INTS    0x04
 #define DS3231_CTRL_ALARM2_INT    0x02
 #define DS3231_CTRL_ALARM1_INT    0x01
+#define DS3231_CTRL_RATE_MASK     0x18  // RS2:RS1, 00 selects 1 Hz
 
 #define DS3231_ALARM_WDAY   0x40
 #define DS3231_ALARM_NOTSET 0x80
@@ -55,6 +56,9 @@ class DS3231 {
     
         // Get the time from the DS3231
         esp_err_t getTime(struct tm* time);
+
+        // Output a 1 Hz square wave on SQW (falling edge on each seconds update), or alarm interrupts
+        esp_err_t enableSquareWave(bool enable);
     
         // Get the raw temperature value
         esp_err_t getRawTemperature(int16_t* temp);
@@ -0,0 +1,190 @@
+/**
+ * @file async_bench.cpp
+ * @brief Requests per second of blocking reads versus submitted ones on a ModbusBus.
+ *
+ * Reads a block of holding registers round-robin from the simulated slaves,
+ * with a fixed amount of per-response work on the caller (decoding, storing)
+ * three ways:
+ *
+ *  - blocking: transact(), then the work, then the next transact();
+ *  - pipelined: up to --depth requests submitted, the work on the oldest
+ *    response runs while the bus task has the next request on the wire;
+ *  - batch: --batch requests through one transact() call, the work after it.
+ *
+ * Reported are requests per second, the share of the time the bus was busy
+ * and the mean time from one completed response to the next. Times are
+ * simulated time.
+ *
+ * Usage: async_bench [--requests N] [--slaves N] [--regs Q] [--work-us US]
+ *                    [--depth N] [--batch N] [--time-scale X]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "host_hal.h"
+#include "Modbus.h"
+#include "ModbusBus.h"
+
+struct BenchConfig {
+    uint32_t requests = 600;
+    int slaves = 3;
+    uint16_t regs = 13;
+    uint32_t work_us = 2000;        // Caller work per response
+    uint32_t depth = 4;             // Requests in flight in the pipelined run
+    uint32_t batch = 6;             // Requests per transact() in the batch run
+    double time_scale = 0.1;
+};
+
+struct Result {
+    uint32_t requests;
+    uint32_t failures;
+    int64_t elapsed_us;
+    int64_t bus_us;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--requests N] [--slaves N] [--regs Q] [--work-us US] [--depth N] [--batch N]\n"
+            "          [--time-scale X]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--requests") == 0 && has_value) {
+            config.requests = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--regs") == 0 && has_value) {
+            config.regs = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--work-us") == 0 && has_value) {
+            config.work_us = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--depth") == 0 && has_value) {
+            config.depth = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--batch") == 0 && has_value) {
+            config.batch = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--time-scale") == 0 && has_value) {
+            config.time_scale = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.requests < 1 || config.slaves < 1 || config.slaves > 247 || config.regs < 1 ||
+        config.regs > 125 || config.depth < 1 || config.depth > MB_BUS_QUEUE_LENGTH || config.batch < 1 ||
+        config.time_scale <= 0) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static void prepare(const BenchConfig& config, ModbusRequest* request, uint32_t index, uint16_t* buffer) {
+    *request = ModbusRequest{};
+    request->slave_id = (uint8_t)(1 + index % config.slaves);
+    request->command = MB_FUNC_READ_HOLDING_REGISTER;
+    request->address = 0;
+    request->quantity = config.regs;
+    request->data = buffer;
+}
+
+template <typename Run>
+static Result measure(Run run) {
+    host_mb_stats_t before;
+    host_mb_get_stats(&before);
+    int64_t start = esp_timer_get_time();
+    Result result = {};
+    run(&result);
+    result.elapsed_us = esp_timer_get_time() - start;
+    host_mb_stats_t after;
+    host_mb_get_stats(&after);
+    result.bus_us = after.busy_us - before.busy_us;
+    return result;
+}
+
+static void report(const char* label, const Result& result) {
+    printf("  %-10s: %7.1f requests/s, bus busy %5.1f%%, %6.2f ms per response, %u failed\n", label,
+           result.requests * 1e6 / result.elapsed_us, 100.0 * result.bus_us / result.elapsed_us,
+           result.elapsed_us / 1000.0 / result.requests, (unsigned)result.failures);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+
+    host_set_time_scale(config.time_scale);
+    host_log_set_console(NULL, 115200);
+    for (int addr = 1; addr <= config.slaves; addr++) {
+        host_mb_slave_add((uint8_t)addr);
+    }
+
+    ModbusBus bus(UART_NUM_1, 115200, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
+    if (!bus.init()) {
+        fprintf(stderr, "bus initialization failed\n");
+        return 1;
+    }
+
+    printf("async_bench: %u reads of %u registers from %d slaves, %u us work per response\n",
+           (unsigned)config.requests, (unsigned)config.regs, config.slaves, (unsigned)config.work_us);
+
+    std::vector<uint16_t> buffers((size_t)std::max(config.depth, config.batch) * config.regs);
+
+    Result blocking = measure([&](Result* result) {
+        for (uint32_t i = 0; i < config.requests; i++) {
+            esp_err_t err = bus.transact((uint8_t)(1 + i % config.slaves), MB_FUNC_READ_HOLDING_REGISTER, 0,
+                                         config.regs, buffers.data());
+            result->failures += err != ESP_OK;
+            host_sleep_us(config.work_us);
+            result->requests++;
+        }
+    });
+    report("blocking", blocking);
+
+    // The bus completes in submission order, so every notification is the oldest request
+    Result pipelined = measure([&](Result* result) {
+        std::vector<ModbusRequest> window(config.depth);
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        uint32_t submitted = 0;
+        for (uint32_t i = 0; i < config.requests; i++) {
+            while (submitted < config.requests && submitted < i + config.depth) {
+                ModbusRequest* request = &window[submitted % config.depth];
+                prepare(config, request, submitted, &buffers[(submitted % config.depth) * config.regs]);
+                request->notify = self;
+                bus.submit(request);
+                submitted++;
+            }
+            ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+            result->failures += window[i % config.depth].result != ESP_OK;
+            host_sleep_us(config.work_us);
+            result->requests++;
+        }
+    });
+    report("pipelined", pipelined);
+
+    Result batched = measure([&](Result* result) {
+        std::vector<ModbusRequest> requests(config.batch);
+        for (uint32_t i = 0; i < config.requests; i += config.batch) {
+            uint32_t count = std::min(config.batch, config.requests - i);
+            for (uint32_t j = 0; j < count; j++) {
+                prepare(config, &requests[j], i + j, &buffers[j * config.regs]);
+            }
+            bus.transact(requests.data(), count);
+            for (uint32_t j = 0; j < count; j++) {
+                result->failures += requests[j].result != ESP_OK;
+                host_sleep_us(config.work_us);
+                result->requests++;
+            }
+        }
+    });
+    report("batch", batched);
+    fflush(stdout);
+
+    bool ok = blocking.failures == 0 && pipelined.failures == 0 && batched.failures == 0;
+    _exit(ok ? 0 : 1);
+}
@@ -0,0 +1,336 @@
+/**
+ * @file column_bench.cpp
+ * @brief Batch decode of 32-bit registers into columns versus one register pair at a time.
+ *
+ * Kernels: random register blocks of 62 floats (one full 124-register read)
+ * with some NaNs and out-of-range values are converted and checked against
+ * per-value limits, once pair by pair through a convertRegistersToFloat helper
+ * with a check per value, and once with mbDecodeFloats and mbCheckRange.
+ * Both must give the same values and validity bitmap.
+ *
+ * Meter: a simulated energy meter with 60 floats, 4 counters and 2 signed
+ * values, word swapped (CDAB), is read over the simulated bus through a
+ * ModbusReadPlan. ModbusColumns decodes the plan into columns, the per-value
+ * path looks each CID up in the plan and converts it. Every value and
+ * validity flag is checked against what the slave was given, and columns
+ * built from a device profile of the meter must match those built from its
+ * descriptor table. Times are real
+ * host time.
+ *
+ * Usage: column_bench [--blocks N] [--rounds N]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "host_hal.h"
+#include "Modbus.h"
+#include "ModbusBus.h"
+#include "ModbusColumns.h"
+#include "ModbusProfiles.h"
+#include "ModbusReadPlan.h"
+
+#define BLOCK_VALUES    62
+#define METER_ADDR      1
+#define METER_FLOATS    60
+#define METER_COUNTERS  4
+#define METER_SIGNED    2
+#define METER_REG_START 100
+
+struct BenchConfig {
+    int blocks = 1024;
+    int rounds = 200;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--blocks N] [--rounds N]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--blocks") == 0 && has_value) {
+            config.blocks = atoi(argv[++i]);
+        } else if (strcmp(arg, "--rounds") == 0 && has_value) {
+            config.rounds = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.blocks < 1 || config.rounds < 1) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The helper main.cpp used before register maps, one pair per call
+__attribute__((noinline)) static float convertRegistersToFloat(uint16_t high, uint16_t low) {
+    uint32_t combined = ((uint32_t)high << 16) | low;
+    float value;
+    memcpy(&value, &combined, sizeof(value));
+    return value;
+}
+
+static void splitFloat(float value, bool word_swap, uint16_t* regs) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    regs[word_swap ? 1 : 0] = (uint16_t)(bits >> 16);
+    regs[word_swap ? 0 : 1] = (uint16_t)bits;
+}
+
+// ---- Kernels ----
+
+static bool runKernels(const BenchConfig& config, bool word_swap) {
+    mb_byte_order_t order = word_swap ? MB_ORDER_CDAB : MB_ORDER_ABCD;
+    size_t values = (size_t)config.blocks * BLOCK_VALUES;
+
+    // Readings within -1000..1000, one in 16 outside and one in 64 NaN
+    std::mt19937 rng(4242);
+    std::uniform_real_distribution<float> reading(-1000.0f, 1000.0f);
+    std::vector<uint16_t> regs(values * 2);
+    std::vector<float> min(BLOCK_VALUES, -1000.0f);
+    std::vector<float> max(BLOCK_VALUES, 1000.0f);
+    for (size_t i = 0; i < values; i++) {
+        float value = reading(rng);
+        uint32_t pick = rng() % 64;
+        if (pick == 0) {
+            value = NAN;
+        } else if (pick < 4) {
+            value *= 10.0f;
+        }
+        splitFloat(value, word_swap, &regs[2 * i]);
+    }
+
+    std::vector<float> pair_values(values);
+    std::vector<uint32_t> pair_valid((size_t)config.blocks * MB_COLUMN_BITMAP_WORDS(BLOCK_VALUES));
+    std::vector<float> batch_values(values);
+    std::vector<uint32_t> batch_valid(pair_valid.size());
+    size_t words = MB_COLUMN_BITMAP_WORDS(BLOCK_VALUES);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < config.rounds; round++) {
+        for (int b = 0; b < config.blocks; b++) {
+            const uint16_t* block = &regs[(size_t)b * BLOCK_VALUES * 2];
+            float* out = &pair_values[(size_t)b * BLOCK_VALUES];
+            uint32_t* valid = &pair_valid[(size_t)b * words];
+            memset(valid, 0, words * sizeof(uint32_t));
+            for (int i = 0; i < BLOCK_VALUES; i++) {
+                float value = word_swap ? convertRegistersToFloat(block[2 * i + 1], block[2 * i])
+                                        : convertRegistersToFloat(block[2 * i], block[2 * i + 1]);
+                out[i] = value;
+                if (!isnan(value) && value >= min[i] && value <= max[i]) {
+                    valid[i / 32] |= 1u << (i % 32);
+                }
+            }
+        }
+        asm volatile("" : : "r"(pair_values.data()), "r"(pair_valid.data()) : "memory");
+    }
+    double pair_ns = elapsedNs(start);
+
+    size_t num_valid = 0;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < config.rounds; round++) {
+        num_valid = 0;
+        for (int b = 0; b < config.blocks; b++) {
+            float* out = &batch_values[(size_t)b * BLOCK_VALUES];
+            mbDecodeFloats(&regs[(size_t)b * BLOCK_VALUES * 2], BLOCK_VALUES, order, out);
+            num_valid += mbCheckRange(out, min.data(), max.data(), BLOCK_VALUES, &batch_valid[(size_t)b * words]);
+        }
+        asm volatile("" : : "r"(batch_values.data()), "r"(batch_valid.data()) : "memory");
+    }
+    double batch_ns = elapsedNs(start);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < values; i++) {
+        bool same = (isnan(pair_values[i]) && isnan(batch_values[i])) || pair_values[i] == batch_values[i];
+        mismatches += !same;
+    }
+    mismatches += memcmp(pair_valid.data(), batch_valid.data(), pair_valid.size() * sizeof(uint32_t)) != 0;
+
+    double decodes = (double)values * config.rounds;
+    printf("  %-13s: pair by pair %5.2f ns/value, batch %5.2f ns/value, %.2fx, %zu of %zu valid, %zu mismatches\n",
+           word_swap ? "kernels CDAB" : "kernels ABCD", pair_ns / decodes, batch_ns / decodes, pair_ns / batch_ns,
+           num_valid, values, mismatches);
+    return mismatches == 0;
+}
+
+// ---- Meter over the simulated bus ----
+
+struct MeterValue {
+    uint16_t cid;
+    mb_descr_type_t type;
+    double value;
+    bool valid;
+};
+
+static bool runMeter(const BenchConfig& config) {
+    host_mb_slave_add(METER_ADDR);
+    ModbusBus bus(UART_NUM_1, 115200, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
+    if (!bus.init()) {
+        fprintf(stderr, "bus initialization failed\n");
+        return false;
+    }
+
+    // Floats with limits of +-500, counters, then signed values of -1000..1000
+    std::vector<mb_parameter_descriptor_t> table;
+    std::vector<MeterValue> expected;
+    uint16_t reg = METER_REG_START;
+    for (int i = 0; i < METER_FLOATS + METER_COUNTERS + METER_SIGNED; i++, reg += 2) {
+        mb_parameter_descriptor_t param = {};
+        param.cid = (uint16_t)i;
+        param.param_key = "tag";
+        param.param_units = "";
+        param.mb_slave_addr = METER_ADDR;
+        param.mb_param_type = MB_PARAM_HOLDING;
+        param.mb_reg_start = reg;
+        param.mb_size = 2;
+        param.access = PAR_PERMS_READ;
+
+        uint16_t words[2];
+        MeterValue value = { param.cid, PARAM_TYPE_FLOAT, 0.0, true };
+        if (i < METER_FLOATS) {
+            param.param_type = PARAM_TYPE_FLOAT;
+            param.param_size = PARAM_SIZE_FLOAT;
+            param.param_opts = { .opt1 = -500, .opt2 = 500, .opt3 = 0 };
+            // One NaN and one reading out of range
+            float reading = i == 7 ? NAN : i == 11 ? 750.0f : (float)(i * 7.25 - 200.0);
+            splitFloat(reading, true, words);
+            value.value = reading;
+            value.valid = i != 7 && i != 11;
+        } else {
+            bool is_signed = i >= METER_FLOATS + METER_COUNTERS;
+            param.param_type = PARAM_TYPE_U32;
+            param.param_size = PARAM_SIZE_U32;
+            param.param_opts = is_signed ? mb_parameter_opt_t{ .opt1 = -1000, .opt2 = 1000, .opt3 = 0 }
+                                         : mb_parameter_opt_t{ .opt1 = 0, .opt2 = 0, .opt3 = 0 };
+            uint32_t bits = is_signed ? (uint32_t)(int32_t)(-300 * (i - METER_FLOATS - METER_COUNTERS + 1))
+                                      : 100000u * (uint32_t)i + 70000u;
+            words[0] = (uint16_t)bits;
+            words[1] = (uint16_t)(bits >> 16);
+            value.type = PARAM_TYPE_U32;
+            value.value = is_signed ? (double)(int32_t)bits : (double)bits;
+        }
+        host_mb_slave_set_register(METER_ADDR, reg, words[0]);
+        host_mb_slave_set_register(METER_ADDR, (uint16_t)(reg + 1), words[1]);
+        table.push_back(param);
+        expected.push_back(value);
+    }
+
+    ModbusReadPlan plan;
+    ModbusColumns columns(MB_ORDER_CDAB);
+    if (!plan.build(table.data(), (uint16_t)table.size()) ||
+        !columns.build(table.data(), (uint16_t)table.size(), METER_ADDR) || plan.readSlave(&bus, METER_ADDR) != ESP_OK) {
+        fprintf(stderr, "meter read failed\n");
+        return false;
+    }
+
+    // Columns against the values the slave was given
+    size_t num_valid = columns.decode(plan);
+    size_t mismatches = 0;
+    size_t rows[MB_COLUMN_COUNT] = {};
+    for (const MeterValue& value : expected) {
+        mb_column_type_t type = value.type == PARAM_TYPE_FLOAT ? MB_COLUMN_FLOAT
+                                : value.value < 0 ? MB_COLUMN_I32 : MB_COLUMN_U32;
+        size_t row = rows[type]++;
+        double decoded = type == MB_COLUMN_FLOAT ? (double)columns.getFloats()[row]
+                         : type == MB_COLUMN_I32 ? (double)columns.getInt32()[row]
+                                                 : (double)columns.getUint32()[row];
+        bool same = columns.getCids(type)[row] == value.cid && columns.isValid(type, row) == value.valid &&
+                    ((isnan(decoded) && isnan(value.value)) || decoded == value.value);
+        mismatches += !same;
+    }
+
+    // The meter as a device type, with no address in its descriptors: its profile must give the same columns
+    std::vector<mb_parameter_descriptor_t> type_params(table);
+    for (mb_parameter_descriptor_t& param : type_params) {
+        param.mb_slave_addr = 0;
+    }
+    const mb_device_type_t meter_type = { 1, "meter", type_params.data(), (uint8_t)type_params.size(), nullptr, 0 };
+    const mb_profile_slave_t meter_profile = { METER_ADDR, 1, 0, 1, 1000, 0 };
+    ModbusProfiles profiles(&meter_type, 1);
+    ModbusColumns profiled(MB_ORDER_CDAB);
+    if (profiles.setSlaves(&meter_profile, 1) != ESP_OK || !profiled.build(profiles, METER_ADDR)) {
+        fprintf(stderr, "meter profile rejected\n");
+        return false;
+    }
+    size_t profiled_valid = profiled.decode(plan);
+    mismatches += profiled_valid != num_valid;
+    for (int type = 0; type < MB_COLUMN_COUNT; type++) {
+        mb_column_type_t column = (mb_column_type_t)type;
+        size_t count = columns.getCount(column);
+        mismatches += profiled.getCount(column) != count;
+        if (profiled.getCount(column) == count) {
+            mismatches += memcmp(profiled.getCids(column), columns.getCids(column), count * sizeof(uint16_t)) != 0;
+            mismatches += memcmp(profiled.getValidity(column), columns.getValidity(column),
+                                 MB_COLUMN_BITMAP_WORDS(count) * sizeof(uint32_t)) != 0;
+        }
+    }
+    mismatches += memcmp(profiled.getFloats(), columns.getFloats(),
+                         columns.getCount(MB_COLUMN_FLOAT) * sizeof(float)) != 0;
+
+    // Decode time of the whole meter, columns against a lookup and conversion per CID
+    int iterations = config.rounds * 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        columns.decode(plan);
+        asm volatile("" : : "r"(columns.getFloats()) : "memory");
+    }
+    double columns_ns = elapsedNs(start) / iterations;
+
+    std::vector<float> values(table.size());
+    std::vector<uint32_t> valid(MB_COLUMN_BITMAP_WORDS(table.size()));
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        std::fill(valid.begin(), valid.end(), 0);
+        for (size_t c = 0; c < table.size(); c++) {
+            const uint16_t* regs = plan.getRegisters(table[c].cid);
+            if (regs == nullptr) {
+                continue;
+            }
+            float value = convertRegistersToFloat(regs[1], regs[0]);
+            values[c] = value;
+            if (!isnan(value) && value >= table[c].param_opts.min && value <= table[c].param_opts.max) {
+                valid[c / 32] |= 1u << (c % 32);
+            }
+        }
+        asm volatile("" : : "r"(values.data()), "r"(valid.data()) : "memory");
+    }
+    double per_cid_ns = elapsedNs(start) / iterations;
+
+    mb_columns_stats_t stats;
+    columns.getStats(&stats);
+    printf("  %-13s: %zu values in %zu blocks, per CID %6.0f ns, columns %6.0f ns, %.2fx, %zu valid, "
+           "%u runs split over blocks, %zu mismatches\n",
+           "meter CDAB", table.size(), plan.getNumBlocks(), per_cid_ns, columns_ns, per_cid_ns / columns_ns,
+           num_valid, (unsigned)(stats.split_runs / stats.decodes), mismatches);
+    return mismatches == 0;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_set_time_scale(0.01);
+    host_log_set_console(NULL, 0);
+
+    printf("column_bench: %d blocks of %d floats, %d rounds\n", config.blocks, BLOCK_VALUES, config.rounds);
+    bool ok = runKernels(config, false);
+    ok = runKernels(config, true) && ok;
+    ok = runMeter(config) && ok;
+    fflush(stdout);
+
+    // The bus task loops forever, leave without unwinding it
+    _exit(ok ? 0 : 1);
+}
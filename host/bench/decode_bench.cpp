@@ -0,0 +1,261 @@
+/**
+ * @file decode_bench.cpp
+ * @brief Register decoding through a ModbusRegisterMap versus a descriptor table switched at run time.
+ *
+ * Decodes blocks of random registers into values two ways: with the decoder a
+ * ModbusRegisterMap generates at compile time, and with a generic decoder that
+ * walks a table of the same fields and switches on the value type and byte
+ * order of each one, the way a decoder driven by PARAM_TYPE_* descriptors
+ * works. Both must give the same values, integers bit for bit in their own
+ * type and scaled fields as floats. Two profiles are run: the climate
+ * sensor of main.cpp (3 fields) and an energy meter with mixed types, byte
+ * orders and scales (17 fields). Times are real host time.
+ *
+ * Usage: decode_bench [--blocks N] [--rounds N]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <chrono>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "Modbus.h"
+#include "ModbusRegisterMap.h"
+
+struct BenchConfig {
+    int blocks = 4096;
+    int rounds = 200;
+};
+
+// Energy meter: voltages and currents as scaled integers, powers signed and
+// word swapped, energy counters little endian, frequency and power factor as
+// floats, the board temperature with an offset, and a raw 64-bit pulse count
+typedef ModbusRegisterMap<ModbusField<uint16_t, 0, MB_ORDER_ABCD, 0.1f>,
+                          ModbusField<uint16_t, 1, MB_ORDER_ABCD, 0.1f>,
+                          ModbusField<uint16_t, 2, MB_ORDER_ABCD, 0.1f>,
+                          ModbusField<uint16_t, 3, MB_ORDER_ABCD, 0.01f>,
+                          ModbusField<uint16_t, 4, MB_ORDER_ABCD, 0.01f>,
+                          ModbusField<uint16_t, 5, MB_ORDER_ABCD, 0.01f>,
+                          ModbusField<int32_t, 6, MB_ORDER_CDAB>,
+                          ModbusField<int32_t, 8, MB_ORDER_CDAB>,
+                          ModbusField<int32_t, 10, MB_ORDER_CDAB>,
+                          ModbusField<uint32_t, 20, MB_ORDER_DCBA, 0.001f>,
+                          ModbusField<uint32_t, 22, MB_ORDER_DCBA, 0.001f>,
+                          ModbusField<float, 30, MB_ORDER_ABCD>,
+                          ModbusField<float, 32, MB_ORDER_BADC>,
+                          ModbusField<int16_t, 40, MB_ORDER_ABCD, 0.1f, -40.0f>,
+                          ModbusField<uint16_t, 41>,
+                          ModbusField<uint64_t, 42, MB_ORDER_CDAB, 0.001f>,
+                          ModbusField<uint64_t, 46>> EnergyMeterMap;
+
+// ---- Run-time decoding from a field table ----
+
+enum FieldKind { KIND_U16, KIND_I16, KIND_U32, KIND_I32, KIND_U64, KIND_FLOAT };
+
+struct RuntimeField {
+    uint16_t offset;            // Register offset in the block
+    FieldKind kind;
+    mb_byte_order_t order;
+    float scale;
+    float add;
+};
+
+// Decoded value, in the member that fits its kind: u or i for unscaled integers, f otherwise
+struct RuntimeValue {
+    uint64_t u;
+    int64_t i;
+    float f;
+};
+
+template <typename T> static FieldKind kindOf() {
+    if constexpr (std::is_same_v<T, uint16_t>) return KIND_U16;
+    if constexpr (std::is_same_v<T, int16_t>) return KIND_I16;
+    if constexpr (std::is_same_v<T, uint32_t>) return KIND_U32;
+    if constexpr (std::is_same_v<T, int32_t>) return KIND_I32;
+    if constexpr (std::is_same_v<T, uint64_t>) return KIND_U64;
+    return KIND_FLOAT;
+}
+
+// The same fields as the map, as a table read at run time
+template <typename... Fields>
+static std::vector<RuntimeField> runtimeTable(ModbusRegisterMap<Fields...>*) {
+    typedef ModbusRegisterMap<Fields...> Map;
+    return { RuntimeField{(uint16_t)(Fields::reg - Map::start), kindOf<typename Fields::type>(), Fields::order,
+                          Fields::scale, Fields::offset}... };
+}
+
+static RuntimeValue decodeField(const RuntimeField& field, const uint16_t* regs) {
+    int words;
+    switch (field.kind) {
+    case KIND_U16:
+    case KIND_I16:
+        words = 1;
+        break;
+    case KIND_U64:
+        words = 4;
+        break;
+    default:
+        words = 2;
+        break;
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < words; i++) {
+        uint16_t word;
+        switch (field.order) {
+        case MB_ORDER_CDAB:
+        case MB_ORDER_DCBA:
+            word = regs[field.offset + words - 1 - i];
+            break;
+        default:
+            word = regs[field.offset + i];
+            break;
+        }
+        if (field.order == MB_ORDER_BADC || field.order == MB_ORDER_DCBA) {
+            word = (uint16_t)((word << 8) | (word >> 8));
+        }
+        bits = (bits << 16) | word;
+    }
+
+    RuntimeValue value = {};
+    switch (field.kind) {
+    case KIND_U16:
+    case KIND_U32:
+    case KIND_U64:
+        value.u = bits;
+        value.f = (float)bits;
+        break;
+    case KIND_I16:
+        value.i = (int16_t)(uint16_t)bits;
+        value.f = (float)value.i;
+        break;
+    case KIND_I32:
+        value.i = (int32_t)(uint32_t)bits;
+        value.f = (float)value.i;
+        break;
+    default: {
+        uint32_t raw = (uint32_t)bits;
+        memcpy(&value.f, &raw, sizeof(value.f));
+        break;
+    }
+    }
+    if (field.scale != 1.0f) {
+        value.f *= field.scale;
+    }
+    if (field.add != 0.0f) {
+        value.f += field.add;
+    }
+    return value;
+}
+
+static void decodeRuntime(const std::vector<RuntimeField>& table, const uint16_t* regs, RuntimeValue* values) {
+    for (size_t i = 0; i < table.size(); i++) {
+        values[i] = decodeField(table[i], regs);
+    }
+}
+
+// ---- Bench ----
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--blocks N] [--rounds N]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--blocks") == 0 && has_value) {
+            config.blocks = atoi(argv[++i]);
+        } else if (strcmp(arg, "--rounds") == 0 && has_value) {
+            config.rounds = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.blocks < 1 || config.rounds < 1) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static bool sameValue(float a, float b) {
+    return (isnan(a) && isnan(b)) || a == b;
+}
+
+// A value of the register map against the run-time decode of the same field
+template <typename V>
+static bool sameField(V value, const RuntimeValue& runtime) {
+    if constexpr (std::is_floating_point_v<V>) {
+        return sameValue(value, runtime.f);
+    } else if constexpr (std::is_signed_v<V>) {
+        return (int64_t)value == runtime.i;
+    } else {
+        return (uint64_t)value == runtime.u;
+    }
+}
+
+template <typename Values, size_t... I>
+static size_t mismatchesOf(const Values& values, const RuntimeValue* runtime, std::index_sequence<I...>) {
+    return (0 + ... + (size_t)!sameField(std::get<I>(values), runtime[I]));
+}
+
+template <typename Map>
+static bool runProfile(const char* name, const BenchConfig& config) {
+    const size_t fields = Map::num_fields;
+    std::vector<RuntimeField> table = runtimeTable((Map*)nullptr);
+
+    // Random register images, every bit pattern including NaNs and infinities
+    std::mt19937 rng(12345);
+    std::vector<uint16_t> regs((size_t)config.blocks * Map::span);
+    for (uint16_t& reg : regs) {
+        reg = (uint16_t)rng();
+    }
+    std::vector<typename Map::Values> generated((size_t)config.blocks);
+    std::vector<RuntimeValue> runtime((size_t)config.blocks * fields);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < config.rounds; round++) {
+        for (int b = 0; b < config.blocks; b++) {
+            generated[b] = Map::decode(&regs[(size_t)b * Map::span]);
+        }
+        asm volatile("" : : "r"(generated.data()) : "memory");
+    }
+    double generated_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < config.rounds; round++) {
+        for (int b = 0; b < config.blocks; b++) {
+            decodeRuntime(table, &regs[(size_t)b * Map::span], &runtime[(size_t)b * fields]);
+        }
+        asm volatile("" : : "r"(runtime.data()) : "memory");
+    }
+    double runtime_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    size_t mismatches = 0;
+    for (size_t b = 0; b < generated.size(); b++) {
+        mismatches += mismatchesOf(generated[b], &runtime[b * fields], std::make_index_sequence<Map::num_fields>());
+    }
+
+    double decodes = (double)config.blocks * config.rounds;
+    printf("  %-13s: %2zu fields in %3u registers, register map %7.1f ns/block, run-time table %7.1f ns/block, "
+           "%.2fx, %zu mismatches\n",
+           name, fields, (unsigned)Map::span, generated_ns / decodes, runtime_ns / decodes, runtime_ns / generated_ns,
+           mismatches);
+    return mismatches == 0;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+
+    printf("decode_bench: %d blocks, %d rounds\n", config.blocks, config.rounds);
+    bool ok = runProfile<ClimateSensorMap>("climate", config);
+    ok = runProfile<EnergyMeterMap>("energy meter", config) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+/**
+ * @file flash_log_bench.cpp
+ * @brief Sustained write throughput and power-loss recovery of FlashLog.
+ *
+ * Runs against a simulated SPI NOR partition, kept in memory or backed by an
+ * image file. The write phase appends a stream of numbered records, wrapping
+ * the ring at least once, and reports throughput on the simulated flash
+ * timings, write amplification and erase spread. The read phase streams them
+ * back.
+ *
+ * The power-loss phase repeats: mount, read and commit part of the backlog,
+ * then append until the power is cut at a random byte of a program or erase.
+ * Every remount is timed, and the records that come back are checked. They
+ * must be intact, in order, resume at the committed position and lose nothing
+ * beyond the block that was in flight. Cuts in quick succession can join
+ * their losses into one longer gap. With --compress the log writes SeriesBlocks.
+ *
+ * Usage: flash_log_bench [--size KIB] [--image PATH] [--records N] [--batch B]
+ *                        [--cycles N] [--seed S] [--compress]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+
+#include "host_hal.h"
+#include "FlashLog.h"
+
+struct BenchConfig {
+    uint32_t size_kib = 256;
+    const char* image = NULL;
+    uint32_t records = 20000;
+    uint32_t batch = 3;
+    uint32_t cycles = 200;
+    uint32_t seed = 1;
+    bool compress = false;
+};
+
+struct Verifier {
+    uint32_t next;              // Sequence number expected next
+    uint64_t records;
+    uint64_t corrupt;
+    uint64_t out_of_order;
+    uint64_t lost;              // Records skipped over by forward jumps
+    uint64_t max_jump;          // Largest single gap
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--size KIB] [--image PATH] [--records N] [--batch B] [--cycles N] [--seed S] [--compress]\n",
+            prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--size") == 0 && has_value) {
+            config.size_kib = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--image") == 0 && has_value) {
+            config.image = argv[++i];
+        } else if (strcmp(arg, "--records") == 0 && has_value) {
+            config.records = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--batch") == 0 && has_value) {
+            config.batch = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--cycles") == 0 && has_value) {
+            config.cycles = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--seed") == 0 && has_value) {
+            config.seed = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--compress") == 0) {
+            config.compress = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.size_kib < 16 || config.size_kib % 4 != 0 || config.batch < 1 || config.batch > 64) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static int16_t checkWord(uint32_t seq) {
+    return (int16_t)((seq * 2654435761u) >> 16);
+}
+
+static void makeRecord(SensorRecord* record, uint32_t seq) {
+    sensorRecordInit(record, 1, SENSOR_TAG_CLIMATE, (int64_t)seq * 1000);
+    record->value_types = (SENSOR_VALUE_U16 << 0) | (SENSOR_VALUE_U16 << 2) | (SENSOR_VALUE_I16 << 4);
+    record->values[0] = (int16_t)(seq & 0xffff);
+    record->values[1] = (int16_t)(seq >> 16);
+    record->values[2] = checkWord(seq);
+}
+
+static void verify(Verifier* verifier, const SensorRecord* records, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const SensorRecord* record = &records[i];
+        uint32_t seq = (uint16_t)record->values[0] | ((uint32_t)(uint16_t)record->values[1] << 16);
+        verifier->records++;
+        if (!sensorRecordIsValid(record) || record->values[2] != checkWord(seq) ||
+            sensorRecordGetTimestamp(record) != (int64_t)seq * 1000) {
+            verifier->corrupt++;
+            continue;
+        }
+        if (seq < verifier->next) {
+            verifier->out_of_order++;
+        } else {
+            uint64_t jump = seq - verifier->next;
+            verifier->lost += jump;
+            verifier->max_jump = jump > verifier->max_jump ? jump : verifier->max_jump;
+            verifier->next = seq + 1;
+        }
+    }
+}
+
+static double wallUs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    std::mt19937 rng(config.seed);
+
+    // Program and erase times are simulated, keep their wall cost small
+    host_set_time_scale(0.001);
+    host_log_set_console(NULL, 0);
+    if (!host_flash_add_partition(FLASH_LOG_PARTITION_LABEL, ESP_PARTITION_SUBTYPE_ANY, config.size_kib * 1024,
+                                  config.image)) {
+        fprintf(stderr, "cannot create the flash partition\n");
+        return 1;
+    }
+
+    // ---- Sustained writes ----
+    FlashLog writer(FLASH_LOG_PARTITION_LABEL, config.compress);
+    if (writer.mount() != ESP_OK) {
+        fprintf(stderr, "mount failed\n");
+        return 1;
+    }
+    // Start from wherever an existing image left off
+    Verifier verifier = {};
+    SensorRecord batch[64];
+    while (writer.read(batch, 64) > 0) {
+    }
+    writer.commit();
+    flash_log_stats_t log_before;
+    writer.getStats(&log_before);
+
+    host_flash_stats_t flash_before, flash_after;
+    host_flash_get_stats(&flash_before);
+    uint32_t seq = 1u << 20;
+    verifier.next = seq;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t written = 0; written < config.records; written += config.batch) {
+        uint32_t n = config.records - written < config.batch ? config.records - written : config.batch;
+        for (uint32_t i = 0; i < n; i++) {
+            makeRecord(&batch[i], seq++);
+        }
+        writer.append(batch, n);
+    }
+    writer.flush();
+    double write_wall_us = wallUs(start);
+    host_flash_get_stats(&flash_after);
+
+    flash_log_stats_t log_stats;
+    writer.getStats(&log_stats);
+    double busy_s = (double)(flash_after.busy_us - flash_before.busy_us) / 1e6;
+    uint64_t payload = (uint64_t)config.records * sizeof(SensorRecord);
+    uint64_t programmed = flash_after.bytes_written - flash_before.bytes_written;
+    uint32_t blocks = log_stats.blocks_written - log_before.blocks_written;
+    printf("flash_log_bench: %u KiB partition, %s, %.1f records per block, %u blocks%s%s\n",
+           (unsigned)config.size_kib, config.compress ? "compressed" : "plain",
+           blocks ? (double)config.records / blocks : 0.0, (unsigned)(writer.getCapacity() / FLASH_LOG_RECORDS_PER_BLOCK),
+           config.image ? ", image " : "", config.image ? config.image : "");
+    printf("  write            : %u records in batches of %u, %.0f records/s on flash timings (%.2f s busy), "
+           "%.2f us/record host CPU\n",
+           (unsigned)config.records, (unsigned)config.batch, busy_s > 0 ? config.records / busy_s : 0.0,
+           busy_s, write_wall_us / config.records);
+    printf("  flash traffic    : %llu bytes programmed for %llu payload (x%.2f), %llu erases, "
+           "most worn sector %u erases, %u sectors dropped unread\n",
+           (unsigned long long)programmed, (unsigned long long)payload,
+           payload ? (double)programmed / (double)payload : 0.0,
+           (unsigned long long)(flash_after.erases - flash_before.erases), (unsigned)flash_after.max_sector_erases,
+           (unsigned)(log_stats.sectors_dropped - log_before.sectors_dropped));
+
+    // ---- Stream back ----
+    start = std::chrono::steady_clock::now();
+    host_flash_get_stats(&flash_before);
+    size_t n;
+    while ((n = writer.read(batch, 64)) > 0) {
+        verify(&verifier, batch, n);
+    }
+    writer.commit();
+    host_flash_get_stats(&flash_after);
+    printf("  read             : %llu records, %llu lost to wrap, %llu corrupt, %llu out of order, "
+           "%.2f us/record host CPU, %.1f ms flash busy\n",
+           (unsigned long long)verifier.records, (unsigned long long)verifier.lost,
+           (unsigned long long)verifier.corrupt, (unsigned long long)verifier.out_of_order,
+           verifier.records ? wallUs(start) / verifier.records : 0.0,
+           (flash_after.busy_us - flash_before.busy_us) / 1000.0);
+
+    // ---- Power loss and recovery ----
+    Verifier recovered = {};
+    recovered.next = seq;
+    uint32_t committed_next = seq;      // Sequence number the committed cursor points at
+    uint64_t resume_errors = 0;
+    double mount_wall_sum = 0, mount_wall_max = 0;
+    int64_t mount_flash_sum = 0, mount_flash_max = 0;
+
+    for (uint32_t cycle = 0; cycle < config.cycles; cycle++) {
+        host_flash_power_on();
+        FlashLog log(FLASH_LOG_PARTITION_LABEL, config.compress);
+        host_flash_get_stats(&flash_before);
+        start = std::chrono::steady_clock::now();
+        if (log.mount() != ESP_OK) {
+            fprintf(stderr, "remount failed\n");
+            return 1;
+        }
+        double mount_wall = wallUs(start);
+        host_flash_get_stats(&flash_after);
+        int64_t mount_flash = flash_after.busy_us - flash_before.busy_us;
+        mount_wall_sum += mount_wall;
+        mount_flash_sum += mount_flash;
+        mount_wall_max = mount_wall > mount_wall_max ? mount_wall : mount_wall_max;
+        mount_flash_max = mount_flash > mount_flash_max ? mount_flash : mount_flash_max;
+
+        // The stream must resume exactly at the committed cursor, or after it
+        // when the records there never made it to flash
+        n = log.read(batch, 1);
+        if (n > 0) {
+            uint32_t first = (uint16_t)batch[0].values[0] | ((uint32_t)(uint16_t)batch[0].values[1] << 16);
+            if (first < committed_next) {
+                resume_errors++;
+            }
+            recovered.next = committed_next;
+            verify(&recovered, batch, 1);
+        }
+
+        // Read and commit part of the backlog, read some more without committing
+        uint32_t to_commit = std::uniform_int_distribution<uint32_t>(0, 1000)(rng);
+        for (uint32_t i = 0; i < to_commit && (n = log.read(batch, 1)) > 0; i++) {
+            verify(&recovered, batch, n);
+        }
+        if (log.commit() == ESP_OK) {
+            committed_next = recovered.next;
+        }
+        uint32_t uncommitted = std::uniform_int_distribution<uint32_t>(0, 50)(rng);
+        for (uint32_t i = 0; i < uncommitted && (n = log.read(batch, 1)) > 0; i++) {
+            verify(&recovered, batch, n);
+        }
+
+        // Append until the power goes, somewhere in the next few blocks or an erase
+        host_flash_power_loss_after(std::uniform_int_distribution<int64_t>(0, 12000)(rng));
+        while (host_flash_is_powered()) {
+            for (uint32_t i = 0; i < config.batch; i++) {
+                makeRecord(&batch[i], seq++);
+            }
+            log.append(batch, config.batch);
+            if (std::uniform_int_distribution<int>(0, 9)(rng) == 0) {
+                log.flush();
+            }
+        }
+        // Records the reader re-reads after the restart are expected again
+        recovered.next = committed_next;
+    }
+    host_flash_power_on();
+
+    printf("  power loss       : %u cuts, remount mean %.1f us max %.1f us host CPU, "
+           "mean %.2f ms max %.2f ms flash reads\n",
+           (unsigned)config.cycles, config.cycles ? mount_wall_sum / config.cycles : 0.0, mount_wall_max,
+           config.cycles ? mount_flash_sum / 1000.0 / config.cycles : 0.0, mount_flash_max / 1000.0);
+    printf("  recovered        : %llu records checked, %llu corrupt, %llu out of order, %llu resumed before the "
+           "committed cursor, %llu lost (%.1f per cut, longest gap %llu)\n",
+           (unsigned long long)recovered.records, (unsigned long long)recovered.corrupt,
+           (unsigned long long)recovered.out_of_order, (unsigned long long)resume_errors,
+           (unsigned long long)recovered.lost, config.cycles ? (double)recovered.lost / config.cycles : 0.0,
+           (unsigned long long)recovered.max_jump);
+    return recovered.corrupt == 0 && recovered.out_of_order == 0 && resume_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+/**
+ * @file pipeline_bench.cpp
+ * @brief End-to-end benchmark of the gateway pipeline on the host HAL.
+ *
+ * Runs the unmodified app_main (Wi-Fi, Modbus polling, LED and the queue
+ * consumer) against simulated slaves for a fixed stretch of simulated time
+ * and reports throughput, poll cycle time, sensor ring occupancy, the lag
+ * of each ring reader and the batching of the consumer stage. At the end the
+ * register shadow is read while the poller keeps storing into it, to show
+ * the cost of a read served without the bus.
+ *
+ * Usage: pipeline_bench [--duration S] [--time-scale X] [--slaves N]
+ *                       [--offline ADDR] [--turnaround-us US] [--console-baud B]
+ *                       [--serial DEVICE] [--flash-image PATH] [--rtc-drift-ppm P]
+ *                       [--no-sqw] [--verbose]
+ *
+ * With --serial the Modbus port talks RTU to a real serial device, normally
+ * the pty of tools/mb_slave_sim, instead of the in-process slaves. The time
+ * scale is forced to 1.0 in that mode. A GATEWAY_MB_NATIVE_RTU build without
+ * --serial polls two segments, UART1 and UART2 each backed by an in-process
+ * RS-485 line with all the slaves; the bus line then adds up both lines.
+ *
+ * The simulated DS3231 drives its SQW output onto GPIO4 (RTC_SQW_GPIO in
+ * main.cpp) unless --no-sqw is given, and can run off esp_timer by a drift.
+ *
+ * The sensor log partition is kept in memory, or in an image file given with
+ * --flash-image so that the backlog survives from one run to the next. The
+ * MQTT uplink forwards new records live and the backlog behind them to the
+ * in-process broker (20 ms round trip, 1 Mbit/s).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "host_hal.h"
+#include "SensorPipeline.h"
+#include "SensorLogSink.h"
+#include "FlashLog.h"
+#include "MqttUplink.h"
+#include "SensorRollup.h"
+#include "ModbusDeadband.h"
+#include "ModbusShadow.h"
+#include "ModbusReadPlan.h"
+#include "Modbus.h"
+
+extern "C" void app_main(void);
+extern SensorRing sensorRing;
+extern SensorPipeline sensorPipeline;
+extern SensorLogSink sensorLogSink;
+extern FlashLog flashLog;
+extern MqttUplink mqttUplink;
+extern SensorRollup sensorRollup;
+extern ModbusDeadband modbusDeadband;
+extern ModbusShadow modbusShadow;
+
+// Size of the "sensorlog" partition in partitions.csv
+#define SENSOR_LOG_PARTITION_SIZE (1024 * 1024)
+
+struct BenchConfig {
+    double duration_s = 60.0;
+    double time_scale = 0.05;
+    int slaves = 3;
+    int offline[16];
+    int num_offline = 0;
+    uint32_t turnaround_us = 1000;
+    uint32_t console_baud = 115200;
+    const char* serial = NULL;
+    const char* flash_image = NULL;
+    double rtc_drift_ppm = 0.0;
+    bool sqw = true;
+    bool verbose = false;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--duration S] [--time-scale X] [--slaves N] [--offline ADDR]...\n"
+            "          [--turnaround-us US] [--console-baud B] [--serial DEVICE]\n"
+            "          [--flash-image PATH] [--rtc-drift-ppm P] [--no-sqw] [--verbose]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--duration") == 0 && has_value) {
+            config.duration_s = atof(argv[++i]);
+        } else if (strcmp(arg, "--time-scale") == 0 && has_value) {
+            config.time_scale = atof(argv[++i]);
+        } else if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--offline") == 0 && has_value && config.num_offline < 16) {
+            config.offline[config.num_offline++] = atoi(argv[++i]);
+        } else if (strcmp(arg, "--turnaround-us") == 0 && has_value) {
+            config.turnaround_us = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--console-baud") == 0 && has_value) {
+            config.console_baud = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--serial") == 0 && has_value) {
+            config.serial = argv[++i];
+        } else if (strcmp(arg, "--flash-image") == 0 && has_value) {
+            config.flash_image = argv[++i];
+        } else if (strcmp(arg, "--rtc-drift-ppm") == 0 && has_value) {
+            config.rtc_drift_ppm = atof(argv[++i]);
+        } else if (strcmp(arg, "--no-sqw") == 0) {
+            config.sqw = false;
+        } else if (strcmp(arg, "--verbose") == 0) {
+            config.verbose = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.serial != NULL) {
+        config.time_scale = 1.0;
+    }
+    if (config.duration_s <= 0 || config.time_scale <= 0 || config.slaves < 1 || config.slaves > 247) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static double perSecond(uint64_t count, double seconds) {
+    return seconds > 0 ? (double)count / seconds : 0.0;
+}
+
+static double meanMs(int64_t sum_us, uint64_t count) {
+    return count ? (double)sum_us / (double)count / 1000.0 : 0.0;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+
+    host_set_time_scale(config.time_scale);
+    host_log_set_console(config.verbose ? stdout : NULL, config.console_baud);
+    host_mb_set_turnaround_us(config.turnaround_us);
+    host_ds3231_set_drift_ppm(config.rtc_drift_ppm);
+    if (!host_flash_add_partition(FLASH_LOG_PARTITION_LABEL, ESP_PARTITION_SUBTYPE_ANY, SENSOR_LOG_PARTITION_SIZE,
+                                  config.flash_image)) {
+        fprintf(stderr, "cannot create the sensorlog partition\n");
+        return 1;
+    }
+    if (config.sqw) {
+        host_ds3231_set_sqw_pin(GPIO_NUM_4);
+    }
+    if (config.serial != NULL) {
+        if (!host_uart_attach(UART_NUM_1, config.serial, 115200)) {
+            fprintf(stderr, "cannot open %s\n", config.serial);
+            return 1;
+        }
+    } else {
+#if MB_BUS_NATIVE_RTU
+        for (uart_port_t port : {UART_NUM_1, UART_NUM_2}) {
+            host_uart_attach_slaves(port, 1, (uint8_t)config.slaves, 115200, config.turnaround_us);
+            for (int i = 0; i < config.num_offline; i++) {
+                host_uart_line_set_online(port, (uint8_t)config.offline[i], false);
+            }
+        }
+#else
+        for (int addr = 1; addr <= config.slaves; addr++) {
+            host_mb_slave_add((uint8_t)addr);
+        }
+        for (int i = 0; i < config.num_offline; i++) {
+            host_mb_slave_set_online((uint8_t)config.offline[i], false);
+        }
+#endif
+    }
+
+    // app_main starts the tasks and returns
+    std::thread(app_main).detach();
+    host_sleep_us((int64_t)(config.duration_s * 1e6));
+
+    fanout_ring_stats_t ring;
+    sensorRing.getStats(&ring);
+    fanout_reader_stats_t stage_reader = {};
+    sensorRing.getReaderStats(sensorPipeline.getReader(), &stage_reader);
+    fanout_reader_stats_t log_reader = {};
+    if (sensorLogSink.getReader() >= 0) {
+        sensorRing.getReaderStats(sensorLogSink.getReader(), &log_reader);
+    }
+    sensor_pipeline_stats_t stage;
+    sensorPipeline.getStats(&stage);
+    flash_log_stats_t log;
+    flashLog.getStats(&log);
+    host_flash_stats_t flash;
+    host_flash_get_stats(&flash);
+    mqtt_uplink_stats_t uplink;
+    mqttUplink.getStats(&uplink);
+    sensor_rollup_stats_t rollup;
+    sensorRollup.getStats(&rollup);
+    mb_deadband_stats_t deadband;
+    modbusDeadband.getStats(&deadband);
+    host_mqtt_stats_t mqtt;
+    host_mqtt_get_stats(&mqtt);
+    host_mb_stats_t bus;
+    host_mb_get_stats(&bus);
+#if MB_BUS_NATIVE_RTU
+    for (uart_port_t port : {UART_NUM_1, UART_NUM_2}) {
+        host_uart_line_stats_t line;
+        if (config.serial == NULL && host_uart_get_line_stats(port, &line)) {
+            bus.transactions += line.transactions;
+            bus.failures += line.timeouts;
+            bus.timeouts += line.timeouts;
+            bus.busy_us += line.busy_us;
+        }
+    }
+#endif
+    host_i2c_stats_t i2c;
+    host_i2c_get_stats(&i2c);
+    host_log_stats_t console;
+    host_log_get_stats(&console);
+
+    // Shadow reads of the name of slave 1 with a TTL of two poll periods, real host time
+    const mb_parameter_descriptor_t& param = climate_sensor_params[CLIMATE_PARAM_NAME];
+    const uint8_t shadow_slave = MB_DEVICE_ADDR1;
+    const int shadow_reads = 200000;
+    uint16_t shadow_regs[MB_PLAN_MAX_REGISTERS];
+    int shadow_served = 0;
+    auto shadow_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < shadow_reads; i++) {
+        shadow_served += modbusShadow.read(shadow_slave, param.mb_param_type, param.mb_reg_start,
+                                           param.mb_size, shadow_regs, 2000) == ESP_OK;
+    }
+    double shadow_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() -
+                                                                shadow_start).count() / shadow_reads;
+    mb_shadow_stats_t shadow;
+    modbusShadow.getStats(&shadow);
+
+    double seconds = config.duration_s;
+    if (config.serial != NULL) {
+        printf("pipeline_bench: %.1f s on %s\n", seconds, config.serial);
+    } else {
+        printf("pipeline_bench: %.1f s simulated (time scale %.3f), %d slaves, %d offline\n",
+               seconds, config.time_scale, config.slaves, config.num_offline);
+    }
+    printf("  records          : produced %llu, consumed %llu, dropped %llu\n",
+           (unsigned long long)ring.published, (unsigned long long)stage_reader.consumed,
+           (unsigned long long)ring.full);
+    printf("  deadband         : %u records reported (%u heartbeats, %u status changes), %u suppressed\n",
+           (unsigned)deadband.reported, (unsigned)deadband.heartbeats, (unsigned)deadband.status_changes,
+           (unsigned)deadband.suppressed);
+    printf("  throughput       : %.2f records/s\n", perSecond(stage_reader.consumed, seconds));
+    printf("  poll cycle       : mean %.1f ms, max %.1f ms over %llu cycles\n",
+           meanMs(bus.cycle_sum_us, bus.cycles), bus.cycle_max_us / 1000.0, (unsigned long long)bus.cycles);
+    printf("  bus              : %llu transactions (%.1f/s), %llu failed, %llu timeouts, %llu crc, %.1f%% busy\n",
+           (unsigned long long)bus.transactions, perSecond(bus.transactions, seconds),
+           (unsigned long long)bus.failures, (unsigned long long)bus.timeouts, (unsigned long long)bus.crc_errors,
+           100.0 * (double)bus.busy_us / (seconds * 1e6));
+    printf("  sensor ring      : high water %u of %u (%u-byte records, %u bytes), %u readers\n",
+           (unsigned)ring.high_water, (unsigned)sensorRing.capacity(), (unsigned)sizeof(SensorRecord),
+           (unsigned)sizeof(sensorRing), (unsigned)sensorRing.getReaderCount());
+    printf("  ring readers     : stage lag %u (max %u), %u wakeups; log lag %u (max %u), %u wakeups, "
+           "%u not logged\n",
+           (unsigned)stage_reader.lag, (unsigned)stage_reader.max_lag, (unsigned)stage_reader.wakeups,
+           (unsigned)log_reader.lag, (unsigned)log_reader.max_lag, (unsigned)log_reader.wakeups,
+           (unsigned)log_reader.overruns);
+    printf("  register shadow  : %u registers in %u blocks, %u stored, %u failed; %d of %d reads served, "
+           "%.0f ns/read, %u retries\n",
+           (unsigned)shadow.registers, (unsigned)shadow.regions, (unsigned)shadow.updates, (unsigned)shadow.failures,
+           shadow_served, shadow_reads, shadow_ns, (unsigned)shadow.retries);
+    printf("  consumer stage   : %u wakeups, %u batches, mean %.2f max %u records per batch\n",
+           (unsigned)stage.wakeups, (unsigned)stage.batches,
+           stage.batches ? (double)stage.records / (double)stage.batches : 0.0,
+           (unsigned)stage.max_batch);
+    printf("  rollup           : %u records in, %u windows closed, %u rollups and %u raw records out\n",
+           (unsigned)rollup.records_in, (unsigned)rollup.windows, (unsigned)rollup.records_out,
+           (unsigned)rollup.records_raw);
+    printf("  flash log        : %u records appended, %u blocks written, %u erases, %u blocks unread, "
+           "%.1f ms flash busy\n",
+           (unsigned)log.records_appended, (unsigned)log.blocks_written, (unsigned)log.sectors_erased,
+           (unsigned)flashLog.getBacklogBlocks(), flash.busy_us / 1000.0);
+    printf("  mqtt uplink      : %u messages, %u records acknowledged (%u sent live, %u skipped in the log), "
+           "%.1f wire bytes/record, PUBACK mean %.1f ms\n",
+           (unsigned)uplink.messages, (unsigned)uplink.records_acked, (unsigned)uplink.records_live,
+           (unsigned)uplink.records_skipped,
+           uplink.records_sent ? (double)mqtt.wire_bytes / uplink.records_sent : 0.0,
+           uplink.acks ? uplink.ack_latency_sum_us / 1000.0 / uplink.acks : 0.0);
+    printf("  controller setup : %llu mbc_master_init calls\n", (unsigned long long)bus.controller_inits);
+    printf("  i2c              : %llu transactions, %.1f ms busy\n",
+           (unsigned long long)i2c.transactions, i2c.busy_us / 1000.0);
+    printf("  console          : %llu lines, %llu bytes, %.1f ms busy\n",
+           (unsigned long long)console.lines, (unsigned long long)console.bytes, console.busy_us / 1000.0);
+    fflush(stdout);
+
+    // The gateway tasks loop forever, leave without unwinding them
+    _exit(0);
+}
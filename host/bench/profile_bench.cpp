@@ -0,0 +1,312 @@
+/**
+ * @file profile_bench.cpp
+ * @brief Device profiles against one descriptor table with an entry per slave and parameter.
+ *
+ * A full bus of 247 slaves is configured as device profiles: three climate
+ * sensors out of four and an energy meter type (local to the bench, 30 floats)
+ * for every fourth address. The same slaves are also expanded into the flat
+ * descriptor and deadband tables the gateway used to compile in, one entry per
+ * slave and parameter with its own CID and address.
+ *
+ * Reported are the bytes each layout takes, the time to resolve a CID to its
+ * descriptor and slave (profiles: bisect over the slaves; flat: the linear
+ * scan of mbc_master_get_cid_info, and a direct index for reference) and a
+ * slave and parameter to its CID, and the read plans built from both, which
+ * must have the same blocks. The profile blob then goes through NVS and back,
+ * and a blob with a flipped bit, another version or a period of 0 must be
+ * refused. Times are real host time.
+ *
+ * Usage: profile_bench [--slaves N] [--lookups N]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "host_hal.h"
+#include "nvs_flash.h"
+#include "Modbus.h"
+#include "ModbusDeadband.h"
+#include "ModbusProfiles.h"
+#include "ModbusReadPlan.h"
+
+#define DEVICE_TYPE_METER   2
+#define METER_PARAMS        30
+
+struct BenchConfig {
+    int slaves = MB_PROFILE_MAX_SLAVE_ADDR;
+    int lookups = 1000000;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--slaves N] [--lookups N]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--lookups") == 0 && has_value) {
+            config.lookups = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.slaves < 1 || config.slaves > MB_PROFILE_MAX_SLAVE_ADDR || config.lookups < 1) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static mb_parameter_descriptor_t meter_params[METER_PARAMS];
+static mb_deadband_t meter_deadbands[METER_PARAMS];
+
+// The climate sensor of the firmware and a meter of 30 floats at registers 0..59
+static std::vector<mb_device_type_t> buildTypes() {
+    for (uint16_t i = 0; i < METER_PARAMS; i++) {
+        meter_params[i] = { i, STR("Meter value"), STR("--"), 0, MB_PARAM_HOLDING, (uint16_t)(2 * i), 2,
+                            0, PARAM_TYPE_FLOAT, PARAM_SIZE_FLOAT, OPTS( 0, 0, 0 ), PAR_PERMS_READ };
+        meter_deadbands[i] = DEADBAND(i, 0.1f, 0.5f, 300000);
+    }
+    std::vector<mb_device_type_t> types(device_types, device_types + num_device_types);
+    types.push_back({ DEVICE_TYPE_METER, "meter", meter_params, METER_PARAMS, meter_deadbands, METER_PARAMS });
+    return types;
+}
+
+// Addresses 1..slaves, every fourth one a meter, listed in reverse to exercise the sort
+static std::vector<mb_profile_slave_t> buildSlaves(int slaves) {
+    std::vector<mb_profile_slave_t> config;
+    for (int addr = slaves; addr >= 1; addr--) {
+        uint8_t type = addr % 4 == 0 ? DEVICE_TYPE_METER : DEVICE_TYPE_CLIMATE;
+        config.push_back({ (uint8_t)addr, type, (uint8_t)(addr % 2), 1, 1000, 100 });
+    }
+    return config;
+}
+
+// The tables of the old layout, expanded from the profiles
+static void expand(const ModbusProfiles& profiles, std::vector<mb_parameter_descriptor_t>* params,
+                   std::vector<mb_deadband_t>* deadbands) {
+    for (size_t i = 0; i < profiles.getNumSlaves(); i++) {
+        uint8_t slave_addr = profiles.getSlave(i).slave_addr;
+        const mb_device_type_t* type = profiles.getType(slave_addr);
+        for (uint8_t p = 0; p < type->num_params; p++) {
+            mb_parameter_descriptor_t param = type->params[p];
+            param.cid = (uint16_t)params->size();
+            param.mb_slave_addr = slave_addr;
+            params->push_back(param);
+        }
+        for (uint8_t d = 0; d < type->num_deadbands; d++) {
+            mb_deadband_t deadband = type->deadbands[d];
+            deadband.cid = profiles.getCid(slave_addr, (uint8_t)deadband.cid);
+            deadbands->push_back(deadband);
+        }
+    }
+}
+
+// What mbc_master_get_cid_info does with the table
+__attribute__((noinline)) static const mb_parameter_descriptor_t* scanCid(
+        const std::vector<mb_parameter_descriptor_t>& params, uint16_t cid) {
+    for (const mb_parameter_descriptor_t& param : params) {
+        if (param.cid == cid) {
+            return &param;
+        }
+    }
+    return nullptr;
+}
+
+// First CID of a slave in the table, then its parameter
+__attribute__((noinline)) static uint16_t scanSlave(const std::vector<mb_parameter_descriptor_t>& params,
+                                                    uint8_t slave_addr, uint8_t param) {
+    for (size_t i = 0; i < params.size(); i++) {
+        if (params[i].mb_slave_addr == slave_addr) {
+            return params[i + param].cid;
+        }
+    }
+    return MB_PROFILE_NO_CID;
+}
+
+static bool samePlans(const ModbusReadPlan& a, const ModbusReadPlan& b) {
+    if (a.getNumBlocks() != b.getNumBlocks() || a.getNumParams() != b.getNumParams()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.getNumBlocks(); i++) {
+        const ModbusReadBlock& x = a.getBlock(i);
+        const ModbusReadBlock& y = b.getBlock(i);
+        if (x.slave_addr != y.slave_addr || x.param_type != y.param_type || x.reg_start != y.reg_start ||
+            x.reg_size != y.reg_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Blob through NVS and back, then the two corrupt ones
+static bool runNvs(const std::vector<mb_device_type_t>& types, const std::vector<mb_profile_slave_t>& slaves,
+                   const ModbusProfiles& expected) {
+    std::vector<uint8_t> blob(MB_PROFILE_BLOB_SIZE(slaves.size()));
+    size_t size = ModbusProfiles::serialize(slaves.data(), slaves.size(), blob.data(), blob.size());
+    nvs_handle_t handle;
+    if (size == 0 || nvs_flash_init() != ESP_OK ||
+        nvs_open(MB_PROFILE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        fprintf(stderr, "cannot store the profile blob\n");
+        return false;
+    }
+    esp_err_t stored = nvs_set_blob(handle, MB_PROFILE_NVS_KEY, blob.data(), size);
+    nvs_commit(handle);
+    nvs_close(handle);
+
+    ModbusProfiles loaded(types.data(), types.size());
+    esp_err_t err = stored == ESP_OK ? loaded.loadFromNvs(MB_PROFILE_NVS_NAMESPACE, MB_PROFILE_NVS_KEY) : stored;
+    bool same = err == ESP_OK && loaded.getNumSlaves() == expected.getNumSlaves() &&
+                loaded.getNumCids() == expected.getNumCids();
+    for (size_t i = 0; same && i < expected.getNumSlaves(); i++) {
+        same = memcmp(&loaded.getSlave(i), &expected.getSlave(i), sizeof(mb_profile_slave_t)) == 0;
+    }
+
+    std::vector<uint8_t> corrupt(blob.begin(), blob.begin() + size);
+    corrupt[MB_PROFILE_BLOB_HEADER + 5] ^= 0x10;
+    esp_err_t crc_err = loaded.load(corrupt.data(), corrupt.size());
+    corrupt = std::vector<uint8_t>(blob.begin(), blob.begin() + size);
+    corrupt[4] = MB_PROFILE_BLOB_VERSION + 1;
+    esp_err_t version_err = loaded.load(corrupt.data(), corrupt.size());
+
+    // Intact blob, but a slave that could not be scheduled
+    std::vector<mb_profile_slave_t> unschedulable(slaves);
+    unschedulable[0].period_ms = 0;
+    ModbusProfiles::serialize(unschedulable.data(), unschedulable.size(), blob.data(), blob.size());
+    esp_err_t period_err = loaded.load(blob.data(), size);
+
+    printf("  nvs          : %zu-byte blob stored and loaded (%s), %s; flipped bit %s, version %d %s, "
+           "period 0 %s\n", size, esp_err_to_name(err), same ? "same slaves" : "MISMATCH", esp_err_to_name(crc_err),
+           MB_PROFILE_BLOB_VERSION + 1, esp_err_to_name(version_err), esp_err_to_name(period_err));
+    return same && crc_err == ESP_ERR_INVALID_CRC && version_err == ESP_ERR_INVALID_VERSION &&
+           period_err == ESP_ERR_INVALID_ARG;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_log_set_console(NULL, 0);
+
+    std::vector<mb_device_type_t> types = buildTypes();
+    std::vector<mb_profile_slave_t> slaves = buildSlaves(config.slaves);
+    ModbusProfiles profiles(types.data(), types.size());
+    if (profiles.setSlaves(slaves.data(), slaves.size()) != ESP_OK) {
+        fprintf(stderr, "profiles rejected\n");
+        return 1;
+    }
+    std::vector<mb_parameter_descriptor_t> params;
+    std::vector<mb_deadband_t> deadbands;
+    expand(profiles, &params, &deadbands);
+
+    // Memory: type tables once plus the profiles, against an entry per slave and parameter
+    size_t type_bytes = 0;
+    for (const mb_device_type_t& type : types) {
+        type_bytes += sizeof(type) + type.num_params * sizeof(mb_parameter_descriptor_t) +
+                      type.num_deadbands * sizeof(mb_deadband_t);
+    }
+    size_t profile_bytes = profiles.getMemoryUsage();
+    size_t flat_bytes = params.size() * sizeof(mb_parameter_descriptor_t) + deadbands.size() * sizeof(mb_deadband_t);
+
+    // Random CIDs and random slave and parameter pairs, the same for every method
+    std::mt19937 rng(2474);
+    std::vector<uint16_t> cids(config.lookups);
+    std::vector<uint8_t> addrs(config.lookups);
+    std::vector<uint8_t> indexes(config.lookups);
+    for (int i = 0; i < config.lookups; i++) {
+        cids[i] = (uint16_t)(rng() % params.size());
+        addrs[i] = (uint8_t)(1 + rng() % config.slaves);
+        indexes[i] = (uint8_t)(rng() % profiles.getType(addrs[i])->num_params);
+    }
+
+    // Every method must agree before anything is timed
+    size_t mismatches = 0;
+    for (int i = 0; i < config.lookups; i++) {
+        uint8_t slave_addr = 0;
+        const mb_parameter_descriptor_t* shared = profiles.findCid(cids[i], &slave_addr);
+        const mb_parameter_descriptor_t* flat = scanCid(params, cids[i]);
+        mismatches += shared == nullptr || flat == nullptr || slave_addr != flat->mb_slave_addr ||
+                      shared->mb_reg_start != flat->mb_reg_start || shared->mb_size != flat->mb_size;
+        mismatches += profiles.getCid(addrs[i], indexes[i]) != scanSlave(params, addrs[i], indexes[i]);
+    }
+
+    uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < config.lookups; i++) {
+        uint8_t slave_addr;
+        sink += profiles.findCid(cids[i], &slave_addr)->mb_reg_start + slave_addr;
+    }
+    double find_ns = elapsedNs(start) / config.lookups;
+
+    int scans = std::max(1, config.lookups / 100);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < scans; i++) {
+        const mb_parameter_descriptor_t* param = scanCid(params, cids[i]);
+        sink += param->mb_reg_start + param->mb_slave_addr;
+    }
+    double scan_ns = elapsedNs(start) / scans;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < config.lookups; i++) {
+        const mb_parameter_descriptor_t& param = params[cids[i]];
+        sink += param.mb_reg_start + param.mb_slave_addr;
+        asm volatile("" : : "r"(&param) : "memory");
+    }
+    double index_ns = elapsedNs(start) / config.lookups;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < config.lookups; i++) {
+        sink += profiles.getCid(addrs[i], indexes[i]);
+    }
+    double get_ns = elapsedNs(start) / config.lookups;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < scans; i++) {
+        sink += scanSlave(params, addrs[i], indexes[i]);
+    }
+    double slave_scan_ns = elapsedNs(start) / scans;
+    asm volatile("" : : "r"(sink));
+
+    // Read plans and deadbands from both layouts
+    ModbusReadPlan flat_plan;
+    ModbusReadPlan profile_plan;
+    start = std::chrono::steady_clock::now();
+    bool flat_built = flat_plan.build(params.data(), (uint16_t)params.size());
+    double flat_build_us = elapsedNs(start) / 1000.0;
+    start = std::chrono::steady_clock::now();
+    bool profile_built = profile_plan.build(profiles);
+    double profile_build_us = elapsedNs(start) / 1000.0;
+    bool plans_match = flat_built && profile_built && samePlans(flat_plan, profile_plan);
+    ModbusDeadband deadband;
+    bool deadbands_ok = deadband.init(profiles);
+
+    printf("profile_bench: %zu slaves (%zu climate, %zu meter), %u CIDs, %d lookups\n", profiles.getNumSlaves(),
+           profiles.getNumSlaves() - config.slaves / 4, (size_t)(config.slaves / 4), (unsigned)profiles.getNumCids(),
+           config.lookups);
+    printf("  memory       : flat tables %zu bytes (%zu descriptors of %zu, %zu deadbands); "
+           "profiles %zu + type tables %zu = %zu bytes, %.1fx smaller; blob %zu bytes\n",
+           flat_bytes, params.size(), sizeof(mb_parameter_descriptor_t), deadbands.size(), profile_bytes, type_bytes,
+           profile_bytes + type_bytes, (double)flat_bytes / (profile_bytes + type_bytes),
+           (size_t)MB_PROFILE_BLOB_SIZE(slaves.size()));
+    printf("  cid lookup   : profiles %.1f ns, table scan %.1f ns, table index %.1f ns\n", find_ns, scan_ns,
+           index_ns);
+    printf("  slave lookup : profiles %.1f ns, table scan %.1f ns\n", get_ns, slave_scan_ns);
+    printf("  read plan    : %zu blocks, %zu CIDs from the table in %.0f us, from the profiles in %.0f us, %s\n",
+           profile_plan.getNumBlocks(), profile_plan.getNumParams(), flat_build_us, profile_build_us,
+           plans_match ? "same blocks" : "MISMATCH");
+    printf("  deadbands    : %s, %zu mismatched lookups\n", deadbands_ok ? "mapped to every slave" : "REJECTED",
+           mismatches);
+    bool ok = runNvs(types, slaves, profiles);
+    return ok && plans_match && deadbands_ok && mismatches == 0 ? 0 : 1;
+}
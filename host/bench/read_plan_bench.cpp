@@ -0,0 +1,155 @@
+/**
+ * @file read_plan_bench.cpp
+ * @brief Bus cost of reading a descriptor table per CID versus through ModbusReadPlan.
+ *
+ * Builds an energy-meter style descriptor table (24 float tags per slave in two
+ * register groups, with small holes between some tags) and reads it over the
+ * simulated bus three ways: one request per CID, a plan without gap fill and a
+ * plan with the given gap fill. Reports requests and simulated bus time per
+ * poll cycle.
+ *
+ * Usage: read_plan_bench [--slaves N] [--cycles N] [--gap G] [--time-scale X]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "host_hal.h"
+#include "Modbus.h"
+#include "ModbusBus.h"
+#include "ModbusReadPlan.h"
+
+#define TAGS_PER_SLAVE 24
+
+struct BenchConfig {
+    int slaves = 3;
+    int cycles = 20;
+    uint16_t gap = MB_PLAN_DEFAULT_GAP;
+    double time_scale = 0.02;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--slaves N] [--cycles N] [--gap G] [--time-scale X]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--cycles") == 0 && has_value) {
+            config.cycles = atoi(argv[++i]);
+        } else if (strcmp(arg, "--gap") == 0 && has_value) {
+            config.gap = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--time-scale") == 0 && has_value) {
+            config.time_scale = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.slaves < 1 || config.slaves > 247 || config.cycles < 1 || config.time_scale <= 0) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+// Voltages, currents and powers from register 0, energy counters from 100,
+// with a reserved register after every fourth tag
+static std::vector<mb_parameter_descriptor_t> meterTable(int slaves) {
+    std::vector<mb_parameter_descriptor_t> table;
+    uint16_t cid = 0;
+    for (int slave = 1; slave <= slaves; slave++) {
+        for (int tag = 0; tag < TAGS_PER_SLAVE; tag++) {
+            int group = tag < 16 ? 0 : 1;
+            int index = group == 0 ? tag : tag - 16;
+            uint16_t reg = (uint16_t)(group * 100 + index * 2 + index / 4);
+            mb_parameter_descriptor_t param = {};
+            param.cid = cid++;
+            param.param_key = "tag";
+            param.param_units = "";
+            param.mb_slave_addr = (uint8_t)slave;
+            param.mb_param_type = MB_PARAM_HOLDING;
+            param.mb_reg_start = reg;
+            param.mb_size = 2;
+            param.param_type = PARAM_TYPE_FLOAT;
+            param.param_size = PARAM_SIZE_FLOAT;
+            param.access = PAR_PERMS_READ;
+            table.push_back(param);
+        }
+    }
+    return table;
+}
+
+struct Result {
+    uint64_t requests;
+    int64_t bus_us;
+};
+
+static Result measure(ModbusBus* bus, const std::vector<mb_parameter_descriptor_t>& table,
+                      ModbusReadPlan* plan, int slaves, int cycles) {
+    host_mb_stats_t before;
+    host_mb_get_stats(&before);
+    uint16_t regs[MB_PLAN_MAX_REGISTERS];
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        if (plan != nullptr) {
+            for (int slave = 1; slave <= slaves; slave++) {
+                plan->readSlave(bus, (uint8_t)slave);
+            }
+        } else {
+            for (const mb_parameter_descriptor_t& param : table) {
+                bus->transact(param.mb_slave_addr, MB_FUNC_READ_HOLDING_REGISTER, param.mb_reg_start,
+                              param.mb_size, regs);
+            }
+        }
+    }
+    host_mb_stats_t after;
+    host_mb_get_stats(&after);
+    return Result{after.transactions - before.transactions, after.busy_us - before.busy_us};
+}
+
+static void report(const char* label, const Result& result, int cycles) {
+    printf("  %-18s: %6.1f requests/cycle, %8.2f ms bus time/cycle\n", label,
+           (double)result.requests / cycles, (double)result.bus_us / cycles / 1000.0);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+
+    host_set_time_scale(config.time_scale);
+    host_log_set_console(NULL, 115200);
+    for (int addr = 1; addr <= config.slaves; addr++) {
+        host_mb_slave_add((uint8_t)addr);
+    }
+
+    ModbusBus bus(UART_NUM_1, 115200, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
+    if (!bus.init()) {
+        fprintf(stderr, "bus initialization failed\n");
+        return 1;
+    }
+
+    std::vector<mb_parameter_descriptor_t> table = meterTable(config.slaves);
+    ModbusReadPlan tight(0);
+    ModbusReadPlan filled(config.gap);
+    if (!tight.build(table.data(), (uint16_t)table.size()) || !filled.build(table.data(), (uint16_t)table.size())) {
+        fprintf(stderr, "plan build failed\n");
+        return 1;
+    }
+
+    printf("read_plan_bench: %d slaves x %d tags, %d cycles at 115200 baud\n",
+           config.slaves, TAGS_PER_SLAVE, config.cycles);
+    report("per CID", measure(&bus, table, nullptr, config.slaves, config.cycles), config.cycles);
+    report("plan, no gap fill", measure(&bus, table, &tight, config.slaves, config.cycles), config.cycles);
+    char label[32];
+    snprintf(label, sizeof(label), "plan, gap fill %u", (unsigned)config.gap);
+    report(label, measure(&bus, table, &filled, config.slaves, config.cycles), config.cycles);
+    fflush(stdout);
+
+    _exit(0);
+}
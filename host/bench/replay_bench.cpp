@@ -0,0 +1,361 @@
+/**
+ * @file replay_bench.cpp
+ * @brief Backlog replay after a long outage, with new records arriving meanwhile.
+ *
+ * Each run fills a fresh flash log partition with the records of an outage
+ * (--offline-h hours at --rate records per second), brings the link up and
+ * keeps producing records at the same rate through a FlashLogSink, as the
+ * pipeline does. Two runs are compared:
+ *
+ *  - live + budget: the uplink is the sink's tap, sends new records live and
+ *    replays the backlog within the bandwidth budget and its PUBACK window
+ *  - backlog only: no tap and no budget, new records queue behind the backlog
+ *
+ * Reported are the latency of the records produced during the run (from their
+ * timestamp to their first arrival at the broker), how long the backlog took,
+ * the link throughput against the budget and the window the uplink settled on.
+ * With --congest-ms the broker holds every PUBACK back that long for a stretch
+ * in the middle of the replay; with --drops the link goes down for two seconds
+ * that many times. The broker counts duplicates and records that never arrive.
+ *
+ * Usage: replay_bench [--offline-h H] [--rate R] [--live-s S] [--budget BYTES_PER_S]
+ *                     [--batch B] [--linger-ms MS] [--in-flight W] [--rtt-ms MS]
+ *                     [--bandwidth-kbps K] [--congest-ms MS] [--drops N] [--time-scale X]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "host_hal.h"
+#include "FlashLog.h"
+#include "FlashLogSink.h"
+#include "MqttUplink.h"
+
+#define BENCH_EPOCH_MS          1717000000000LL
+#define BENCH_RUN_TIMEOUT_US    (4LL * 3600 * 1000 * 1000)
+#define BENCH_DROP_US           (2LL * 1000 * 1000)
+
+struct BenchConfig {
+    double offline_h = 2.0;
+    double rate = 3.0;
+    double live_s = 120.0;
+    uint32_t budget = MQTT_UPLINK_BUDGET;
+    size_t batch = MQTT_UPLINK_BATCH_RECORDS;
+    uint32_t linger_ms = 1000;
+    size_t in_flight = MQTT_UPLINK_MAX_IN_FLIGHT;
+    uint32_t rtt_ms = 50;
+    uint32_t bandwidth_kbps = 1000;
+    uint32_t congest_ms = 0;
+    uint32_t drops = 0;
+    double time_scale = 0.1;
+};
+
+// Broker side: which records arrived, how late the first time, and how often
+struct Receiver {
+    std::mutex mutex;
+    const char* topic = NULL;
+    std::vector<int64_t> latency_ms;
+    std::vector<uint8_t> seen;
+    uint64_t received = 0;
+    uint64_t duplicates = 0;
+    uint64_t bad = 0;
+};
+
+static Receiver s_receiver;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--offline-h H] [--rate R] [--live-s S] [--budget BYTES_PER_S] [--batch B]\n"
+            "          [--linger-ms MS] [--in-flight W] [--rtt-ms MS] [--bandwidth-kbps K]\n"
+            "          [--congest-ms MS] [--drops N] [--time-scale X]\n",
+            prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--offline-h") == 0 && has_value) {
+            config.offline_h = atof(argv[++i]);
+        } else if (strcmp(arg, "--rate") == 0 && has_value) {
+            config.rate = atof(argv[++i]);
+        } else if (strcmp(arg, "--live-s") == 0 && has_value) {
+            config.live_s = atof(argv[++i]);
+        } else if (strcmp(arg, "--budget") == 0 && has_value) {
+            config.budget = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--batch") == 0 && has_value) {
+            config.batch = (size_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--linger-ms") == 0 && has_value) {
+            config.linger_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--in-flight") == 0 && has_value) {
+            config.in_flight = (size_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--rtt-ms") == 0 && has_value) {
+            config.rtt_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--bandwidth-kbps") == 0 && has_value) {
+            config.bandwidth_kbps = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--congest-ms") == 0 && has_value) {
+            config.congest_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--drops") == 0 && has_value) {
+            config.drops = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--time-scale") == 0 && has_value) {
+            config.time_scale = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.offline_h < 0 || config.rate <= 0 || config.live_s <= 0 || config.batch < 1 ||
+        config.batch > MQTT_UPLINK_MAX_BATCH || config.in_flight < 1 ||
+        config.in_flight > MQTT_UPLINK_IN_FLIGHT_LIMIT || config.time_scale <= 0) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static int64_t nowMs() {
+    return BENCH_EPOCH_MS + host_time_us() / 1000;
+}
+
+// The sequence number rides in the first two values, the timestamp is the production time
+static void makeRecord(SensorRecord* record, uint32_t seq, int64_t timestamp_ms) {
+    sensorRecordInit(record, (uint8_t)(1 + seq % 3), SENSOR_TAG_CLIMATE, timestamp_ms);
+    sensorRecordSetValue(record, 0, SENSOR_VALUE_U16, (float)(seq & 0xffff));
+    sensorRecordSetValue(record, 1, SENSOR_VALUE_U16, (float)(seq >> 16));
+    sensorRecordSetValue(record, 2, SENSOR_VALUE_CENTI, 23.0f + (float)(seq % 300) / 100.0f);
+}
+
+static void receive(const char* topic, const uint8_t* data, size_t len, void* arg) {
+    (void)arg;
+    static SensorRecord records[MQTT_UPLINK_MAX_BATCH];
+    std::lock_guard<std::mutex> lock(s_receiver.mutex);
+    if (s_receiver.topic == NULL || strcmp(topic, s_receiver.topic) != 0) {
+        return;
+    }
+    size_t count = sensorPayloadDecode(data, len, records, MQTT_UPLINK_MAX_BATCH);
+    if (count == 0) {
+        s_receiver.bad++;
+        return;
+    }
+    int64_t now = nowMs();
+    for (size_t i = 0; i < count; i++) {
+        uint32_t seq = (uint16_t)records[i].values[0] | ((uint32_t)(uint16_t)records[i].values[1] << 16);
+        if (seq >= s_receiver.seen.size()) {
+            s_receiver.bad++;
+        } else if (s_receiver.seen[seq]++ > 0) {
+            s_receiver.duplicates++;
+        } else {
+            s_receiver.latency_ms[seq] = now - sensorRecordGetTimestamp(&records[i]);
+            s_receiver.received++;
+        }
+    }
+}
+
+static double percentileMs(std::vector<int64_t>& latencies, double p) {
+    if (latencies.empty()) {
+        return 0.0;
+    }
+    size_t at = (size_t)(p * (double)(latencies.size() - 1));
+    std::nth_element(latencies.begin(), latencies.begin() + at, latencies.end());
+    return (double)latencies[at];
+}
+
+static bool runOnce(const BenchConfig& config, int run, const char* name, bool live, uint32_t budget) {
+    uint32_t backlog = (uint32_t)(config.offline_h * 3600 * config.rate);
+    uint32_t produced_max = backlog + (uint32_t)(config.live_s * config.rate) * 4 + 1000;
+
+    // A fresh partition per run, with room for the backlog and what comes in meanwhile
+    char label[16];
+    snprintf(label, sizeof(label), "replay%d", run);
+    uint32_t blocks = produced_max / FLASH_LOG_RECORDS_PER_BLOCK + 1;
+    uint32_t sectors = FLASH_LOG_JOURNAL_SECTORS + 2 + blocks / FLASH_LOG_BLOCKS_PER_SECTOR;
+    if (!host_flash_add_partition(label, ESP_PARTITION_SUBTYPE_ANY, sectors * FLASH_LOG_SECTOR_SIZE, NULL)) {
+        fprintf(stderr, "cannot create partition %s\n", label);
+        return false;
+    }
+    FlashLog* log = new FlashLog(strdup(label));
+    if (log->mount() != ESP_OK) {
+        return false;
+    }
+
+    // The outage: records logged while the link was down
+    host_wifi_set_link(false);
+    int64_t period_ms = (int64_t)(1000.0 / config.rate);
+    int64_t start_ms = nowMs();
+    SensorRecord record;
+    for (uint32_t seq = 0; seq < backlog; seq++) {
+        makeRecord(&record, seq, start_ms - (int64_t)(backlog - seq) * period_ms);
+        log->append(&record, 1);
+    }
+    log->flush();
+
+    char* topic = (char*)malloc(32);
+    snprintf(topic, 32, "paktani/bench/replay%d", run);
+    {
+        std::lock_guard<std::mutex> lock(s_receiver.mutex);
+        s_receiver.topic = topic;
+        s_receiver.latency_ms.assign(produced_max, 0);
+        s_receiver.seen.assign(produced_max, 0);
+        s_receiver.received = 0;
+        s_receiver.duplicates = 0;
+        s_receiver.bad = 0;
+    }
+
+    mqtt_uplink_config_t uplink_config = MQTT_UPLINK_DEFAULT_CONFIG();
+    uplink_config.broker_uri = "mqtt://127.0.0.1";
+    uplink_config.topic = topic;
+    uplink_config.batch_records = config.batch;
+    uplink_config.linger_ms = config.linger_ms;
+    uplink_config.max_in_flight = config.in_flight;
+    uplink_config.budget_bytes_per_s = budget;
+    MqttUplink* uplink = new MqttUplink(log);
+    FlashLogSink* sink = new FlashLogSink(log);
+    if (uplink->init(&uplink_config) != ESP_OK || uplink->start() != ESP_OK) {
+        return false;
+    }
+    if (live) {
+        sink->setTap(uplink);
+    }
+
+    // The producer plays the pipeline's consumer stage
+    std::atomic<bool> producing{true};
+    std::atomic<uint32_t> produced{backlog};
+    std::thread producer([&]() {
+        int64_t next_us = host_time_us();
+        SensorRecord fresh;
+        while (producing) {
+            uint32_t seq = produced;
+            if (seq >= produced_max) {
+                break;
+            }
+            makeRecord(&fresh, seq, nowMs());
+            sink->write(&fresh, 1);
+            produced = seq + 1;
+            next_us += period_ms * 1000;
+            host_sleep_us(next_us - host_time_us());
+        }
+    });
+
+    host_mqtt_stats_t before, at_replay;
+    host_mqtt_get_stats(&before);
+    host_mqtt_set_broker_delay_ms(0);
+    int64_t start_us = host_time_us();
+    host_wifi_set_link(true);
+
+    // Until the backlog is in and live_s have passed, then until the rest is in
+    int64_t replay_done_us = 0;
+    int64_t congest_until_us = 0;
+    bool congested = false;
+    uint32_t drops = 0;
+    uint32_t backlog_seen = 0;
+    int64_t live_until_us = start_us + (int64_t)(config.live_s * 1e6);
+    while (host_time_us() - start_us < BENCH_RUN_TIMEOUT_US) {
+        host_sleep_us(50 * 1000);
+        int64_t now = host_time_us();
+        {
+            std::lock_guard<std::mutex> lock(s_receiver.mutex);
+            while (backlog_seen < backlog && s_receiver.seen[backlog_seen] > 0) {
+                backlog_seen++;
+            }
+        }
+        if (replay_done_us == 0 && backlog_seen == backlog) {
+            replay_done_us = now;
+            host_mqtt_get_stats(&at_replay);
+        }
+        // Congestion a third of the way into the replay, drops spread over it
+        if (config.congest_ms > 0 && !congested && backlog_seen >= backlog / 3) {
+            host_mqtt_set_broker_delay_ms(config.congest_ms);
+            congested = true;
+            congest_until_us = now + 10LL * 1000 * 1000;
+        }
+        if (congested && congest_until_us != 0 && now >= congest_until_us) {
+            host_mqtt_set_broker_delay_ms(0);
+            congest_until_us = 0;
+        }
+        if (drops < config.drops && backlog_seen >= (uint64_t)backlog * (drops + 1) / (config.drops + 2)) {
+            host_wifi_set_link(false);
+            host_sleep_us(BENCH_DROP_US);
+            host_wifi_set_link(true);
+            drops++;
+        }
+        if (producing && replay_done_us != 0 && now >= live_until_us) {
+            producing = false;
+            producer.join();
+        }
+        if (!producing) {
+            std::lock_guard<std::mutex> lock(s_receiver.mutex);
+            if (s_receiver.received >= produced) {
+                break;
+            }
+        }
+    }
+    if (producing) {
+        producing = false;
+        producer.join();
+    }
+    host_mqtt_set_broker_delay_ms(0);
+    mqtt_uplink_stats_t stats;
+    uplink->getStats(&stats);
+
+    uint32_t total = produced;
+    std::vector<int64_t> latencies;
+    uint64_t missing = 0, duplicates, bad;
+    {
+        std::lock_guard<std::mutex> lock(s_receiver.mutex);
+        for (uint32_t seq = 0; seq < total; seq++) {
+            if (s_receiver.seen[seq] == 0) {
+                missing++;
+            } else if (seq >= backlog) {
+                latencies.push_back(s_receiver.latency_ms[seq]);
+            }
+        }
+        duplicates = s_receiver.duplicates;
+        bad = s_receiver.bad;
+        s_receiver.topic = NULL;
+    }
+
+    double replay_s = replay_done_us > 0 ? (double)(replay_done_us - start_us) / 1e6 : 0.0;
+    double link_bytes_per_s = replay_s > 0 ? (double)(at_replay.wire_bytes - before.wire_bytes) / replay_s : 0.0;
+    char share[32] = "";
+    if (budget > 0) {
+        snprintf(share, sizeof(share), " (%.0f%% of budget)", 100.0 * link_bytes_per_s / budget);
+    }
+    printf("  %-13s : backlog in %.1f s (%.0f records/s), link %.0f B/s%s, %u new records: "
+           "latency p50 %.0f ms p99 %.0f ms max %.0f ms\n",
+           name, replay_s, replay_s > 0 ? backlog / replay_s : 0.0, link_bytes_per_s, share,
+           (unsigned)(total - backlog), percentileMs(latencies, 0.5), percentileMs(latencies, 0.99),
+           percentileMs(latencies, 1.0));
+    printf("  %-13s   %u sent live, %u resumed from the log, %u skipped in the log, %u live sessions "
+           "(%u overflowed), window %.1f "
+           "(%u decreases), PUBACK mean %.1f ms max %.1f ms, %u rewinds, %llu duplicates, %llu missing\n",
+           "", (unsigned)stats.records_live, (unsigned)stats.records_resumed, (unsigned)stats.records_skipped, (unsigned)stats.live_sessions,
+           (unsigned)stats.live_overflows, stats.window, (unsigned)stats.window_decreases,
+           stats.acks ? (double)stats.ack_latency_sum_us / stats.acks / 1000.0 : 0.0,
+           (double)stats.ack_latency_max_us / 1000.0, (unsigned)stats.rewinds, (unsigned long long)duplicates,
+           (unsigned long long)missing);
+    // The uplink task keeps running on its empty log, leave everything in place
+    return replay_done_us > 0 && missing == 0 && bad == 0;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_set_time_scale(config.time_scale);
+    host_log_set_console(NULL, 0);
+    host_mqtt_set_link(config.rtt_ms, config.bandwidth_kbps);
+    host_mqtt_set_receiver(receive, NULL);
+
+    printf("replay_bench: %.1f h offline at %.1f records/s (%u records backlog), %.0f s live, budget %u B/s, "
+           "%u ms RTT, %u kbit/s, %u link drops\n",
+           config.offline_h, config.rate, (unsigned)(config.offline_h * 3600 * config.rate), config.live_s,
+           (unsigned)config.budget, (unsigned)config.rtt_ms, (unsigned)config.bandwidth_kbps,
+           (unsigned)config.drops);
+    bool ok = runOnce(config, 0, "live + budget", true, config.budget);
+    ok = runOnce(config, 1, "backlog only", false, 0) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,384 @@
+/**
+ * @file ring_bench.cpp
+ * @brief Sensor record hand-off through a FreeRTOS queue versus SpscRing.
+ *
+ * A producer task passes a stream of SensorRecords to a consumer task three
+ * ways: xQueueSend/xQueueReceive with one copy in and one out per record, the
+ * ring one record at a time written in place, and the ring in batches.
+ * The consumer checks the sequence of every record and measures the hand-off
+ * latency from the producer stamp. Times are real host time, the queue is the
+ * host stand-in, so compare the modes against each other rather than with the
+ * target.
+ *
+ * The fan-out run passes the stream in batches through a FanoutRing to two
+ * holding readers and one spilling reader that spends --slow-ns on every
+ * record. The holding readers must see every record in order; the spilling
+ * reader must see them in order with gaps adding up to its overruns, and
+ * must not hold up the producer.
+ *
+ * Usage: ring_bench [--records N] [--batch B] [--slow-ns NS]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "host_hal.h"
+#include "SensorRecord.h"
+#include "SpscRing.h"
+#include "FanoutRing.h"
+
+// Same depth as the sensor ring in main.cpp
+#define RING_LENGTH 64
+
+struct BenchConfig {
+    uint32_t records = 1000000;
+    uint32_t batch = 16;
+    uint32_t slow_ns = 5000;
+};
+
+typedef enum {
+    MODE_QUEUE = 0,
+    MODE_RING_SINGLE,
+    MODE_RING_BATCH
+} bench_mode_t;
+
+struct BenchRun {
+    bench_mode_t mode;
+    uint32_t records;
+    uint32_t batch;
+    QueueHandle_t queue;
+    SpscRing<SensorRecord, RING_LENGTH>* ring;
+    std::atomic<bool> producer_done;
+};
+
+struct BenchResult {
+    double seconds;
+    uint32_t received;
+    uint32_t out_of_order;
+    double latency_sum_us;
+    double latency_max_us;
+    uint32_t producer_waits;
+    uint32_t wakeups;
+};
+
+static std::chrono::steady_clock::time_point s_epoch;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--records N] [--batch B] [--slow-ns NS]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--records") == 0 && has_value) {
+            config.records = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--batch") == 0 && has_value) {
+            config.batch = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--slow-ns") == 0 && has_value) {
+            config.slow_ns = (uint32_t)atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.records < 1 || config.batch < 1 || config.batch > RING_LENGTH) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+// Record number seq, stamped with the producer time in the timestamp field
+static void fillRecord(SensorRecord* record, uint32_t seq) {
+    sensorRecordInit(record, (uint8_t)(1 + seq % 3), SENSOR_TAG_CLIMATE, nowNs());
+    record->value_types = (SENSOR_VALUE_U16 << 0) | (SENSOR_VALUE_U16 << 2);
+    record->values[0] = (int16_t)(seq & 0xffff);
+    record->values[1] = (int16_t)(seq >> 16);
+}
+
+static uint32_t s_producer_waits = 0;
+
+static void producerTask(void* arg) {
+    BenchRun* run = static_cast<BenchRun*>(arg);
+    SensorRecord record;
+    uint32_t seq = 0;
+
+    while (seq < run->records) {
+        if (run->mode == MODE_QUEUE) {
+            fillRecord(&record, seq);
+            xQueueSend(run->queue, &record, portMAX_DELAY);
+            seq++;
+            continue;
+        }
+
+        SensorRecord* slots = NULL;
+        size_t free_slots = run->ring->reserve(&slots);
+        if (free_slots == 0) {
+            s_producer_waits++;
+            taskYIELD();
+            continue;
+        }
+        size_t count = run->mode == MODE_RING_SINGLE ? 1 : run->batch;
+        if (count > free_slots) {
+            count = free_slots;
+        }
+        if (count > run->records - seq) {
+            count = run->records - seq;
+        }
+        for (size_t i = 0; i < count; i++) {
+            fillRecord(&slots[i], seq++);
+        }
+        run->ring->publish(count);
+    }
+
+    run->producer_done = true;
+    vTaskDelete(NULL);
+}
+
+// Returns false once the record breaks the sequence
+static bool checkRecord(const SensorRecord* record, uint32_t expected, BenchResult* result) {
+    double latency = (double)(nowNs() - sensorRecordGetTimestamp(record)) / 1000.0;
+    result->latency_sum_us += latency;
+    if (latency > result->latency_max_us) {
+        result->latency_max_us = latency;
+    }
+    uint32_t seq = (uint16_t)record->values[0] | ((uint32_t)(uint16_t)record->values[1] << 16);
+    return seq == expected;
+}
+
+static BenchResult runMode(bench_mode_t mode, const BenchConfig& config) {
+    static SpscRing<SensorRecord, RING_LENGTH> ring;
+    BenchRun run;
+    run.mode = mode;
+    run.records = config.records;
+    run.batch = config.batch;
+    run.queue = mode == MODE_QUEUE ? xQueueCreate(RING_LENGTH, sizeof(SensorRecord)) : NULL;
+    run.ring = &ring;
+    run.producer_done = false;
+    s_producer_waits = 0;
+
+    BenchResult result = {};
+    spsc_ring_stats_t before;
+    ring.getStats(&before);
+    ring.setConsumer(xTaskGetCurrentTaskHandle());
+
+    auto start = std::chrono::steady_clock::now();
+    xTaskCreate(producerTask, "producer", 4096, &run, 5, NULL);
+
+    SensorRecord record;
+    while (result.received < config.records) {
+        if (mode == MODE_QUEUE) {
+            xQueueReceive(run.queue, &record, portMAX_DELAY);
+            if (!checkRecord(&record, result.received, &result)) {
+                result.out_of_order++;
+            }
+            result.received++;
+            continue;
+        }
+
+        ring.waitForData(portMAX_DELAY);
+        const SensorRecord* records = NULL;
+        size_t count = ring.peek(&records);
+        for (size_t i = 0; i < count; i++) {
+            if (!checkRecord(&records[i], result.received, &result)) {
+                result.out_of_order++;
+            }
+            result.received++;
+        }
+        ring.release(count);
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    while (!run.producer_done) {
+        taskYIELD();
+    }
+    spsc_ring_stats_t after;
+    ring.getStats(&after);
+    result.wakeups = after.wakeups - before.wakeups;
+    result.producer_waits = s_producer_waits;
+    if (run.queue != NULL) {
+        vQueueDelete(run.queue);
+    }
+    return result;
+}
+
+// ---- Fan-out ----
+
+#define FANOUT_READERS 3
+
+typedef FanoutRing<SensorRecord, RING_LENGTH, FANOUT_READERS> BenchFanout;
+
+struct FanoutReader {
+    BenchFanout* ring;
+    int id;
+    uint32_t slow_ns;
+    uint32_t records;               // Stream length
+    uint32_t received;
+    uint32_t skipped;               // Records missing from the sequence
+    uint32_t out_of_order;          // Records at or before the previous one
+    std::atomic<bool> done;
+};
+
+struct FanoutRun {
+    BenchFanout* ring;
+    uint32_t records;
+    uint32_t batch;
+    std::atomic<bool> producer_done;
+};
+
+static uint32_t recordSeq(const SensorRecord* record) {
+    return (uint16_t)record->values[0] | ((uint32_t)(uint16_t)record->values[1] << 16);
+}
+
+static void fanoutReaderTask(void* arg) {
+    FanoutReader* reader = static_cast<FanoutReader*>(arg);
+    uint32_t expected = 0;
+    // The stream ends with the last record, whatever a spilling reader skipped before it
+    while (expected < reader->records) {
+        reader->ring->waitForData(reader->id, portMAX_DELAY);
+        const SensorRecord* records = NULL;
+        size_t count;
+        while (expected < reader->records && (count = reader->ring->peek(reader->id, &records)) > 0) {
+            // A slow reader takes one record per claim and works on it after
+            // the release, so the producer can move it on meanwhile
+            if (reader->slow_ns > 0) {
+                count = 1;
+            }
+            for (size_t i = 0; i < count; i++) {
+                uint32_t seq = recordSeq(&records[i]);
+                if (seq < expected) {
+                    reader->out_of_order++;
+                } else {
+                    reader->skipped += seq - expected;
+                    expected = seq + 1;
+                }
+                reader->received++;
+            }
+            reader->ring->release(reader->id, count);
+            if (reader->slow_ns > 0) {
+                int64_t until = nowNs() + reader->slow_ns;
+                while (nowNs() < until) {
+                }
+            }
+        }
+    }
+    reader->done = true;
+    vTaskDelete(NULL);
+}
+
+static void fanoutProducerTask(void* arg) {
+    FanoutRun* run = static_cast<FanoutRun*>(arg);
+    BenchFanout* ring = run->ring;
+    uint32_t seq = 0;
+    while (seq < run->records) {
+        SensorRecord* slots = NULL;
+        size_t free_slots = ring->reserve(&slots);
+        if (free_slots == 0) {
+            s_producer_waits++;
+            taskYIELD();
+            continue;
+        }
+        size_t count = free_slots < run->batch ? free_slots : run->batch;
+        if (count > run->records - seq) {
+            count = run->records - seq;
+        }
+        for (size_t i = 0; i < count; i++) {
+            fillRecord(&slots[i], seq++);
+        }
+        ring->publish(count);
+    }
+    run->producer_done = true;
+    vTaskDelete(NULL);
+}
+
+// false if a holding reader missed a record or any reader saw one out of order
+static bool runFanout(const BenchConfig& config) {
+    static BenchFanout ring;
+    static FanoutReader readers[FANOUT_READERS];
+    FanoutRun run;
+    run.ring = &ring;
+    run.records = config.records;
+    run.batch = config.batch;
+    run.producer_done = false;
+    s_producer_waits = 0;
+
+    for (int i = 0; i < FANOUT_READERS; i++) {
+        FanoutReader* reader = &readers[i];
+        bool spill = i == FANOUT_READERS - 1;
+        reader->ring = &ring;
+        reader->id = ring.addReader(spill);
+        reader->slow_ns = spill ? config.slow_ns : 0;
+        reader->records = config.records;
+        reader->done = false;
+        TaskHandle_t task = NULL;
+        xTaskCreate(fanoutReaderTask, "reader", 4096, reader, 5, &task);
+        ring.setReaderTask(reader->id, task);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    xTaskCreate(fanoutProducerTask, "producer", 4096, &run, 5, NULL);
+    while (!run.producer_done || !readers[0].done || !readers[1].done) {
+        vTaskDelay(1);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    while (!readers[FANOUT_READERS - 1].done) {
+        vTaskDelay(1);
+    }
+
+    fanout_ring_stats_t stats;
+    ring.getStats(&stats);
+    printf("  %-18s: %7.2f Mrec/s, %6.1f ns/record, %u producer waits, high water %u, %u bytes for %u readers\n",
+           "fan-out x3", config.records / seconds / 1e6, seconds * 1e9 / config.records,
+           (unsigned)s_producer_waits, (unsigned)stats.high_water, (unsigned)sizeof(ring), FANOUT_READERS);
+    bool ok = true;
+    for (int i = 0; i < FANOUT_READERS; i++) {
+        const FanoutReader* reader = &readers[i];
+        fanout_reader_stats_t reader_stats;
+        ring.getReaderStats(reader->id, &reader_stats);
+        bool spill = i == FANOUT_READERS - 1;
+        bool reader_ok = reader->out_of_order == 0 && reader->skipped == reader_stats.overruns &&
+                         reader->received + reader->skipped == config.records && (spill || reader->skipped == 0);
+        ok = ok && reader_ok;
+        printf("    reader %d %-8s: %u received, %u skipped, %u overruns, max lag %u, %u wakeups, %s\n",
+               reader->id, spill ? "spilling" : "holding", (unsigned)reader->received, (unsigned)reader->skipped,
+               (unsigned)reader_stats.overruns, (unsigned)reader_stats.max_lag, (unsigned)reader_stats.wakeups,
+               reader_ok ? "ok" : "MISMATCH");
+    }
+    return ok;
+}
+
+static void report(const char* name, const BenchResult& result) {
+    double per_record_ns = result.received ? result.seconds * 1e9 / result.received : 0.0;
+    printf("  %-18s: %7.2f Mrec/s, %6.1f ns/record, latency mean %7.2f us max %8.1f us, "
+           "%u producer waits, %u wakeups, %u out of order\n",
+           name, result.received / result.seconds / 1e6, per_record_ns,
+           result.received ? result.latency_sum_us / result.received : 0.0, result.latency_max_us,
+           (unsigned)result.producer_waits, (unsigned)result.wakeups, (unsigned)result.out_of_order);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    s_epoch = std::chrono::steady_clock::now();
+    // Producer back-off is a yield, not a simulated sleep
+    host_set_time_scale(0.001);
+
+    printf("ring_bench: %u records of %u bytes, depth %d, batch %u\n",
+           (unsigned)config.records, (unsigned)sizeof(SensorRecord), RING_LENGTH, (unsigned)config.batch);
+    report("xQueue", runMode(MODE_QUEUE, config));
+    report("ring, single", runMode(MODE_RING_SINGLE, config));
+    char name[32];
+    snprintf(name, sizeof(name), "ring, batch %u", (unsigned)config.batch);
+    report(name, runMode(MODE_RING_BATCH, config));
+    return runFanout(config) ? 0 : 1;
+}
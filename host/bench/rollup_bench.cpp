@@ -0,0 +1,212 @@
+/**
+ * @file rollup_bench.cpp
+ * @brief Volume reduction, cost and accuracy of SensorRollup.
+ *
+ * Feeds climate records of a number of slaves polled at a fixed rate through
+ * a SensorRollup with the default 1 and 15 minute resolutions and counts what
+ * comes out. Reported are the records in and out, the reduction in records
+ * (and so in flash and uplink bytes, every record being 16 bytes) and the
+ * host CPU time per record.
+ *
+ * A second pass emits every statistic and checks each rollup against one
+ * computed from the raw samples of its window: min, max, mean, last and count
+ * must match exactly, the standard deviation to within one unit of the slot.
+ *
+ * Usage: rollup_bench [--slaves N] [--rate HZ] [--hours H] [--raw] [--seed S]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "host_hal.h"
+#include "SensorRollup.h"
+
+struct BenchConfig {
+    uint32_t slaves = 3;
+    double rate_hz = 1.0;
+    uint32_t hours = 24;
+    bool raw = false;
+    uint32_t seed = 1;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--slaves N] [--rate HZ] [--hours H] [--raw] [--seed S]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--rate") == 0 && has_value) {
+            config.rate_hz = atof(argv[++i]);
+        } else if (strcmp(arg, "--hours") == 0 && has_value) {
+            config.hours = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--raw") == 0) {
+            config.raw = true;
+        } else if (strcmp(arg, "--seed") == 0 && has_value) {
+            config.seed = (uint32_t)atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.slaves < 1 || config.slaves > 64 || !(config.rate_hz > 0 && config.rate_hz <= 100) ||
+        config.hours < 1) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+// Keeps what the stage writes
+class CollectSink : public SensorSink {
+public:
+    void write(const SensorRecord* records, size_t count) override {
+        this->records.insert(this->records.end(), records, records + count);
+    }
+    std::vector<SensorRecord> records;
+};
+
+static std::vector<SensorRecord> makeRecords(const BenchConfig& config) {
+    std::mt19937 rng(config.seed);
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+    std::vector<SensorRecord> records;
+    int64_t start_ms = 1700000000000ll + 12345;
+    double period_ms = 1000.0 / config.rate_hz;
+    uint64_t polls = (uint64_t)(config.hours * 3600.0 * config.rate_hz);
+    for (uint64_t poll = 0; poll < polls; poll++) {
+        double day = 2.0 * M_PI * poll * period_ms / 86400000.0;
+        for (uint32_t slave = 0; slave < config.slaves; slave++) {
+            SensorRecord record;
+            int64_t timestamp_ms = start_ms + (int64_t)(poll * period_ms) + slave;
+            sensorRecordInit(&record, (uint8_t)(slave + 1), SENSOR_TAG_CLIMATE, timestamp_ms);
+            sensorRecordSetValue(&record, 0, SENSOR_VALUE_U16, (poll / 5000) % 3 == 0 ? 0x8001 : 0x0001);
+            sensorRecordSetValue(&record, 1, SENSOR_VALUE_CENTI, 50.0f + 8.0f * (float)sin(day + slave) + noise(rng));
+            sensorRecordSetValue(&record, 2, SENSOR_VALUE_CENTI, 21.0f - 3.0f * (float)cos(day) + noise(rng));
+            records.push_back(record);
+        }
+    }
+    return records;
+}
+
+static double runStage(SensorRollup* rollup, const std::vector<SensorRecord>& records) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); i += SENSOR_PIPELINE_MAX_BATCH) {
+        size_t n = records.size() - i < SENSOR_PIPELINE_MAX_BATCH ? records.size() - i : SENSOR_PIPELINE_MAX_BATCH;
+        rollup->write(&records[i], n);
+    }
+    rollup->flush();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+typedef std::tuple<uint8_t, size_t, int64_t> WindowKey;     // slave, resolution, start
+
+static int32_t slotValue(const SensorRecord* record, int slot) {
+    return sensorRecordGetType(record, slot) == SENSOR_VALUE_U16 ? (uint16_t)record->values[slot]
+                                                                  : record->values[slot];
+}
+
+// Rollups that differ from the statistics of the raw samples
+static uint64_t verify(const sensor_rollup_config_t& config, const std::vector<SensorRecord>& records,
+                       const std::vector<SensorRecord>& rollups, uint64_t* checked) {
+    std::map<WindowKey, std::vector<const SensorRecord*>> windows;
+    for (const SensorRecord& record : records) {
+        int64_t timestamp = sensorRecordGetTimestamp(&record);
+        for (size_t r = 0; r < config.num_resolutions; r++) {
+            int64_t length = (int64_t)config.resolutions_s[r] * 1000;
+            windows[WindowKey(record.slave_id, r, timestamp - timestamp % length)].push_back(&record);
+        }
+    }
+    uint64_t errors = 0;
+    *checked = 0;
+    for (const SensorRecord& rollup : rollups) {
+        if (!(rollup.tag_id & SENSOR_TAG_ROLLUP)) {
+            continue;
+        }
+        int stat = (rollup.tag_id >> 4) & 0x07;
+        size_t r = (rollup.tag_id >> 2) & 0x03;
+        auto it = windows.find(WindowKey(rollup.slave_id, r, sensorRecordGetTimestamp(&rollup)));
+        if (it == windows.end()) {
+            errors++;
+            continue;
+        }
+        const std::vector<const SensorRecord*>& samples = it->second;
+        for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+            int64_t sum = 0;
+            int32_t low = INT32_MAX, high = INT32_MIN;
+            for (const SensorRecord* sample : samples) {
+                int32_t value = slotValue(sample, slot);
+                sum += value;
+                low = value < low ? value : low;
+                high = value > high ? value : high;
+            }
+            double mean = (double)sum / samples.size();
+            double squares = 0;
+            for (const SensorRecord* sample : samples) {
+                squares += (slotValue(sample, slot) - mean) * (slotValue(sample, slot) - mean);
+            }
+            double stddev = samples.size() > 1 ? sqrt(squares / (samples.size() - 1)) : 0.0;
+            int32_t got = slotValue(&rollup, slot);
+            bool ok;
+            switch (stat) {
+                case SENSOR_STAT_MIN:    ok = got == low; break;
+                case SENSOR_STAT_MAX:    ok = got == high; break;
+                case SENSOR_STAT_MEAN:   ok = got == (int32_t)llround(mean); break;
+                case SENSOR_STAT_LAST:   ok = got == slotValue(samples.back(), slot); break;
+                case SENSOR_STAT_STDDEV: ok = fabs(got - stddev) <= 1.0; break;
+                default:                 ok = got == (int32_t)samples.size(); break;
+            }
+            errors += ok ? 0 : 1;
+            (*checked)++;
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_log_set_console(NULL, 0);
+    std::vector<SensorRecord> records = makeRecords(config);
+    printf("rollup_bench: %u slaves at %.1f Hz for %u h, %zu records\n", (unsigned)config.slaves, config.rate_hz,
+           (unsigned)config.hours, records.size());
+
+    // ---- Default statistics ----
+    CollectSink sink;
+    SensorRollup rollup(&sink);
+    sensor_rollup_config_t rollup_config = SENSOR_ROLLUP_DEFAULT_CONFIG();
+    rollup_config.raw_tags = config.raw ? SENSOR_ROLLUP_TAG_BIT(SENSOR_TAG_CLIMATE) : 0;
+    rollup.init(&rollup_config);
+    double ns = runStage(&rollup, records);
+    sensor_rollup_stats_t stats;
+    rollup.getStats(&stats);
+    printf("  output           : %zu records (%u rollups in %u windows, %u raw), reduction x%.1f, "
+           "%.1f KiB/day instead of %.1f KiB/day\n",
+           sink.records.size(), (unsigned)stats.records_out, (unsigned)stats.windows, (unsigned)stats.records_raw,
+           sink.records.empty() ? 0.0 : (double)records.size() / sink.records.size(),
+           sink.records.size() * sizeof(SensorRecord) / 1024.0 / config.hours * 24,
+           records.size() * sizeof(SensorRecord) / 1024.0 / config.hours * 24);
+    printf("  cost             : %.1f ns/record host CPU, %u series\n", ns / records.size(),
+           (unsigned)stats.series);
+
+    // ---- Every statistic against the raw samples ----
+    CollectSink all_sink;
+    SensorRollup all(&all_sink);
+    rollup_config.stats = (1u << SENSOR_STAT_NUM) - 1;
+    rollup_config.raw_tags = 0;
+    all.init(&rollup_config);
+    runStage(&all, records);
+    uint64_t checked = 0;
+    uint64_t errors = verify(rollup_config, records, all_sink.records, &checked);
+    printf("  accuracy         : %llu values checked against the raw samples, %llu wrong\n",
+           (unsigned long long)checked, (unsigned long long)errors);
+    return errors == 0 && checked > 0 ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/**
+ * @file rtu_bench.cpp
+ * @brief Transactions per second and turnaround of the two Modbus RTU backends.
+ *
+ * Reads the same block of holding registers round-robin from a range of
+ * slaves behind a serial device, normally the pty of tools/mb_slave_sim, once
+ * through mbc_master_send_request() and once through ModbusRtuMaster. Reported
+ * are transactions per second, the latency from the start of a request to its
+ * decoded response (mean, p50, p99, max) and the failures, next to the bare
+ * line time of a transaction at the baud rate. Times are real host time.
+ *
+ * On the host the esp-modbus side is the fake controller of the host HAL, a
+ * synchronous stand-in without the controller task and event groups of the
+ * real stack, so the gap on the target is wider than here.
+ *
+ * Finally the table-driven CRC16 is timed against the bitwise one of the host
+ * simulators over full-size frames.
+ *
+ * Usage: rtu_bench --serial DEVICE [--baud B] [--requests N] [--regs Q]
+ *                  [--slaves N] [--delay-us US]
+ *
+ * Start the simulator first with the same baud rate and slave range:
+ *   mb_slave_sim --addr 1-3 --baud 115200 --report 0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "host_hal.h"
+#include "mbcontroller.h"
+#include "Modbus.h"
+#include "ModbusRtuMaster.h"
+#include "Rtu.h"
+
+struct BenchConfig {
+    const char* serial = NULL;
+    uint32_t baud = 115200;
+    uint32_t requests = 2000;
+    uint16_t regs = 13;             // Status, name and both floats of a slave, one block of the read plan
+    int slaves = 3;
+    uint32_t delay_us = 1000;       // Slave turnaround configured on mb_slave_sim, for the line time only
+};
+
+struct BenchResult {
+    double seconds;
+    uint32_t failures;
+    std::vector<int64_t> latencies_us;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s --serial DEVICE [--baud B] [--requests N] [--regs Q] [--slaves N] [--delay-us US]\n",
+            prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--serial") == 0 && has_value) {
+            config.serial = argv[++i];
+        } else if (strcmp(arg, "--baud") == 0 && has_value) {
+            config.baud = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--requests") == 0 && has_value) {
+            config.requests = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--regs") == 0 && has_value) {
+            config.regs = (uint16_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--delay-us") == 0 && has_value) {
+            config.delay_us = (uint32_t)atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.serial == NULL || config.requests < 1 || config.regs < 1 || config.regs > 125 ||
+        config.slaves < 1 || config.slaves > 247) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+template <typename Transact>
+static BenchResult run(const BenchConfig& config, Transact transact) {
+    BenchResult result = {};
+    result.latencies_us.reserve(config.requests);
+    uint16_t regs[125];
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < config.requests; i++) {
+        uint8_t slave_id = (uint8_t)(1 + i % config.slaves);
+        int64_t begin = esp_timer_get_time();
+        esp_err_t err = transact(slave_id, regs);
+        if (err == ESP_OK) {
+            result.latencies_us.push_back(esp_timer_get_time() - begin);
+        } else {
+            result.failures++;
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+static void report(const char* name, BenchResult result) {
+    std::vector<int64_t>& latencies = result.latencies_us;
+    std::sort(latencies.begin(), latencies.end());
+    double mean = 0;
+    for (int64_t latency : latencies) {
+        mean += latency;
+    }
+    mean = latencies.empty() ? 0.0 : mean / latencies.size();
+    auto percentile = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] / 1000.0;
+    };
+    printf("  %-12s: %7.1f transactions/s, latency mean %6.2f ms p50 %6.2f p99 %6.2f max %6.2f, %u failed\n",
+           name, (latencies.size() + result.failures) / result.seconds, mean / 1000.0, percentile(0.5),
+           percentile(0.99), latencies.empty() ? 0.0 : latencies.back() / 1000.0, (unsigned)result.failures);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_log_set_console(NULL, 0);
+    host_set_time_scale(1.0);
+    if (!host_uart_attach(UART_NUM_1, config.serial, config.baud)) {
+        fprintf(stderr, "cannot open %s\n", config.serial);
+        return 1;
+    }
+
+    // Request and response frames on the wire, each followed by T3.5, and the slave turnaround
+    int64_t line_us = mbRtuCharTimeUs(8, config.baud, false) + mbRtuCharTimeUs(5 + 2 * config.regs, config.baud, false)
+                    + 2 * mbRtuFrameGapUs(config.baud, false) + config.delay_us;
+    printf("rtu_bench: %u reads of %u registers from %d slaves on %s at %u baud, line time %.2f ms\n",
+           (unsigned)config.requests, (unsigned)config.regs, config.slaves, config.serial, (unsigned)config.baud,
+           line_us / 1000.0);
+
+    // ---- esp-modbus ----
+    mb_communication_info_t comm = {};
+    comm.port = UART_NUM_1;
+    comm.mode = MB_MODE_RTU;
+    comm.baudrate = config.baud;
+    comm.parity = UART_PARITY_DISABLE;
+    void* handler = NULL;
+    if (mbc_master_init(MB_PORT_SERIAL_MASTER, &handler) != ESP_OK || mbc_master_setup(&comm) != ESP_OK ||
+        mbc_master_start() != ESP_OK) {
+        fprintf(stderr, "esp-modbus master setup failed\n");
+        return 1;
+    }
+    BenchResult esp_modbus = run(config, [&](uint8_t slave_id, uint16_t* regs) {
+        mb_param_request_t request = {};
+        request.slave_addr = slave_id;
+        request.command = MB_FUNC_READ_HOLDING_REGISTER;
+        request.reg_start = 0;
+        request.reg_size = config.regs;
+        return mbc_master_send_request(&request, regs);
+    });
+    mbc_master_destroy();
+    report("esp-modbus", esp_modbus);
+
+    // ---- In-tree engine ----
+    ModbusRtuMaster rtu(UART_NUM_1, config.baud, UART_PARITY_DISABLE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE,
+                        UART_PIN_NO_CHANGE);
+    if (!rtu.init()) {
+        fprintf(stderr, "RTU master setup failed\n");
+        return 1;
+    }
+    BenchResult native = run(config, [&](uint8_t slave_id, uint16_t* regs) {
+        return rtu.transact(slave_id, MB_FUNC_READ_HOLDING_REGISTER, 0, config.regs, regs);
+    });
+    report("native RTU", native);
+    mb_rtu_stats_t stats;
+    rtu.getStats(&stats);
+    printf("  %-12s: %u timeouts, %u crc errors, %u exceptions, %u invalid\n", "", (unsigned)stats.timeouts,
+           (unsigned)stats.crc_errors, (unsigned)stats.exceptions, (unsigned)stats.invalid);
+
+    // ---- CRC16 ----
+    uint8_t frame[MB_RTU_MAX_FRAME];
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        frame[i] = (uint8_t)(i * 37 + 11);
+    }
+    const int rounds = 20000;
+    uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        frame[0] = (uint8_t)i;
+        sink += rtuCrc16(frame, sizeof(frame));
+    }
+    double bitwise_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        frame[0] = (uint8_t)i;
+        sink -= mbRtuCrc16(frame, sizeof(frame));
+    }
+    double table_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    bool same = sink == 0;
+    for (size_t len = 0; len <= sizeof(frame); len++) {
+        same = same && rtuCrc16(frame, len) == mbRtuCrc16(frame, len);
+    }
+    printf("  %-12s: table %.2f ns/byte, bitwise %.2f ns/byte, %s\n", "crc16",
+           table_ns / rounds / sizeof(frame), bitwise_ns / rounds / sizeof(frame),
+           same ? "same results" : "MISMATCH");
+
+    bool ok = same && native.failures == 0 && esp_modbus.failures == 0;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file segment_bench.cpp
+ * @brief Poll cycle of one RS-485 segment against the same slaves split over two.
+ *
+ * Every UART is backed by an in-process RS-485 line (host_uart_attach_slaves)
+ * and driven by a ModbusSegment on ModbusRtuMaster. The slaves are polled as
+ * fast as the bus allows, one 13-register block each (name, status, humidity
+ * and temperature of the climate sensor type, one device profile per slave):
+ *
+ *  - one segment on UART0 with all the slaves;
+ *  - two segments on UART1 and UART2 with half of them each.
+ *
+ * Both layouts run side by side on their own lines. Reported is the poll
+ * cycle, the time until every slave of a segment has been read once, per
+ * segment and for the layout (its slowest segment), with the share of the
+ * time each line was busy. Times are simulated time. --slaves goes up to a
+ * full bus of 247, all of them on the single segment.
+ *
+ * Usage: segment_bench [--slaves N] [--duration S] [--turnaround-us US]
+ *                      [--baud B] [--time-scale X]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "host_hal.h"
+#include "Modbus.h"
+#include "ModbusProfiles.h"
+#include "ModbusSegment.h"
+
+#if !MB_BUS_NATIVE_RTU
+#error "segment_bench needs ModbusBus on ModbusRtuMaster, esp-modbus drives a single bus"
+#endif
+
+#define MAX_SLAVES 247
+
+struct BenchConfig {
+    int slaves = 8;
+    double duration_s = 10.0;
+    uint32_t turnaround_us = 1000;
+    uint32_t baud = 115200;
+    double time_scale = 0.2;
+};
+
+struct Layout {
+    const char* name;
+    std::vector<ModbusSegment*> segments;
+    std::vector<int> slaves;        // Per segment
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--slaves N] [--duration S] [--turnaround-us US] [--baud B] [--time-scale X]\n",
+            prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--duration") == 0 && has_value) {
+            config.duration_s = atof(argv[++i]);
+        } else if (strcmp(arg, "--turnaround-us") == 0 && has_value) {
+            config.turnaround_us = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--baud") == 0 && has_value) {
+            config.baud = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--time-scale") == 0 && has_value) {
+            config.time_scale = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.slaves < 2 || config.slaves > MAX_SLAVES || config.duration_s <= 0.0 || config.time_scale <= 0.0) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+// A climate sensor at every slave address
+static bool buildProfiles(ModbusProfiles* profiles, int slaves) {
+    std::vector<mb_profile_slave_t> config;
+    for (int addr = 1; addr <= slaves; addr++) {
+        config.push_back(mb_profile_slave_t{(uint8_t)addr, DEVICE_TYPE_CLIMATE, 0, 1, 1000, 0});
+    }
+    return profiles->setSlaves(config.data(), config.size()) == ESP_OK;
+}
+
+static bool startSegment(ModbusSegment* segment, const ModbusProfiles& profiles, int first, int last,
+                         BaseType_t core_id) {
+    std::vector<mb_segment_slave_t> slaves;
+    for (int addr = first; addr <= last; addr++) {
+        // A period shorter than a read keeps every slave due, the schedule goes round robin
+        slaves.push_back(mb_segment_slave_t{(uint8_t)addr, 1, 1, 0});
+    }
+    mb_segment_config_t config = MB_SEGMENT_DEFAULT_CONFIG();
+    config.profiles = &profiles;
+    config.slaves = slaves.data();
+    config.num_slaves = slaves.size();
+    config.core_id = core_id;
+    return segment->init(&config) == ESP_OK && segment->start() == ESP_OK;
+}
+
+// Print the layout, returns its poll cycle in ms
+static double report(const Layout& layout, int64_t elapsed_us) {
+    double cycle_ms = 0.0;
+    uint32_t polls = 0;
+    uint32_t failures = 0;
+    char detail[256];
+    size_t len = 0;
+    for (size_t i = 0; i < layout.segments.size(); i++) {
+        ModbusSegment* segment = layout.segments[i];
+        mb_segment_stats_t stats;
+        segment->getStats(&stats);
+        host_uart_line_stats_t line = {};
+        host_uart_get_line_stats(segment->getPort(), &line);
+        double segment_ms = stats.polls ? elapsed_us / 1000.0 * layout.slaves[i] / stats.polls : 0.0;
+        cycle_ms = segment_ms > cycle_ms ? segment_ms : cycle_ms;
+        polls += stats.polls;
+        failures += stats.failures;
+        len += snprintf(detail + len, sizeof(detail) - len, "%sUART%d %d slaves %.1f ms %.0f%% busy",
+                        i == 0 ? "" : ", ", (int)segment->getPort(), layout.slaves[i], segment_ms,
+                        100.0 * (double)line.busy_us / (double)elapsed_us);
+    }
+    printf("  %-12s: cycle %.1f ms (%s), %u polls, %u failed\n", layout.name, cycle_ms, detail, (unsigned)polls,
+           (unsigned)failures);
+    return cycle_ms;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_set_time_scale(config.time_scale);
+    host_log_set_console(NULL, 0);
+
+    int half = config.slaves / 2;
+    if (!host_uart_attach_slaves(UART_NUM_0, 1, (uint8_t)config.slaves, config.baud, config.turnaround_us) ||
+        !host_uart_attach_slaves(UART_NUM_1, 1, (uint8_t)half, config.baud, config.turnaround_us) ||
+        !host_uart_attach_slaves(UART_NUM_2, (uint8_t)(half + 1), (uint8_t)config.slaves, config.baud,
+                                 config.turnaround_us)) {
+        fprintf(stderr, "cannot attach the RS-485 lines\n");
+        return 1;
+    }
+    static ModbusProfiles profiles(device_types, num_device_types);
+    if (!buildProfiles(&profiles, config.slaves)) {
+        fprintf(stderr, "cannot configure %d slaves\n", config.slaves);
+        return 1;
+    }
+
+    static ModbusSegment single(NULL, UART_NUM_0, config.baud, 17, 16, -1);
+    static ModbusSegment first(NULL, UART_NUM_1, config.baud, 17, 16, -1);
+    static ModbusSegment second(NULL, UART_NUM_2, config.baud, 25, 26, -1);
+    Layout one = {"1 segment", {&single}, {config.slaves}};
+    Layout two = {"2 segments", {&first, &second}, {half, config.slaves - half}};
+
+    int64_t start_us = esp_timer_get_time();
+    if (!startSegment(&single, profiles, 1, config.slaves, 1) || !startSegment(&first, profiles, 1, half, 1) ||
+        !startSegment(&second, profiles, half + 1, config.slaves, 0)) {
+        fprintf(stderr, "cannot start the segments\n");
+        return 1;
+    }
+    host_sleep_us((int64_t)(config.duration_s * 1e6));
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    printf("segment_bench: %d slaves at %u baud, turnaround %u us, %.1f s simulated (time scale %.3f)\n",
+           config.slaves, (unsigned)config.baud, (unsigned)config.turnaround_us, elapsed_us / 1e6,
+           config.time_scale);
+    double single_ms = report(one, elapsed_us);
+    double split_ms = report(two, elapsed_us);
+    printf("  %-12s: %.2fx shorter poll cycle\n", "speedup", split_ms > 0.0 ? single_ms / split_ms : 0.0);
+    fflush(stdout);
+
+    // The poll tasks loop forever, leave without unwinding them
+    _exit(0);
+}
@@ -0,0 +1,378 @@
+/**
+ * @file series_bench.cpp
+ * @brief Compression ratio and speed of SeriesBlock on climate readings.
+ *
+ * The readings come from a CSV export of the field sensors, one line per
+ * record: timestamp_ms,slave,status,humidity,temperature. Without one the
+ * bench synthesises them: a few slaves polled once a second with some
+ * timing jitter, humidity and temperature following a daily cycle plus a
+ * slow random walk and a couple of hundredths of sensor noise. The
+ * synthetic numbers are only as good as that model, run a real export to
+ * size the flash.
+ *
+ * Reports, with every block decoded again and compared bit for bit:
+ *  - bytes per record and ratio for blocks of growing length
+ *  - encode and decode time per record and per value
+ *  - uplink payload size of a 64-record batch, binary against series
+ *  - records per flash block and backlog days in the partition, FlashLog
+ *    with and without compression, and compressed with a partly filled
+ *    block flushed as the FlashLogSink does: every FLASH_LOG_FLUSH_MS, or
+ *    FLASH_LOG_ROLLUP_FLUSH_MS with --rollup
+ *
+ * With --rollup the readings first go through a SensorRollup with the default
+ * configuration, as in the firmware, and the bench compresses its output.
+ *
+ * Usage: series_bench [--csv PATH] [--hours H] [--slaves N] [--jitter MS] [--seed S] [--rollup]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "host_hal.h"
+#include "FlashLog.h"
+#include "FlashLogSink.h"
+#include "SensorPayload.h"
+#include "SensorRollup.h"
+#include "SeriesBlock.h"
+
+#define BENCH_PARTITION_KIB     1024    // Size of the sensorlog partition in partitions.csv
+#define BENCH_BATCH             64      // Records per uplink message
+
+struct BenchConfig {
+    const char* csv = NULL;
+    uint32_t hours = 24;
+    uint32_t slaves = 3;
+    uint32_t jitter_ms = 5;
+    uint32_t seed = 1;
+    bool rollup = false;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--csv PATH] [--hours H] [--slaves N] [--jitter MS] [--seed S] [--rollup]\n",
+            prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--csv") == 0 && has_value) {
+            config.csv = argv[++i];
+        } else if (strcmp(arg, "--hours") == 0 && has_value) {
+            config.hours = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--jitter") == 0 && has_value) {
+            config.jitter_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--seed") == 0 && has_value) {
+            config.seed = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--rollup") == 0) {
+            config.rollup = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.hours < 1 || config.slaves < 1 || config.slaves > 247) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static void makeClimate(SensorRecord* record, uint8_t slave, int64_t timestamp_ms, uint16_t status,
+                        float humidity, float temperature) {
+    sensorRecordInit(record, slave, SENSOR_TAG_CLIMATE, timestamp_ms);
+    sensorRecordSetValue(record, 0, SENSOR_VALUE_U16, status);
+    sensorRecordSetValue(record, 1, SENSOR_VALUE_CENTI, humidity);
+    sensorRecordSetValue(record, 2, SENSOR_VALUE_CENTI, temperature);
+}
+
+static bool loadCsv(const char* path, std::vector<SensorRecord>* records) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        long long timestamp_ms;
+        unsigned slave, status;
+        float humidity, temperature;
+        if (sscanf(line, "%lld,%u,%u,%f,%f", &timestamp_ms, &slave, &status, &humidity, &temperature) != 5) {
+            continue;   // Header or a broken line
+        }
+        SensorRecord record;
+        makeClimate(&record, (uint8_t)slave, timestamp_ms, (uint16_t)status, humidity, temperature);
+        records->push_back(record);
+    }
+    fclose(file);
+    return true;
+}
+
+static void synthesise(const BenchConfig& config, std::vector<SensorRecord>* records) {
+    std::mt19937 rng(config.seed);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    std::normal_distribution<float> walk(0.0f, 0.005f);
+    std::uniform_int_distribution<int> jitter(0, (int)config.jitter_ms);
+    std::vector<float> humidity_drift(config.slaves, 0.0f), temperature_drift(config.slaves, 0.0f);
+
+    int64_t start_ms = 1700000000000ll;
+    uint32_t polls = config.hours * 3600;
+    for (uint32_t poll = 0; poll < polls; poll++) {
+        // One poll round a second, the slaves answer one after another
+        double day = 2.0 * M_PI * poll / 86400.0;
+        for (uint32_t slave = 0; slave < config.slaves; slave++) {
+            humidity_drift[slave] += walk(rng);
+            temperature_drift[slave] += walk(rng);
+            int64_t timestamp_ms = start_ms + (int64_t)poll * 1000 + slave * 40 + jitter(rng);
+            float humidity = 50.0f + 8.0f * (float)sin(day + slave) + humidity_drift[slave] + noise(rng);
+            float temperature = 21.0f - 3.0f * (float)cos(day + slave) + temperature_drift[slave] + noise(rng);
+            SensorRecord record;
+            makeClimate(&record, (uint8_t)(slave + 1), timestamp_ms, 0, humidity, temperature);
+            records->push_back(record);
+        }
+    }
+}
+
+// Collects what the rollup stage writes
+class CollectSink : public SensorSink {
+public:
+    explicit CollectSink(std::vector<SensorRecord>* records) : records(records) {}
+    void write(const SensorRecord* batch, size_t count) override {
+        records->insert(records->end(), batch, batch + count);
+    }
+
+private:
+    std::vector<SensorRecord>* records;
+};
+
+static void rollUp(std::vector<SensorRecord>* records) {
+    std::vector<SensorRecord> rollups;
+    CollectSink sink(&rollups);
+    SensorRollup rollup(&sink);
+    sensor_rollup_config_t config = SENSOR_ROLLUP_DEFAULT_CONFIG();
+    rollup.init(&config);
+    for (size_t i = 0; i < records->size(); i += BENCH_BATCH) {
+        size_t n = records->size() - i < BENCH_BATCH ? records->size() - i : BENCH_BATCH;
+        rollup.write(&(*records)[i], n);
+    }
+    rollup.flush();
+    records->swap(rollups);
+}
+
+static double wallNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Encode records into consecutive blocks of at most block_records, returns the bytes
+static size_t encodeBlocks(const std::vector<SensorRecord>& records, size_t block_records,
+                           std::vector<uint8_t>* out) {
+    out->resize(SERIES_BLOCK_MAX_SIZE(records.size()) +
+                (records.size() / SERIES_BLOCK_MAX_SERIES + 1) * SERIES_BLOCK_MAX_SIZE(0));
+    SeriesEncoder encoder;
+    size_t used = 0;
+    size_t i = 0;
+    while (i < records.size()) {
+        encoder.begin(out->data() + used, out->size() - used);
+        while (i < records.size() && encoder.count() < block_records && encoder.append(&records[i])) {
+            i++;
+        }
+        used += encoder.finish();
+    }
+    out->resize(used);
+    return used;
+}
+
+// Decode the blocks, false on any difference from the records
+static bool decodeBlocks(const std::vector<uint8_t>& blocks, const std::vector<SensorRecord>& records) {
+    SeriesDecoder decoder;
+    size_t used = 0;
+    size_t i = 0;
+    SensorRecord record;
+    while (used < blocks.size()) {
+        if (!decoder.begin(blocks.data() + used, blocks.size() - used)) {
+            return false;
+        }
+        while (decoder.next(&record)) {
+            if (i >= records.size() || memcmp(&record, &records[i], sizeof(record)) != 0) {
+                return false;
+            }
+            i++;
+        }
+        used += decoder.size();
+    }
+    return i == records.size();
+}
+
+// flush_ms: write a partly filled block once its first record is that much
+// older than the next one, 0 to write full blocks only
+static bool flashRun(const char* label, bool compress, uint32_t flush_ms, const std::vector<SensorRecord>& records,
+                     double* records_per_block) {
+    FlashLog log(label, compress);
+    if (log.mount() != ESP_OK) {
+        return false;
+    }
+    if (flush_ms > 0) {
+        int64_t block_start_ms = -1;
+        for (size_t i = 0; i < records.size(); i++) {
+            int64_t timestamp_ms = sensorRecordGetTimestamp(&records[i]);
+            if (block_start_ms >= 0 && timestamp_ms - block_start_ms >= flush_ms) {
+                log.flush();
+                block_start_ms = -1;
+            }
+            flash_log_stats_t before;
+            log.getStats(&before);
+            if (log.append(&records[i], 1) != ESP_OK) {
+                return false;
+            }
+            flash_log_stats_t after;
+            log.getStats(&after);
+            if (block_start_ms < 0 || after.blocks_written != before.blocks_written) {
+                block_start_ms = timestamp_ms;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < records.size(); i += BENCH_BATCH) {
+            size_t n = records.size() - i < BENCH_BATCH ? records.size() - i : BENCH_BATCH;
+            if (log.append(&records[i], n) != ESP_OK) {
+                return false;
+            }
+        }
+    }
+    log.flush();
+    flash_log_stats_t stats;
+    log.getStats(&stats);
+    *records_per_block = stats.blocks_written ? (double)stats.records_appended / stats.blocks_written : 0.0;
+
+    // Everything must come back, unchanged and in order
+    SensorRecord batch[BENCH_BATCH];
+    size_t checked = 0, n;
+    while ((n = log.read(batch, BENCH_BATCH)) > 0) {
+        for (size_t i = 0; i < n; i++, checked++) {
+            if (checked >= records.size() || memcmp(&batch[i], &records[checked], sizeof(SensorRecord)) != 0) {
+                return false;
+            }
+        }
+    }
+    return checked == records.size();
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_set_time_scale(0.001);
+    host_log_set_console(NULL, 0);
+
+    std::vector<SensorRecord> records;
+    if (config.csv != NULL) {
+        if (!loadCsv(config.csv, &records) || records.empty()) {
+            fprintf(stderr, "no records in %s\n", config.csv);
+            return 1;
+        }
+    } else {
+        synthesise(config, &records);
+    }
+    if (config.rollup) {
+        rollUp(&records);
+    }
+    int64_t span_ms = sensorRecordGetTimestamp(&records.back()) - sensorRecordGetTimestamp(&records.front());
+    double records_per_day = span_ms > 0 ? records.size() * 86400000.0 / span_ms : 0.0;
+    printf("series_bench: %zu records over %.1f h from %s%s\n", records.size(), span_ms / 3600000.0,
+           config.csv ? config.csv : "synthetic climate data", config.rollup ? ", rolled up" : "");
+    bool ok = true;
+
+    // ---- Ratio by block length ----
+    static const size_t lengths[] = {16, 64, 128, 1024};
+    std::vector<uint8_t> blocks;
+    for (size_t length : lengths) {
+        size_t bytes = encodeBlocks(records, length, &blocks);
+        bool exact = decodeBlocks(blocks, records);
+        ok = ok && exact;
+        printf("  block %5zu      : %6.2f bytes/record, ratio %5.2f, %s\n", length,
+               (double)bytes / records.size(), (double)(records.size() * sizeof(SensorRecord)) / bytes,
+               exact ? "bit exact" : "MISMATCH");
+    }
+
+    // ---- Speed, blocks of 128 records ----
+    const int rounds = 5;
+    double encode_ns = 1e30, decode_ns = 1e30;
+    for (int round = 0; round < rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        encodeBlocks(records, 128, &blocks);
+        double ns = wallNs(start);
+        encode_ns = ns < encode_ns ? ns : encode_ns;
+
+        start = std::chrono::steady_clock::now();
+        SeriesDecoder decoder;
+        SensorRecord record;
+        size_t used = 0;
+        while (used < blocks.size() && decoder.begin(blocks.data() + used, blocks.size() - used)) {
+            while (decoder.next(&record)) {
+            }
+            used += decoder.size();
+        }
+        ns = wallNs(start);
+        decode_ns = ns < decode_ns ? ns : decode_ns;
+    }
+    // A value is the timestamp or one of the readings
+    size_t values = records.size() * (1 + SENSOR_RECORD_VALUES);
+    printf("  encode           : %.1f ns/record, %.1f ns/value (best of %d)\n", encode_ns / records.size(),
+           encode_ns / values, rounds);
+    printf("  decode           : %.1f ns/record, %.1f ns/value\n", decode_ns / records.size(), decode_ns / values);
+
+    // ---- Uplink payloads ----
+    uint8_t payload[4096];
+    SensorRecord decoded[BENCH_BATCH];
+    uint64_t binary_bytes = 0, series_bytes = 0;
+    size_t batches = 0;
+    for (size_t i = 0; i + BENCH_BATCH <= records.size(); i += BENCH_BATCH, batches++) {
+        binary_bytes += sensorPayloadEncode(SENSOR_PAYLOAD_BINARY, &records[i], BENCH_BATCH, payload,
+                                            sizeof(payload));
+        size_t len = sensorPayloadEncode(SENSOR_PAYLOAD_SERIES, &records[i], BENCH_BATCH, payload, sizeof(payload));
+        series_bytes += len;
+        if (sensorPayloadDecode(payload, len, decoded, BENCH_BATCH) != BENCH_BATCH ||
+            memcmp(decoded, &records[i], sizeof(decoded)) != 0) {
+            ok = false;
+        }
+    }
+    if (batches > 0) {
+        printf("  uplink x%d       : binary %.0f bytes, series %.0f bytes per message, ratio %.2f\n", BENCH_BATCH,
+               (double)binary_bytes / batches, (double)series_bytes / batches,
+               series_bytes ? (double)binary_bytes / series_bytes : 0.0);
+    }
+
+    // ---- Flash backlog ----
+    // Room for the plain blocks and one more per flush interval, the flushed log may cut each one short
+    uint32_t flush_ms = config.rollup ? FLASH_LOG_ROLLUP_FLUSH_MS : FLASH_LOG_FLUSH_MS;
+    size_t blocks_needed = records.size() / FLASH_LOG_RECORDS_PER_BLOCK + (size_t)(span_ms / flush_ms) +
+                           FLASH_LOG_BLOCKS_PER_SECTOR;
+    size_t partition_size = (blocks_needed / FLASH_LOG_BLOCKS_PER_SECTOR + 1 + FLASH_LOG_JOURNAL_SECTORS) *
+                            FLASH_LOG_SECTOR_SIZE;
+    if (!host_flash_add_partition("plainlog", ESP_PARTITION_SUBTYPE_ANY, partition_size, NULL) ||
+        !host_flash_add_partition("serieslog", ESP_PARTITION_SUBTYPE_ANY, partition_size, NULL) ||
+        !host_flash_add_partition("flushedlog", ESP_PARTITION_SUBTYPE_ANY, partition_size, NULL)) {
+        fprintf(stderr, "cannot create the flash partitions\n");
+        return 1;
+    }
+    double plain_per_block = 0, series_per_block = 0, flushed_per_block = 0;
+    bool plain_ok = flashRun("plainlog", false, 0, records, &plain_per_block);
+    bool series_ok = flashRun("serieslog", true, 0, records, &series_per_block);
+    bool flushed_ok = flashRun("flushedlog", true, flush_ms, records, &flushed_per_block);
+    ok = ok && plain_ok && series_ok && flushed_ok;
+    uint32_t ring_blocks = (BENCH_PARTITION_KIB * 1024 / FLASH_LOG_SECTOR_SIZE - FLASH_LOG_JOURNAL_SECTORS) *
+                           FLASH_LOG_BLOCKS_PER_SECTOR;
+    printf("  flash plain      : %.1f records/block, %.1f days in %u KiB%s\n", plain_per_block,
+           records_per_day > 0 ? ring_blocks * plain_per_block / records_per_day : 0.0, BENCH_PARTITION_KIB,
+           plain_ok ? "" : ", READ BACK FAILED");
+    printf("  flash compressed : %.1f records/block, %.1f days in %u KiB%s\n", series_per_block,
+           records_per_day > 0 ? ring_blocks * series_per_block / records_per_day : 0.0, BENCH_PARTITION_KIB,
+           series_ok ? "" : ", READ BACK FAILED");
+    printf("  flash flushed    : %.1f records/block, %.1f days in %u KiB, a block written at least every %u s%s\n",
+           flushed_per_block, records_per_day > 0 ? ring_blocks * flushed_per_block / records_per_day : 0.0,
+           BENCH_PARTITION_KIB, flush_ms / 1000, flushed_ok ? "" : ", READ BACK FAILED");
+    return ok ? 0 : 1;
+}
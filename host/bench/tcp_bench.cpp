@@ -0,0 +1,314 @@
+/**
+ * @file tcp_bench.cpp
+ * @brief Modbus TCP clients over loopback against ModbusTcpServer and the register shadow.
+ *
+ * A poller task reads every slave once per poll period through the read plan
+ * of the default device profiles and stores the blocks in a ModbusShadow, as the gateway
+ * does. ModbusTcpServer serves the shadow on a free loopback port, and a
+ * number of client threads read the first block of every slave with function
+ * 0x03 back to back for the duration.
+ *
+ * Reported are TCP requests per second and their latency (p50, p99, max), next
+ * to the frames that went on the simulated serial bus in the same time: only
+ * the poller's. Then a client writes a holding register (0x06) and a coil
+ * (0x05) through the bus queue, reads the register back from the shadow and
+ * from the slave, and checks the exceptions for an unknown unit, an address
+ * outside the shadow and an unsupported function.
+ *
+ * Usage: tcp_bench [--clients N] [--duration S] [--slaves N] [--poll-ms MS]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host_hal.h"
+#include "Modbus.h"
+#include "ModbusBus.h"
+#include "ModbusProfiles.h"
+#include "ModbusReadPlan.h"
+#include "ModbusShadow.h"
+#include "ModbusTcpServer.h"
+
+struct BenchConfig {
+    int clients = 3;               // One slot of the server stays free for the write checks
+    double duration_s = 5.0;
+    int slaves = 3;
+    uint32_t poll_ms = 1000;
+};
+
+struct Poller {
+    ModbusBus* bus;
+    ModbusReadPlan* plan;
+    ModbusShadow* shadow;
+    int slaves;
+    uint32_t poll_ms;
+    std::atomic<uint32_t> cycles;
+};
+
+struct ClientResult {
+    uint32_t requests = 0;
+    uint32_t exceptions = 0;
+    std::vector<int64_t> latencies_us;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [--clients N] [--duration S] [--slaves N] [--poll-ms MS]\n", prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--clients") == 0 && has_value) {
+            config.clients = atoi(argv[++i]);
+        } else if (strcmp(arg, "--duration") == 0 && has_value) {
+            config.duration_s = atof(argv[++i]);
+        } else if (strcmp(arg, "--slaves") == 0 && has_value) {
+            config.slaves = atoi(argv[++i]);
+        } else if (strcmp(arg, "--poll-ms") == 0 && has_value) {
+            config.poll_ms = (uint32_t)atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.clients < 1 || config.clients > MB_TCP_MAX_CLIENTS - 1 || config.duration_s <= 0 ||
+        config.slaves < 1 || config.slaves > 3 || config.poll_ms < 1) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static void pollTask(void* arg) {
+    Poller* poller = static_cast<Poller*>(arg);
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        for (int slave = 1; slave <= poller->slaves; slave++) {
+            poller->plan->readSlave(poller->bus, (uint8_t)slave);
+            poller->shadow->update(*poller->plan, (uint8_t)slave);
+        }
+        poller->cycles++;
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(poller->poll_ms));
+    }
+}
+
+static int connectServer(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+// One request and its response, the PDU of the response in pdu; 0 on a connection error
+static size_t exchange(int fd, uint16_t transaction, uint8_t unit, const uint8_t* request, size_t request_len,
+                       uint8_t* pdu) {
+    uint8_t frame[MB_TCP_MAX_ADU];
+    frame[0] = (uint8_t)(transaction >> 8);
+    frame[1] = (uint8_t)transaction;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = (uint8_t)((request_len + 1) >> 8);
+    frame[5] = (uint8_t)(request_len + 1);
+    frame[6] = unit;
+    memcpy(&frame[MB_TCP_MBAP_LENGTH], request, request_len);
+    if (send(fd, frame, MB_TCP_MBAP_LENGTH + request_len, 0) != (ssize_t)(MB_TCP_MBAP_LENGTH + request_len)) {
+        return 0;
+    }
+
+    size_t have = 0;
+    size_t need = MB_TCP_MBAP_LENGTH;
+    while (have < need) {
+        ssize_t n = recv(fd, frame + have, need - have, 0);
+        if (n <= 0) {
+            return 0;
+        }
+        have += (size_t)n;
+        if (have == MB_TCP_MBAP_LENGTH) {
+            need = 6 + (size_t)((frame[4] << 8) | frame[5]);
+            if (need > sizeof(frame) || ((frame[0] << 8) | frame[1]) != transaction) {
+                return 0;
+            }
+        }
+    }
+    memcpy(pdu, &frame[MB_TCP_MBAP_LENGTH], need - MB_TCP_MBAP_LENGTH);
+    return need - MB_TCP_MBAP_LENGTH;
+}
+
+static size_t readRequest(uint8_t function, uint16_t address, uint16_t quantity, uint8_t* request) {
+    request[0] = function;
+    request[1] = (uint8_t)(address >> 8);
+    request[2] = (uint8_t)address;
+    request[3] = (uint8_t)(quantity >> 8);
+    request[4] = (uint8_t)quantity;
+    return 5;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+
+    host_set_time_scale(1.0);
+    host_log_set_console(NULL, 115200);
+    for (int addr = 1; addr <= config.slaves; addr++) {
+        host_mb_slave_add((uint8_t)addr);
+    }
+
+    ModbusBus bus(UART_NUM_1, 115200, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
+    ModbusProfiles profiles(device_types, num_device_types);
+    ModbusReadPlan plan;
+    ModbusShadow shadow;
+    if (profiles.setSlaves(default_slaves, num_default_slaves) != ESP_OK || !bus.init() || !plan.build(profiles) ||
+        !shadow.init(plan)) {
+        fprintf(stderr, "bus, plan or shadow setup failed\n");
+        return 1;
+    }
+    ModbusTcpServer server(&shadow);
+    mb_tcp_server_config_t server_config = MB_TCP_SERVER_DEFAULT_CONFIG();
+    server_config.port = 0;
+    server_config.max_age_ms = 3 * config.poll_ms;
+    server.setBus(&bus);
+    if (server.init(&server_config) != ESP_OK || server.start() != ESP_OK) {
+        fprintf(stderr, "server setup failed\n");
+        return 1;
+    }
+
+    Poller poller = { &bus, &plan, &shadow, config.slaves, config.poll_ms, {0} };
+    xTaskCreate(pollTask, "poller", 4096, &poller, 5, NULL);
+    while (poller.cycles == 0) {
+        host_sleep_us(1000);
+    }
+
+    const ModbusReadBlock& block = plan.getBlock(0);
+    printf("tcp_bench: %d clients over loopback port %u for %.1f s, %d slaves polled every %u ms, "
+           "%u-register reads\n", config.clients, (unsigned)server.getPort(), config.duration_s, config.slaves,
+           (unsigned)config.poll_ms, (unsigned)block.reg_size);
+
+    // ---- Reads from the shadow ----
+    host_mb_stats_t bus_before;
+    host_mb_get_stats(&bus_before);
+    uint32_t cycles_before = poller.cycles;
+    std::atomic<bool> stop(false);
+    std::vector<ClientResult> results(config.clients);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < config.clients; c++) {
+        threads.emplace_back([&, c] {
+            ClientResult& result = results[c];
+            int fd = connectServer(server.getPort());
+            if (fd < 0) {
+                return;
+            }
+            uint8_t request[5];
+            uint8_t pdu[256];
+            for (uint16_t transaction = 1; !stop; transaction++) {
+                uint8_t unit = (uint8_t)(1 + (transaction + c) % config.slaves);
+                size_t len = readRequest(MB_FUNC_READ_HOLDING_REGISTER, block.reg_start, block.reg_size, request);
+                auto begin = std::chrono::steady_clock::now();
+                size_t got = exchange(fd, transaction, unit, request, len, pdu);
+                if (got == 0) {
+                    break;
+                }
+                result.latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - begin).count());
+                result.requests++;
+                result.exceptions += (pdu[0] & 0x80) != 0 || got != 2 + 2 * (size_t)block.reg_size;
+            }
+            close(fd);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(config.duration_s));
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    host_mb_stats_t bus_after;
+    host_mb_get_stats(&bus_after);
+    uint32_t cycles = poller.cycles - cycles_before;
+
+    std::vector<int64_t> latencies;
+    uint32_t requests = 0;
+    uint32_t exceptions = 0;
+    for (const ClientResult& result : results) {
+        requests += result.requests;
+        exceptions += result.exceptions;
+        latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] / 1000.0;
+    };
+    uint64_t frames = bus_after.transactions - bus_before.transactions;
+    printf("  tcp reads    : %.0f requests/s, latency p50 %.3f ms p99 %.3f ms max %.3f ms, %u exceptions\n",
+           requests / seconds, percentile(0.5), percentile(0.99),
+           latencies.empty() ? 0.0 : latencies.back() / 1000.0, (unsigned)exceptions);
+    printf("  serial bus   : %llu frames in %u poll cycles (%.1f per cycle), %.1f%% busy\n",
+           (unsigned long long)frames, (unsigned)cycles, cycles ? (double)frames / cycles : 0.0,
+           100.0 * (double)(bus_after.busy_us - bus_before.busy_us) / (seconds * 1e6));
+
+    // ---- Writes through the bus queue, read back from the shadow ----
+    bool ok = requests > 0 && exceptions == 0;
+    int fd = connectServer(server.getPort());
+    uint8_t request[16];
+    uint8_t pdu[256];
+    uint16_t written = 0x4D42;
+    size_t len = readRequest(MB_FUNC_WRITE_SINGLE_REGISTER, block.reg_start, written, request);
+    auto begin = std::chrono::steady_clock::now();
+    bool write_ok = fd >= 0 && exchange(fd, 1, 1, request, len, pdu) == 5 && memcmp(pdu, request, 5) == 0;
+    double write_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    len = readRequest(MB_FUNC_WRITE_SINGLE_COIL, 0, 0xFF00, request);
+    write_ok = write_ok && exchange(fd, 2, 1, request, len, pdu) == 5 && memcmp(pdu, request, 5) == 0;
+    len = readRequest(MB_FUNC_READ_HOLDING_REGISTER, block.reg_start, 1, request);
+    bool readback = exchange(fd, 3, 1, request, len, pdu) == 4 && ((pdu[2] << 8) | pdu[3]) == written;
+    uint16_t direct = 0;
+    readback = readback && bus.transact(1, MB_FUNC_READ_HOLDING_REGISTER, block.reg_start, 1, &direct) == ESP_OK &&
+               direct == written;
+    printf("  writes       : 0x06 and 0x05 %s in %.2f ms, register read back %s\n", write_ok ? "answered" : "FAILED",
+           write_ms, readback ? "from the shadow and the slave" : "WRONG");
+
+    // ---- Exceptions ----
+    len = readRequest(MB_FUNC_READ_HOLDING_REGISTER, block.reg_start, 1, request);
+    bool unknown_unit = exchange(fd, 4, 0, request, len, pdu) == 2 && pdu[1] == MB_EX_GATEWAY_PATH;
+    len = readRequest(MB_FUNC_READ_HOLDING_REGISTER, 1000, 4, request);
+    bool outside = exchange(fd, 5, 1, request, len, pdu) == 2 && pdu[1] == MB_EX_ILLEGAL_DATA_ADDRESS;
+    len = readRequest(0x2B, 0, 0, request);
+    bool function = exchange(fd, 6, 1, request, len, pdu) == 2 && pdu[1] == MB_EX_ILLEGAL_FUNCTION;
+    printf("  exceptions   : unknown unit %s, unshadowed range %s, unsupported function %s\n",
+           unknown_unit ? "0x0A" : "WRONG", outside ? "0x02" : "WRONG", function ? "0x01" : "WRONG");
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    mb_tcp_server_stats_t stats;
+    server.getStats(&stats);
+    printf("  server       : %u connections, %u requests, %u reads, %u writes, %u exceptions\n",
+           (unsigned)stats.connections, (unsigned)stats.requests, (unsigned)stats.reads, (unsigned)stats.writes,
+           (unsigned)stats.exceptions);
+    fflush(stdout);
+
+    ok = ok && write_ok && readback && unknown_unit && outside && function;
+    _exit(ok ? 0 : 1);
+}
@@ -0,0 +1,257 @@
+/**
+ * @file uplink_bench.cpp
+ * @brief Backlog upload through MqttUplink: batched binary against JSON per reading.
+ *
+ * Each run fills a fresh flash log partition with a backlog of climate
+ * records and lets an MqttUplink send it to the in-process broker over a
+ * simulated link (round trip time, bandwidth, TCP send buffer). Four runs
+ * are compared: one JSON message per reading, one binary message per reading,
+ * binary batches and compressed series batches. Reported are messages and records per second on the
+ * simulated clock, payload and wire bytes per record (MQTT and TCP/IP headers
+ * included) and the PUBACK latency.
+ *
+ * The broker checks every record it receives, so records that never arrive
+ * and duplicates (resends after a lost PUBACK) are counted. With --drops the
+ * Wi-Fi link goes down for two seconds that many times during each run.
+ * The uplink's bandwidth budget is off unless --budget sets one.
+ *
+ * Usage: uplink_bench [--records N] [--batch B] [--linger-ms MS] [--in-flight W]
+ *                     [--rtt-ms MS] [--bandwidth-kbps K] [--broker-delay-ms MS]
+ *                     [--budget BYTES_PER_S] [--drops N] [--time-scale X]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "host_hal.h"
+#include "FlashLog.h"
+#include "MqttUplink.h"
+
+#define BENCH_TOPIC             "paktani/bench/records"
+#define BENCH_EPOCH_MS          1717000000000LL
+#define BENCH_RUN_TIMEOUT_US    (3600LL * 1000 * 1000)
+
+struct BenchConfig {
+    uint32_t records = 5000;
+    size_t batch = MQTT_UPLINK_BATCH_RECORDS;
+    uint32_t linger_ms = 1000;
+    size_t in_flight = MQTT_UPLINK_MAX_IN_FLIGHT;
+    uint32_t rtt_ms = 50;
+    uint32_t bandwidth_kbps = 1000;
+    uint32_t broker_delay_ms = 0;
+    uint32_t budget = 0;
+    uint32_t drops = 0;
+    double time_scale = 0.1;
+};
+
+// Broker side: which records arrived, and how often
+struct Receiver {
+    std::mutex mutex;
+    std::vector<uint8_t> seen;
+    uint64_t duplicates = 0;
+    uint64_t bad = 0;
+};
+
+static Receiver s_receiver;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--records N] [--batch B] [--linger-ms MS] [--in-flight W]\n"
+            "          [--rtt-ms MS] [--bandwidth-kbps K] [--broker-delay-ms MS] [--budget BYTES_PER_S]\n"
+            "          [--drops N] [--time-scale X]\n",
+            prog);
+    exit(2);
+}
+
+static BenchConfig parseArgs(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--records") == 0 && has_value) {
+            config.records = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--batch") == 0 && has_value) {
+            config.batch = (size_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--linger-ms") == 0 && has_value) {
+            config.linger_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--in-flight") == 0 && has_value) {
+            config.in_flight = (size_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--rtt-ms") == 0 && has_value) {
+            config.rtt_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--bandwidth-kbps") == 0 && has_value) {
+            config.bandwidth_kbps = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--broker-delay-ms") == 0 && has_value) {
+            config.broker_delay_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--budget") == 0 && has_value) {
+            config.budget = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--drops") == 0 && has_value) {
+            config.drops = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--time-scale") == 0 && has_value) {
+            config.time_scale = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.records < 1 || config.batch < 1 || config.batch > MQTT_UPLINK_MAX_BATCH ||
+        config.in_flight < 1 || config.in_flight > MQTT_UPLINK_IN_FLIGHT_LIMIT || config.time_scale <= 0) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static void markSeen(int64_t timestamp_ms) {
+    int64_t seq = (timestamp_ms - BENCH_EPOCH_MS) / 1000;
+    if (seq < 0 || seq >= (int64_t)s_receiver.seen.size()) {
+        s_receiver.bad++;
+    } else if (s_receiver.seen[seq]++ > 0) {
+        s_receiver.duplicates++;
+    }
+}
+
+static void receive(const char* topic, const uint8_t* data, size_t len, void* arg) {
+    (void)arg;
+    if (strcmp(topic, BENCH_TOPIC) != 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(s_receiver.mutex);
+    if (len > 0 && (data[0] == SENSOR_PAYLOAD_BINARY_V1 || data[0] == SENSOR_PAYLOAD_SERIES_V2)) {
+        static SensorRecord records[MQTT_UPLINK_MAX_BATCH];
+        size_t count = sensorPayloadDecode(data, len, records, MQTT_UPLINK_MAX_BATCH);
+        if (count == 0) {
+            s_receiver.bad++;
+        }
+        for (size_t i = 0; i < count; i++) {
+            markSeen(sensorRecordGetTimestamp(&records[i]));
+        }
+        return;
+    }
+    // JSON, pick out every "ts"
+    std::string text((const char*)data, len);
+    size_t at = 0;
+    while ((at = text.find("\"ts\":", at)) != std::string::npos) {
+        at += 5;
+        markSeen(strtoll(text.c_str() + at, NULL, 10));
+    }
+}
+
+static void makeRecord(SensorRecord* record, uint32_t seq) {
+    sensorRecordInit(record, (uint8_t)(1 + seq % 3), SENSOR_TAG_CLIMATE, BENCH_EPOCH_MS + (int64_t)seq * 1000);
+    sensorRecordSetValue(record, 0, SENSOR_VALUE_U16, 0);
+    sensorRecordSetValue(record, 1, SENSOR_VALUE_CENTI, 55.0f + (float)(seq % 700) / 100.0f);
+    sensorRecordSetValue(record, 2, SENSOR_VALUE_CENTI, 23.0f + (float)(seq % 300) / 100.0f);
+}
+
+static bool runOnce(const BenchConfig& config, int run, const char* name, sensor_payload_format_t format,
+                    size_t batch) {
+    // A fresh partition and log per run, sized for the backlog
+    char label[16];
+    snprintf(label, sizeof(label), "uplink%d", run);
+    uint32_t blocks = (config.records + FLASH_LOG_RECORDS_PER_BLOCK - 1) / FLASH_LOG_RECORDS_PER_BLOCK;
+    uint32_t sectors = FLASH_LOG_JOURNAL_SECTORS + 2 + blocks / FLASH_LOG_BLOCKS_PER_SECTOR;
+    if (!host_flash_add_partition(label, ESP_PARTITION_SUBTYPE_ANY, sectors * FLASH_LOG_SECTOR_SIZE, NULL)) {
+        fprintf(stderr, "cannot create partition %s\n", label);
+        return false;
+    }
+    FlashLog* log = new FlashLog(strdup(label));
+    if (log->mount() != ESP_OK) {
+        return false;
+    }
+    SensorRecord record;
+    for (uint32_t seq = 0; seq < config.records; seq++) {
+        makeRecord(&record, seq);
+        log->append(&record, 1);
+    }
+    log->flush();
+
+    {
+        std::lock_guard<std::mutex> lock(s_receiver.mutex);
+        s_receiver.seen.assign(config.records, 0);
+        s_receiver.duplicates = 0;
+        s_receiver.bad = 0;
+    }
+    host_mqtt_stats_t before, after;
+    host_mqtt_get_stats(&before);
+
+    mqtt_uplink_config_t uplink_config = MQTT_UPLINK_DEFAULT_CONFIG();
+    uplink_config.broker_uri = "mqtt://127.0.0.1";
+    uplink_config.topic = BENCH_TOPIC;
+    uplink_config.format = format;
+    uplink_config.batch_records = batch;
+    uplink_config.linger_ms = config.linger_ms;
+    uplink_config.max_in_flight = config.in_flight;
+    uplink_config.budget_bytes_per_s = config.budget;
+    MqttUplink* uplink = new MqttUplink(log);
+    int64_t start = host_time_us();
+    if (uplink->init(&uplink_config) != ESP_OK || uplink->start() != ESP_OK) {
+        return false;
+    }
+
+    // Wait for the whole backlog to be acknowledged, dropping the link on the way
+    mqtt_uplink_stats_t stats = {};
+    uint32_t drops = 0;
+    int64_t next_drop = 0;
+    while (host_time_us() - start < BENCH_RUN_TIMEOUT_US) {
+        host_sleep_us(20 * 1000);
+        uplink->getStats(&stats);
+        if (stats.records_acked >= config.records) {
+            break;
+        }
+        if (drops < config.drops && stats.records_acked >= (uint64_t)config.records * (drops + 1) / (config.drops + 1) &&
+            host_time_us() >= next_drop) {
+            host_wifi_set_link(false);
+            host_sleep_us(2 * 1000 * 1000);
+            host_wifi_set_link(true);
+            drops++;
+            next_drop = host_time_us() + 1000 * 1000;
+        }
+    }
+    double seconds = (double)(host_time_us() - start) / 1e6;
+    host_mqtt_get_stats(&after);
+
+    uint64_t missing = 0, duplicates, bad;
+    {
+        std::lock_guard<std::mutex> lock(s_receiver.mutex);
+        for (uint8_t count : s_receiver.seen) {
+            missing += count == 0;
+        }
+        duplicates = s_receiver.duplicates;
+        bad = s_receiver.bad;
+    }
+    uint64_t messages = after.publishes - before.publishes;
+    double per_record = 1.0 / config.records;
+    printf("  %-13s : %6llu messages, %7.1f msg/s, %8.1f records/s, %6.1f payload B/record, %6.1f wire B/record, "
+           "PUBACK mean %.1f ms max %.1f ms, %llu rewinds, %llu duplicates, %llu missing\n",
+           name, (unsigned long long)messages, messages / seconds, config.records / seconds,
+           (double)(after.payload_bytes - before.payload_bytes) * per_record,
+           (double)(after.wire_bytes - before.wire_bytes) * per_record,
+           stats.acks ? (double)stats.ack_latency_sum_us / stats.acks / 1000.0 : 0.0,
+           (double)stats.ack_latency_max_us / 1000.0, (unsigned long long)stats.rewinds,
+           (unsigned long long)duplicates, (unsigned long long)missing);
+    // The uplink task keeps running on its empty log, leave both in place
+    return missing == 0 && bad == 0 && log->getBacklogBlocks() == 0;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config = parseArgs(argc, argv);
+    host_set_time_scale(config.time_scale);
+    host_log_set_console(NULL, 0);
+    host_mqtt_set_link(config.rtt_ms, config.bandwidth_kbps);
+    host_mqtt_set_broker_delay_ms(config.broker_delay_ms);
+    host_mqtt_set_receiver(receive, NULL);
+
+    printf("uplink_bench: %u records backlog, %u ms RTT, %u kbit/s, %u in flight, %u link drops\n",
+           (unsigned)config.records, (unsigned)config.rtt_ms, (unsigned)config.bandwidth_kbps,
+           (unsigned)config.in_flight, (unsigned)config.drops);
+    char batched[32], series[32];
+    snprintf(batched, sizeof(batched), "binary x%u", (unsigned)config.batch);
+    snprintf(series, sizeof(series), "series x%u", (unsigned)config.batch);
+    bool ok = runOnce(config, 0, "JSON x1", SENSOR_PAYLOAD_JSON, 1);
+    ok = runOnce(config, 1, "binary x1", SENSOR_PAYLOAD_BINARY, 1) && ok;
+    ok = runOnce(config, 2, batched, SENSOR_PAYLOAD_BINARY, config.batch) && ok;
+    ok = runOnce(config, 3, series, SENSOR_PAYLOAD_SERIES, config.batch) && ok;
+    return ok ? 0 : 1;
+}
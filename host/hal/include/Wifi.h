@@ -0,0 +1,40 @@
+/**
+ * @file Wifi.h
+ * @brief Host stand-in for the Wifi driver. The link state is driven from the
+ *        host side with host_wifi_set_link().
+ */
+#ifndef WIFI_H
+#define WIFI_H
+
+#include <string>
+#include "esp_log.h"
+
+class Wifi {
+public:
+    // Constructor
+    Wifi();
+
+    // Destructor
+    ~Wifi();
+
+    // Initialize WiFi
+    bool init();
+
+    // Connect to the configured WiFi network
+    bool connect();
+
+    // Set the SSID for the WiFi network
+    void setSSID(const std::string& ssid);
+
+    // Set the password for the WiFi network
+    void setPassword(const std::string& password);
+
+private:
+    std::string ssid;
+    std::string password;
+
+    // Tag for logging
+    static constexpr const char* TAG = "Wifi";
+};
+
+#endif // WIFI_H
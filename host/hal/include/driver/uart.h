@@ -0,0 +1,81 @@
+/**
+ * @file uart.h
+ * @brief Host stand-in for the ESP-IDF UART driver.
+ *
+ * A port only moves bytes once it is attached to a serial device on the host
+ * (a pty from tools/mb_slave_sim, or a USB RS-485 adapter) with host_uart_attach().
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int uart_port_t;
+
+#define UART_NUM_0          (0)
+#define UART_NUM_1          (1)
+#define UART_NUM_2          (2)
+#define UART_NUM_MAX        (3)
+
+#define UART_PIN_NO_CHANGE  (-1)
+
+typedef enum {
+    UART_DATA_5_BITS = 0x0,
+    UART_DATA_6_BITS = 0x1,
+    UART_DATA_7_BITS = 0x2,
+    UART_DATA_8_BITS = 0x3
+} uart_word_length_t;
+
+typedef enum {
+    UART_STOP_BITS_1 = 0x1,
+    UART_STOP_BITS_1_5 = 0x2,
+    UART_STOP_BITS_2 = 0x3
+} uart_stop_bits_t;
+
+typedef enum {
+    UART_PARITY_DISABLE = 0x0,
+    UART_PARITY_EVEN = 0x2,
+    UART_PARITY_ODD = 0x3
+} uart_parity_t;
+
+typedef enum {
+    UART_HW_FLOWCTRL_DISABLE = 0x0,
+    UART_HW_FLOWCTRL_RTS = 0x1,
+    UART_HW_FLOWCTRL_CTS = 0x2,
+    UART_HW_FLOWCTRL_CTS_RTS = 0x3
+} uart_hw_flowcontrol_t;
+
+typedef enum {
+    UART_MODE_UART = 0x00,
+    UART_MODE_RS485_HALF_DUPLEX = 0x01
+} uart_mode_t;
+
+typedef enum {
+    UART_SCLK_APB = 0x0,
+    UART_SCLK_DEFAULT = UART_SCLK_APB
+} uart_sclk_t;
+
+typedef struct {
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t rx_flow_ctrl_thresh;
+    uart_sclk_t source_clk;
+} uart_config_t;
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, void* uart_queue, int intr_alloc_flags);
+esp_err_t uart_driver_delete(uart_port_t uart_num);
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t* uart_config);
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num);
+esp_err_t uart_set_mode(uart_port_t uart_num, uart_mode_t mode);
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh);
+int uart_write_bytes(uart_port_t uart_num, const void* src, size_t size);
+int uart_read_bytes(uart_port_t uart_num, void* buf, uint32_t length, TickType_t ticks_to_wait);
+esp_err_t uart_flush_input(uart_port_t uart_num);
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait);
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t* size);
@@ -0,0 +1,20 @@
+/**
+ * @file esp_event.h
+ * @brief Host stand-in for the ESP-IDF event types used by component callbacks.
+ *
+ * There is no default event loop on the host; components that post events
+ * call their registered handlers directly from their own thread.
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef const char* esp_event_base_t;
+
+typedef void (*esp_event_handler_t)(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id,
+                                    void* event_data);
+
+#define ESP_EVENT_ANY_ID        -1
+
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
@@ -0,0 +1,10 @@
+/**
+ * @file esp_rom_crc.h
+ * @brief Host stand-in for the CRC routines in the ESP32 ROM.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected). Pass 0 to start, or the previous result to continue.
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
@@ -0,0 +1,10 @@
+/**
+ * @file esp_timer.h
+ * @brief Host stand-in for the ESP-IDF high resolution timer.
+ */
+#pragma once
+
+#include <stdint.h>
+
+// Microseconds since boot, on the simulated (time scaled) clock
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,44 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host stand-in for the FreeRTOS kernel types, backed by std::thread.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ      (CONFIG_FREERTOS_HZ)
+#define portTICK_PERIOD_MS      ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdFAIL                  (pdFALSE)
+#define pdPASS                  (pdTRUE)
+#define errQUEUE_EMPTY          ((BaseType_t)0)
+#define errQUEUE_FULL           ((BaseType_t)0)
+
+#define tskNO_AFFINITY          ((BaseType_t)0x7FFFFFFF)
+
+// Spinlock critical sections. On the host a spinning lock is enough: the
+// sections are a few instructions long and "ISRs" run on ordinary threads.
+typedef struct {
+    volatile int owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+#define portMUX_INITIALIZE(mux)         ((mux)->owner = 0)
+
+void vPortEnterCritical(portMUX_TYPE* mux);
+void vPortExitCritical(portMUX_TYPE* mux);
+
+#define portENTER_CRITICAL(mux)         vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)          vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux)     vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)      vPortExitCritical(mux)
@@ -0,0 +1,25 @@
+/**
+ * @file queue.h
+ * @brief Host stand-in for the FreeRTOS queue API.
+ *
+ * Items are copied in and out exactly like the kernel does. Every queue keeps
+ * occupancy and latency statistics that host benchmarks read through
+ * host_queue_get_stats().
+ */
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct QueueDefinition* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+void vQueueDelete(QueueHandle_t xQueue);
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait);
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait);
+BaseType_t xQueueReset(QueueHandle_t xQueue);
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue);
@@ -0,0 +1,20 @@
+/**
+ * @file semphr.h
+ * @brief Host stand-in for the FreeRTOS semaphore and mutex API.
+ *
+ * Mutexes are binary semaphores that start available; priority inheritance
+ * and recursion are not emulated.
+ */
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct SemaphoreDefinition* SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount);
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
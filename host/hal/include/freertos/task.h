@@ -0,0 +1,49 @@
+/**
+ * @file task.h
+ * @brief Host stand-in for the FreeRTOS task API. Every task is a std::thread.
+ */
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct tskTaskControlBlock* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode,
+                       const char* pcName,
+                       uint32_t usStackDepth,
+                       void* pvParameters,
+                       UBaseType_t uxPriority,
+                       TaskHandle_t* pxCreatedTask);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pxTaskCode,
+                                   const char* pcName,
+                                   uint32_t usStackDepth,
+                                   void* pvParameters,
+                                   UBaseType_t uxPriority,
+                                   TaskHandle_t* pxCreatedTask,
+                                   BaseType_t xCoreID);
+
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+void vTaskDelay(TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t* pxPreviousWakeTime, TickType_t xTimeIncrement);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+typedef enum {
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction);
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t* pulNotificationValue, TickType_t xTicksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t* pxHigherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+
+#define taskYIELD() vTaskDelay(0)
+#define portYIELD_FROM_ISR(x) ((void)(x))
@@ -0,0 +1,228 @@
+/**
+ * @file host_hal.h
+ * @brief Host-side control and instrumentation of the fake ESP-IDF HAL.
+ *
+ * None of this exists on the target. Benchmarks use it to shape the simulated
+ * hardware (slaves, console, flash, Wi-Fi link, MQTT broker) and to read back
+ * what happened.
+ *
+ * All times are on the simulated clock. With a time scale below 1.0 every
+ * sleep, timeout and wire delay runs proportionally faster in wall time, so a
+ * minute of gateway operation can be benchmarked in a few seconds. CPU work is
+ * not scaled, so keep the scale close to 1.0 when CPU cost matters.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_partition.h"
+
+// ---------------------------------------------------------------------------
+// Simulated clock
+// ---------------------------------------------------------------------------
+
+// Set the simulated-to-wall time ratio. Call once, before any task starts.
+void host_set_time_scale(double scale);
+double host_get_time_scale(void);
+
+// Microseconds since start on the simulated clock
+int64_t host_time_us(void);
+
+// Block the calling thread for a simulated duration
+void host_sleep_us(int64_t us);
+
+// ---------------------------------------------------------------------------
+// Console (esp_log)
+// ---------------------------------------------------------------------------
+
+// Route log lines to out (NULL discards them) and charge the calling task the
+// time the line takes on a console UART at baud (0 disables the cost).
+void host_log_set_console(FILE* out, uint32_t baud);
+
+typedef struct {
+    uint64_t lines;
+    uint64_t bytes;
+    int64_t busy_us;    // Time spent by callers waiting on the console
+} host_log_stats_t;
+
+void host_log_get_stats(host_log_stats_t* stats);
+
+// ---------------------------------------------------------------------------
+// FreeRTOS queues
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t sends;             // Items accepted
+    uint64_t send_failures;     // Items rejected because the queue was full
+    uint64_t receives;          // Items handed to a receiver
+    UBaseType_t length;         // Queue capacity
+    UBaseType_t item_size;      // Bytes per item
+    UBaseType_t high_water;     // Highest occupancy seen
+    uint64_t occupancy_sum;     // Sum of the occupancy after each send
+    int64_t latency_sum_us;     // Sum of send -> receive time
+    int64_t latency_max_us;
+} host_queue_stats_t;
+
+void host_queue_get_stats(QueueHandle_t queue, host_queue_stats_t* stats);
+
+// ---------------------------------------------------------------------------
+// UART
+// ---------------------------------------------------------------------------
+
+// Back a UART port with a host serial device (raw mode, 8 data bits). Once the
+// port is attached, the fake mbcontroller talks RTU over it instead of
+// answering from the in-process slaves. Timing is then real, so run with a
+// time scale of 1.0.
+bool host_uart_attach(uart_port_t uart_num, const char* device, uint32_t baud);
+bool host_uart_is_attached(uart_port_t uart_num);
+
+// Back a UART port with an in-process RS-485 line instead: slaves first..last
+// (the host_mb_slave_add register map) answer each request frame after their
+// turnaround, at the baud rate on the simulated clock. Gives ModbusRtuMaster
+// a bus without a serial device, one per port, so several segments can be
+// polled side by side at any time scale.
+bool host_uart_attach_slaves(uart_port_t uart_num, uint8_t first, uint8_t last, uint32_t baud,
+                             uint32_t turnaround_us);
+bool host_uart_line_set_online(uart_port_t uart_num, uint8_t address, bool online);
+
+typedef struct {
+    uint64_t transactions;      // Request frames written to the line
+    uint64_t timeouts;          // Requests nobody answered
+    int64_t busy_us;            // Request, turnaround and response time on the line
+} host_uart_line_stats_t;
+
+bool host_uart_get_line_stats(uart_port_t uart_num, host_uart_line_stats_t* stats);
+
+// ---------------------------------------------------------------------------
+// Modbus RTU slaves behind the fake mbcontroller
+// ---------------------------------------------------------------------------
+
+// Add an online in-process slave. Its holding and input registers follow the
+// climate_sensor_params layout: ASCII name at 0..7, status at 8, humidity float at
+// 9..10 and temperature float at 11..12 (high word first), both slowly varying.
+// See host/sim/SlaveBank.h for the register map schema.
+void host_mb_slave_add(uint8_t address);
+
+// Replace the register map of all in-process slaves with a map file
+bool host_mb_load_register_map(const char* path);
+
+void host_mb_slave_set_online(uint8_t address, bool online);
+bool host_mb_slave_set_register(uint8_t address, uint16_t reg, uint16_t value);
+
+// Time a slave takes between the end of the request and its response
+void host_mb_set_turnaround_us(uint32_t turnaround_us);
+
+// Time the master waits for a silent slave before giving up
+void host_mb_set_response_timeout_ms(uint32_t timeout_ms);
+
+typedef struct {
+    uint64_t controller_inits;  // mbc_master_init() calls
+    uint64_t transactions;      // Requests put on the bus
+    uint64_t failures;          // Requests that did not complete
+    uint64_t timeouts;          // Requests that failed on the response timeout
+    uint64_t crc_errors;        // Responses rejected on their CRC (serial only)
+    int64_t busy_us;            // Total time the bus was in use
+    uint64_t cycles;            // Completed poll cycles (see below)
+    int64_t cycle_sum_us;       // Sum of poll cycle periods
+    int64_t cycle_max_us;
+} host_mb_stats_t;
+
+// A poll cycle starts at each request to the first slave that was added, or to
+// the lowest address seen so far when the bus is a serial device.
+void host_mb_get_stats(host_mb_stats_t* stats);
+
+// ---------------------------------------------------------------------------
+// I2C bus
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t transactions;
+    int64_t busy_us;
+} host_i2c_stats_t;
+
+void host_i2c_get_stats(host_i2c_stats_t* stats);
+
+// Wire the simulated DS3231 SQW output to a GPIO. The pin toggles at 1 Hz once
+// the firmware clears INTCN and RS2:RS1 in the control register.
+void host_ds3231_set_sqw_pin(gpio_num_t pin);
+
+// Make the simulated DS3231 oscillator run fast (positive) or slow against esp_timer
+void host_ds3231_set_drift_ppm(double ppm);
+
+// ---------------------------------------------------------------------------
+// SPI flash partitions (esp_partition)
+// ---------------------------------------------------------------------------
+
+// Register a data partition of size bytes (a multiple of SPI_FLASH_SEC_SIZE).
+// With an image path the contents are loaded from that file, created erased
+// if it does not exist, and every change is written through to it. NULL keeps
+// the partition in memory only.
+bool host_flash_add_partition(const char* label, esp_partition_subtype_t subtype, uint32_t size,
+                              const char* image_path);
+
+// Cut the power after bytes more bytes have been programmed (an erase counts
+// as one sector). The operation in progress stops part way, leaving a torn
+// write or a partly erased sector, and every later write or erase fails until
+// host_flash_power_on(). A negative count disarms.
+void host_flash_power_loss_after(int64_t bytes);
+void host_flash_power_on(void);
+bool host_flash_is_powered(void);
+
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t writes;            // esp_partition_write calls
+    uint64_t erases;            // Sectors erased
+    uint32_t max_sector_erases; // Erase count of the most worn sector
+    int64_t busy_us;            // Read, program and erase time
+} host_flash_stats_t;
+
+void host_flash_get_stats(host_flash_stats_t* stats);
+
+// ---------------------------------------------------------------------------
+// GPIO
+// ---------------------------------------------------------------------------
+
+// Drive an input pin from outside. Fires the ISR handler on a matching edge.
+void host_gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+
+// ---------------------------------------------------------------------------
+// Wi-Fi
+// ---------------------------------------------------------------------------
+
+void host_wifi_set_link(bool up);
+bool host_wifi_get_link(void);
+
+// ---------------------------------------------------------------------------
+// MQTT broker (mqtt_client)
+// ---------------------------------------------------------------------------
+
+// Shape the path to the broker. Takes effect for the next publish or connect.
+void host_mqtt_set_link(uint32_t rtt_ms, uint32_t bandwidth_kbps);
+
+// Time the broker takes to acknowledge a QoS 1 message, on top of the round trip
+void host_mqtt_set_broker_delay_ms(uint32_t delay_ms);
+
+// Called from the client thread with every message that reaches the broker
+typedef void (*host_mqtt_receiver_t)(const char* topic, const uint8_t* data, size_t len, void* arg);
+void host_mqtt_set_receiver(host_mqtt_receiver_t receiver, void* arg);
+
+typedef struct {
+    uint64_t connects;
+    uint64_t publishes;         // Messages accepted by esp_mqtt_client_publish
+    uint64_t publish_failures;  // Publishes refused while disconnected or timed out
+    uint64_t received;          // Messages that reached the broker
+    uint64_t acks;              // PUBACKs back at the client
+    uint64_t payload_bytes;     // Payload bytes that reached the broker
+    uint64_t wire_bytes;        // Bytes sent, MQTT and TCP/IP headers included
+    int64_t ack_latency_sum_us; // Publish call to PUBACK
+    int64_t ack_latency_max_us;
+} host_mqtt_stats_t;
+
+void host_mqtt_get_stats(host_mqtt_stats_t* stats);
@@ -0,0 +1,119 @@
+/**
+ * @file mbcontroller.h
+ * @brief Host stand-in for the esp-modbus master controller API.
+ *
+ * Requests are answered by simulated slaves (see host_hal.h). Each transaction
+ * blocks the caller for the time the frames would spend on the wire at the
+ * configured baud rate plus the slave turnaround, or for the response timeout
+ * when the slave is silent.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/uart.h"
+
+typedef enum {
+    MB_PORT_SERIAL_MASTER = 0x00,
+    MB_PORT_SERIAL_SLAVE,
+    MB_PORT_TCP_MASTER,
+    MB_PORT_TCP_SLAVE,
+    MB_PORT_COUNT,
+    MB_PORT_INACTIVE = 0xFF
+} mb_port_type_t;
+
+typedef enum {
+    MB_MODE_RTU,
+    MB_MODE_ASCII,
+    MB_MODE_TCP
+} mb_mode_type_t;
+
+typedef enum {
+    MB_PARAM_HOLDING = 0x00,
+    MB_PARAM_INPUT,
+    MB_PARAM_COIL,
+    MB_PARAM_DISCRETE,
+    MB_PARAM_COUNT,
+    MB_PARAM_UNKNOWN = 0xFF
+} mb_param_type_t;
+
+typedef enum {
+    PARAM_TYPE_U8 = 0x00,
+    PARAM_TYPE_U16 = 0x01,
+    PARAM_TYPE_U32 = 0x02,
+    PARAM_TYPE_FLOAT = 0x03,
+    PARAM_TYPE_ASCII = 0x04
+} mb_descr_type_t;
+
+typedef enum {
+    PARAM_SIZE_U8 = 0x01,
+    PARAM_SIZE_U16 = 0x02,
+    PARAM_SIZE_U32 = 0x04,
+    PARAM_SIZE_FLOAT = 0x04,
+    PARAM_SIZE_ASCII = 0x08,
+    PARAM_SIZE_ASCII24 = 0x18,
+    PARAM_MAX_SIZE
+} mb_descr_size_t;
+
+typedef union {
+    struct {
+        int opt1;
+        int opt2;
+        int opt3;
+    };
+    struct {
+        int min;
+        int max;
+        int step;
+    };
+} mb_parameter_opt_t;
+
+typedef enum {
+    PAR_PERMS_READ = 1 << 0,
+    PAR_PERMS_WRITE = 1 << 1,
+    PAR_PERMS_TRIGGER = 1 << 2,
+    PAR_PERMS_READ_WRITE = PAR_PERMS_READ | PAR_PERMS_WRITE,
+    PAR_PERMS_READ_TRIGGER = PAR_PERMS_READ | PAR_PERMS_TRIGGER,
+    PAR_PERMS_WRITE_TRIGGER = PAR_PERMS_WRITE | PAR_PERMS_TRIGGER,
+    PAR_PERMS_READ_WRITE_TRIGGER = PAR_PERMS_READ_WRITE | PAR_PERMS_TRIGGER
+} mb_param_perms_t;
+
+typedef struct {
+    uint16_t cid;
+    const char* param_key;
+    const char* param_units;
+    uint8_t mb_slave_addr;
+    mb_param_type_t mb_param_type;
+    uint16_t mb_reg_start;
+    uint16_t mb_size;
+    uint32_t param_offset;
+    mb_descr_type_t param_type;
+    mb_descr_size_t param_size;
+    mb_parameter_opt_t param_opts;
+    mb_param_perms_t access;
+} mb_parameter_descriptor_t;
+
+typedef struct {
+    uint8_t slave_addr;
+    uint8_t command;
+    uint16_t reg_start;
+    uint16_t reg_size;
+} mb_param_request_t;
+
+typedef struct {
+    mb_mode_type_t mode;
+    uint8_t slave_addr;
+    uart_port_t port;
+    uint32_t baudrate;
+    uart_parity_t parity;
+    uint16_t dummy_port;
+} mb_communication_info_t;
+
+esp_err_t mbc_master_init(mb_port_type_t port_type, void** handler);
+esp_err_t mbc_master_setup(void* comm_info);
+esp_err_t mbc_master_start(void);
+esp_err_t mbc_master_destroy(void);
+esp_err_t mbc_master_set_descriptor(const mb_parameter_descriptor_t* descriptor, const uint16_t num_elements);
+esp_err_t mbc_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_info);
+esp_err_t mbc_master_send_request(mb_param_request_t* request, void* data_ptr);
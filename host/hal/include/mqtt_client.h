@@ -0,0 +1,104 @@
+/**
+ * @file mqtt_client.h
+ * @brief Host stand-in for the esp-mqtt client, talking to an in-process broker.
+ *
+ * The client follows the simulated Wi-Fi link: it connects two round trips
+ * after the link comes up and drops the connection when it goes down. A
+ * publish is charged its bytes on the wire (MQTT and TCP/IP headers included)
+ * at the link bandwidth. It returns as soon as the message fits in the TCP
+ * send buffer and blocks while the buffer is full, up to network.timeout_ms.
+ * QoS 1 messages reach the broker half a round trip after their last byte
+ * and are acknowledged (MQTT_EVENT_PUBLISHED) after the broker delay and the
+ * other half.
+ *
+ * Unlike esp-mqtt there is no outbox: a QoS 1 publish while disconnected
+ * fails, and messages in flight when the connection drops are never
+ * acknowledged, whether or not the broker got them. Link parameters are set
+ * with host_mqtt_set_link(). Only the fields below are honoured.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+ESP_EVENT_DECLARE_BASE(MQTT_EVENTS);
+
+typedef struct esp_mqtt_client* esp_mqtt_client_handle_t;
+
+typedef enum {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct {
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char* data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char* topic;
+    int topic_len;
+    int msg_id;
+    int session_present;
+    int qos;
+    bool retain;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t* esp_mqtt_event_handle_t;
+
+typedef struct esp_mqtt_client_config_t {
+    struct broker_t {
+        struct address_t {
+            const char* uri;
+        } address;
+    } broker;
+    struct credentials_t {
+        const char* username;
+        const char* client_id;
+    } credentials;
+    struct session_t {
+        bool disable_clean_session;
+        int keepalive;
+    } session;
+    struct network_t {
+        int reconnect_timeout_ms;
+        int timeout_ms;             // Longest a publish blocks on a full send buffer, 10 s if 0
+    } network;
+    struct task_t {
+        int priority;
+        int stack_size;
+    } task;
+    struct buffer_t {
+        int size;
+        int out_size;
+    } buffer;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config);
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void* event_handler_arg);
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Publish a message.
+ *
+ * @return Message id (0 for QoS 0), -1 when not connected or the send timed out.
+ */
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len,
+                            int qos, int retain);
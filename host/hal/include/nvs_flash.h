@@ -0,0 +1,10 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host stand-in for the NVS partition setup.
+ */
+#pragma once
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
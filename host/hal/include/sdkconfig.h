@@ -0,0 +1,17 @@
+/**
+ * @file sdkconfig.h
+ * @brief Host stand-in for the menuconfig generated configuration.
+ */
+#pragma once
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_IDF_TARGET_LINUX 1
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+
+#define CONFIG_MB_UART_PORT_NUM 1
+#define CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND 150
+
+#define CONFIG_LWIP_TCP_SND_BUF_DEFAULT 5760
+#define CONFIG_LWIP_TCP_MSS 1436
@@ -0,0 +1,37 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "host_hal.h"
+#include "esp_timer.h"
+
+static const std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+static std::atomic<double> s_time_scale{1.0};
+
+void host_set_time_scale(double scale) {
+    if (scale > 0.0) {
+        s_time_scale = scale;
+    }
+}
+
+double host_get_time_scale(void) {
+    return s_time_scale;
+}
+
+int64_t host_time_us(void) {
+    auto wall = std::chrono::steady_clock::now() - s_start;
+    double wall_us = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count() / 1000.0;
+    return (int64_t)(wall_us / s_time_scale);
+}
+
+void host_sleep_us(int64_t us) {
+    if (us <= 0) {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::nanoseconds((int64_t)(us * 1000.0 * s_time_scale)));
+}
+
+int64_t esp_timer_get_time(void) {
+    return host_time_us();
+}
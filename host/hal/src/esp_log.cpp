@@ -0,0 +1,83 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "esp_log.h"
+#include "host_hal.h"
+#include "sdkconfig.h"
+
+static std::mutex s_console_mutex;
+static FILE* s_console_out = stdout;
+static uint32_t s_console_baud = 0;
+static host_log_stats_t s_stats;
+
+static std::mutex s_level_mutex;
+static esp_log_level_t s_default_level = (esp_log_level_t)CONFIG_LOG_DEFAULT_LEVEL;
+static std::map<std::string, esp_log_level_t> s_tag_levels;
+
+static const char s_level_letter[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+
+void host_log_set_console(FILE* out, uint32_t baud) {
+    std::lock_guard<std::mutex> lock(s_console_mutex);
+    s_console_out = out;
+    s_console_baud = baud;
+}
+
+void host_log_get_stats(host_log_stats_t* stats) {
+    std::lock_guard<std::mutex> lock(s_console_mutex);
+    *stats = s_stats;
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level) {
+    std::lock_guard<std::mutex> lock(s_level_mutex);
+    if (tag[0] == '*' && tag[1] == '\0') {
+        s_default_level = level;
+        s_tag_levels.clear();
+    } else {
+        s_tag_levels[tag] = level;
+    }
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(host_time_us() / 1000);
+}
+
+static esp_log_level_t levelForTag(const char* tag) {
+    std::lock_guard<std::mutex> lock(s_level_mutex);
+    auto it = s_tag_levels.find(tag);
+    return it != s_tag_levels.end() ? it->second : s_default_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...) {
+    if (level > levelForTag(tag)) {
+        return;
+    }
+
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%c (%u) %s: ", s_level_letter[level], (unsigned)esp_log_timestamp(), tag);
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(line + len, sizeof(line) - len, format, args);
+    va_end(args);
+    if (len > (int)sizeof(line) - 2) {
+        len = sizeof(line) - 2;
+    }
+    line[len++] = '\n';
+    line[len] = '\0';
+
+    // The console UART is shared, so writers queue behind each other like on the target
+    std::lock_guard<std::mutex> lock(s_console_mutex);
+    int64_t start = host_time_us();
+    if (s_console_out != NULL) {
+        fputs(line, s_console_out);
+    }
+    if (s_console_baud > 0) {
+        host_sleep_us((int64_t)len * 10 * 1000000 / s_console_baud);
+    }
+    s_stats.lines++;
+    s_stats.bytes += len;
+    s_stats.busy_us += host_time_us() - start;
+}
@@ -0,0 +1,26 @@
+#include "esp_rom_crc.h"
+
+static uint32_t s_crc32_table[256];
+static bool s_crc32_ready = false;
+
+static void buildTable(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+        s_crc32_table[i] = crc;
+    }
+    s_crc32_ready = true;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    if (!s_crc32_ready) {
+        buildTable();
+    }
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc = s_crc32_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
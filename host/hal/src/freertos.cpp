@@ -0,0 +1,366 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "host_hal.h"
+
+#define TICK_PERIOD_US (1000000 / configTICK_RATE_HZ)
+
+// Wait on cv until pred holds or the tick timeout runs out on the simulated clock
+template <typename Pred>
+static bool waitTicks(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Pred pred) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, pred);
+        return true;
+    }
+    double real_ns = (double)ticks * TICK_PERIOD_US * 1000.0 * host_get_time_scale();
+    return cv.wait_for(lock, std::chrono::nanoseconds((int64_t)real_ns), pred);
+}
+
+// ---------------------------------------------------------------------------
+// Critical sections
+// ---------------------------------------------------------------------------
+
+void vPortEnterCritical(portMUX_TYPE* mux) {
+    while (__atomic_exchange_n(&mux->owner, 1, __ATOMIC_ACQUIRE) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+void vPortExitCritical(portMUX_TYPE* mux) {
+    __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+// ---------------------------------------------------------------------------
+// Tasks
+// ---------------------------------------------------------------------------
+
+struct tskTaskControlBlock {
+    std::string name;
+    TaskFunction_t code;
+    void* parameters;
+    UBaseType_t priority;
+    BaseType_t core_id;
+
+    // Direct-to-task notification
+    std::mutex notify_mutex;
+    std::condition_variable notify_cv;
+    uint32_t notify_value = 0;
+    bool notify_pending = false;
+};
+
+// Thrown by vTaskDelete(NULL) to unwind the calling task's thread
+struct TaskDeleted {};
+
+static thread_local TaskHandle_t s_current_task = NULL;
+
+static void taskEntry(TaskHandle_t task) {
+    s_current_task = task;
+    try {
+        task->code(task->parameters);
+    } catch (const TaskDeleted&) {
+    }
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pxTaskCode, const char* pcName, uint32_t usStackDepth,
+                                   void* pvParameters, UBaseType_t uxPriority, TaskHandle_t* pxCreatedTask,
+                                   BaseType_t xCoreID) {
+    (void)usStackDepth;
+    // Task control blocks are never freed, handles stay valid for the process lifetime
+    TaskHandle_t task = new tskTaskControlBlock();
+    task->name = pcName;
+    task->code = pxTaskCode;
+    task->parameters = pvParameters;
+    task->priority = uxPriority;
+    task->core_id = xCoreID;
+    std::thread(taskEntry, task).detach();
+    if (pxCreatedTask != NULL) {
+        *pxCreatedTask = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char* pcName, uint32_t usStackDepth,
+                       void* pvParameters, UBaseType_t uxPriority, TaskHandle_t* pxCreatedTask) {
+    return xTaskCreatePinnedToCore(pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority,
+                                   pxCreatedTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    // Only self-deletion can be emulated with threads
+    if (xTaskToDelete == NULL || xTaskToDelete == s_current_task) {
+        throw TaskDeleted();
+    }
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    host_sleep_us((int64_t)xTicksToDelay * TICK_PERIOD_US);
+}
+
+void vTaskDelayUntil(TickType_t* pxPreviousWakeTime, TickType_t xTimeIncrement) {
+    TickType_t wake = *pxPreviousWakeTime + xTimeIncrement;
+    int64_t remaining = (int64_t)wake * TICK_PERIOD_US - host_time_us();
+    if (remaining > 0) {
+        host_sleep_us(remaining);
+    }
+    *pxPreviousWakeTime = wake;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(host_time_us() / TICK_PERIOD_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    // Threads that were not started through xTaskCreate (app_main in a host
+    // harness) are adopted on first use, like the main task on the target
+    if (s_current_task == NULL) {
+        s_current_task = new tskTaskControlBlock();
+        s_current_task->name = "main";
+    }
+    return s_current_task;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction) {
+    BaseType_t result = pdPASS;
+    {
+        std::lock_guard<std::mutex> lock(xTaskToNotify->notify_mutex);
+        switch (eAction) {
+            case eSetBits:               xTaskToNotify->notify_value |= ulValue; break;
+            case eIncrement:             xTaskToNotify->notify_value++; break;
+            case eSetValueWithOverwrite: xTaskToNotify->notify_value = ulValue; break;
+            case eSetValueWithoutOverwrite:
+                if (xTaskToNotify->notify_pending) {
+                    result = pdFAIL;
+                } else {
+                    xTaskToNotify->notify_value = ulValue;
+                }
+                break;
+            case eNoAction:
+                break;
+        }
+        xTaskToNotify->notify_pending = true;
+    }
+    xTaskToNotify->notify_cv.notify_all();
+    return result;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify) {
+    return xTaskNotify(xTaskToNotify, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t* pxHigherPriorityTaskWoken) {
+    xTaskNotify(xTaskToNotify, 0, eIncrement);
+    if (pxHigherPriorityTaskWoken != NULL) {
+        *pxHigherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(self->notify_mutex);
+    waitTicks(self->notify_cv, lock, xTicksToWait, [self] { return self->notify_value != 0; });
+    uint32_t value = self->notify_value;
+    if (value != 0) {
+        self->notify_value = xClearCountOnExit ? 0 : value - 1;
+    }
+    self->notify_pending = false;
+    return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t* pulNotificationValue, TickType_t xTicksToWait) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(self->notify_mutex);
+    if (!self->notify_pending) {
+        self->notify_value &= ~ulBitsToClearOnEntry;
+    }
+    bool notified = waitTicks(self->notify_cv, lock, xTicksToWait, [self] { return self->notify_pending; });
+    if (pulNotificationValue != NULL) {
+        *pulNotificationValue = self->notify_value;
+    }
+    if (!notified) {
+        return pdFAIL;
+    }
+    self->notify_value &= ~ulBitsToClearOnExit;
+    self->notify_pending = false;
+    return pdPASS;
+}
+
+// ---------------------------------------------------------------------------
+// Queues
+// ---------------------------------------------------------------------------
+
+struct QueueDefinition {
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    std::vector<uint8_t> storage;
+    std::deque<int64_t> enqueue_times;    // Send timestamp of every queued item
+    UBaseType_t head;
+    UBaseType_t count;
+    host_queue_stats_t stats;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+    if (uxQueueLength == 0 || uxItemSize == 0) {
+        return NULL;
+    }
+    QueueHandle_t queue = new QueueDefinition();
+    queue->length = uxQueueLength;
+    queue->item_size = uxItemSize;
+    queue->storage.resize((size_t)uxQueueLength * uxItemSize);
+    queue->head = 0;
+    queue->count = 0;
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    queue->stats.length = uxQueueLength;
+    queue->stats.item_size = uxItemSize;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t xQueue) {
+    delete xQueue;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+    if (!waitTicks(xQueue->not_full, lock, xTicksToWait, [xQueue] { return xQueue->count < xQueue->length; })) {
+        xQueue->stats.send_failures++;
+        return errQUEUE_FULL;
+    }
+    UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+    memcpy(&xQueue->storage[(size_t)tail * xQueue->item_size], pvItemToQueue, xQueue->item_size);
+    xQueue->enqueue_times.push_back(host_time_us());
+    xQueue->count++;
+
+    xQueue->stats.sends++;
+    xQueue->stats.occupancy_sum += xQueue->count;
+    if (xQueue->count > xQueue->stats.high_water) {
+        xQueue->stats.high_water = xQueue->count;
+    }
+    lock.unlock();
+    xQueue->not_empty.notify_one();
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait) {
+    return xQueueSendToBack(xQueue, pvItemToQueue, xTicksToWait);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+    if (!waitTicks(xQueue->not_empty, lock, xTicksToWait, [xQueue] { return xQueue->count > 0; })) {
+        return pdFAIL;
+    }
+    memcpy(pvBuffer, &xQueue->storage[(size_t)xQueue->head * xQueue->item_size], xQueue->item_size);
+    xQueue->head = (xQueue->head + 1) % xQueue->length;
+    xQueue->count--;
+
+    int64_t latency = host_time_us() - xQueue->enqueue_times.front();
+    xQueue->enqueue_times.pop_front();
+    xQueue->stats.receives++;
+    xQueue->stats.latency_sum_us += latency;
+    if (latency > xQueue->stats.latency_max_us) {
+        xQueue->stats.latency_max_us = latency;
+    }
+    lock.unlock();
+    xQueue->not_full.notify_one();
+    return pdPASS;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+    if (!waitTicks(xQueue->not_empty, lock, xTicksToWait, [xQueue] { return xQueue->count > 0; })) {
+        return pdFAIL;
+    }
+    memcpy(pvBuffer, &xQueue->storage[(size_t)xQueue->head * xQueue->item_size], xQueue->item_size);
+    return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue) {
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+    xQueue->head = 0;
+    xQueue->count = 0;
+    xQueue->enqueue_times.clear();
+    lock.unlock();
+    xQueue->not_full.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+    std::lock_guard<std::mutex> lock(xQueue->mutex);
+    return xQueue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue) {
+    std::lock_guard<std::mutex> lock(xQueue->mutex);
+    return xQueue->length - xQueue->count;
+}
+
+void host_queue_get_stats(QueueHandle_t queue, host_queue_stats_t* stats) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    *stats = queue->stats;
+}
+
+// ---------------------------------------------------------------------------
+// Semaphores and mutexes
+// ---------------------------------------------------------------------------
+
+struct SemaphoreDefinition {
+    std::mutex mutex;
+    std::condition_variable available;
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount) {
+    if (uxMaxCount == 0 || uxInitialCount > uxMaxCount) {
+        return NULL;
+    }
+    SemaphoreHandle_t semaphore = new SemaphoreDefinition();
+    semaphore->count = uxInitialCount;
+    semaphore->max_count = uxMaxCount;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore) {
+    delete xSemaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xSemaphore->mutex);
+    if (!waitTicks(xSemaphore->available, lock, xTicksToWait, [xSemaphore] { return xSemaphore->count > 0; })) {
+        return pdFAIL;
+    }
+    xSemaphore->count--;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) {
+    std::unique_lock<std::mutex> lock(xSemaphore->mutex);
+    if (xSemaphore->count >= xSemaphore->max_count) {
+        return pdFAIL;
+    }
+    xSemaphore->count++;
+    lock.unlock();
+    xSemaphore->available.notify_one();
+    return pdPASS;
+}
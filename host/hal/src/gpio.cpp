@@ -0,0 +1,131 @@
+#include <mutex>
+
+#include "driver/gpio.h"
+#include "host_hal.h"
+
+struct PinState {
+    gpio_mode_t mode;
+    gpio_int_type_t intr_type;
+    uint32_t level;
+    gpio_isr_t isr;
+    void* isr_arg;
+};
+
+static std::mutex s_gpio_mutex;
+static PinState s_pins[GPIO_NUM_MAX];
+static bool s_isr_service_installed = false;
+
+static bool validPin(gpio_num_t gpio_num) {
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX;
+}
+
+esp_err_t gpio_config(const gpio_config_t* pGPIOConfig) {
+    if (pGPIOConfig == NULL) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    for (int pin = 0; pin < GPIO_NUM_MAX; pin++) {
+        if (pGPIOConfig->pin_bit_mask & (1ULL << pin)) {
+            s_pins[pin].mode = pGPIOConfig->mode;
+            s_pins[pin].intr_type = pGPIOConfig->intr_type;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num) {
+    if (!validPin(gpio_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    s_pins[gpio_num] = PinState{};
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    if (!validPin(gpio_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    s_pins[gpio_num].level = level ? 1 : 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+    if (!validPin(gpio_num)) return 0;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    return (int)s_pins[gpio_num].level;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+    if (!validPin(gpio_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    s_pins[gpio_num].mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+    if (!validPin(gpio_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    s_pins[gpio_num].intr_type = intr_type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+    (void)intr_alloc_flags;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    if (s_isr_service_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_isr_service_installed = true;
+    return ESP_OK;
+}
+
+void gpio_uninstall_isr_service(void) {
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    s_isr_service_installed = false;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void* args) {
+    if (!validPin(gpio_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    if (!s_isr_service_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_pins[gpio_num].isr = isr_handler;
+    s_pins[gpio_num].isr_arg = args;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num) {
+    if (!validPin(gpio_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_gpio_mutex);
+    s_pins[gpio_num].isr = NULL;
+    s_pins[gpio_num].isr_arg = NULL;
+    return ESP_OK;
+}
+
+void host_gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+    if (!validPin(gpio_num)) return;
+
+    gpio_isr_t isr = NULL;
+    void* isr_arg = NULL;
+    {
+        std::lock_guard<std::mutex> lock(s_gpio_mutex);
+        PinState& pin = s_pins[gpio_num];
+        uint32_t previous = pin.level;
+        pin.level = level ? 1 : 0;
+
+        bool fire = false;
+        switch (pin.intr_type) {
+            case GPIO_INTR_POSEDGE:    fire = !previous && pin.level; break;
+            case GPIO_INTR_NEGEDGE:    fire = previous && !pin.level; break;
+            case GPIO_INTR_ANYEDGE:    fire = previous != pin.level; break;
+            case GPIO_INTR_LOW_LEVEL:  fire = !pin.level; break;
+            case GPIO_INTR_HIGH_LEVEL: fire = pin.level; break;
+            default:                   break;
+        }
+        if (fire && s_isr_service_installed) {
+            isr = pin.isr;
+            isr_arg = pin.isr_arg;
+        }
+    }
+    // Handlers run outside the lock, they may touch GPIO themselves
+    if (isr != NULL) {
+        isr(isr_arg);
+    }
+}
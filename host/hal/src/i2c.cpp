@@ -0,0 +1,245 @@
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "driver/i2c.h"
+#include "host_hal.h"
+
+// Standard mode clock, 9 clocks per byte (8 data + ACK)
+#define I2C_CLOCK_HZ 100000
+#define I2C_BYTE_US (9 * 1000000 / I2C_CLOCK_HZ)
+
+#define DS3231_ADDRESS 0x68
+#define DS3231_REGISTERS 0x13
+#define DS3231_CONTROL 0x0e
+#define DS3231_CONTROL_SQW_MASK 0x1c    // INTCN and RS2:RS1, all clear for a 1 Hz square wave
+
+enum CommandType { CMD_START, CMD_STOP, CMD_WRITE, CMD_READ };
+
+struct Command {
+    CommandType type;
+    std::vector<uint8_t> data;  // Bytes to write
+    uint8_t* out;               // Destination for reads
+    size_t len;
+};
+
+struct CommandLink {
+    std::vector<Command> commands;
+};
+
+static std::mutex s_i2c_mutex;
+static host_i2c_stats_t s_stats;
+
+// DS3231 register file. Time registers are generated from the host clock,
+// running fast or slow by the configured drift. Control powers up with INTCN set.
+static uint8_t s_ds3231_regs[DS3231_REGISTERS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x1c };
+static uint8_t s_ds3231_pointer = 0;
+static int64_t s_ds3231_offset_s = 0;
+static std::atomic<double> s_ds3231_drift_ppm{0.0};
+static std::atomic<int> s_ds3231_sqw_pin{GPIO_NUM_NC};
+
+static uint8_t dec2bcd(int val) {
+    return (uint8_t)(((val / 10) << 4) | (val % 10));
+}
+
+static int bcd2dec(uint8_t val) {
+    return (val >> 4) * 10 + (val & 0x0f);
+}
+
+// Microseconds counted by the DS3231 oscillator since boot
+static int64_t ds3231Micros(int64_t host_us) {
+    return host_us + (int64_t)((double)host_us * s_ds3231_drift_ppm / 1e6);
+}
+
+static time_t ds3231Now() {
+    static const time_t boot = time(NULL);
+    return boot + s_ds3231_offset_s + ds3231Micros(host_time_us()) / 1000000;
+}
+
+// Drives the SQW pin: falls as the seconds register advances, rises half a second later
+static void ds3231SquareWave() {
+    while (true) {
+        int64_t host_us = host_time_us();
+        int64_t rtc_us = ds3231Micros(host_us);
+        int64_t next = (rtc_us / 500000 + 1) * 500000;
+        host_sleep_us((int64_t)((double)(next - rtc_us) / (1.0 + s_ds3231_drift_ppm / 1e6)) + 1);
+
+        bool enabled;
+        {
+            std::lock_guard<std::mutex> lock(s_i2c_mutex);
+            enabled = (s_ds3231_regs[DS3231_CONTROL] & DS3231_CONTROL_SQW_MASK) == 0;
+        }
+        if (enabled) {
+            host_gpio_set_level((gpio_num_t)s_ds3231_sqw_pin.load(), next % 1000000 != 0);
+        }
+    }
+}
+
+static uint8_t ds3231Read(uint8_t reg) {
+    if (reg <= 0x06) {
+        time_t now = ds3231Now();
+        struct tm t;
+        gmtime_r(&now, &t);
+        switch (reg) {
+            case 0: return dec2bcd(t.tm_sec);
+            case 1: return dec2bcd(t.tm_min);
+            case 2: return dec2bcd(t.tm_hour);
+            case 3: return dec2bcd(t.tm_wday + 1);
+            case 4: return dec2bcd(t.tm_mday);
+            case 5: return dec2bcd(t.tm_mon + 1);
+            default: return dec2bcd(t.tm_year % 100);
+        }
+    }
+    if (reg == 0x11) return 25;     // Temperature MSB, 25.25 C
+    if (reg == 0x12) return 0x40;   // Temperature LSB
+    return s_ds3231_regs[reg % DS3231_REGISTERS];
+}
+
+static void ds3231Write(const std::vector<uint8_t>& bytes) {
+    if (bytes.empty()) return;
+    s_ds3231_pointer = bytes[0];
+    if (bytes.size() < 2) return;
+
+    for (size_t i = 1; i < bytes.size(); i++) {
+        s_ds3231_regs[(s_ds3231_pointer + i - 1) % DS3231_REGISTERS] = bytes[i];
+    }
+    // A write that covers the seconds register sets the clock
+    if (s_ds3231_pointer == 0 && bytes.size() >= 8) {
+        struct tm t = {};
+        t.tm_sec = bcd2dec(s_ds3231_regs[0]);
+        t.tm_min = bcd2dec(s_ds3231_regs[1]);
+        t.tm_hour = bcd2dec(s_ds3231_regs[2]);
+        t.tm_mday = bcd2dec(s_ds3231_regs[4]);
+        t.tm_mon = bcd2dec(s_ds3231_regs[5] & 0x1f) - 1;
+        t.tm_year = bcd2dec(s_ds3231_regs[6]) + 100;
+        s_ds3231_offset_s += (int64_t)timegm(&t) - (int64_t)ds3231Now();
+    }
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t* i2c_conf) {
+    (void)i2c_num; (void)i2c_conf;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len,
+                             size_t slv_tx_buf_len, int intr_alloc_flags) {
+    (void)i2c_num; (void)mode; (void)slv_rx_buf_len; (void)slv_tx_buf_len; (void)intr_alloc_flags;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num) {
+    (void)i2c_num;
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+    return new CommandLink();
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle) {
+    delete static_cast<CommandLink*>(cmd_handle);
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle) {
+    static_cast<CommandLink*>(cmd_handle)->commands.push_back({CMD_START, {}, NULL, 0});
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle) {
+    static_cast<CommandLink*>(cmd_handle)->commands.push_back({CMD_STOP, {}, NULL, 0});
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, const uint8_t* data, size_t data_len, bool ack_en) {
+    (void)ack_en;
+    std::vector<uint8_t> bytes(data, data + data_len);
+    static_cast<CommandLink*>(cmd_handle)->commands.push_back({CMD_WRITE, bytes, NULL, data_len});
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en) {
+    return i2c_master_write(cmd_handle, &data, 1, ack_en);
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd_handle, uint8_t* data, size_t data_len, i2c_ack_type_t ack) {
+    (void)ack;
+    static_cast<CommandLink*>(cmd_handle)->commands.push_back({CMD_READ, {}, data, data_len});
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t* data, i2c_ack_type_t ack) {
+    return i2c_master_read(cmd_handle, data, 1, ack);
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait) {
+    (void)i2c_num; (void)ticks_to_wait;
+    CommandLink* link = static_cast<CommandLink*>(cmd_handle);
+    std::lock_guard<std::mutex> lock(s_i2c_mutex);
+
+    size_t bytes_on_bus = 0;
+    esp_err_t result = ESP_OK;
+    bool expect_address = false;
+    bool selected = false;
+    bool reading = false;
+    std::vector<uint8_t> written;
+
+    for (const Command& cmd : link->commands) {
+        switch (cmd.type) {
+            case CMD_START:
+                if (selected && !reading) ds3231Write(written);
+                written.clear();
+                expect_address = true;
+                break;
+            case CMD_STOP:
+                if (selected && !reading) ds3231Write(written);
+                written.clear();
+                selected = false;
+                break;
+            case CMD_WRITE:
+                bytes_on_bus += cmd.len;
+                for (size_t i = 0; i < cmd.len; i++) {
+                    if (expect_address) {
+                        expect_address = false;
+                        selected = (cmd.data[i] >> 1) == DS3231_ADDRESS;
+                        reading = (cmd.data[i] & 1) == I2C_MASTER_READ;
+                        if (!selected) result = ESP_FAIL;   // Address NACK
+                    } else if (selected) {
+                        written.push_back(cmd.data[i]);
+                    }
+                }
+                break;
+            case CMD_READ:
+                bytes_on_bus += cmd.len;
+                for (size_t i = 0; i < cmd.len; i++) {
+                    cmd.out[i] = selected ? ds3231Read(s_ds3231_pointer++) : 0xff;
+                    s_ds3231_pointer %= DS3231_REGISTERS;
+                }
+                break;
+        }
+        if (result != ESP_OK) break;
+    }
+
+    int64_t busy = (int64_t)bytes_on_bus * I2C_BYTE_US;
+    host_sleep_us(busy);
+    s_stats.transactions++;
+    s_stats.busy_us += busy;
+    return result;
+}
+
+void host_ds3231_set_sqw_pin(gpio_num_t pin) {
+    if (s_ds3231_sqw_pin.exchange(pin) == GPIO_NUM_NC && pin != GPIO_NUM_NC) {
+        host_gpio_set_level(pin, 1);
+        std::thread(ds3231SquareWave).detach();
+    }
+}
+
+void host_ds3231_set_drift_ppm(double ppm) {
+    s_ds3231_drift_ppm = ppm;
+}
+
+void host_i2c_get_stats(host_i2c_stats_t* stats) {
+    std::lock_guard<std::mutex> lock(s_i2c_mutex);
+    *stats = s_stats;
+}
@@ -0,0 +1,300 @@
+#include <string.h>
+
+#include <mutex>
+#include <string>
+
+#include "mbcontroller.h"
+#include "host_hal.h"
+#include "sdkconfig.h"
+#include "Rtu.h"
+#include "SlaveBank.h"
+
+// Function codes understood by the master
+#define FC_READ_COILS               0x01
+#define FC_READ_DISCRETE_INPUTS     0x02
+#define FC_READ_HOLDING_REGISTERS   0x03
+#define FC_READ_INPUT_REGISTERS     0x04
+#define FC_WRITE_SINGLE_COIL        0x05
+#define FC_WRITE_SINGLE_REGISTER    0x06
+#define FC_WRITE_MULTIPLE_COILS     0x0F
+#define FC_WRITE_MULTIPLE_REGISTERS 0x10
+
+// Held for the whole transaction, the master serializes requests like esp-modbus does
+static std::mutex s_bus_mutex;
+static SlaveBank s_slaves;
+static bool s_initialized = false;
+static bool s_started = false;
+static mb_communication_info_t s_comm = {};
+static const mb_parameter_descriptor_t* s_descriptors = NULL;
+static uint16_t s_num_descriptors = 0;
+
+static uint32_t s_turnaround_us = 1000;
+static uint32_t s_timeout_ms = CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND;
+
+static host_mb_stats_t s_stats = {};
+static int64_t s_cycle_start_us = -1;
+static uint8_t s_lowest_address = 0xFF;
+
+void host_mb_slave_add(uint8_t address) {
+    s_slaves.addSlave(address);
+}
+
+bool host_mb_load_register_map(const char* path) {
+    RegisterMap map;
+    std::string error;
+    if (!map.load(path, &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return false;
+    }
+    s_slaves.setMap(map);
+    return true;
+}
+
+void host_mb_slave_set_online(uint8_t address, bool online) {
+    s_slaves.setOnline(address, online);
+}
+
+bool host_mb_slave_set_register(uint8_t address, uint16_t reg, uint16_t value) {
+    return s_slaves.setRegister(address, reg, value);
+}
+
+void host_mb_set_turnaround_us(uint32_t turnaround_us) {
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    s_turnaround_us = turnaround_us;
+}
+
+void host_mb_set_response_timeout_ms(uint32_t timeout_ms) {
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    s_timeout_ms = timeout_ms;
+}
+
+void host_mb_get_stats(host_mb_stats_t* stats) {
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    *stats = s_stats;
+}
+
+esp_err_t mbc_master_init(mb_port_type_t port_type, void** handler) {
+    if (port_type != MB_PORT_SERIAL_MASTER || handler == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    // Like esp-modbus, a second init silently replaces the global controller
+    s_initialized = true;
+    s_started = false;
+    s_stats.controller_inits++;
+    *handler = &s_comm;
+    return ESP_OK;
+}
+
+esp_err_t mbc_master_setup(void* comm_info) {
+    if (comm_info == NULL) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    if (!s_initialized) return ESP_ERR_INVALID_STATE;
+    s_comm = *static_cast<mb_communication_info_t*>(comm_info);
+    return ESP_OK;
+}
+
+esp_err_t mbc_master_start(void) {
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    if (!s_initialized) return ESP_ERR_INVALID_STATE;
+    s_started = true;
+    return ESP_OK;
+}
+
+esp_err_t mbc_master_destroy(void) {
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    if (!s_initialized) return ESP_ERR_INVALID_STATE;
+    s_initialized = false;
+    s_started = false;
+    return ESP_OK;
+}
+
+esp_err_t mbc_master_set_descriptor(const mb_parameter_descriptor_t* descriptor, const uint16_t num_elements) {
+    if (descriptor == NULL || num_elements == 0) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    if (!s_initialized) return ESP_ERR_INVALID_STATE;
+    s_descriptors = descriptor;
+    s_num_descriptors = num_elements;
+    return ESP_OK;
+}
+
+esp_err_t mbc_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_info) {
+    if (param_info == NULL) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    for (uint16_t i = 0; i < s_num_descriptors; i++) {
+        if (s_descriptors[i].cid == cid) {
+            *param_info = &s_descriptors[i];
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+// Build the request PDU, returns its length or 0 for an invalid request
+static size_t encodeRequest(const mb_param_request_t* request, const void* data_ptr, uint8_t* pdu) {
+    uint16_t start = request->reg_start;
+    uint16_t count = request->reg_size;
+    const uint16_t* regs = static_cast<const uint16_t*>(data_ptr);
+    const uint8_t* bits = static_cast<const uint8_t*>(data_ptr);
+
+    pdu[0] = request->command;
+    pdu[1] = start >> 8;
+    pdu[2] = start & 0xFF;
+    pdu[3] = count >> 8;
+    pdu[4] = count & 0xFF;
+    switch (request->command) {
+        case FC_READ_COILS:
+        case FC_READ_DISCRETE_INPUTS:
+            return (count >= 1 && count <= 2000) ? 5 : 0;
+        case FC_READ_HOLDING_REGISTERS:
+        case FC_READ_INPUT_REGISTERS:
+            return (count >= 1 && count <= 125) ? 5 : 0;
+        case FC_WRITE_SINGLE_COIL:
+            pdu[3] = bits[0] ? 0xFF : 0x00;
+            pdu[4] = 0x00;
+            return 5;
+        case FC_WRITE_SINGLE_REGISTER:
+            pdu[3] = regs[0] >> 8;
+            pdu[4] = regs[0] & 0xFF;
+            return 5;
+        case FC_WRITE_MULTIPLE_COILS:
+            if (count < 1 || count > 1968) return 0;
+            pdu[5] = (uint8_t)((count + 7) / 8);
+            memcpy(&pdu[6], bits, pdu[5]);
+            return 6 + pdu[5];
+        case FC_WRITE_MULTIPLE_REGISTERS:
+            if (count < 1 || count > 123) return 0;
+            pdu[5] = (uint8_t)(2 * count);
+            for (uint16_t i = 0; i < count; i++) {
+                pdu[6 + 2 * i] = regs[i] >> 8;
+                pdu[7 + 2 * i] = regs[i] & 0xFF;
+            }
+            return 6 + pdu[5];
+        default:
+            return 0;
+    }
+}
+
+// Unpack the response PDU into the caller's buffer
+static esp_err_t decodeResponse(const mb_param_request_t* request, const uint8_t* pdu, size_t len, void* data_ptr) {
+    if (len < 2 || (pdu[0] & 0x7F) != request->command) return ESP_ERR_INVALID_RESPONSE;
+    if (pdu[0] & 0x80) return ESP_ERR_NOT_SUPPORTED;      // Exception response, as esp-modbus reports it
+
+    uint16_t count = request->reg_size;
+    switch (request->command) {
+        case FC_READ_COILS:
+        case FC_READ_DISCRETE_INPUTS:
+            if (pdu[1] != (count + 7) / 8 || len < 2 + (size_t)pdu[1]) return ESP_ERR_INVALID_RESPONSE;
+            memcpy(data_ptr, &pdu[2], pdu[1]);
+            return ESP_OK;
+        case FC_READ_HOLDING_REGISTERS:
+        case FC_READ_INPUT_REGISTERS: {
+            if (pdu[1] != 2 * count || len < 2 + (size_t)pdu[1]) return ESP_ERR_INVALID_RESPONSE;
+            uint16_t* regs = static_cast<uint16_t*>(data_ptr);
+            for (uint16_t i = 0; i < count; i++) {
+                regs[i] = (uint16_t)((pdu[2 + 2 * i] << 8) | pdu[3 + 2 * i]);
+            }
+            return ESP_OK;
+        }
+        default:
+            return len == 5 ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+    }
+}
+
+// Answer from the in-process slaves, charging the caller the simulated wire time
+static esp_err_t transactInProcess(uint8_t address, const uint8_t* pdu, size_t len,
+                                   uint8_t* response, size_t* response_len) {
+    bool parity = s_comm.parity != UART_PARITY_DISABLE;
+    int64_t busy = rtuCharTimeUs(len + 3, s_comm.baudrate, parity) + rtuFrameGapUs(s_comm.baudrate, parity);
+    *response_len = s_slaves.process(address, pdu, len, response, host_time_us() / 1e6);
+
+    esp_err_t result = ESP_OK;
+    if (*response_len == 0) {
+        busy += (int64_t)s_timeout_ms * 1000;
+        result = ESP_ERR_TIMEOUT;
+    } else {
+        busy += s_turnaround_us + rtuCharTimeUs(*response_len + 3, s_comm.baudrate, parity)
+              + rtuFrameGapUs(s_comm.baudrate, parity);
+    }
+    host_sleep_us(busy);
+    return result;
+}
+
+// Put the RTU frame on the attached serial device and collect the answer
+static esp_err_t transactSerial(uint8_t address, const uint8_t* pdu, size_t len,
+                                uint8_t* response, size_t* response_len) {
+    uint8_t frame[RTU_MAX_FRAME];
+    frame[0] = address;
+    memcpy(&frame[1], pdu, len);
+    size_t frame_len = rtuAppendCrc(frame, len + 1);
+
+    uart_flush_input(s_comm.port);
+    uart_write_bytes(s_comm.port, frame, frame_len);
+
+    // Collect bytes until the frame is complete according to its header
+    TickType_t timeout = pdMS_TO_TICKS(s_timeout_ms);
+    size_t have = 0;
+    size_t expected = 0;
+    while (expected == 0 || have < expected) {
+        size_t want = expected ? expected - have : (have < 3 ? 3 - have : 1);
+        int n = uart_read_bytes(s_comm.port, frame + have, want, timeout);
+        if (n <= 0) {
+            return ESP_ERR_TIMEOUT;
+        }
+        have += (size_t)n;
+        if (expected == 0) {
+            expected = rtuResponseLength(frame, have);
+            if (expected > RTU_MAX_FRAME) return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    if (!rtuCheckCrc(frame, expected)) {
+        s_stats.crc_errors++;
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (frame[0] != address) return ESP_ERR_INVALID_RESPONSE;
+    *response_len = expected - 3;
+    memcpy(response, &frame[1], *response_len);
+    return ESP_OK;
+}
+
+esp_err_t mbc_master_send_request(mb_param_request_t* request, void* data_ptr) {
+    if (request == NULL || data_ptr == NULL) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> lock(s_bus_mutex);
+    if (!s_started) return ESP_ERR_INVALID_STATE;
+
+    uint8_t pdu[RTU_MAX_PDU];
+    size_t len = encodeRequest(request, data_ptr, pdu);
+    if (len == 0) return ESP_ERR_INVALID_ARG;
+
+    bool serial = host_uart_is_attached(s_comm.port);
+    int64_t now = host_time_us();
+    uint8_t first = serial ? s_lowest_address : s_slaves.firstAddress();
+    if (serial && request->slave_addr < s_lowest_address) {
+        s_lowest_address = first = request->slave_addr;
+    }
+    if (request->slave_addr == first) {
+        if (s_cycle_start_us >= 0) {
+            int64_t period = now - s_cycle_start_us;
+            s_stats.cycles++;
+            s_stats.cycle_sum_us += period;
+            if (period > s_stats.cycle_max_us) s_stats.cycle_max_us = period;
+        }
+        s_cycle_start_us = now;
+    }
+
+    uint8_t response[RTU_MAX_PDU];
+    size_t response_len = 0;
+    esp_err_t result = serial ? transactSerial(request->slave_addr, pdu, len, response, &response_len)
+                              : transactInProcess(request->slave_addr, pdu, len, response, &response_len);
+    if (result == ESP_OK) {
+        result = decodeResponse(request, response, response_len, data_ptr);
+    }
+
+    s_stats.transactions++;
+    s_stats.busy_us += host_time_us() - now;
+    if (result == ESP_ERR_TIMEOUT) s_stats.timeouts++;
+    if (result != ESP_OK) s_stats.failures++;
+    return result;
+}
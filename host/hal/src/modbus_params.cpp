@@ -0,0 +1,6 @@
+#include "modbus_params.h"
+
+holding_reg_params_t holding_reg_params = {};
+input_reg_params_t input_reg_params = {};
+coil_reg_params_t coil_reg_params = {};
+discrete_reg_params_t discrete_reg_params = {};
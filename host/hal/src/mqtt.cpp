@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sdkconfig.h"
+#include "mqtt_client.h"
+#include "host_hal.h"
+
+ESP_EVENT_DEFINE_BASE(MQTT_EVENTS);
+
+// lwIP send buffer and MSS as configured. Every segment carries 40 bytes of
+// IPv4 and TCP headers.
+#define MQTT_TCP_SND_BUF        CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define MQTT_TCP_MSS            CONFIG_LWIP_TCP_MSS
+#define MQTT_TCP_IP_HEADERS     40
+#define MQTT_DEFAULT_TIMEOUT_MS 10000
+
+// How often the client thread looks at the link when nothing is due
+#define MQTT_POLL_US            5000
+
+struct InFlight {
+    int msg_id;                 // 0 for QoS 0, never acknowledged
+    int64_t published_us;
+    int64_t arrive_us;          // When the broker has the whole message
+    int64_t ack_us;             // When the PUBACK is back at the client
+    bool arrived;
+    std::string topic;
+    std::vector<uint8_t> payload;
+};
+
+struct esp_mqtt_client {
+    std::string uri;
+    std::string client_id;
+    int64_t timeout_us;
+    esp_event_handler_t handler = nullptr;
+    void* handler_arg = nullptr;
+
+    std::mutex mutex;
+    std::thread thread;
+    bool started = false;
+    bool stopping = false;
+    bool connected = false;
+    int next_msg_id = 1;
+    int64_t link_free_us = 0;   // When the bytes queued so far are on the wire
+    std::deque<InFlight> in_flight;
+};
+
+static std::atomic<int64_t> s_rtt_us{20 * 1000};
+static std::atomic<uint32_t> s_bandwidth_kbps{1000};
+static std::atomic<int64_t> s_broker_delay_us{0};
+
+static std::mutex s_mqtt_mutex;
+static host_mqtt_receiver_t s_receiver = nullptr;
+static void* s_receiver_arg = nullptr;
+static host_mqtt_stats_t s_stats;
+
+void host_mqtt_set_link(uint32_t rtt_ms, uint32_t bandwidth_kbps) {
+    s_rtt_us = (int64_t)rtt_ms * 1000;
+    s_bandwidth_kbps = bandwidth_kbps > 0 ? bandwidth_kbps : 1;
+}
+
+void host_mqtt_set_broker_delay_ms(uint32_t delay_ms) {
+    s_broker_delay_us = (int64_t)delay_ms * 1000;
+}
+
+void host_mqtt_set_receiver(host_mqtt_receiver_t receiver, void* arg) {
+    std::lock_guard<std::mutex> lock(s_mqtt_mutex);
+    s_receiver = receiver;
+    s_receiver_arg = arg;
+}
+
+void host_mqtt_get_stats(host_mqtt_stats_t* stats) {
+    std::lock_guard<std::mutex> lock(s_mqtt_mutex);
+    *stats = s_stats;
+}
+
+static int64_t wireTimeUs(size_t bytes) {
+    return (int64_t)bytes * 8 * 1000 / s_bandwidth_kbps;
+}
+
+// Bytes a PUBLISH puts on the wire, MQTT fixed and variable header included
+static size_t publishWireBytes(size_t topic_len, size_t payload_len, int qos) {
+    size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+    size_t length_bytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+    size_t mqtt = 1 + length_bytes + remaining;
+    size_t segments = (mqtt + MQTT_TCP_MSS - 1) / MQTT_TCP_MSS;
+    return mqtt + segments * MQTT_TCP_IP_HEADERS;
+}
+
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event_id, int msg_id) {
+    if (client->handler == nullptr) {
+        return;
+    }
+    esp_mqtt_event_t event = {};
+    event.event_id = event_id;
+    event.client = client;
+    event.msg_id = msg_id;
+    client->handler(client->handler_arg, MQTT_EVENTS, event_id, &event);
+}
+
+static void clientThread(esp_mqtt_client_handle_t client) {
+    std::unique_lock<std::mutex> lock(client->mutex);
+    while (!client->stopping) {
+        bool link = host_wifi_get_link();
+        if (!client->connected && link) {
+            // TCP handshake, then CONNECT / CONNACK
+            lock.unlock();
+            host_sleep_us(2 * s_rtt_us);
+            lock.lock();
+            if (host_wifi_get_link() && !client->stopping) {
+                client->connected = true;
+                client->link_free_us = host_time_us();
+                {
+                    std::lock_guard<std::mutex> stats_lock(s_mqtt_mutex);
+                    s_stats.connects++;
+                }
+                lock.unlock();
+                dispatch(client, MQTT_EVENT_CONNECTED, 0);
+                lock.lock();
+            }
+            continue;
+        }
+        if (client->connected && !link) {
+            client->connected = false;
+            client->in_flight.clear();
+            lock.unlock();
+            dispatch(client, MQTT_EVENT_DISCONNECTED, 0);
+            lock.lock();
+            continue;
+        }
+
+        // Deliver what is due, to the broker and back to the client
+        int64_t now = host_time_us();
+        int64_t next_due = now + MQTT_POLL_US;
+        std::vector<InFlight> arrived;
+        std::vector<int> acked;
+        for (auto it = client->in_flight.begin(); it != client->in_flight.end();) {
+            if (!it->arrived && it->arrive_us <= now) {
+                it->arrived = true;
+                arrived.push_back(*it);
+            }
+            if (it->arrived && (it->msg_id == 0 || it->ack_us <= now)) {
+                if (it->msg_id != 0) {
+                    acked.push_back(it->msg_id);
+                    std::lock_guard<std::mutex> stats_lock(s_mqtt_mutex);
+                    int64_t latency = now - it->published_us;
+                    s_stats.acks++;
+                    s_stats.ack_latency_sum_us += latency;
+                    s_stats.ack_latency_max_us = std::max(s_stats.ack_latency_max_us, latency);
+                }
+                it = client->in_flight.erase(it);
+                continue;
+            }
+            next_due = std::min(next_due, it->arrived ? it->ack_us : it->arrive_us);
+            ++it;
+        }
+        lock.unlock();
+        for (const InFlight& message : arrived) {
+            host_mqtt_receiver_t receiver;
+            void* receiver_arg;
+            {
+                std::lock_guard<std::mutex> stats_lock(s_mqtt_mutex);
+                s_stats.received++;
+                s_stats.payload_bytes += message.payload.size();
+                receiver = s_receiver;
+                receiver_arg = s_receiver_arg;
+            }
+            if (receiver != nullptr) {
+                receiver(message.topic.c_str(), message.payload.data(), message.payload.size(), receiver_arg);
+            }
+        }
+        for (int msg_id : acked) {
+            dispatch(client, MQTT_EVENT_PUBLISHED, msg_id);
+        }
+        if (arrived.empty() && acked.empty()) {
+            host_sleep_us(next_due - now);
+        }
+        lock.lock();
+    }
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config) {
+    if (config == NULL || config->broker.address.uri == NULL) {
+        return NULL;
+    }
+    esp_mqtt_client_handle_t client = new esp_mqtt_client;
+    client->uri = config->broker.address.uri;
+    client->client_id = config->credentials.client_id != NULL ? config->credentials.client_id : "";
+    int timeout_ms = config->network.timeout_ms > 0 ? config->network.timeout_ms : MQTT_DEFAULT_TIMEOUT_MS;
+    client->timeout_us = (int64_t)timeout_ms * 1000;
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void* event_handler_arg) {
+    if (client == NULL || event != MQTT_EVENT_ANY) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(client->mutex);
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (client->started) {
+        return ESP_FAIL;
+    }
+    client->started = true;
+    client->stopping = false;
+    client->thread = std::thread(clientThread, client);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        if (!client->started) {
+            return ESP_FAIL;
+        }
+        client->stopping = true;
+    }
+    client->thread.join();
+    std::lock_guard<std::mutex> lock(client->mutex);
+    client->started = false;
+    client->connected = false;
+    client->in_flight.clear();
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->started) {
+        esp_mqtt_client_stop(client);
+    }
+    delete client;
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len,
+                            int qos, int retain) {
+    (void)retain;
+    if (client == NULL || topic == NULL) {
+        return -1;
+    }
+    if (len <= 0 && data != NULL) {
+        len = (int)strlen(data);
+    }
+    size_t topic_len = strlen(topic);
+    size_t wire = publishWireBytes(topic_len, (size_t)len, qos);
+
+    std::unique_lock<std::mutex> lock(client->mutex);
+    int64_t now = host_time_us();
+    bool accepted = client->connected;
+    int64_t wait_us = 0;
+    if (accepted) {
+        // Queue behind what is still waiting for the wire, block until the
+        // rest fits in the send buffer
+        int64_t done_us = std::max(now, client->link_free_us) + wireTimeUs(wire);
+        wait_us = std::max<int64_t>(0, done_us - now - wireTimeUs(MQTT_TCP_SND_BUF));
+        if (wait_us > client->timeout_us) {
+            accepted = false;
+            wait_us = client->timeout_us;
+        } else {
+            client->link_free_us = done_us;
+        }
+    }
+    if (wait_us > 0) {
+        lock.unlock();
+        host_sleep_us(wait_us);
+        lock.lock();
+        accepted = accepted && client->connected;
+    }
+    if (!accepted) {
+        std::lock_guard<std::mutex> stats_lock(s_mqtt_mutex);
+        s_stats.publish_failures++;
+        return -1;
+    }
+
+    InFlight message;
+    message.msg_id = 0;
+    if (qos > 0) {
+        message.msg_id = client->next_msg_id;
+        client->next_msg_id = client->next_msg_id % 65535 + 1;
+    }
+    message.published_us = now;
+    message.arrive_us = client->link_free_us + s_rtt_us / 2;
+    message.ack_us = message.arrive_us + s_broker_delay_us + s_rtt_us / 2;
+    message.arrived = false;
+    message.topic = topic;
+    message.payload.assign((const uint8_t*)data, (const uint8_t*)data + len);
+    client->in_flight.push_back(std::move(message));
+    int msg_id = client->in_flight.back().msg_id;
+    lock.unlock();
+
+    std::lock_guard<std::mutex> stats_lock(s_mqtt_mutex);
+    s_stats.publishes++;
+    s_stats.wire_bytes += wire;
+    return msg_id;
+}
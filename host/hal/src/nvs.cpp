@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nvs_flash.h"
+
+struct NvsHandle {
+    std::string name_space;
+    bool writable;
+};
+
+static std::mutex s_mutex;
+static bool s_initialized = false;
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> s_values;
+static std::map<nvs_handle_t, NvsHandle> s_handles;
+static nvs_handle_t s_next_handle = 1;
+
+static bool validName(const char* name) {
+    return name != NULL && name[0] != '\0' && strlen(name) < NVS_KEY_NAME_MAX_SIZE;
+}
+
+esp_err_t nvs_flash_init(void) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_values.clear();
+    s_initialized = false;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name_space, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!s_initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (!validName(name_space) || out_handle == NULL) return ESP_ERR_NVS_INVALID_NAME;
+    // A namespace that was never written cannot be opened read-only
+    if (open_mode == NVS_READONLY && s_values.find(name_space) == s_values.end()) return ESP_ERR_NVS_NOT_FOUND;
+    *out_handle = s_next_handle++;
+    s_handles[*out_handle] = NvsHandle{name_space, open_mode == NVS_READWRITE};
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_handles.erase(handle);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto h = s_handles.find(handle);
+    if (h == s_handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!validName(key) || length == NULL) return ESP_ERR_NVS_INVALID_NAME;
+    auto ns = s_values.find(h->second.name_space);
+    if (ns == s_values.end()) return ESP_ERR_NVS_NOT_FOUND;
+    auto value = ns->second.find(key);
+    if (value == ns->second.end()) return ESP_ERR_NVS_NOT_FOUND;
+    if (out_value == NULL) {
+        *length = value->second.size();
+        return ESP_OK;
+    }
+    if (*length < value->second.size()) {
+        *length = value->second.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, value->second.data(), value->second.size());
+    *length = value->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto h = s_handles.find(handle);
+    if (h == s_handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!h->second.writable) return ESP_ERR_NVS_READ_ONLY;
+    if (!validName(key) || (value == NULL && length > 0)) return ESP_ERR_NVS_INVALID_NAME;
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    s_values[h->second.name_space][key] = std::vector<uint8_t>(bytes, bytes + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto h = s_handles.find(handle);
+    if (h == s_handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!h->second.writable) return ESP_ERR_NVS_READ_ONLY;
+    auto ns = s_values.find(h->second.name_space);
+    if (ns == s_values.end() || ns->second.erase(key) == 0) return ESP_ERR_NVS_NOT_FOUND;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_handles.count(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
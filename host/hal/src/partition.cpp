@@ -0,0 +1,236 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "esp_partition.h"
+#include "host_hal.h"
+
+// Typical quad SPI NOR timings (W25Q class): page program about 0.4 ms for
+// 256 bytes, sector erase 45 ms, reads at 40 MB/s. Reads are only accounted,
+// program and erase block the caller.
+#define FLASH_PAGE_SIZE             256
+#define FLASH_PROGRAM_SETUP_US      50
+#define FLASH_PROGRAM_NS_PER_BYTE   1500
+#define FLASH_ERASE_US              45000
+#define FLASH_READ_SETUP_NS         1000
+#define FLASH_READ_NS_PER_BYTE      25
+
+// Partitions follow the app in a 4 MB flash
+#define FLASH_FIRST_DATA_ADDRESS    0x210000
+
+struct HostPartition {
+    esp_partition_t info;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> erase_counts;
+    int fd;
+};
+
+static std::mutex s_flash_mutex;
+static std::vector<std::unique_ptr<HostPartition>> s_partitions;
+static uint32_t s_next_address = FLASH_FIRST_DATA_ADDRESS;
+static int64_t s_power_budget = -1;     // Bytes until power loss, negative when disarmed
+static bool s_powered = true;
+static host_flash_stats_t s_stats;
+
+// Call with the flash mutex held
+static HostPartition* findPartition(const esp_partition_t* partition) {
+    for (auto& entry : s_partitions) {
+        if (&entry->info == partition) {
+            return entry.get();
+        }
+    }
+    return nullptr;
+}
+
+// Spend up to bytes of the power budget, returns how many can still be done
+static size_t spendPower(size_t bytes) {
+    if (!s_powered) {
+        return 0;
+    }
+    if (s_power_budget < 0) {
+        return bytes;
+    }
+    if ((int64_t)bytes < s_power_budget) {
+        s_power_budget -= (int64_t)bytes;
+        return bytes;
+    }
+    size_t allowed = (size_t)s_power_budget;
+    s_power_budget = -1;
+    s_powered = false;
+    return allowed;
+}
+
+static void writeThrough(HostPartition* part, size_t offset, size_t size) {
+    if (part->fd >= 0 && size > 0) {
+        if (pwrite(part->fd, &part->data[offset], size, (off_t)offset) != (ssize_t)size) {
+            perror("flash image write");
+        }
+    }
+}
+
+bool host_flash_add_partition(const char* label, esp_partition_subtype_t subtype, uint32_t size,
+                              const char* image_path) {
+    if (label == NULL || size == 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+        return false;
+    }
+    auto part = std::make_unique<HostPartition>();
+    memset(&part->info, 0, sizeof(part->info));
+    part->info.type = ESP_PARTITION_TYPE_DATA;
+    part->info.subtype = subtype;
+    part->info.size = size;
+    part->info.erase_size = SPI_FLASH_SEC_SIZE;
+    strncpy(part->info.label, label, sizeof(part->info.label) - 1);
+    part->data.assign(size, 0xff);
+    part->erase_counts.assign(size / SPI_FLASH_SEC_SIZE, 0);
+    part->fd = -1;
+
+    if (image_path != NULL) {
+        part->fd = open(image_path, O_RDWR | O_CREAT, 0644);
+        if (part->fd < 0) {
+            perror(image_path);
+            return false;
+        }
+        ssize_t loaded = pread(part->fd, part->data.data(), size, 0);
+        if (loaded < (ssize_t)size) {
+            // New or short image: the rest is erased flash
+            std::fill(part->data.begin() + (loaded > 0 ? loaded : 0), part->data.end(), 0xff);
+            writeThrough(part.get(), 0, size);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    part->info.address = s_next_address;
+    s_next_address += size;
+    s_partitions.push_back(std::move(part));
+    return true;
+}
+
+void host_flash_power_loss_after(int64_t bytes) {
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    s_power_budget = bytes;
+}
+
+void host_flash_power_on(void) {
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    s_powered = true;
+    s_power_budget = -1;
+}
+
+bool host_flash_is_powered(void) {
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    return s_powered;
+}
+
+void host_flash_get_stats(host_flash_stats_t* stats) {
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    *stats = s_stats;
+    stats->max_sector_erases = 0;
+    for (auto& part : s_partitions) {
+        for (uint32_t count : part->erase_counts) {
+            stats->max_sector_erases = std::max(stats->max_sector_erases, count);
+        }
+    }
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    for (auto& part : s_partitions) {
+        if (type != ESP_PARTITION_TYPE_ANY && part->info.type != type) {
+            continue;
+        }
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && part->info.subtype != subtype) {
+            continue;
+        }
+        if (label != NULL && strcmp(part->info.label, label) != 0) {
+            continue;
+        }
+        return &part->info;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    std::lock_guard<std::mutex> lock(s_flash_mutex);
+    HostPartition* part = findPartition(partition);
+    if (part == nullptr || dst == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (src_offset > part->info.size || size > part->info.size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, &part->data[src_offset], size);
+    s_stats.bytes_read += size;
+    s_stats.busy_us += (FLASH_READ_SETUP_NS + (int64_t)size * FLASH_READ_NS_PER_BYTE) / 1000;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    int64_t cost_us;
+    esp_err_t result = ESP_OK;
+    {
+        std::lock_guard<std::mutex> lock(s_flash_mutex);
+        HostPartition* part = findPartition(partition);
+        if (part == nullptr || src == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (dst_offset > part->info.size || size > part->info.size - dst_offset) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        size_t done = spendPower(size);
+        // NOR programming can only clear bits
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+        for (size_t i = 0; i < done; i++) {
+            part->data[dst_offset + i] &= bytes[i];
+        }
+        writeThrough(part, dst_offset, done);
+        if (done < size) {
+            result = ESP_FAIL;
+        }
+        size_t pages = (dst_offset % FLASH_PAGE_SIZE + done + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+        cost_us = (int64_t)pages * FLASH_PROGRAM_SETUP_US + (int64_t)done * FLASH_PROGRAM_NS_PER_BYTE / 1000;
+        s_stats.bytes_written += done;
+        s_stats.writes++;
+        s_stats.busy_us += cost_us;
+    }
+    host_sleep_us(cost_us);
+    return result;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    int64_t cost_us = 0;
+    esp_err_t result = ESP_OK;
+    {
+        std::lock_guard<std::mutex> lock(s_flash_mutex);
+        HostPartition* part = findPartition(partition);
+        if (part == nullptr) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (offset > part->info.size || size > part->info.size - offset) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        for (size_t sector = offset; sector < offset + size; sector += SPI_FLASH_SEC_SIZE) {
+            size_t done = spendPower(SPI_FLASH_SEC_SIZE);
+            memset(&part->data[sector], 0xff, done);
+            writeThrough(part, sector, done);
+            cost_us += FLASH_ERASE_US * (int64_t)done / SPI_FLASH_SEC_SIZE;
+            if (done < SPI_FLASH_SEC_SIZE) {
+                result = ESP_FAIL;
+                break;
+            }
+            part->erase_counts[sector / SPI_FLASH_SEC_SIZE]++;
+            s_stats.erases++;
+        }
+        s_stats.busy_us += cost_us;
+    }
+    host_sleep_us(cost_us);
+    return result;
+}
@@ -0,0 +1,330 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+#include "driver/uart.h"
+#include "host_hal.h"
+#include "Rtu.h"
+#include "SlaveBank.h"
+
+// In-process RS-485 line: a bank of slaves that answers each request frame on the simulated clock
+struct SimLine {
+    std::mutex mutex;
+    SlaveBank slaves;
+    uint32_t baud;
+    uint32_t turnaround_us;
+    uint8_t response[RTU_MAX_FRAME];
+    size_t response_len;
+    size_t response_pos;
+    int64_t response_at_us;     // The response is handed over at the RX timeout after its last byte
+    host_uart_line_stats_t stats;
+};
+
+struct UartState {
+    bool installed;
+    uart_config_t config;
+    uart_mode_t mode;
+    int tx_pin;
+    int rx_pin;
+    int rts_pin;
+    uint8_t rx_timeout;     // Character times, bytes reach the reader as soon as they arrive on the host
+    int fd;
+    SimLine* line;          // Never freed, like the task control blocks
+};
+
+static std::mutex s_uart_mutex;
+static UartState s_uarts[UART_NUM_MAX] = {
+    {false, {}, UART_MODE_UART, -1, -1, -1, 0, -1, NULL},
+    {false, {}, UART_MODE_UART, -1, -1, -1, 0, -1, NULL},
+    {false, {}, UART_MODE_UART, -1, -1, -1, 0, -1, NULL},
+};
+
+static bool validPort(uart_port_t uart_num) {
+    return uart_num >= 0 && uart_num < UART_NUM_MAX;
+}
+
+static speed_t termiosSpeed(uint32_t baud) {
+    switch (baud) {
+        case 1200:   return B1200;
+        case 2400:   return B2400;
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        default:     return B115200;
+    }
+}
+
+static int portFd(uart_port_t uart_num) {
+    if (!validPort(uart_num)) return -1;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    return s_uarts[uart_num].fd;
+}
+
+bool host_uart_attach(uart_port_t uart_num, const char* device, uint32_t baud) {
+    if (!validPort(uart_num) || device == NULL) return false;
+
+    int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) return false;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, termiosSpeed(baud));
+        cfsetospeed(&tio, termiosSpeed(baud));
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    if (s_uarts[uart_num].line != NULL) {
+        close(fd);
+        return false;
+    }
+    if (s_uarts[uart_num].fd >= 0) close(s_uarts[uart_num].fd);
+    s_uarts[uart_num].fd = fd;
+    return true;
+}
+
+static SimLine* portLine(uart_port_t uart_num) {
+    if (!validPort(uart_num)) return NULL;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    return s_uarts[uart_num].line;
+}
+
+bool host_uart_attach_slaves(uart_port_t uart_num, uint8_t first, uint8_t last, uint32_t baud,
+                             uint32_t turnaround_us) {
+    if (!validPort(uart_num) || first == 0 || first > last) return false;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    if (s_uarts[uart_num].fd >= 0 || s_uarts[uart_num].line != NULL) return false;
+    SimLine* line = new SimLine();
+    line->slaves.addRange(first, last);
+    line->baud = baud;
+    line->turnaround_us = turnaround_us;
+    line->response_len = 0;
+    line->response_pos = 0;
+    line->response_at_us = 0;
+    line->stats = {};
+    s_uarts[uart_num].line = line;
+    return true;
+}
+
+bool host_uart_line_set_online(uart_port_t uart_num, uint8_t address, bool online) {
+    SimLine* line = portLine(uart_num);
+    if (line == NULL || !line->slaves.hasSlave(address)) return false;
+    line->slaves.setOnline(address, online);
+    return true;
+}
+
+bool host_uart_get_line_stats(uart_port_t uart_num, host_uart_line_stats_t* stats) {
+    SimLine* line = portLine(uart_num);
+    if (line == NULL || stats == NULL) return false;
+    std::lock_guard<std::mutex> lock(line->mutex);
+    *stats = line->stats;
+    return true;
+}
+
+bool host_uart_is_attached(uart_port_t uart_num) {
+    return portFd(uart_num) >= 0 || portLine(uart_num) != NULL;
+}
+
+// The request goes out at line speed, the addressed slave answers after its turnaround
+static int lineWrite(SimLine* line, const uint8_t* bytes, size_t size) {
+    int64_t request_us = rtuCharTimeUs(size, line->baud, false);
+    host_sleep_us(request_us);
+
+    uint8_t response[RTU_MAX_FRAME];
+    size_t response_len = 0;
+    if (size >= 4 && size <= RTU_MAX_FRAME && rtuCheckCrc(bytes, size) && bytes[0] != 0) {
+        size_t pdu_len = line->slaves.process(bytes[0], bytes + 1, size - 3, response + 1, host_time_us() / 1e6);
+        if (pdu_len > 0) {
+            response[0] = bytes[0];
+            response_len = rtuAppendCrc(response, pdu_len + 1);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(line->mutex);
+    line->stats.transactions++;
+    line->stats.busy_us += request_us;
+    line->response_len = response_len;
+    line->response_pos = 0;
+    if (response_len > 0) {
+        int64_t response_us = line->turnaround_us + rtuCharTimeUs(response_len, line->baud, false);
+        line->response_at_us = host_time_us() + response_us + rtuFrameGapUs(line->baud, false);
+        line->stats.busy_us += response_us;
+    } else if (bytes[0] != 0) {
+        line->stats.timeouts++;
+    }
+    memcpy(line->response, response, response_len);
+    return (int)size;
+}
+
+static int lineRead(SimLine* line, uint8_t* bytes, uint32_t length, TickType_t ticks_to_wait) {
+    int64_t deadline = ticks_to_wait == portMAX_DELAY
+                           ? INT64_MAX
+                           : host_time_us() + (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+    std::unique_lock<std::mutex> lock(line->mutex);
+    if (line->response_pos >= line->response_len) {
+        // Nothing will come, wait out the timeout as the driver would
+        lock.unlock();
+        if (deadline != INT64_MAX) host_sleep_us(deadline - host_time_us());
+        return 0;
+    }
+    int64_t ready = line->response_at_us;
+    if (ready > host_time_us()) {
+        lock.unlock();
+        int64_t until = ready < deadline ? ready : deadline;
+        host_sleep_us(until - host_time_us());
+        lock.lock();
+        if (host_time_us() < ready) return 0;
+    }
+    size_t count = line->response_len - line->response_pos;
+    if (count > length) count = length;
+    memcpy(bytes, line->response + line->response_pos, count);
+    line->response_pos += count;
+    return (int)count;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, void* uart_queue, int intr_alloc_flags) {
+    (void)rx_buffer_size; (void)tx_buffer_size; (void)queue_size; (void)uart_queue; (void)intr_alloc_flags;
+    if (!validPort(uart_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    if (s_uarts[uart_num].installed) {
+        return ESP_FAIL;
+    }
+    s_uarts[uart_num].installed = true;
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num) {
+    if (!validPort(uart_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    s_uarts[uart_num].installed = false;
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t* uart_config) {
+    if (!validPort(uart_num) || uart_config == NULL) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    s_uarts[uart_num].config = *uart_config;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num) {
+    (void)cts_io_num;
+    if (!validPort(uart_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    if (tx_io_num != UART_PIN_NO_CHANGE) s_uarts[uart_num].tx_pin = tx_io_num;
+    if (rx_io_num != UART_PIN_NO_CHANGE) s_uarts[uart_num].rx_pin = rx_io_num;
+    if (rts_io_num != UART_PIN_NO_CHANGE) s_uarts[uart_num].rts_pin = rts_io_num;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_mode(uart_port_t uart_num, uart_mode_t mode) {
+    if (!validPort(uart_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    s_uarts[uart_num].mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh) {
+    if (!validPort(uart_num)) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(s_uart_mutex);
+    s_uarts[uart_num].rx_timeout = tout_thresh;
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void* src, size_t size) {
+    SimLine* line = portLine(uart_num);
+    if (line != NULL) return lineWrite(line, static_cast<const uint8_t*>(src), size);
+    int fd = portFd(uart_num);
+    if (fd < 0) return -1;
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(src);
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, bytes + written, size - written);
+        if (n > 0) {
+            written += (size_t)n;
+        } else {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            if (poll(&pfd, 1, 100) <= 0) break;
+        }
+    }
+    return (int)written;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void* buf, uint32_t length, TickType_t ticks_to_wait) {
+    SimLine* line = portLine(uart_num);
+    if (line != NULL) return lineRead(line, static_cast<uint8_t*>(buf), length, ticks_to_wait);
+    int fd = portFd(uart_num);
+    if (fd < 0) return -1;
+
+    uint8_t* bytes = static_cast<uint8_t*>(buf);
+    int64_t deadline = host_time_us() + (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+    uint32_t received = 0;
+    while (received < length) {
+        ssize_t n = read(fd, bytes + received, length - received);
+        if (n > 0) {
+            received += (uint32_t)n;
+            continue;
+        }
+        int64_t remaining_us = deadline - host_time_us();
+        if (ticks_to_wait != portMAX_DELAY && remaining_us <= 0) break;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int wait_ms = ticks_to_wait == portMAX_DELAY ? -1 : (int)((remaining_us + 999) / 1000);
+        if (poll(&pfd, 1, wait_ms) <= 0 && ticks_to_wait != portMAX_DELAY) break;
+    }
+    return (int)received;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num) {
+    SimLine* line = portLine(uart_num);
+    if (line != NULL) {
+        std::lock_guard<std::mutex> lock(line->mutex);
+        line->response_pos = line->response_len;
+        return ESP_OK;
+    }
+    int fd = portFd(uart_num);
+    if (fd < 0) return ESP_ERR_INVALID_STATE;
+    uint8_t scratch[256];
+    while (read(fd, scratch, sizeof(scratch)) > 0) {
+    }
+    return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait) {
+    (void)ticks_to_wait;
+    if (portLine(uart_num) != NULL) return ESP_OK;     // The write returned once the frame was out
+    int fd = portFd(uart_num);
+    if (fd < 0) return ESP_ERR_INVALID_STATE;
+    tcdrain(fd);
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t* size) {
+    SimLine* line = portLine(uart_num);
+    if (line != NULL && size != NULL) {
+        std::lock_guard<std::mutex> lock(line->mutex);
+        *size = host_time_us() >= line->response_at_us ? line->response_len - line->response_pos : 0;
+        return ESP_OK;
+    }
+    int fd = portFd(uart_num);
+    if (fd < 0 || size == NULL) return ESP_ERR_INVALID_STATE;
+    int pending = 0;
+    ioctl(fd, FIONREAD, &pending);
+    *size = pending > 0 ? (size_t)pending : 0;
+    return ESP_OK;
+}
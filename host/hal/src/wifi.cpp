@@ -0,0 +1,49 @@
+#include <atomic>
+
+#include "Wifi.h"
+#include "host_hal.h"
+
+// Simulated association time
+#define WIFI_CONNECT_TIME_US (500 * 1000)
+
+static std::atomic<bool> s_link_up{true};
+
+void host_wifi_set_link(bool up) {
+    s_link_up = up;
+}
+
+bool host_wifi_get_link(void) {
+    return s_link_up;
+}
+
+// Constructor
+Wifi::Wifi() {}
+
+// Destructor
+Wifi::~Wifi() {}
+
+// Initialize WiFi
+bool Wifi::init() {
+    return true;
+}
+
+// Connect to the configured WiFi network
+bool Wifi::connect() {
+    host_sleep_us(WIFI_CONNECT_TIME_US);
+    if (s_link_up) {
+        ESP_LOGI(TAG, "Connected to AP SSID: %s", ssid.c_str());
+        return true;
+    }
+    ESP_LOGI(TAG, "Failed to connect to SSID: %s", ssid.c_str());
+    return false;
+}
+
+// Set the SSID for the WiFi network
+void Wifi::setSSID(const std::string& ssid) {
+    this->ssid = ssid;
+}
+
+// Set the password for the WiFi network
+void Wifi::setPassword(const std::string& password) {
+    this->password = password;
+}
@@ -0,0 +1,60 @@
+#include "Rtu.h"
+
+#include <cstdint>
+
+uint16_t rtuCrc16(const uint8_t* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+size_t rtuAppendCrc(uint8_t* frame, size_t len) {
+    uint16_t crc = rtuCrc16(frame, len);
+    frame[len++] = crc & 0xFF;      // CRC goes out low byte first
+    frame[len++] = crc >> 8;
+    return len;
+}
+
+bool rtuCheckCrc(const uint8_t* frame, size_t len) {
+    if (len < 4) return false;
+    uint16_t crc = rtuCrc16(frame, len - 2);
+    return frame[len - 2] == (crc & 0xFF) && frame[len - 1] == (crc >> 8);
+}
+
+size_t rtuRequestLength(const uint8_t* frame, size_t have) {
+    if (have < 2) return 0;
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06:
+            return 8;
+        case 0x0F: case 0x10:
+            return have < 7 ? 0 : 9 + (size_t)frame[6];
+        default:
+            return SIZE_MAX;
+    }
+}
+
+size_t rtuResponseLength(const uint8_t* frame, size_t have) {
+    if (have < 2) return 0;
+    if (frame[1] & 0x80) return 5;
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04:
+            return have < 3 ? 0 : 5 + (size_t)frame[2];
+        default:
+            return 8;
+    }
+}
+
+int64_t rtuCharTimeUs(size_t n, uint32_t baud, bool parity) {
+    if (baud == 0) return 0;
+    return (int64_t)n * (parity ? 11 : 10) * 1000000 / baud;
+}
+
+int64_t rtuFrameGapUs(uint32_t baud, bool parity) {
+    if (baud > 19200) return 1750;
+    return rtuCharTimeUs(7, baud, parity) / 2;
+}
@@ -0,0 +1,34 @@
+/**
+ * @file Rtu.h
+ * @brief Modbus RTU framing helpers shared by the host simulators.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Largest RTU frame: address + 253 byte PDU + CRC
+#define RTU_MAX_FRAME 256
+#define RTU_MAX_PDU   253
+
+// Modbus CRC16 (polynomial 0xA001, initial value 0xFFFF)
+uint16_t rtuCrc16(const uint8_t* data, size_t len);
+
+// Append the CRC to a frame of len bytes, returns the new length
+size_t rtuAppendCrc(uint8_t* frame, size_t len);
+
+// True when the last two bytes of the frame are its CRC
+bool rtuCheckCrc(const uint8_t* frame, size_t len);
+
+// Total length of a request frame once enough of it has arrived, 0 while unknown.
+// Returns SIZE_MAX for function codes the simulators do not understand.
+size_t rtuRequestLength(const uint8_t* frame, size_t have);
+
+// Total length of a response frame once enough of it has arrived, 0 while unknown.
+size_t rtuResponseLength(const uint8_t* frame, size_t have);
+
+// Line time of n characters (start + 8 data + optional parity + stop bits)
+int64_t rtuCharTimeUs(size_t n, uint32_t baud, bool parity);
+
+// The T3.5 silent interval that terminates a frame (fixed 1750 us above 19200 baud)
+int64_t rtuFrameGapUs(uint32_t baud, bool parity);
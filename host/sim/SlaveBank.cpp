@@ -0,0 +1,289 @@
+#include "SlaveBank.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// Modbus exception codes
+#define EX_ILLEGAL_FUNCTION     0x01
+#define EX_ILLEGAL_DATA_ADDRESS 0x02
+#define EX_ILLEGAL_DATA_VALUE   0x03
+
+static uint16_t getU16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void putU16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+RegisterMap RegisterMap::deviceParameters() {
+    RegisterMap map;
+    map.entries_.push_back({0, RegisterEntry::ASCII, 0, 0, 0, "SLAVE%03u", 8});
+    map.entries_.push_back({8, RegisterEntry::U16, 1, 0, 0, "", 1});
+    map.entries_.push_back({9, RegisterEntry::FLOAT, 60.0, 10.0, 600.0, "", 2});
+    map.entries_.push_back({11, RegisterEntry::FLOAT, 25.0, 3.0, 3600.0, "", 2});
+    return map;
+}
+
+bool RegisterMap::parseLine(const std::string& raw, std::string* error) {
+    std::string line = raw.substr(0, raw.find('#'));
+    std::istringstream in(line);
+    unsigned address;
+    std::string kind;
+    if (!(in >> address)) {
+        // Blank or comment only
+        return line.find_first_not_of(" \t\r") == std::string::npos;
+    }
+    if (!(in >> kind)) {
+        if (error) *error = "missing type";
+        return false;
+    }
+
+    RegisterEntry entry = {(uint16_t)address, RegisterEntry::U16, 0, 0, 0, "", 1};
+    if (kind == "ascii") {
+        entry.kind = RegisterEntry::ASCII;
+        in >> entry.text;
+        entry.words = (uint16_t)((entry.text.size() + 1) / 2);
+        if (entry.text.find("%u") != std::string::npos) {
+            entry.words = (uint16_t)((entry.text.size() + 2) / 2);
+        }
+    } else {
+        if (kind == "u16") {
+            entry.kind = RegisterEntry::U16;
+        } else if (kind == "u32") {
+            entry.kind = RegisterEntry::U32;
+            entry.words = 2;
+        } else if (kind == "float") {
+            entry.kind = RegisterEntry::FLOAT;
+            entry.words = 2;
+        } else {
+            if (error) *error = "unknown type '" + kind + "'";
+            return false;
+        }
+        if (!(in >> entry.value)) {
+            if (error) *error = "missing value";
+            return false;
+        }
+        in >> entry.amplitude >> entry.period_s;
+    }
+    if (address + entry.words > SIM_SLAVE_REGISTERS) {
+        if (error) *error = "register out of range";
+        return false;
+    }
+    entries_.push_back(entry);
+    return true;
+}
+
+bool RegisterMap::load(const char* path, std::string* error) {
+    std::ifstream file(path);
+    if (!file) {
+        if (error) *error = std::string("cannot open ") + path;
+        return false;
+    }
+    entries_.clear();
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        std::string line_error;
+        if (!parseLine(line, &line_error)) {
+            if (error) *error = std::string(path) + ":" + std::to_string(number) + ": " + line_error;
+            return false;
+        }
+    }
+    return true;
+}
+
+void RegisterMap::render(uint8_t slave, double t_s, uint16_t* regs) const {
+    for (const RegisterEntry& entry : entries_) {
+        double value = entry.value;
+        if (entry.amplitude != 0 && entry.period_s > 0) {
+            value += entry.amplitude * std::sin(t_s / entry.period_s + slave);
+        }
+        switch (entry.kind) {
+            case RegisterEntry::U16:
+                regs[entry.address] = (uint16_t)value;
+                break;
+            case RegisterEntry::U32: {
+                uint32_t raw = (uint32_t)value;
+                regs[entry.address] = (uint16_t)(raw >> 16);
+                regs[entry.address + 1] = (uint16_t)(raw & 0xFFFF);
+                break;
+            }
+            case RegisterEntry::FLOAT: {
+                float f = (float)value;
+                uint32_t raw;
+                memcpy(&raw, &f, sizeof(raw));
+                regs[entry.address] = (uint16_t)(raw >> 16);
+                regs[entry.address + 1] = (uint16_t)(raw & 0xFFFF);
+                break;
+            }
+            case RegisterEntry::ASCII: {
+                char text[2 * SIM_SLAVE_REGISTERS + 1] = {};
+                snprintf(text, sizeof(text), entry.text.c_str(), (unsigned)slave);
+                for (uint16_t i = 0; i < entry.words; i++) {
+                    regs[entry.address + i] = (uint16_t)((text[2 * i] << 8) | (uint8_t)text[2 * i + 1]);
+                }
+                break;
+            }
+        }
+    }
+}
+
+SlaveBank::SlaveBank(const RegisterMap& map) : map_(map) {}
+
+void SlaveBank::setMap(const RegisterMap& map) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    map_ = map;
+}
+
+SlaveBank::Slave* SlaveBank::find(uint8_t address) {
+    for (Slave& slave : slaves_) {
+        if (slave.address == address) return &slave;
+    }
+    return nullptr;
+}
+
+void SlaveBank::addSlave(uint8_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (address == 0 || find(address) != nullptr) return;
+    Slave slave = {};
+    slave.address = address;
+    slave.online = true;
+    slaves_.push_back(slave);
+}
+
+void SlaveBank::addRange(uint8_t first, uint8_t last) {
+    for (unsigned address = first; address <= last; address++) {
+        addSlave((uint8_t)address);
+    }
+}
+
+bool SlaveBank::hasSlave(uint8_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return find(address) != nullptr;
+}
+
+uint8_t SlaveBank::firstAddress() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slaves_.empty() ? 0 : slaves_.front().address;
+}
+
+void SlaveBank::setOnline(uint8_t address, bool online) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slave* slave = find(address);
+    if (slave != nullptr) slave->online = online;
+}
+
+bool SlaveBank::isOnline(uint8_t address) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slave* slave = find(address);
+    return slave != nullptr && slave->online;
+}
+
+bool SlaveBank::setRegister(uint8_t address, uint16_t reg, uint16_t value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slave* slave = find(address);
+    if (slave == nullptr || reg >= SIM_SLAVE_REGISTERS) return false;
+    slave->holding[reg] = value;
+    slave->input[reg] = value;
+    slave->pinned[reg] = true;
+    return true;
+}
+
+// Re-render the mapped registers, leaving pinned and written ones alone
+void SlaveBank::refresh(Slave& slave, double t_s) {
+    uint16_t rendered[SIM_SLAVE_REGISTERS];
+    memcpy(rendered, slave.input, sizeof(rendered));
+    map_.render(slave.address, t_s, rendered);
+    for (int reg = 0; reg < SIM_SLAVE_REGISTERS; reg++) {
+        if (!slave.pinned[reg]) {
+            slave.holding[reg] = rendered[reg];
+            slave.input[reg] = rendered[reg];
+        }
+    }
+}
+
+static size_t exception(uint8_t function, uint8_t code, uint8_t* response) {
+    response[0] = function | 0x80;
+    response[1] = code;
+    return 2;
+}
+
+size_t SlaveBank::process(uint8_t address, const uint8_t* pdu, size_t len, uint8_t* response, double t_s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slave* slave = find(address);
+    if (slave == nullptr || !slave->online || len < 1) return 0;
+
+    uint8_t function = pdu[0];
+    if (len < 5) return exception(function, EX_ILLEGAL_DATA_VALUE, response);
+    uint16_t start = getU16(&pdu[1]);
+    uint16_t count = getU16(&pdu[3]);
+
+    refresh(*slave, t_s);
+    switch (function) {
+        case 0x01:
+        case 0x02: {
+            if (count < 1 || count > 2000) return exception(function, EX_ILLEGAL_DATA_VALUE, response);
+            if (start + count > SIM_SLAVE_REGISTERS) return exception(function, EX_ILLEGAL_DATA_ADDRESS, response);
+            const uint8_t* bits = function == 0x01 ? slave->coils : slave->discrete;
+            size_t bytes = (count + 7) / 8;
+            response[0] = function;
+            response[1] = (uint8_t)bytes;
+            memset(&response[2], 0, bytes);
+            for (uint16_t i = 0; i < count; i++) {
+                if (bits[start + i]) response[2 + i / 8] |= (uint8_t)(1 << (i % 8));
+            }
+            return 2 + bytes;
+        }
+        case 0x03:
+        case 0x04: {
+            if (count < 1 || count > 125) return exception(function, EX_ILLEGAL_DATA_VALUE, response);
+            if (start + count > SIM_SLAVE_REGISTERS) return exception(function, EX_ILLEGAL_DATA_ADDRESS, response);
+            const uint16_t* regs = function == 0x03 ? slave->holding : slave->input;
+            response[0] = function;
+            response[1] = (uint8_t)(2 * count);
+            for (uint16_t i = 0; i < count; i++) {
+                putU16(&response[2 + 2 * i], regs[start + i]);
+            }
+            return 2 + 2 * (size_t)count;
+        }
+        case 0x05:
+            if (start >= SIM_SLAVE_REGISTERS) return exception(function, EX_ILLEGAL_DATA_ADDRESS, response);
+            if (count != 0xFF00 && count != 0x0000) return exception(function, EX_ILLEGAL_DATA_VALUE, response);
+            slave->coils[start] = count == 0xFF00;
+            memcpy(response, pdu, 5);
+            return 5;
+        case 0x06:
+            if (start >= SIM_SLAVE_REGISTERS) return exception(function, EX_ILLEGAL_DATA_ADDRESS, response);
+            slave->holding[start] = count;
+            slave->pinned[start] = true;
+            memcpy(response, pdu, 5);
+            return 5;
+        case 0x0F:
+        case 0x10: {
+            size_t max = function == 0x0F ? 1968 : 123;
+            size_t bytes = function == 0x0F ? (count + 7) / 8 : 2 * (size_t)count;
+            if (count < 1 || count > max || len < 6 + bytes || pdu[5] != bytes) {
+                return exception(function, EX_ILLEGAL_DATA_VALUE, response);
+            }
+            if (start + count > SIM_SLAVE_REGISTERS) return exception(function, EX_ILLEGAL_DATA_ADDRESS, response);
+            for (uint16_t i = 0; i < count; i++) {
+                if (function == 0x0F) {
+                    slave->coils[start + i] = (pdu[6 + i / 8] >> (i % 8)) & 1;
+                } else {
+                    slave->holding[start + i] = getU16(&pdu[6 + 2 * i]);
+                    slave->pinned[start + i] = true;
+                }
+            }
+            memcpy(response, pdu, 5);
+            return 5;
+        }
+        default:
+            return exception(function, EX_ILLEGAL_FUNCTION, response);
+    }
+}
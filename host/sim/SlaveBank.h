@@ -0,0 +1,103 @@
+/**
+ * @file SlaveBank.h
+ * @brief A set of simulated Modbus slaves sharing one register map schema.
+ *
+ * The register map describes what every slave exposes in its holding and input
+ * registers. The default map follows climate_sensor_params in
+ * drivers/Modbus/Modbus.cpp:
+ *
+ *     0..7    ASCII device name
+ *     8       status (U16)
+ *     9..10   humidity (float, high word first)
+ *     11..12  temperature (float, high word first)
+ *
+ * A map file holds one entry per line, '#' starts a comment:
+ *
+ *     <register> u16|u32|float|ascii <value> [<amplitude> <period_s>]
+ *
+ * Numeric entries with an amplitude follow value + amplitude * sin(t / period),
+ * phase shifted per slave. For ascii entries the value is the text, "%u" in it
+ * is replaced by the slave address.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define SIM_SLAVE_REGISTERS 256
+
+struct RegisterEntry {
+    enum Kind { U16, U32, FLOAT, ASCII };
+
+    uint16_t address;
+    Kind kind;
+    double value;
+    double amplitude;
+    double period_s;
+    std::string text;
+    uint16_t words;     // Registers occupied (ascii only)
+};
+
+class RegisterMap {
+public:
+    // The climate_sensor_params layout
+    static RegisterMap deviceParameters();
+
+    // Load a map file, replacing all entries
+    bool load(const char* path, std::string* error);
+
+    // Parse one map file line, blank and comment lines are accepted
+    bool parseLine(const std::string& line, std::string* error);
+
+    // Fill the registers of one slave at simulated time t_s
+    void render(uint8_t slave, double t_s, uint16_t* regs) const;
+
+    const std::vector<RegisterEntry>& entries() const { return entries_; }
+
+private:
+    std::vector<RegisterEntry> entries_;
+};
+
+class SlaveBank {
+public:
+    explicit SlaveBank(const RegisterMap& map = RegisterMap::deviceParameters());
+
+    void setMap(const RegisterMap& map);
+
+    void addSlave(uint8_t address);
+    void addRange(uint8_t first, uint8_t last);
+    bool hasSlave(uint8_t address);
+    uint8_t firstAddress();
+
+    // An offline slave never answers
+    void setOnline(uint8_t address, bool online);
+    bool isOnline(uint8_t address);
+
+    // Pin a register to a fixed value, overriding the map
+    bool setRegister(uint8_t address, uint16_t reg, uint16_t value);
+
+    // Execute a request PDU for a slave. Writes the response PDU (normal or
+    // exception) and returns its length, or 0 when the slave does not answer.
+    size_t process(uint8_t address, const uint8_t* pdu, size_t len, uint8_t* response, double t_s);
+
+private:
+    struct Slave {
+        uint8_t address;
+        bool online;
+        uint16_t holding[SIM_SLAVE_REGISTERS];
+        uint16_t input[SIM_SLAVE_REGISTERS];
+        bool pinned[SIM_SLAVE_REGISTERS];
+        uint8_t coils[SIM_SLAVE_REGISTERS];
+        uint8_t discrete[SIM_SLAVE_REGISTERS];
+    };
+
+    Slave* find(uint8_t address);
+    void refresh(Slave& slave, double t_s);
+
+    std::mutex mutex_;
+    RegisterMap map_;
+    std::vector<Slave> slaves_;
+};
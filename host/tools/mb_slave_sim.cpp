@@ -0,0 +1,306 @@
+/**
+ * @file mb_slave_sim.cpp
+ * @brief Modbus RTU multi-slave simulator on a Linux pseudo-terminal.
+ *
+ * Opens a pty and answers RTU requests for a range of slave addresses, using
+ * the register map schema from host/sim/SlaveBank.h (climate_sensor_params layout
+ * by default). Line timing is emulated at the configured baud rate, so a master
+ * on the other end of the pty sees realistic frame times even though the pty
+ * itself moves bytes instantly.
+ *
+ * Usage: mb_slave_sim [--addr FIRST-LAST] [--baud B] [--parity none|even|odd]
+ *                     [--delay-us US] [--crc-error-rate P] [--timeout-rate P]
+ *                     [--silent ADDR]... [--map FILE] [--link PATH]
+ *                     [--report S] [--seed N]
+ *
+ * The slave side of the pty is printed on startup (and symlinked to --link).
+ * Point the host build at it, e.g. pipeline_bench --serial /dev/pts/3.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Rtu.h"
+#include "SlaveBank.h"
+
+// A partial frame older than this is discarded to resynchronize
+#define STALE_FRAME_US 50000
+
+struct SimConfig {
+    unsigned first = 1;
+    unsigned last = 3;
+    uint32_t baud = 115200;
+    bool parity = false;
+    uint32_t delay_us = 1000;
+    double crc_error_rate = 0.0;
+    double timeout_rate = 0.0;
+    std::vector<unsigned> silent;
+    const char* map_path = nullptr;
+    const char* link_path = nullptr;
+    double report_s = 5.0;
+    unsigned seed = 1;
+};
+
+struct SimStats {
+    uint64_t requests = 0;          // Frames addressed to one of our slaves
+    uint64_t foreign = 0;           // Frames for other addresses
+    uint64_t bad_crc = 0;           // Requests dropped on their CRC
+    uint64_t responses = 0;
+    uint64_t exceptions = 0;
+    uint64_t injected_crc = 0;
+    uint64_t injected_silent = 0;
+    uint64_t response_bytes = 0;
+    int64_t gap_sum_us = 0;         // Master turnaround: end of our response to next request
+    int64_t gap_max_us = 0;
+    uint64_t gaps = 0;
+};
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void onSignal(int) {
+    s_stop = 1;
+}
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sleepUntil(int64_t deadline_us) {
+    int64_t remaining = deadline_us - nowUs();
+    if (remaining > 0) std::this_thread::sleep_for(std::chrono::microseconds(remaining));
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--addr FIRST-LAST] [--baud B] [--parity none|even|odd] [--delay-us US]\n"
+            "          [--crc-error-rate P] [--timeout-rate P] [--silent ADDR]... [--map FILE]\n"
+            "          [--link PATH] [--report S] [--seed N]\n", prog);
+    exit(2);
+}
+
+static SimConfig parseArgs(int argc, char** argv) {
+    SimConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--addr") == 0 && has_value) {
+            if (sscanf(argv[++i], "%u-%u", &config.first, &config.last) == 1) config.last = config.first;
+        } else if (strcmp(arg, "--baud") == 0 && has_value) {
+            config.baud = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--parity") == 0 && has_value) {
+            config.parity = strcmp(argv[++i], "none") != 0;
+        } else if (strcmp(arg, "--delay-us") == 0 && has_value) {
+            config.delay_us = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(arg, "--crc-error-rate") == 0 && has_value) {
+            config.crc_error_rate = atof(argv[++i]);
+        } else if (strcmp(arg, "--timeout-rate") == 0 && has_value) {
+            config.timeout_rate = atof(argv[++i]);
+        } else if (strcmp(arg, "--silent") == 0 && has_value) {
+            config.silent.push_back((unsigned)atoi(argv[++i]));
+        } else if (strcmp(arg, "--map") == 0 && has_value) {
+            config.map_path = argv[++i];
+        } else if (strcmp(arg, "--link") == 0 && has_value) {
+            config.link_path = argv[++i];
+        } else if (strcmp(arg, "--report") == 0 && has_value) {
+            config.report_s = atof(argv[++i]);
+        } else if (strcmp(arg, "--seed") == 0 && has_value) {
+            config.seed = (unsigned)atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.first < 1 || config.last > 247 || config.first > config.last || config.baud == 0) {
+        usage(argv[0]);
+    }
+    return config;
+}
+
+static void report(const SimStats& stats, double seconds, const char* label) {
+    printf("[%s] %.1f s: %llu requests (%.1f frames/s), %llu responses, %llu exceptions, "
+           "%llu foreign, %llu bad crc, injected %llu crc / %llu silent, "
+           "master gap mean %.2f ms max %.2f ms\n",
+           label, seconds, (unsigned long long)stats.requests,
+           seconds > 0 ? (double)stats.requests / seconds : 0.0,
+           (unsigned long long)stats.responses, (unsigned long long)stats.exceptions,
+           (unsigned long long)stats.foreign, (unsigned long long)stats.bad_crc,
+           (unsigned long long)stats.injected_crc, (unsigned long long)stats.injected_silent,
+           stats.gaps ? (double)stats.gap_sum_us / (double)stats.gaps / 1000.0 : 0.0,
+           stats.gap_max_us / 1000.0);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    SimConfig config = parseArgs(argc, argv);
+
+    RegisterMap map = RegisterMap::deviceParameters();
+    if (config.map_path != nullptr) {
+        std::string error;
+        if (!map.load(config.map_path, &error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    }
+    SlaveBank bank(map);
+    bank.addRange((uint8_t)config.first, (uint8_t)config.last);
+    for (unsigned address : config.silent) {
+        bank.setOnline((uint8_t)address, false);
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    const char* slave_path = ptsname(master);
+
+    // Hold the slave side open in raw mode so the line discipline never mangles
+    // frames and the master side does not see a hang-up between clients
+    int slave = open(slave_path, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+    if (config.link_path != nullptr) {
+        unlink(config.link_path);
+        if (symlink(slave_path, config.link_path) != 0) perror("symlink");
+    }
+
+    printf("mb_slave_sim: slaves %u-%u on %s at %u baud, delay %u us\n",
+           config.first, config.last, slave_path, config.baud, config.delay_us);
+    fflush(stdout);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    SimStats total;
+    SimStats interval;
+    int64_t start_us = nowUs();
+    int64_t interval_start_us = start_us;
+    int64_t last_response_end_us = -1;
+    int64_t frame_start_us = 0;
+    uint8_t frame[RTU_MAX_FRAME];
+    size_t have = 0;
+
+    while (!s_stop) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        int ready = poll(&pfd, 1, 10);
+        int64_t now = nowUs();
+
+        if (config.report_s > 0 && now - interval_start_us >= (int64_t)(config.report_s * 1e6)) {
+            report(interval, (now - interval_start_us) / 1e6, "interval");
+            interval = SimStats();
+            interval_start_us = now;
+        }
+        if (ready <= 0) {
+            if (have > 0 && now - frame_start_us > STALE_FRAME_US) have = 0;
+            continue;
+        }
+
+        ssize_t n = read(master, frame + have, sizeof(frame) - have);
+        if (n <= 0) continue;
+        if (have == 0) frame_start_us = now;
+        have += (size_t)n;
+
+        size_t expected = rtuRequestLength(frame, have);
+        if (expected == 0 || (expected != SIZE_MAX && have < expected)) continue;
+        if (expected == SIZE_MAX || expected > sizeof(frame)) expected = have;
+        size_t consumed = expected;
+
+        for (SimStats* stats : {&total, &interval}) {
+            if (last_response_end_us >= 0) {
+                int64_t gap = frame_start_us - last_response_end_us;
+                stats->gap_sum_us += gap;
+                stats->gaps++;
+                stats->gap_max_us = std::max(stats->gap_max_us, gap);
+            }
+        }
+        last_response_end_us = -1;
+
+        uint8_t address = frame[0];
+        bool ours = bank.hasSlave(address) || address == 0;
+        if (!rtuCheckCrc(frame, expected)) {
+            total.bad_crc++;
+            interval.bad_crc++;
+        } else if (!ours) {
+            total.foreign++;
+            interval.foreign++;
+        } else {
+            total.requests++;
+            interval.requests++;
+
+            // The request took its line time to arrive, then T3.5 marks its end
+            int64_t request_end = frame_start_us + rtuCharTimeUs(expected, config.baud, config.parity)
+                                + rtuFrameGapUs(config.baud, config.parity);
+            uint8_t response[RTU_MAX_FRAME];
+            double t_s = (now - start_us) / 1e6;
+            size_t pdu_len = 0;
+            if (address == 0) {
+                // Broadcast: every slave executes it, nobody answers
+                for (unsigned a = config.first; a <= config.last; a++) {
+                    bank.process((uint8_t)a, &frame[1], expected - 3, &response[1], t_s);
+                }
+            } else {
+                pdu_len = bank.process(address, &frame[1], expected - 3, &response[1], t_s);
+            }
+
+            if (pdu_len > 0 && chance(rng) < config.timeout_rate) {
+                total.injected_silent++;
+                interval.injected_silent++;
+                pdu_len = 0;
+            }
+            if (pdu_len > 0) {
+                response[0] = address;
+                size_t response_len = rtuAppendCrc(response, pdu_len + 1);
+                if (chance(rng) < config.crc_error_rate) {
+                    response[response_len - 1] ^= 0x5A;
+                    total.injected_crc++;
+                    interval.injected_crc++;
+                }
+                if (response[1] & 0x80) {
+                    total.exceptions++;
+                    interval.exceptions++;
+                }
+
+                // Turnaround, then the response takes its own line time plus T3.5
+                int64_t response_end = request_end + config.delay_us
+                                     + rtuCharTimeUs(response_len, config.baud, config.parity)
+                                     + rtuFrameGapUs(config.baud, config.parity);
+                sleepUntil(response_end);
+                if (write(master, response, response_len) == (ssize_t)response_len) {
+                    last_response_end_us = nowUs();
+                    total.responses++;
+                    interval.responses++;
+                    total.response_bytes += response_len;
+                }
+            }
+        }
+
+        memmove(frame, frame + consumed, have - consumed);
+        have -= consumed;
+        frame_start_us = nowUs();
+    }
+
+    report(total, (nowUs() - start_us) / 1e6, "total");
+    if (config.link_path != nullptr) unlink(config.link_path);
+    if (slave >= 0) close(slave);
+    close(master);
+    return 0;
+}
@@ -3,15 +3,108 @@
 #include <cstdint>
 #include <cstddef>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+
+struct ModbusRequest;
+
+// Runs on the task that completed the request, keep it short
+typedef void (*modbus_request_cb_t)(ModbusRequest* request, void* arg);
+
+/**
+ * @brief One request of the asynchronous API.
+ *
+ * The caller owns the request and its data buffer, and must leave both alone
+ * from submit() until the request completes. On completion the result is
+ * set, then the callback runs, then the notify task is given a notification;
+ * the request may be reused or freed once the last of them has happened.
+ */
+struct ModbusRequest {
+    uint8_t command;                // Modbus function code
+    uint16_t address;               // First register, coil or input
+    uint16_t quantity;              // Number of registers, coils or inputs
+    void* data;                     // Response buffer for reads, values for writes
+    modbus_request_cb_t callback;   // May be NULL
+    void* arg;                      // Passed to the callback
+    TaskHandle_t notify;            // Given a task notification on completion, may be NULL
+    esp_err_t result;               // ESP_ERR_NOT_FINISHED while in flight
+
+    // Filled in by the handle and the bus
+    uint8_t slave_id;
+    uint32_t batch;
+    SemaphoreHandle_t done;         // Given last by the bus, for a transaction waiting on its requests
+};
+
 class ModbusInterface {
     public:
         virtual bool readHoldingRegisters(uint16_t address, uint16_t quantity, uint16_t* response) = 0;
         virtual bool writeSingleRegister(uint16_t address, uint16_t value) = 0;
         virtual bool writeMultipleRegisters(uint16_t address, uint16_t quantity, uint16_t* values) = 0;
-    
+
         virtual bool readCoils(uint16_t address, uint16_t quantity, uint8_t* response) = 0;
         virtual bool writeSingleCoil(uint16_t address, bool value) = 0;
         virtual bool writeMultipleCoils(uint16_t address, uint16_t quantity, uint8_t* values) = 0;
-    
+
+        /**
+         * @brief Start a request and return without waiting for the response.
+         *
+         * Completes through the request's callback and notify task. Without
+         * a bus of its own to queue on, the request runs on the calling task
+         * through the blocking calls above and has completed on return.
+         *
+         * @return false if the request could not be queued; it then does not complete.
+         */
+        virtual bool submit(ModbusRequest* request) {
+            request->result = ESP_ERR_NOT_FINISHED;
+            bool ok;
+            switch (request->command) {
+                case 0x01:  // Read Coils
+                    ok = readCoils(request->address, request->quantity, static_cast<uint8_t*>(request->data));
+                    break;
+                case 0x03:  // Read Holding Registers
+                    ok = readHoldingRegisters(request->address, request->quantity, static_cast<uint16_t*>(request->data));
+                    break;
+                case 0x05:  // Write Single Coil
+                    ok = writeSingleCoil(request->address, *static_cast<uint8_t*>(request->data) != 0);
+                    break;
+                case 0x06:  // Write Single Register
+                    ok = writeSingleRegister(request->address, *static_cast<uint16_t*>(request->data));
+                    break;
+                case 0x0F:  // Write Multiple Coils
+                    ok = writeMultipleCoils(request->address, request->quantity, static_cast<uint8_t*>(request->data));
+                    break;
+                case 0x10:  // Write Multiple Registers
+                    ok = writeMultipleRegisters(request->address, request->quantity, static_cast<uint16_t*>(request->data));
+                    break;
+                default:
+                    return false;
+            }
+            request->result = ok ? ESP_OK : ESP_FAIL;
+            if (request->callback != nullptr) {
+                request->callback(request, request->arg);
+            }
+            if (request->notify != nullptr) {
+                xTaskNotifyGive(request->notify);
+            }
+            return true;
+        }
+
+        /**
+         * @brief Run a list of requests back to back and wait for all of them.
+         *
+         * Each request gets its own result; callbacks run as for submit().
+         *
+         * @return true if every request succeeded.
+         */
+        virtual bool transact(ModbusRequest* requests, size_t count) {
+            bool ok = true;
+            for (size_t i = 0; i < count; i++) {
+                ok = submit(&requests[i]) && requests[i].result == ESP_OK && ok;
+            }
+            return ok;
+        }
+
         virtual ~ModbusInterface() = default;
-    };
\ No newline at end of file
+    };
@@ -0,0 +1,637 @@
+#include "FlashLog.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "FlashLog";
+
+// Read position as committed to the journal
+typedef struct __attribute__((packed)) {
+    uint32_t seq;
+    uint16_t index;
+    uint16_t check;             // Low half of the CRC-32 of the bytes above
+} flash_log_journal_entry_t;
+
+// Bytes examined per flash read while scanning
+#define SCAN_CHUNK                  256
+
+static uint32_t blockCrc(const uint8_t* block, size_t payload_size) {
+    uint32_t crc = esp_rom_crc32_le(0, block, offsetof(flash_log_block_header_t, crc));
+    return esp_rom_crc32_le(crc, block + sizeof(flash_log_block_header_t), (uint32_t)payload_size);
+}
+
+// Bytes after the header a valid-looking block covers, 0 if its header is off
+static size_t payloadSize(const flash_log_block_header_t* header) {
+    if (header->magic == FLASH_LOG_BLOCK_MAGIC) {
+        return header->count <= FLASH_LOG_RECORDS_PER_BLOCK ? header->count * sizeof(SensorRecord) : 0;
+    }
+    if ((header->magic == FLASH_LOG_SERIES_MAGIC || header->magic == FLASH_LOG_SERIES_V1_MAGIC) &&
+        header->count <= FLASH_LOG_MAX_BLOCK_RECORDS) {
+        series_block_header_t series;
+        memcpy(&series, (const uint8_t*)header + sizeof(*header), sizeof(series));
+        return series.size >= sizeof(series) && series.size <= FLASH_LOG_PAYLOAD_SIZE ? series.size : 0;
+    }
+    return 0;
+}
+
+static uint16_t entryCheck(const flash_log_journal_entry_t* entry) {
+    return (uint16_t)esp_rom_crc32_le(0, (const uint8_t*)entry, offsetof(flash_log_journal_entry_t, check));
+}
+
+static bool allErased(const uint8_t* bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (bytes[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+FlashLog::FlashLog(const char* label, bool compress)
+    : label(label), partition(nullptr), mutex(nullptr), num_sectors(0), num_slots(0),
+      write_slot(0), next_seq(0), oldest_slot(0), has_data(false), compress(compress), write_count(0),
+      block_started_us(0), write_buf(), reader(), committed(), read_loaded(false), read_buf(), read_records(nullptr),
+      journal_sector(0), journal_next(0), stats() {}
+
+FlashLog::~FlashLog() {
+    if (mutex != nullptr) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+esp_err_t FlashLog::mount() {
+    int64_t start = esp_timer_get_time();
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == nullptr) {
+        ESP_LOGE(TAG, "Partition '%s' not found", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (partition->size / FLASH_LOG_SECTOR_SIZE < FLASH_LOG_JOURNAL_SECTORS + 2) {
+        ESP_LOGE(TAG, "Partition '%s' too small", label);
+        partition = nullptr;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (mutex == nullptr) {
+        mutex = xSemaphoreCreateMutex();
+        if (mutex == nullptr) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    num_sectors = partition->size / FLASH_LOG_SECTOR_SIZE - FLASH_LOG_JOURNAL_SECTORS;
+    num_slots = num_sectors * FLASH_LOG_BLOCKS_PER_SECTOR;
+    write_count = 0;
+    read_loaded = false;
+
+    // First valid sequence number of every sector, -1 for sectors without data
+    std::vector<int64_t> first_seq(num_sectors, -1);
+    uint32_t head = 0;
+    has_data = false;
+    for (uint32_t sector = 0; sector < num_sectors; sector++) {
+        for (uint32_t i = 0; i < FLASH_LOG_BLOCKS_PER_SECTOR; i++) {
+            SlotState state = loadSlot(sector * FLASH_LOG_BLOCKS_PER_SECTOR + i, read_buf);
+            if (state == SLOT_ERASED) {
+                break;
+            }
+            if (state == SLOT_VALID) {
+                // Numbering runs on through a sector, so its first slot would have had seq - i
+                const flash_log_block_header_t* header = (const flash_log_block_header_t*)read_buf;
+                first_seq[sector] = (int64_t)header->seq - i;
+                if (!has_data || first_seq[sector] > first_seq[head]) {
+                    head = sector;
+                }
+                has_data = true;
+                break;
+            }
+        }
+    }
+
+    // Write position: after the last used slot of the newest sector
+    next_seq = 0;
+    write_slot = 0;
+    if (has_data) {
+        int last_used = -1;
+        for (uint32_t i = 0; i < FLASH_LOG_BLOCKS_PER_SECTOR; i++) {
+            SlotState state = loadSlot(head * FLASH_LOG_BLOCKS_PER_SECTOR + i, read_buf);
+            if (state != SLOT_ERASED) {
+                last_used = (int)i;
+            }
+            if (state == SLOT_VALID) {
+                const flash_log_block_header_t* header = (const flash_log_block_header_t*)read_buf;
+                if (header->seq + 1 > next_seq) {
+                    next_seq = header->seq + 1;
+                }
+            }
+        }
+        write_slot = head * FLASH_LOG_BLOCKS_PER_SECTOR + (uint32_t)(last_used + 1);
+        // Continue in this sector only if the rest of it is really erased,
+        // otherwise start the next one, which is erased before use
+        if (last_used + 1 >= (int)FLASH_LOG_BLOCKS_PER_SECTOR ||
+            !isErased(slotOffset(write_slot), (FLASH_LOG_BLOCKS_PER_SECTOR - (last_used + 1)) * FLASH_LOG_BLOCK_SIZE)) {
+            write_slot = ((head + 1) % num_sectors) * FLASH_LOG_BLOCKS_PER_SECTOR;
+        }
+
+        // Oldest data: the first sector with data after the head
+        for (uint32_t n = 1; n <= num_sectors; n++) {
+            uint32_t sector = (head + n) % num_sectors;
+            if (first_seq[sector] >= 0) {
+                oldest_slot = sector * FLASH_LOG_BLOCKS_PER_SECTOR;
+                break;
+            }
+        }
+    } else {
+        oldest_slot = 0;
+    }
+
+    bool found = false;
+    uint32_t cursor_seq = 0;
+    uint16_t cursor_index = 0;
+    recoverJournal(&found, &cursor_seq, &cursor_index);
+    if (found && cursor_seq > next_seq) {
+        // Keep numbering ahead of the cursor even if the data is gone
+        next_seq = cursor_seq;
+    }
+    locateCursor(first_seq, found ? cursor_seq : 0, found ? cursor_index : 0);
+    committed = reader;
+
+    stats.mount_us = esp_timer_get_time() - start;
+    uint32_t backlog = reader.seq >= next_seq ? 0 : ringDistance(reader.slot, write_slot);
+    xSemaphoreGive(mutex);
+
+    ESP_LOGI(TAG, "Mounted '%s': %u sectors, next block %u, %u blocks unread, %lld us",
+             label, (unsigned)num_sectors, (unsigned)next_seq, (unsigned)backlog, (long long)stats.mount_us);
+    return ESP_OK;
+}
+
+esp_err_t FlashLog::append(const SensorRecord* records, size_t count, size_t* taken) {
+    if (taken != nullptr) {
+        *taken = 0;
+    }
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t result = ESP_OK;
+    size_t i = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (; i < count; i++) {
+        // A full block goes to flash, also one that could not be written earlier
+        if (!addToBlock(&records[i])) {
+            result = writeBlock();
+            if (result != ESP_OK) {
+                break;
+            }
+            addToBlock(&records[i]);
+        }
+        stats.records_appended++;
+    }
+    // A compressed block is full only once the next record does not fit
+    if (result == ESP_OK && !compress && write_count == FLASH_LOG_RECORDS_PER_BLOCK) {
+        result = writeBlock();
+    }
+    xSemaphoreGive(mutex);
+    if (taken != nullptr) {
+        *taken = i;
+    }
+    return result;
+}
+
+esp_err_t FlashLog::flush(Position* end) {
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    esp_err_t err = write_count > 0 ? writeBlock() : ESP_OK;
+    if (err == ESP_OK && end != nullptr) {
+        end->slot = write_slot;
+        end->seq = next_seq;
+        end->index = 0;
+    }
+    xSemaphoreGive(mutex);
+    return err;
+}
+
+esp_err_t FlashLog::flushIfOlder(uint32_t max_age_ms) {
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (write_count > 0 && esp_timer_get_time() - block_started_us >= (int64_t)max_age_ms * 1000) {
+        err = writeBlock();
+    }
+    xSemaphoreGive(mutex);
+    return err;
+}
+
+size_t FlashLog::read(SensorRecord* out, size_t max, const Position* end) {
+    if (partition == nullptr) {
+        return 0;
+    }
+    size_t copied = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    while (copied < max) {
+        if (!read_loaded) {
+            if (reader.seq >= next_seq) {
+                break;
+            }
+            SlotState state = loadSlot(reader.slot, read_buf);
+            const flash_log_block_header_t* header = (const flash_log_block_header_t*)read_buf;
+            if (state != SLOT_VALID || header->seq < reader.seq) {
+                if (reader.slot == write_slot) {
+                    break;
+                }
+                if (state == SLOT_INVALID) {
+                    stats.blocks_skipped++;
+                }
+                reader.slot = (reader.slot + 1) % num_slots;
+                reader.index = 0;
+                continue;
+            }
+            if (header->magic == FLASH_LOG_SERIES_MAGIC || header->magic == FLASH_LOG_SERIES_V1_MAGIC) {
+                SeriesDecoder decoder;
+                size_t n = 0;
+                int layout = header->magic == FLASH_LOG_SERIES_MAGIC ? SERIES_BLOCK_VERSION : 1;
+                if (decoder.begin(read_buf + sizeof(flash_log_block_header_t), FLASH_LOG_PAYLOAD_SIZE, layout) &&
+                    decoder.count() == header->count) {
+                    while (n < header->count && decoder.next(&decoded[n])) {
+                        n++;
+                    }
+                }
+                if (n != header->count) {
+                    stats.blocks_skipped++;
+                    reader.slot = (reader.slot + 1) % num_slots;
+                    reader.index = 0;
+                    continue;
+                }
+                read_records = decoded;
+            } else {
+                read_records = (const SensorRecord*)(read_buf + sizeof(flash_log_block_header_t));
+            }
+            if (header->seq != reader.seq) {
+                reader.seq = header->seq;
+                reader.index = 0;
+            }
+            read_loaded = true;
+        }
+
+        const flash_log_block_header_t* header = (const flash_log_block_header_t*)read_buf;
+        size_t n = header->count > reader.index ? header->count - reader.index : 0;
+        if (end != nullptr) {
+            int32_t ahead = (int32_t)(end->seq - reader.seq);
+            if (ahead < 0 || (ahead == 0 && reader.index >= end->index)) {
+                break;
+            }
+            if (ahead == 0 && n > (size_t)(end->index - reader.index)) {
+                n = end->index - reader.index;
+            }
+        }
+        if (n > max - copied) {
+            n = max - copied;
+        }
+        if (out != nullptr) {
+            memcpy(&out[copied], &read_records[reader.index], n * sizeof(SensorRecord));
+        }
+        copied += n;
+        reader.index += (uint16_t)n;
+        if (reader.index >= header->count) {
+            reader.slot = (reader.slot + 1) % num_slots;
+            reader.seq = header->seq + 1;
+            reader.index = 0;
+            read_loaded = false;
+        }
+    }
+    stats.records_read += (uint32_t)copied;
+    xSemaphoreGive(mutex);
+    return copied;
+}
+
+esp_err_t FlashLog::commit() {
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    esp_err_t err = writeJournal(reader);
+    xSemaphoreGive(mutex);
+    return err;
+}
+
+esp_err_t FlashLog::commit(const Position& position) {
+    if (partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // Only forward from the committed position, and not past the reader. The
+    // committed sequence number can lag after its sector was reused.
+    uint32_t to_position = ringDistance(committed.slot, position.slot);
+    uint32_t to_reader = ringDistance(committed.slot, reader.slot);
+    bool after_committed = to_position > 0 || position.seq > committed.seq ||
+                           (position.seq == committed.seq && position.index >= committed.index);
+    bool before_reader = to_position < to_reader ||
+                         (to_position == to_reader && position.seq == reader.seq && position.index <= reader.index);
+    esp_err_t err = ESP_ERR_INVALID_ARG;
+    if (after_committed && before_reader) {
+        err = writeJournal(position);
+    }
+    xSemaphoreGive(mutex);
+    return err;
+}
+
+FlashLog::Position FlashLog::tell() {
+    if (partition == nullptr) {
+        return reader;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Position position = reader;
+    xSemaphoreGive(mutex);
+    return position;
+}
+
+bool FlashLog::reached(const Position& position) {
+    if (partition == nullptr) {
+        return false;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int32_t ahead = (int32_t)(reader.seq - position.seq);
+    bool result = ahead > 0 || (ahead == 0 && reader.index >= position.index);
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+esp_err_t FlashLog::writeJournal(const Position& position) {
+    if (position.slot == committed.slot && position.seq == committed.seq && position.index == committed.index) {
+        return ESP_OK;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (journal_next + sizeof(flash_log_journal_entry_t) > FLASH_LOG_SECTOR_SIZE) {
+        // Journal sector full, continue in the other one
+        uint32_t other = (journal_sector + 1) % FLASH_LOG_JOURNAL_SECTORS;
+        err = esp_partition_erase_range(partition, (size_t)other * FLASH_LOG_SECTOR_SIZE, FLASH_LOG_SECTOR_SIZE);
+        if (err == ESP_OK) {
+            stats.sectors_erased++;
+            journal_sector = other;
+            journal_next = 0;
+        }
+    }
+    if (err == ESP_OK) {
+        flash_log_journal_entry_t entry;
+        entry.seq = position.seq;
+        entry.index = position.index;
+        entry.check = entryCheck(&entry);
+        err = esp_partition_write(partition, (size_t)journal_sector * FLASH_LOG_SECTOR_SIZE + journal_next,
+                                  &entry, sizeof(entry));
+        journal_next += sizeof(entry);
+    }
+    if (err == ESP_OK) {
+        committed = position;
+        stats.commits++;
+    } else {
+        stats.write_errors++;
+    }
+    return err;
+}
+
+void FlashLog::rewind() {
+    if (partition == nullptr) {
+        return;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    reader = committed;
+    read_loaded = false;
+    xSemaphoreGive(mutex);
+}
+
+void FlashLog::seek(const Position& position) {
+    if (partition == nullptr) {
+        return;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    reader = position;
+    read_loaded = false;
+    xSemaphoreGive(mutex);
+}
+
+uint32_t FlashLog::getBacklogBlocks() {
+    if (partition == nullptr) {
+        return 0;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint32_t blocks = 0;
+    if (reader.seq < next_seq) {
+        blocks = ringDistance(reader.slot, write_slot);
+        if (blocks == 0) {
+            blocks = num_slots;
+        }
+    }
+    xSemaphoreGive(mutex);
+    return blocks;
+}
+
+void FlashLog::getStats(flash_log_stats_t* out) {
+    if (mutex == nullptr) {
+        *out = stats;
+        return;
+    }
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(mutex);
+}
+
+FlashLog::SlotState FlashLog::loadSlot(uint32_t slot, uint8_t* buf) {
+    if (esp_partition_read(partition, slotOffset(slot), buf, FLASH_LOG_BLOCK_SIZE) != ESP_OK) {
+        return SLOT_INVALID;
+    }
+    if (allErased(buf, sizeof(flash_log_block_header_t))) {
+        return SLOT_ERASED;
+    }
+    const flash_log_block_header_t* header = (const flash_log_block_header_t*)buf;
+    size_t payload = payloadSize(header);
+    if (payload == 0 || header->version != SENSOR_RECORD_VERSION || header->count == 0 ||
+        header->crc != blockCrc(buf, payload)) {
+        return SLOT_INVALID;
+    }
+    return SLOT_VALID;
+}
+
+bool FlashLog::addToBlock(const SensorRecord* record) {
+    if (compress) {
+        if (write_count == 0) {
+            encoder.begin(write_buf + sizeof(flash_log_block_header_t), FLASH_LOG_PAYLOAD_SIZE);
+        }
+        if (write_count == FLASH_LOG_MAX_BLOCK_RECORDS || !encoder.append(record)) {
+            return false;
+        }
+    } else {
+        if (write_count == FLASH_LOG_RECORDS_PER_BLOCK) {
+            return false;
+        }
+        uint8_t* slot = write_buf + sizeof(flash_log_block_header_t) + write_count * sizeof(SensorRecord);
+        memcpy(slot, record, sizeof(SensorRecord));
+    }
+    if (write_count == 0) {
+        block_started_us = esp_timer_get_time();
+    }
+    write_count++;
+    return true;
+}
+
+esp_err_t FlashLog::writeBlock() {
+    // A sector is erased right before its first block
+    if (write_slot % FLASH_LOG_BLOCKS_PER_SECTOR == 0) {
+        esp_err_t err = eraseSector(write_slot / FLASH_LOG_BLOCKS_PER_SECTOR);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Sector erase failed: %s", esp_err_to_name(err));
+            stats.write_errors++;
+            return err;
+        }
+    }
+
+    size_t payload = compress ? encoder.finish() : write_count * sizeof(SensorRecord);
+    flash_log_block_header_t* header = (flash_log_block_header_t*)write_buf;
+    header->magic = compress ? FLASH_LOG_SERIES_MAGIC : FLASH_LOG_BLOCK_MAGIC;
+    header->version = SENSOR_RECORD_VERSION;
+    header->count = (uint8_t)write_count;
+    header->seq = next_seq;
+    header->crc = blockCrc(write_buf, payload);
+    header->reserved = 0xffffffff;
+
+    // Only the used part is programmed, the rest of the page stays erased
+    esp_err_t err = esp_partition_write(partition, slotOffset(write_slot), write_buf,
+                                        sizeof(flash_log_block_header_t) + payload);
+    // The slot is spent either way, a failed write may have left it torn
+    write_slot = (write_slot + 1) % num_slots;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Block write failed: %s", esp_err_to_name(err));
+        stats.write_errors++;
+        return err;
+    }
+    next_seq++;
+    has_data = true;
+    write_count = 0;
+    stats.blocks_written++;
+    return ESP_OK;
+}
+
+esp_err_t FlashLog::eraseSector(uint32_t sector) {
+    if (has_data && oldest_slot / FLASH_LOG_BLOCKS_PER_SECTOR == sector) {
+        // The ring is full, the oldest sector goes and anyone still in it moves on
+        uint32_t next = ((sector + 1) % num_sectors) * FLASH_LOG_BLOCKS_PER_SECTOR;
+        if (inSector(reader, sector) && reader.seq < next_seq) {
+            reader.slot = next;
+            reader.index = 0;
+            read_loaded = false;
+            stats.sectors_dropped++;
+        }
+        if (inSector(committed, sector) && committed.seq < next_seq) {
+            committed.slot = next;
+            committed.index = 0;
+        }
+        oldest_slot = next;
+    }
+    esp_err_t err = esp_partition_erase_range(partition, slotOffset(sector * FLASH_LOG_BLOCKS_PER_SECTOR),
+                                              FLASH_LOG_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        stats.sectors_erased++;
+    }
+    return err;
+}
+
+void FlashLog::recoverJournal(bool* found, uint32_t* seq, uint16_t* index) {
+    flash_log_journal_entry_t chunk[SCAN_CHUNK / sizeof(flash_log_journal_entry_t)];
+    uint32_t used[FLASH_LOG_JOURNAL_SECTORS] = {};
+    uint32_t best_sector = 0;
+    *found = false;
+
+    for (uint32_t sector = 0; sector < FLASH_LOG_JOURNAL_SECTORS; sector++) {
+        for (size_t offset = 0; offset < FLASH_LOG_SECTOR_SIZE; offset += sizeof(chunk)) {
+            if (esp_partition_read(partition, (size_t)sector * FLASH_LOG_SECTOR_SIZE + offset,
+                                   chunk, sizeof(chunk)) != ESP_OK) {
+                break;
+            }
+            for (size_t i = 0; i < sizeof(chunk) / sizeof(chunk[0]); i++) {
+                const flash_log_journal_entry_t* entry = &chunk[i];
+                if (allErased((const uint8_t*)entry, sizeof(*entry))) {
+                    continue;
+                }
+                used[sector] = (uint32_t)(offset + (i + 1) * sizeof(*entry));
+                if (entry->check != entryCheck(entry)) {
+                    continue;
+                }
+                if (!*found || entry->seq > *seq || (entry->seq == *seq && entry->index > *index)) {
+                    *seq = entry->seq;
+                    *index = entry->index;
+                    best_sector = sector;
+                    *found = true;
+                }
+            }
+        }
+    }
+
+    // New entries go after everything written to the sector holding the newest one
+    journal_sector = best_sector;
+    journal_next = used[best_sector];
+}
+
+void FlashLog::locateCursor(const std::vector<int64_t>& first_seq, uint32_t seq, uint16_t index) {
+    read_loaded = false;
+    if (!has_data) {
+        reader = { write_slot, next_seq, 0 };
+        return;
+    }
+
+    // Start at the last sector, oldest first, that begins at or before the cursor
+    uint32_t oldest_sector = oldest_slot / FLASH_LOG_BLOCKS_PER_SECTOR;
+    uint32_t head_sector = ((write_slot + num_slots - 1) % num_slots) / FLASH_LOG_BLOCKS_PER_SECTOR;
+    uint32_t start = oldest_slot;
+    for (uint32_t n = 0; n < num_sectors; n++) {
+        uint32_t sector = (oldest_sector + n) % num_sectors;
+        if (first_seq[sector] >= 0 && first_seq[sector] <= (int64_t)seq) {
+            start = sector * FLASH_LOG_BLOCKS_PER_SECTOR;
+        }
+        if (sector == head_sector) {
+            break;
+        }
+    }
+
+    // Then the first block at or after the cursor
+    for (uint32_t slot = start; ; slot = (slot + 1) % num_slots) {
+        if (loadSlot(slot, read_buf) == SLOT_VALID) {
+            const flash_log_block_header_t* header = (const flash_log_block_header_t*)read_buf;
+            if (header->seq >= seq) {
+                uint16_t consumed = header->seq == seq ? index : 0;
+                if (consumed >= header->count) {
+                    reader = { (slot + 1) % num_slots, header->seq + 1, 0 };
+                } else {
+                    reader = { slot, header->seq, consumed };
+                }
+                return;
+            }
+        }
+        if ((slot + 1) % num_slots == write_slot) {
+            break;
+        }
+    }
+    reader = { write_slot, next_seq, 0 };
+}
+
+bool FlashLog::isErased(size_t offset, size_t size) {
+    uint8_t chunk[64];
+    while (size > 0) {
+        size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+        if (esp_partition_read(partition, offset, chunk, n) != ESP_OK || !allErased(chunk, n)) {
+            return false;
+        }
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool FlashLog::inSector(const Position& cursor, uint32_t sector) const {
+    return cursor.slot / FLASH_LOG_BLOCKS_PER_SECTOR == sector;
+}
@@ -0,0 +1,220 @@
+/**
+ * @file FlashLog.h
+ * @brief Append-only ring log of sensor records in a dedicated flash partition.
+ *
+ * The partition starts with two journal sectors followed by the data ring.
+ * The data ring is a sequence of 256-byte blocks, one flash page each. A block
+ * holds a 16-byte header (magic, record count, sequence number, CRC-32) and up
+ * to FLASH_LOG_RECORDS_PER_BLOCK records. Appended records collect in RAM and
+ * go to flash a whole block at a time. Blocks are written in order through the
+ * sectors and wrap around, and each sector is erased just before its first
+ * block is written. Every sector is therefore erased equally often. When the
+ * ring is full the oldest sector is reused and its unread records are lost.
+ *
+ * Nothing about the write position is stored; mount() finds it again from the
+ * block sequence numbers. A block torn by a power loss fails its CRC and is
+ * skipped. The consumer read position is committed explicitly as an 8-byte
+ * entry appended to the journal sectors, which are used alternately.
+ *
+ * Readers see the log as a stream: read() returns the records after the read
+ * position in order, commit() makes that position survive a restart and
+ * rewind() returns to the last committed one, e.g. after a failed upload.
+ * Records still in the RAM block are not visible until flush().
+ *
+ * With compression on, a block holds a SeriesBlock instead of plain records,
+ * as many as fit in the page (up to FLASH_LOG_MAX_BLOCK_RECORDS). Both kinds
+ * of block are read either way, so the setting can change between boots.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#include "SensorRecord.h"
+#include "SeriesBlock.h"
+
+#define FLASH_LOG_PARTITION_LABEL   "sensorlog"
+
+#define FLASH_LOG_SECTOR_SIZE       4096
+#define FLASH_LOG_BLOCK_SIZE        256
+#define FLASH_LOG_BLOCKS_PER_SECTOR (FLASH_LOG_SECTOR_SIZE / FLASH_LOG_BLOCK_SIZE)
+#define FLASH_LOG_JOURNAL_SECTORS   2
+
+#define FLASH_LOG_BLOCK_MAGIC       0x4c53      // "SL", plain records
+#define FLASH_LOG_SERIES_MAGIC      0x5353      // "SS", a SeriesBlock
+#define FLASH_LOG_SERIES_V1_MAGIC   0x4353      // "SC", a version 1 SeriesBlock, still read
+
+// Most records a compressed block may hold
+#define FLASH_LOG_MAX_BLOCK_RECORDS 128
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;             // FLASH_LOG_BLOCK_MAGIC
+    uint8_t version;            // SENSOR_RECORD_VERSION of the records
+    uint8_t count;              // Records in the block
+    uint32_t seq;               // Block sequence number, one more per block written
+    uint32_t crc;               // CRC-32 of the bytes above and the records or the SeriesBlock
+    uint32_t reserved;          // Left erased
+} flash_log_block_header_t;
+
+#define FLASH_LOG_PAYLOAD_SIZE      (FLASH_LOG_BLOCK_SIZE - sizeof(flash_log_block_header_t))
+
+// Records in an uncompressed block
+#define FLASH_LOG_RECORDS_PER_BLOCK (FLASH_LOG_PAYLOAD_SIZE / sizeof(SensorRecord))
+
+typedef struct {
+    uint32_t records_appended;
+    uint32_t blocks_written;
+    uint32_t write_errors;      // Block or journal writes that failed
+    uint32_t sectors_erased;
+    uint32_t sectors_dropped;   // Sectors reused while they still held unread records
+    uint32_t records_read;
+    uint32_t blocks_skipped;    // Blocks passed over by the reader, torn or corrupt
+    uint32_t commits;
+    int64_t mount_us;           // Time the last mount() took
+} flash_log_stats_t;
+
+class FlashLog {
+public:
+    // A place in the record stream, between two records
+    struct Position {
+        uint32_t slot;
+        uint32_t seq;           // Sequence number expected at slot
+        uint16_t index;         // Records already consumed in that block
+    };
+
+    // compress: write new blocks as SeriesBlocks
+    explicit FlashLog(const char* label = FLASH_LOG_PARTITION_LABEL, bool compress = false);
+    ~FlashLog();
+
+    /**
+     * @brief Find the partition and recover the write and read positions.
+     *
+     * @return ESP_ERR_NOT_FOUND without the partition, ESP_ERR_INVALID_SIZE if
+     *         it holds fewer than two data sectors.
+     */
+    esp_err_t mount();
+
+    /**
+     * @brief Add records, every block that fills up is written right away.
+     *
+     * @param taken Set to the number of records taken, may be NULL.
+     * @return The error of a failed block write. The block stays in RAM and
+     *         records that no longer fit are not taken.
+     */
+    esp_err_t append(const SensorRecord* records, size_t count, size_t* taken = nullptr);
+
+    /**
+     * @brief Write the partly filled block, if any.
+     *
+     * @param end Set to the position after the last record in flash, may be NULL.
+     */
+    esp_err_t flush(Position* end = nullptr);
+
+    // Write the partly filled block once its first record is older than max_age_ms
+    esp_err_t flushIfOlder(uint32_t max_age_ms);
+
+    /**
+     * @brief Read records after the read position and advance it.
+     *
+     * @param end Stop at this position, e.g. one returned by flush(), may be NULL.
+     * @return Number of records copied, 0 when the reader has caught up.
+     */
+    size_t read(SensorRecord* out, size_t max, const Position* end = nullptr);
+
+    // Advance the read position over up to max records without copying them
+    size_t skip(size_t max) { return read(nullptr, max); }
+
+    // Persist the read position, records before it are not read again after a restart
+    esp_err_t commit();
+
+    /**
+     * @brief Persist an earlier read position, e.g. once the records up to it
+     *        have been acknowledged while later ones are still in flight.
+     *
+     * @return ESP_ERR_INVALID_ARG if the position is not between the committed
+     *         and the read position, e.g. because its sector has been reused.
+     */
+    esp_err_t commit(const Position& position);
+
+    // Current read position, for a later commit(position)
+    Position tell();
+
+    // Whether the read position has got to position
+    bool reached(const Position& position);
+
+    // Go back to the last committed read position
+    void rewind();
+
+    // Move the read position, e.g. to read ahead and come back. commit() still
+    // only moves forward from the committed position.
+    void seek(const Position& position);
+
+    // Blocks between the read and write positions
+    uint32_t getBacklogBlocks();
+
+    // Records the data ring can hold uncompressed
+    uint32_t getCapacity() const { return num_slots * FLASH_LOG_RECORDS_PER_BLOCK; }
+
+    void getStats(flash_log_stats_t* stats);
+
+private:
+    enum SlotState { SLOT_ERASED, SLOT_VALID, SLOT_INVALID };
+
+    // Read a data block into buf and classify it
+    SlotState loadSlot(uint32_t slot, uint8_t* buf);
+
+    // Add a record to the RAM block, false if the block is full
+    bool addToBlock(const SensorRecord* record);
+    esp_err_t writeBlock();
+    esp_err_t eraseSector(uint32_t sector);
+    // Append a journal entry for position, call with the mutex held
+    esp_err_t writeJournal(const Position& position);
+    void recoverJournal(bool* found, uint32_t* seq, uint16_t* index);
+    void locateCursor(const std::vector<int64_t>& first_seq, uint32_t seq, uint16_t index);
+    bool isErased(size_t offset, size_t size);
+    bool inSector(const Position& cursor, uint32_t sector) const;
+
+    size_t slotOffset(uint32_t slot) const {
+        return (size_t)(FLASH_LOG_JOURNAL_SECTORS * FLASH_LOG_SECTOR_SIZE) + (size_t)slot * FLASH_LOG_BLOCK_SIZE;
+    }
+    uint32_t ringDistance(uint32_t from, uint32_t to) const {
+        return (to + num_slots - from) % num_slots;
+    }
+
+    const char* label;
+    const esp_partition_t* partition;
+    SemaphoreHandle_t mutex;
+    uint32_t num_sectors;       // Data sectors
+    uint32_t num_slots;         // Data blocks
+
+    // Writer
+    uint32_t write_slot;
+    uint32_t next_seq;
+    uint32_t oldest_slot;
+    bool has_data;
+    bool compress;
+    size_t write_count;
+    int64_t block_started_us;   // When the first record of the RAM block came in
+    uint8_t write_buf[FLASH_LOG_BLOCK_SIZE];
+    SeriesEncoder encoder;
+
+    // Reader
+    Position reader;
+    Position committed;
+    bool read_loaded;
+    uint8_t read_buf[FLASH_LOG_BLOCK_SIZE];
+    const SensorRecord* read_records;   // Records of the loaded block, in read_buf or decoded
+    SensorRecord decoded[FLASH_LOG_MAX_BLOCK_RECORDS];
+
+    // Journal
+    uint32_t journal_sector;
+    uint32_t journal_next;      // Offset of the next entry in the journal sector
+
+    flash_log_stats_t stats;
+};
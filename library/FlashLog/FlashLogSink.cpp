@@ -0,0 +1,29 @@
+#include "FlashLogSink.h"
+#include "esp_log.h"
+
+static const char *TAG = "FlashLogSink";
+
+FlashLogSink::FlashLogSink(FlashLog* log, uint32_t flush_ms)
+    : log(log), tap(nullptr), flush_ms(flush_ms), dropped(0), last_error(ESP_OK) {}
+
+void FlashLogSink::write(const SensorRecord* records, size_t count) {
+    size_t taken = 0;
+    esp_err_t err = log->append(records, count, &taken);
+    dropped += (uint32_t)(count - taken);
+    if (err == ESP_OK) {
+        err = log->flushIfOlder(flush_ms);
+    }
+    if (tap != nullptr) {
+        tap->write(records, taken);
+    }
+
+    // Report a failing flash once, not for every batch
+    if (err != last_error) {
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Flash log write failed: %s", esp_err_to_name(err));
+        } else {
+            ESP_LOGI(TAG, "Flash log writes recovered");
+        }
+        last_error = err;
+    }
+}
@@ -0,0 +1,43 @@
+/**
+ * @file FlashLogSink.h
+ * @brief Pipeline sink that appends every record to the flash log.
+ *
+ * Full blocks go to flash as they fill up. A partly filled block is flushed
+ * once its oldest record has waited for the flush interval, which bounds what
+ * a power loss can take to that interval's worth of records.
+ *
+ * An optional tap sees exactly the records the log took, in order, right
+ * after they were appended. The MQTT uplink uses it as its live feed.
+ */
+#pragma once
+
+#include "FlashLog.h"
+#include "SensorPipeline.h"
+
+// Longest time a record waits in RAM for its block to fill
+#define FLASH_LOG_FLUSH_MS  10000
+
+// The same behind a SensorRollup: its longest default window. A rollup of a
+// few bytes per block barely compresses when every block is cut after 10 s,
+// and the rollup stage already holds up to a window in RAM.
+#define FLASH_LOG_ROLLUP_FLUSH_MS   900000
+
+class FlashLogSink : public SensorSink {
+public:
+    explicit FlashLogSink(FlashLog* log, uint32_t flush_ms = FLASH_LOG_FLUSH_MS);
+
+    void write(const SensorRecord* records, size_t count) override;
+
+    // Hand every record taken by the log on to tap, NULL to detach. Set before the pipeline runs.
+    void setTap(SensorSink* tap) { this->tap = tap; }
+
+    // Records the log did not take
+    uint32_t getDropped() const { return dropped; }
+
+private:
+    FlashLog* log;
+    SensorSink* tap;
+    uint32_t flush_ms;
+    uint32_t dropped;
+    esp_err_t last_error;
+};
@@ -0,0 +1,618 @@
+#include "MqttUplink.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+static const char *TAG = "MqttUplink";
+
+MqttUplink::MqttUplink(FlashLog* log)
+    : log(log), config(), client(nullptr), task_handle(nullptr), connected(false), connection(0),
+      live_mutex(nullptr), live_state(LIVE_IDLE), live_start(), live_id(0), seen_connection(0), in_flight(),
+      num_in_flight(0), bytes_in_flight(0), sessions(), num_sessions(0), backlog_batch(), live_batch(),
+      tail_batch(), tail_session(0), tail_pos(), window(1), base_latency_us(INT64_MAX),
+      period_latency_us(INT64_MAX), period_start_us(0), last_decrease_us(0), tokens(0), tokens_at_us(0), stats() {
+    portMUX_INITIALIZE(&lock);
+}
+
+esp_err_t MqttUplink::init(const mqtt_uplink_config_t* cfg) {
+    if (cfg == nullptr || cfg->broker_uri == nullptr || cfg->topic == nullptr ||
+        cfg->batch_records < 1 || cfg->batch_records > MQTT_UPLINK_MAX_BATCH ||
+        cfg->max_in_flight < 1 || cfg->max_in_flight > MQTT_UPLINK_IN_FLIGHT_LIMIT) {
+        ESP_LOGE(TAG, "Invalid uplink configuration");
+        return ESP_ERR_INVALID_ARG;
+    }
+    config = *cfg;
+    backlog_batch.records.resize(config.batch_records);
+    live_batch.records.resize(config.batch_records);
+    tail_batch.records.resize(config.batch_records);
+    payload.resize(sensorPayloadMaxSize(config.format, config.batch_records));
+    stats.window = window;
+
+    live_mutex = xSemaphoreCreateMutex();
+    if (live_mutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create live feed mutex");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_mqtt_client_config_t mqtt_config = {};
+    mqtt_config.broker.address.uri = config.broker_uri;
+    mqtt_config.credentials.client_id = config.client_id;
+    mqtt_config.buffer.out_size = (int)payload.size() + 64;
+    client = esp_mqtt_client_init(&mqtt_config);
+    if (client == nullptr) {
+        ESP_LOGE(TAG, "Failed to create MQTT client");
+        return ESP_FAIL;
+    }
+    esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, eventHandler, this);
+
+    if (xTaskCreatePinnedToCore(uplinkTask, "mqttUplinkTask", MQTT_UPLINK_STACK, this, config.priority,
+                                &task_handle, config.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create uplink task");
+        esp_mqtt_client_destroy(client);
+        client = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+    acks.setConsumer(task_handle);
+    live.setConsumer(task_handle);
+    return ESP_OK;
+}
+
+esp_err_t MqttUplink::start() {
+    if (client == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_mqtt_client_start(client);
+}
+
+void MqttUplink::getStats(mqtt_uplink_stats_t* out) {
+    portENTER_CRITICAL(&lock);
+    *out = stats;
+    portEXIT_CRITICAL(&lock);
+}
+
+void MqttUplink::write(const SensorRecord* records, size_t count) {
+    if (live_mutex == nullptr) {
+        return;
+    }
+    xSemaphoreTake(live_mutex, portMAX_DELAY);
+    if (live_state == LIVE_REQUESTED && live.isEmpty()) {
+        // Everything in flash so far is backlog, the records from here on are live
+        if (log->flush(&live_start) == ESP_OK) {
+            live_id++;
+            live_state = LIVE_ACTIVE;
+            count = 0;
+        }
+    }
+    if (live_state == LIVE_ACTIVE && count > 0) {
+        size_t pushed = 0;
+        SensorRecord* slots;
+        size_t n;
+        while (pushed < count && (n = live.reserve(&slots)) > 0) {
+            if (n > count - pushed) {
+                n = count - pushed;
+            }
+            memcpy(slots, &records[pushed], n * sizeof(SensorRecord));
+            live.publish(n);
+            pushed += n;
+        }
+        if (pushed < count) {
+            // The uplink fell behind, the rest of the session comes from the log
+            live_state = LIVE_CLOSED;
+            portENTER_CRITICAL(&lock);
+            stats.live_overflows++;
+            portEXIT_CRITICAL(&lock);
+        }
+    }
+    xSemaphoreGive(live_mutex);
+}
+
+void MqttUplink::eventHandler(void* arg, esp_event_base_t base, int32_t event_id, void* event_data) {
+    MqttUplink* self = static_cast<MqttUplink*>(arg);
+    esp_mqtt_event_handle_t event = static_cast<esp_mqtt_event_handle_t>(event_data);
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(TAG, "Connected to %s", self->config.broker_uri);
+            self->connection = self->connection + 1;
+            self->connected = true;
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGW(TAG, "Disconnected from broker");
+            self->connected = false;
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            // A full ring loses the ack, the message is then resent after the timeout
+            self->acks.push(event->msg_id);
+            break;
+        default:
+            break;
+    }
+    xTaskNotifyGive(self->task_handle);
+}
+
+void MqttUplink::uplinkTask(void* arg) {
+    static_cast<MqttUplink*>(arg)->run();
+}
+
+void MqttUplink::run() {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_UPLINK_POLL_MS));
+
+        // A new connection starts again from the last acknowledged record
+        uint32_t current = connection;
+        if (current != seen_connection) {
+            seen_connection = current;
+            portENTER_CRITICAL(&lock);
+            stats.connects++;
+            portEXIT_CRITICAL(&lock);
+            restart();
+            window = 1;
+            base_latency_us = INT64_MAX;
+            period_latency_us = INT64_MAX;
+            period_start_us = esp_timer_get_time();
+            tokens = config.budget_bytes_per_s;
+            tokens_at_us = period_start_us;
+        }
+        bool live_open = num_sessions > 0 && !sessions[num_sessions - 1].closed;
+        if (!connected) {
+            if (num_in_flight > 0 || live_open) {
+                restart();
+            }
+            continue;
+        }
+
+        takeAcks();
+        int64_t now = esp_timer_get_time();
+        if (num_in_flight > 0 && now - in_flight[0].published_us > (int64_t)config.ack_timeout_ms * 1000) {
+            ESP_LOGW(TAG, "No PUBACK for message %d, resending from the last acknowledged record",
+                     in_flight[0].msg_id);
+            portENTER_CRITICAL(&lock);
+            stats.ack_timeouts++;
+            portEXIT_CRITICAL(&lock);
+            restart();
+            window = 1;
+        }
+
+        updateLive();
+        skipLive();
+
+        // Live records first, they only wait for their batch
+        while (connected && live_batch.count > 0 && num_in_flight < MQTT_UPLINK_IN_FLIGHT_LIMIT) {
+            bool full = live_batch.count == config.batch_records;
+            bool lingered = esp_timer_get_time() - live_batch.started_us >= (int64_t)config.linger_ms * 1000;
+            if (!(full || lingered) || !publish(&live_batch, false)) {
+                break;
+            }
+            updateLive();
+        }
+
+        // Without a live feed, records waiting in the log's RAM block count
+        // against the linger time too
+        live_open = num_sessions > 0 && !sessions[num_sessions - 1].closed;
+        if (!live_open) {
+            log->flushIfOlder(config.linger_ms);
+        }
+
+        // Then the tails of closed sessions, then the older backlog up to the
+        // start of the oldest live session
+        if (replayTail()) {
+            continue;
+        }
+        while (connected) {
+            const FlashLog::Position* end = num_sessions > 0 ? &sessions[0].start : nullptr;
+            Batch* batch = &backlog_batch;
+            if (batch->count < config.batch_records) {
+                size_t n = log->read(&batch->records[batch->count], config.batch_records - batch->count, end);
+                if (n > 0 && batch->count == 0) {
+                    batch->started_us = esp_timer_get_time();
+                }
+                batch->count += n;
+            }
+            if (batch->count == 0) {
+                break;
+            }
+            bool full = batch->count == config.batch_records;
+            bool lingered = esp_timer_get_time() - batch->started_us >= (int64_t)config.linger_ms * 1000;
+            bool at_live = end != nullptr && log->reached(*end);
+            if (!(full || lingered || at_live) || !publish(batch, true)) {
+                break;
+            }
+        }
+    }
+}
+
+void MqttUplink::takeAcks() {
+    int msg_id;
+    int64_t now = esp_timer_get_time();
+    while (acks.pop(&msg_id, 1) == 1) {
+        for (size_t i = 0; i < num_in_flight; i++) {
+            Message* message = &in_flight[i];
+            if (message->msg_id == msg_id && !message->acked) {
+                message->acked = true;
+                int64_t latency = now - message->published_us;
+                adaptWindow(latency, now);
+                portENTER_CRITICAL(&lock);
+                stats.acks++;
+                stats.ack_latency_sum_us += latency;
+                if (latency > stats.ack_latency_max_us) {
+                    stats.ack_latency_max_us = latency;
+                }
+                portEXIT_CRITICAL(&lock);
+                break;
+            }
+        }
+    }
+
+    // Backlog and live are separate streams, each counts only up to its first
+    // message still waiting for a PUBACK
+    bool backlog_waiting = false, live_waiting = false;
+    bool committed = false;
+    FlashLog::Position commit_end = {};
+    uint32_t records = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < num_in_flight; i++) {
+        Message* message = &in_flight[i];
+        bool& waiting = message->live ? live_waiting : backlog_waiting;
+        if (waiting || !message->acked) {
+            waiting = true;
+            in_flight[kept++] = *message;
+            continue;
+        }
+        records += (uint32_t)message->count;
+        bytes_in_flight -= message->bytes;
+        if (message->live) {
+            LiveSession* session = findSession(message->session);
+            if (session != nullptr) {
+                session->acked += (uint32_t)message->count;
+                session->outstanding--;
+            }
+        } else {
+            commit_end = message->end;
+            committed = true;
+        }
+    }
+    if (kept == num_in_flight) {
+        return;
+    }
+    num_in_flight = kept;
+    esp_err_t err = committed ? log->commit(commit_end) : ESP_OK;
+
+    portENTER_CRITICAL(&lock);
+    stats.records_acked += records;
+    if (err != ESP_OK) {
+        stats.commit_errors++;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void MqttUplink::adaptWindow(int64_t latency, int64_t now) {
+    if (latency < period_latency_us) {
+        period_latency_us = latency;
+    }
+    if (now - period_start_us >= (int64_t)MQTT_UPLINK_BASE_PERIOD_MS * 1000) {
+        base_latency_us = period_latency_us;
+        period_latency_us = latency;
+        period_start_us = now;
+    }
+    int64_t base = base_latency_us < period_latency_us ? base_latency_us : period_latency_us;
+    int64_t target = 2 * base + (int64_t)MQTT_UPLINK_LATENCY_SLACK_MS * 1000;
+
+    // Grow by one message per window's worth of timely PUBACKs, halve at most
+    // once per round trip when they come back late
+    if (latency <= target) {
+        window += 1.0f / window;
+        if (window > (float)config.max_in_flight) {
+            window = (float)config.max_in_flight;
+        }
+    } else if (now - last_decrease_us >= latency) {
+        window = window / 2 < 1 ? 1 : window / 2;
+        last_decrease_us = now;
+        portENTER_CRITICAL(&lock);
+        stats.window_decreases++;
+        portEXIT_CRITICAL(&lock);
+    }
+    portENTER_CRITICAL(&lock);
+    stats.window = window;
+    portEXIT_CRITICAL(&lock);
+}
+
+void MqttUplink::updateLive() {
+    xSemaphoreTake(live_mutex, portMAX_DELAY);
+    LiveState state = live_state;
+    uint32_t id = live_id;
+    FlashLog::Position start = live_start;
+    if (state == LIVE_IDLE && connected && live_batch.count == 0 && live.isEmpty() &&
+        num_sessions < MQTT_UPLINK_LIVE_SESSIONS) {
+        live_state = LIVE_REQUESTED;
+    }
+    xSemaphoreGive(live_mutex);
+    if (state != LIVE_ACTIVE && state != LIVE_CLOSED) {
+        return;
+    }
+
+    // The session's records can only be in the ring once the tap opened it
+    LiveSession* session = findSession(id);
+    if (session == nullptr) {
+        session = &sessions[num_sessions++];
+        session->id = id;
+        session->start = start;
+        session->acked = 0;
+        session->outstanding = 0;
+        session->closed = false;
+        session->replayed = false;
+        portENTER_CRITICAL(&lock);
+        stats.live_sessions++;
+        portEXIT_CRITICAL(&lock);
+    }
+
+    if (live_batch.count < config.batch_records) {
+        size_t n = live.pop(&live_batch.records[live_batch.count], config.batch_records - live_batch.count);
+        if (n > 0 && live_batch.count == 0) {
+            live_batch.started_us = esp_timer_get_time();
+            live_batch.session = id;
+        }
+        live_batch.count += n;
+    }
+
+    // A closed session has nothing more coming once its ring is drained
+    if (state == LIVE_CLOSED && live.isEmpty()) {
+        session->closed = true;
+        xSemaphoreTake(live_mutex, portMAX_DELAY);
+        live_state = LIVE_IDLE;
+        xSemaphoreGive(live_mutex);
+    }
+}
+
+void MqttUplink::skipLive() {
+    while (num_sessions > 0) {
+        LiveSession* session = &sessions[0];
+        if (backlog_batch.count > 0 || !log->reached(session->start)) {
+            return;
+        }
+        // A commit past the session start must not overtake backlog messages
+        for (size_t i = 0; i < num_in_flight; i++) {
+            if (!in_flight[i].live) {
+                return;
+            }
+        }
+
+        // Pass over what the broker already has, as far as it is in flash
+        if (session->acked > 0) {
+            size_t n = log->skip(session->acked);
+            if (n == 0) {
+                return;
+            }
+            session->start = log->tell();
+            session->acked -= (uint32_t)n;
+            esp_err_t err = log->commit(session->start);
+            portENTER_CRITICAL(&lock);
+            stats.records_skipped += (uint32_t)n;
+            if (err != ESP_OK) {
+                stats.commit_errors++;
+            }
+            portEXIT_CRITICAL(&lock);
+        }
+
+        // Done once nothing more of it can be acknowledged live. What the
+        // live feed did not send is read from the log like any backlog.
+        bool batched = (live_batch.count > 0 && live_batch.session == session->id) ||
+                       (tail_batch.count > 0 && tail_batch.session == session->id);
+        if (!session->closed || session->outstanding > 0 || session->acked > 0 || batched) {
+            return;
+        }
+        if (session->id == tail_session) {
+            tail_session = 0;
+        }
+        for (size_t i = 1; i < num_sessions; i++) {
+            sessions[i - 1] = sessions[i];
+        }
+        num_sessions--;
+    }
+}
+
+bool MqttUplink::replayTail() {
+    // A tail sent up to the next session and acknowledged joins that session
+    for (size_t i = 0; i + 1 < num_sessions;) {
+        if (!sessions[i].replayed || sessions[i].outstanding > 0) {
+            i++;
+            continue;
+        }
+        sessions[i + 1].start = sessions[i].start;
+        sessions[i + 1].acked += sessions[i].acked;
+        for (size_t j = i + 1; j < num_sessions; j++) {
+            sessions[j - 1] = sessions[j];
+        }
+        num_sessions--;
+    }
+
+    size_t index = 0;
+    while (index < num_sessions && !(sessions[index].closed && !sessions[index].replayed)) {
+        index++;
+    }
+    if (index == num_sessions) {
+        return false;
+    }
+    LiveSession* session = &sessions[index];
+    LiveSession* next = index + 1 < num_sessions ? &sessions[index + 1] : nullptr;
+    if (session->id != tail_session) {
+        // The tail starts after the last record acknowledged, once the
+        // session's live messages have settled
+        bool batched = live_batch.count > 0 && live_batch.session == session->id;
+        if (session->outstanding > 0 || batched) {
+            return false;
+        }
+        FlashLog::Position backlog = log->tell();
+        log->seek(session->start);
+        log->skip(session->acked);
+        tail_pos = log->tell();
+        log->seek(backlog);
+        tail_session = session->id;
+        tail_batch.count = 0;
+    }
+
+    Batch* batch = &tail_batch;
+    while (connected) {
+        // A session the tap opened meanwhile bounds the tail even before it is
+        // registered, the mutex keeps the tap from opening one during the read
+        xSemaphoreTake(live_mutex, portMAX_DELAY);
+        bool bounded = next != nullptr || live_state == LIVE_ACTIVE || live_state == LIVE_CLOSED;
+        FlashLog::Position end = next != nullptr ? next->start : live_start;
+        FlashLog::Position backlog = log->tell();
+        log->seek(tail_pos);
+        if (batch->count < config.batch_records) {
+            size_t n = log->read(&batch->records[batch->count], config.batch_records - batch->count,
+                                 bounded ? &end : nullptr);
+            if (n > 0 && batch->count == 0) {
+                batch->started_us = esp_timer_get_time();
+                batch->session = session->id;
+            }
+            batch->count += n;
+            tail_pos = log->tell();
+        }
+        bool at_end = bounded && log->reached(end);
+        log->seek(backlog);
+        xSemaphoreGive(live_mutex);
+
+        if (batch->count == 0) {
+            // Caught up with the log, the backlog goes on until more is flushed
+            if (at_end && next != nullptr) {
+                session->replayed = true;
+            }
+            return false;
+        }
+        bool full = batch->count == config.batch_records;
+        bool lingered = esp_timer_get_time() - batch->started_us >= (int64_t)config.linger_ms * 1000;
+        if (!(full || lingered || at_end) || !publish(batch, true)) {
+            break;
+        }
+    }
+    return true;
+}
+
+void MqttUplink::refillTokens(int64_t now) {
+    tokens += (now - tokens_at_us) * config.budget_bytes_per_s / 1000000;
+    tokens_at_us = now;
+    if (tokens > (int64_t)config.budget_bytes_per_s) {
+        tokens = config.budget_bytes_per_s;
+    }
+}
+
+bool MqttUplink::publish(Batch* batch, bool paced) {
+    size_t len = sensorPayloadEncode(config.format, batch->records.data(), batch->count, payload.data(),
+                                     payload.size());
+    if (len == 0) {
+        ESP_LOGE(TAG, "Batch of %d records does not fit the payload buffer", (int)batch->count);
+        return false;
+    }
+    size_t bytes = len + strlen(config.topic) + MQTT_UPLINK_MESSAGE_OVERHEAD;
+    int64_t now = esp_timer_get_time();
+
+    // Tails and backlog get what the live records leave of the window, the
+    // send buffer and the budget. A message may overdraw the budget, the next
+    // paced message then waits longer.
+    bool limited = config.budget_bytes_per_s > 0;
+    if (limited) {
+        refillTokens(now);
+    }
+    if (paced) {
+        bool in_window = num_in_flight < (size_t)window;
+        bool buffered = num_in_flight == 0 || bytes_in_flight + bytes <= MQTT_UPLINK_SEND_BUFFER;
+        if (!in_window || !buffered || (limited && tokens <= 0)) {
+            return false;
+        }
+    }
+
+    FlashLog::Position end = log->tell();
+    int msg_id = esp_mqtt_client_publish(client, config.topic, (const char*)payload.data(), (int)len, 1, 0);
+    if (msg_id < 0) {
+        // Keep the batch, it goes again on the next pass
+        portENTER_CRITICAL(&lock);
+        stats.publish_errors++;
+        portEXIT_CRITICAL(&lock);
+        return false;
+    }
+    if (limited) {
+        tokens -= (int64_t)bytes;
+    }
+
+    bool live = batch->session != 0;
+    Message* message = &in_flight[num_in_flight++];
+    message->msg_id = msg_id;
+    message->live = live;
+    message->session = batch->session;
+    message->count = batch->count;
+    message->bytes = bytes;
+    message->end = end;
+    message->published_us = now;
+    message->acked = false;
+    bytes_in_flight += bytes;
+    if (live) {
+        LiveSession* session = findSession(batch->session);
+        if (session != nullptr) {
+            session->outstanding++;
+        }
+    }
+
+    portENTER_CRITICAL(&lock);
+    stats.messages++;
+    stats.records_sent += (uint32_t)batch->count;
+    if (live && !paced) {
+        stats.records_live += (uint32_t)batch->count;
+    } else if (live) {
+        stats.records_resumed += (uint32_t)batch->count;
+    }
+    stats.payload_bytes += (uint32_t)len;
+    portEXIT_CRITICAL(&lock);
+    batch->count = 0;
+    return true;
+}
+
+void MqttUplink::restart() {
+    // Close the live session, its unsent records are read from the log later
+    xSemaphoreTake(live_mutex, portMAX_DELAY);
+    bool had_live = live_state == LIVE_ACTIVE || live_state == LIVE_CLOSED;
+    uint32_t id = live_id;
+    live_state = LIVE_IDLE;
+    const SensorRecord* first;
+    size_t n;
+    while ((n = live.peek(&first)) > 0) {
+        live.release(n);
+    }
+    xSemaphoreGive(live_mutex);
+    if (had_live) {
+        LiveSession* session = findSession(id);
+        if (session != nullptr) {
+            session->closed = true;
+        }
+    }
+
+    if (num_in_flight > 0 || backlog_batch.count > 0 || live_batch.count > 0) {
+        log->rewind();
+        portENTER_CRITICAL(&lock);
+        stats.rewinds++;
+        portEXIT_CRITICAL(&lock);
+    }
+    num_in_flight = 0;
+    bytes_in_flight = 0;
+    backlog_batch.count = 0;
+    live_batch.count = 0;
+
+    // The sessions stay, what they had acknowledged is skipped in the log and
+    // their tails are read again from the first record not acknowledged
+    tail_batch.count = 0;
+    tail_session = 0;
+    for (size_t i = 0; i < num_sessions; i++) {
+        sessions[i].outstanding = 0;
+        sessions[i].replayed = false;
+    }
+}
+
+MqttUplink::LiveSession* MqttUplink::findSession(uint32_t id) {
+    for (size_t i = 0; i < num_sessions; i++) {
+        if (sessions[i].id == id) {
+            return &sessions[i];
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,271 @@
+/**
+ * @file MqttUplink.h
+ * @brief Forwards sensor records to an MQTT broker in batched messages, live
+ *        records first and the flash log backlog at a controlled rate.
+ *
+ * Records reach the uplink two ways. Attached as the tap of the FlashLogSink,
+ * it gets every record right after it went into the log (the live feed). Older
+ * records, e.g. those logged while the network was down, are read back from
+ * the FlashLog stream (the backlog). Both are packed into batched payloads
+ * (SensorPayload.h) published with QoS 1. A batch goes out when it is full or
+ * once its first record has waited for the linger time.
+ *
+ * After a connect the uplink asks the tap for a live session. The tap flushes
+ * the log and notes the write position: everything before it is backlog,
+ * everything after it is also fed live. Live batches are sent as they fill.
+ * The backlog is sent in between, within the bandwidth budget, within the
+ * lwIP send buffer and within a window of messages in flight that shrinks
+ * when PUBACKs come back later than the path's base latency and grows again
+ * when they do not. When the backlog reader gets to the start of the live
+ * session, it skips the records acknowledged live, commits and waits there.
+ * The live feed closes when it overflows (the uplink stopped keeping up).
+ *
+ * The log read position is committed only up to the last backlog message
+ * acknowledged in order, so a record leaves the backlog once the broker has
+ * it and not before. When the connection drops or an acknowledgement times
+ * out, the log is rewound to the committed position and the live session
+ * closes; the next connect resumes from there, skipping what was acknowledged
+ * live. Delivery is therefore at least once. Only a restart in the middle of a
+ * replay resends records that were acknowledged live; the backend can drop
+ * duplicates by slave and timestamp.
+ *
+ * The records of a closed session from its first one not acknowledged up to
+ * the next session (its tail: what was in flight, what the feed dropped and
+ * what was logged while the link was down) are recent. They are read from the
+ * log ahead of the older backlog, within the same window and budget, and count
+ * as acknowledged live. A tail sent and acknowledged in full joins the next
+ * session, so the backlog reader skips both in one go.
+ *
+ * Without the tap the uplink sends the log alone. It then flushes the log's
+ * partly filled block after the linger time, so records do not wait for a
+ * full flash block; a linger time much shorter than it takes to fill a block
+ * costs flash wear in that mode.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#include "FlashLog.h"
+#include "SensorPayload.h"
+#include "SensorPipeline.h"
+#include "SpscRing.h"
+
+#define MQTT_UPLINK_BATCH_RECORDS   64      // Default records per message
+#define MQTT_UPLINK_MAX_BATCH       256
+#define MQTT_UPLINK_LINGER_MS       5000    // Default wait for a batch to fill
+#define MQTT_UPLINK_MAX_IN_FLIGHT   4       // Default messages awaiting PUBACK
+#define MQTT_UPLINK_IN_FLIGHT_LIMIT 8
+#define MQTT_UPLINK_ACK_TIMEOUT_MS  10000
+#define MQTT_UPLINK_BUDGET          8192    // Default uplink bytes per second
+
+#define MQTT_UPLINK_STACK           4096
+#define MQTT_UPLINK_PRIORITY        3
+
+// Longest the task sleeps between looks at the batches and the acknowledgements
+#define MQTT_UPLINK_POLL_MS         100
+
+// Live records waiting for the uplink task, a power of two
+#define MQTT_UPLINK_LIVE_LENGTH     64
+
+// Live sessions whose records still have to be skipped in the log
+#define MQTT_UPLINK_LIVE_SESSIONS   4
+
+// Bytes charged against the budget per message on top of payload and topic
+// (MQTT fixed header, message id, TCP/IP headers)
+#define MQTT_UPLINK_MESSAGE_OVERHEAD 48
+
+// Latency above twice the base latency by more than this halves the window
+#define MQTT_UPLINK_LATENCY_SLACK_MS 20
+
+// The base latency is the lowest of the current and the previous period
+#define MQTT_UPLINK_BASE_PERIOD_MS  30000
+
+#ifdef CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define MQTT_UPLINK_SEND_BUFFER     CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#else
+#define MQTT_UPLINK_SEND_BUFFER     5760
+#endif
+
+typedef struct {
+    const char* broker_uri;             // e.g. "mqtt://broker.local"
+    const char* client_id;              // NULL for the esp-mqtt default
+    const char* topic;
+    sensor_payload_format_t format;
+    size_t batch_records;               // Records per message, 1 for a message per record
+    uint32_t linger_ms;                 // Longest a record waits for its batch to fill
+    size_t max_in_flight;               // Upper bound of the window of messages awaiting PUBACK
+    uint32_t ack_timeout_ms;            // Resend from the committed position after this
+    uint32_t budget_bytes_per_s;        // Live and backlog together, 0 for no limit
+    BaseType_t core_id;                 // Uplink task, tskNO_AFFINITY to let it float
+    UBaseType_t priority;
+} mqtt_uplink_config_t;
+
+#define MQTT_UPLINK_DEFAULT_CONFIG() {              \
+    .broker_uri = NULL,                             \
+    .client_id = NULL,                              \
+    .topic = NULL,                                  \
+    .format = SENSOR_PAYLOAD_BINARY,                \
+    .batch_records = MQTT_UPLINK_BATCH_RECORDS,     \
+    .linger_ms = MQTT_UPLINK_LINGER_MS,             \
+    .max_in_flight = MQTT_UPLINK_MAX_IN_FLIGHT,     \
+    .ack_timeout_ms = MQTT_UPLINK_ACK_TIMEOUT_MS,   \
+    .budget_bytes_per_s = MQTT_UPLINK_BUDGET,       \
+    .core_id = tskNO_AFFINITY,                      \
+    .priority = MQTT_UPLINK_PRIORITY,               \
+}
+
+typedef struct {
+    uint32_t connects;
+    uint32_t messages;          // Messages published, resends included
+    uint32_t records_sent;      // Records in those messages
+    uint32_t records_live;      // Records sent from the live feed
+    uint32_t records_resumed;   // Records of closed live sessions sent from the log ahead of the backlog
+    uint32_t payload_bytes;
+    uint32_t acks;              // PUBACKs for messages in flight
+    uint32_t records_acked;     // Records acknowledged, live or committed in the log
+    uint32_t records_skipped;   // Log records passed over because they went out live
+    uint32_t rewinds;           // Restarts from the committed position
+    uint32_t ack_timeouts;
+    uint32_t publish_errors;
+    uint32_t commit_errors;
+    uint32_t live_sessions;
+    uint32_t live_overflows;    // Live sessions closed because the feed was full
+    uint32_t window_decreases;  // Window halved on a late PUBACK
+    float window;               // Current window of messages in flight
+    int64_t ack_latency_sum_us;
+    int64_t ack_latency_max_us;
+} mqtt_uplink_stats_t;
+
+class MqttUplink : public SensorSink {
+public:
+    explicit MqttUplink(FlashLog* log);
+
+    /**
+     * @brief Create the MQTT client and the uplink task.
+     *
+     * @return ESP_ERR_INVALID_ARG for a missing URI or topic, a batch size
+     *         outside 1..MQTT_UPLINK_MAX_BATCH or an in-flight limit outside
+     *         1..MQTT_UPLINK_IN_FLIGHT_LIMIT.
+     */
+    esp_err_t init(const mqtt_uplink_config_t* config);
+
+    /**
+     * @brief Start the MQTT client once the network stack is up.
+     *
+     * The client connects by itself whenever the network is up.
+     */
+    esp_err_t start();
+
+    /**
+     * @brief Live feed, called by the FlashLogSink the uplink is the tap of.
+     *
+     * Records are dropped from the live feed, not from the log, when the uplink
+     * falls behind.
+     */
+    void write(const SensorRecord* records, size_t count) override;
+
+    bool isConnected() const { return connected; }
+
+    void getStats(mqtt_uplink_stats_t* stats);
+
+private:
+    enum LiveState {
+        LIVE_IDLE,              // No session, the uplink may request one
+        LIVE_REQUESTED,         // The tap opens a session on its next call
+        LIVE_ACTIVE,            // The tap feeds records
+        LIVE_CLOSED             // The tap stopped, the uplink drains what is left
+    };
+
+    // Log records that went out live, from start on
+    struct LiveSession {
+        uint32_t id;
+        FlashLog::Position start;
+        uint32_t acked;         // Records from start on acknowledged in order
+        uint32_t outstanding;   // Live messages of the session in flight
+        bool closed;
+        bool replayed;          // Tail read from the log up to the next session
+    };
+
+    struct Message {
+        int msg_id;
+        bool live;              // Counts for a live session, from the feed or its tail
+        uint32_t session;       // Live session of a live message
+        size_t count;
+        size_t bytes;           // Charged against the send buffer
+        FlashLog::Position end; // Read position after a backlog message's records
+        int64_t published_us;
+        bool acked;
+    };
+
+    struct Batch {
+        std::vector<SensorRecord> records;
+        size_t count;
+        int64_t started_us;
+        uint32_t session;       // Live session of the records, 0 for the backlog
+    };
+
+    static void uplinkTask(void* arg);
+    static void eventHandler(void* arg, esp_event_base_t base, int32_t event_id, void* event_data);
+
+    void run();
+    void takeAcks();
+    void adaptWindow(int64_t latency, int64_t now);
+    void updateLive();
+    void skipLive();
+    bool replayTail();
+    bool publish(Batch* batch, bool paced);
+    void refillTokens(int64_t now);
+    void restart();
+    LiveSession* findSession(uint32_t id);
+
+    FlashLog* log;
+    mqtt_uplink_config_t config;
+    esp_mqtt_client_handle_t client;
+    TaskHandle_t task_handle;
+
+    // Set by the MQTT event handler
+    volatile bool connected;
+    volatile uint32_t connection;       // One more per connect
+    SpscRing<int, 2 * MQTT_UPLINK_IN_FLIGHT_LIMIT> acks;
+
+    // Live feed, the tap is the producer. The mutex orders the session
+    // handshake against the tap's pushes.
+    SpscRing<SensorRecord, MQTT_UPLINK_LIVE_LENGTH> live;
+    SemaphoreHandle_t live_mutex;
+    LiveState live_state;
+    FlashLog::Position live_start;
+    uint32_t live_id;
+
+    // Uplink task only
+    uint32_t seen_connection;
+    Message in_flight[MQTT_UPLINK_IN_FLIGHT_LIMIT];
+    size_t num_in_flight;
+    size_t bytes_in_flight;
+    LiveSession sessions[MQTT_UPLINK_LIVE_SESSIONS];
+    size_t num_sessions;
+    Batch backlog_batch;
+    Batch live_batch;
+    Batch tail_batch;
+    uint32_t tail_session;              // Session whose tail is being read, 0 for none
+    FlashLog::Position tail_pos;        // Read position of the tail, the log reader stays on the backlog
+    std::vector<uint8_t> payload;
+    float window;
+    int64_t base_latency_us;            // Lowest PUBACK latency of the previous period
+    int64_t period_latency_us;          // Lowest of the current period
+    int64_t period_start_us;
+    int64_t last_decrease_us;
+    int64_t tokens;                     // Budget bytes available, negative after live overdraws
+    int64_t tokens_at_us;
+
+    portMUX_TYPE lock;
+    mqtt_uplink_stats_t stats;
+};
@@ -0,0 +1,143 @@
+#include "SensorPayload.h"
+#include "SeriesBlock.h"
+
+#include <stdio.h>
+#include <string.h>
+
+size_t sensorPayloadMaxSize(sensor_payload_format_t format, size_t count) {
+    if (format == SENSOR_PAYLOAD_JSON) {
+        // Array brackets and a comma per record
+        return 2 + count * (SENSOR_PAYLOAD_JSON_RECORD_MAX + 1);
+    }
+    if (format == SENSOR_PAYLOAD_SERIES) {
+        // A new block at the latest every SERIES_BLOCK_MAX_SERIES records
+        size_t blocks = count / SERIES_BLOCK_MAX_SERIES + 1;
+        return sizeof(sensor_payload_header_t) + blocks * SERIES_BLOCK_MAX_SIZE(0) + count * SERIES_BLOCK_RECORD_MAX;
+    }
+    return sizeof(sensor_payload_header_t) + count * sizeof(SensorRecord);
+}
+
+static size_t encodeJsonRecord(const SensorRecord* record, char* out, size_t size) {
+    int used = snprintf(out, size, "{\"slave\":%u,\"tag\":%u,\"ts\":%lld,\"values\":[",
+                        (unsigned)record->slave_id, (unsigned)record->tag_id,
+                        (long long)sensorRecordGetTimestamp(record));
+    for (int slot = 0; slot < SENSOR_RECORD_VALUES && used > 0 && (size_t)used < size; slot++) {
+        const char* sep = slot > 0 ? "," : "";
+        sensor_value_type_t type = sensorRecordGetType(record, slot);
+        if (type == SENSOR_VALUE_NONE) {
+            used += snprintf(out + used, size - used, "%snull", sep);
+        } else if (type == SENSOR_VALUE_CENTI) {
+            used += snprintf(out + used, size - used, "%s%.2f", sep, record->values[slot] / 100.0);
+        } else if (type == SENSOR_VALUE_U16) {
+            used += snprintf(out + used, size - used, "%s%u", sep, (unsigned)(uint16_t)record->values[slot]);
+        } else {
+            used += snprintf(out + used, size - used, "%s%d", sep, (int)record->values[slot]);
+        }
+    }
+    if (used > 0 && (size_t)used < size) {
+        used += snprintf(out + used, size - used, "]}");
+    }
+    return used > 0 && (size_t)used < size ? (size_t)used : 0;
+}
+
+size_t sensorPayloadEncode(sensor_payload_format_t format, const SensorRecord* records, size_t count,
+                           uint8_t* buf, size_t size) {
+    if (count == 0) {
+        return 0;
+    }
+    if (format == SENSOR_PAYLOAD_JSON) {
+        char* out = (char*)buf;
+        size_t used = 0;
+        bool array = count > 1;
+        if (array) {
+            if (size < 2) {
+                return 0;
+            }
+            out[used++] = '[';
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) {
+                if (used + 1 >= size) {
+                    return 0;
+                }
+                out[used++] = ',';
+            }
+            size_t n = encodeJsonRecord(&records[i], out + used, size - used);
+            if (n == 0) {
+                return 0;
+            }
+            used += n;
+        }
+        if (array) {
+            if (used + 1 > size) {
+                return 0;
+            }
+            out[used++] = ']';
+        }
+        return used;
+    }
+
+    sensor_payload_header_t header;
+    header.record_version = SENSOR_RECORD_VERSION;
+    header.count = (uint16_t)count;
+    if (format == SENSOR_PAYLOAD_SERIES) {
+        if (count > UINT16_MAX || size < sizeof(header)) {
+            return 0;
+        }
+        header.format = SENSOR_PAYLOAD_SERIES_V2;
+        memcpy(buf, &header, sizeof(header));
+        size_t used = sizeof(header);
+        size_t i = 0;
+        SeriesEncoder encoder;
+        while (i < count) {
+            encoder.begin(buf + used, size - used);
+            while (i < count && encoder.append(&records[i])) {
+                i++;
+            }
+            if (encoder.count() == 0) {
+                return 0;
+            }
+            used += encoder.finish();
+        }
+        return used;
+    }
+
+    if (count > UINT16_MAX || size < sensorPayloadMaxSize(SENSOR_PAYLOAD_BINARY, count)) {
+        return 0;
+    }
+    header.format = SENSOR_PAYLOAD_BINARY_V1;
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), records, count * sizeof(SensorRecord));
+    return sizeof(header) + count * sizeof(SensorRecord);
+}
+
+size_t sensorPayloadDecode(const uint8_t* buf, size_t len, SensorRecord* out, size_t max) {
+    sensor_payload_header_t header;
+    if (len < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if ((header.format == SENSOR_PAYLOAD_SERIES_V2 || header.format == SENSOR_PAYLOAD_SERIES_V1) &&
+        header.record_version == SENSOR_RECORD_VERSION && header.count <= max) {
+        size_t used = sizeof(header);
+        size_t decoded = 0;
+        SeriesDecoder decoder;
+        while (decoded < header.count) {
+            int layout = header.format == SENSOR_PAYLOAD_SERIES_V2 ? SERIES_BLOCK_VERSION : 1;
+            if (!decoder.begin(buf + used, len - used, layout) || decoder.count() == 0) {
+                return 0;
+            }
+            while (decoded < header.count && decoder.next(&out[decoded])) {
+                decoded++;
+            }
+            used += decoder.size();
+        }
+        return used == len ? decoded : 0;
+    }
+    if (header.format != SENSOR_PAYLOAD_BINARY_V1 || header.record_version != SENSOR_RECORD_VERSION ||
+        header.count > max || len != sizeof(header) + (size_t)header.count * sizeof(SensorRecord)) {
+        return 0;
+    }
+    memcpy(out, buf + sizeof(header), (size_t)header.count * sizeof(SensorRecord));
+    return header.count;
+}
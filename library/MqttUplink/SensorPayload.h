@@ -0,0 +1,68 @@
+/**
+ * @file SensorPayload.h
+ * @brief Uplink message formats for batches of sensor records.
+ *
+ * Binary, version 1: a 4-byte header followed by the records exactly as they
+ * are stored, little-endian:
+ *
+ *     0   format           SENSOR_PAYLOAD_BINARY_V1
+ *     1   record_version   SENSOR_RECORD_VERSION of the records
+ *     2   count            uint16, number of records
+ *     4   records          count * 16 bytes, see SensorRecord.h
+ *
+ * Series, version 2: the same header with SENSOR_PAYLOAD_SERIES_V2, followed
+ * by one or more SeriesBlocks (SeriesBlock.h) holding count records between
+ * them. A block takes up to SERIES_BLOCK_MAX_SERIES series, a batch with
+ * more starts another one. Version 1 (SENSOR_PAYLOAD_SERIES_V1) is the same
+ * with version 1 blocks and is still decoded.
+ *
+ * JSON is one object per record, in an array when there is more than one:
+ *
+ *     {"slave":1,"tag":1,"ts":1717171717171,"values":[0,55.25,23.5]}
+ *
+ * It is what a reading-per-message JSON uplink would send, kept for
+ * comparison and for brokers that have to be read by people.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SensorRecord.h"
+
+#define SENSOR_PAYLOAD_BINARY_V1        0xb1
+#define SENSOR_PAYLOAD_SERIES_V1        0xb2
+#define SENSOR_PAYLOAD_SERIES_V2        0xb3
+
+// Longest JSON object one record can produce
+#define SENSOR_PAYLOAD_JSON_RECORD_MAX  96
+
+typedef enum {
+    SENSOR_PAYLOAD_BINARY,
+    SENSOR_PAYLOAD_SERIES,
+    SENSOR_PAYLOAD_JSON
+} sensor_payload_format_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t format;
+    uint8_t record_version;
+    uint16_t count;
+} sensor_payload_header_t;
+
+// Buffer size that always holds count records
+size_t sensorPayloadMaxSize(sensor_payload_format_t format, size_t count);
+
+/**
+ * @brief Encode records into buf.
+ *
+ * @return Bytes used, 0 if buf is too small.
+ */
+size_t sensorPayloadEncode(sensor_payload_format_t format, const SensorRecord* records, size_t count,
+                           uint8_t* buf, size_t size);
+
+/**
+ * @brief Decode a binary or series payload.
+ *
+ * @return Records copied to out, 0 if the payload is malformed or holds more than max.
+ */
+size_t sensorPayloadDecode(const uint8_t* buf, size_t len, SensorRecord* out, size_t max);
@@ -0,0 +1,22 @@
+#include "SensorFilterSink.h"
+
+SensorFilterSink::SensorFilterSink(SensorSink* output, sensor_filter_t filter, void* arg)
+    : output(output), filter(filter), arg(arg), dropped(0) {}
+
+void SensorFilterSink::write(const SensorRecord* records, size_t count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!filter(&records[i], arg)) {
+            dropped++;
+            continue;
+        }
+        out[kept++] = records[i];
+        if (kept == SENSOR_PIPELINE_MAX_BATCH) {
+            output->write(out, kept);
+            kept = 0;
+        }
+    }
+    if (kept > 0) {
+        output->write(out, kept);
+    }
+}
@@ -0,0 +1,31 @@
+/**
+ * @file SensorFilterSink.h
+ * @brief Sink that passes on only the records a filter accepts.
+ *
+ * The filter runs on the task that writes to the sink, once per record and
+ * in order, and may keep state of its own. Accepted records are handed on in
+ * batches of up to SENSOR_PIPELINE_MAX_BATCH.
+ */
+#pragma once
+
+#include "SensorPipeline.h"
+
+// true to pass the record on
+typedef bool (*sensor_filter_t)(const SensorRecord* record, void* arg);
+
+class SensorFilterSink : public SensorSink {
+public:
+    SensorFilterSink(SensorSink* output, sensor_filter_t filter, void* arg = nullptr);
+
+    void write(const SensorRecord* records, size_t count) override;
+
+    // Records the filter turned down
+    uint32_t getDropped() const { return dropped; }
+
+private:
+    SensorSink* output;
+    sensor_filter_t filter;
+    void* arg;
+    uint32_t dropped;
+    SensorRecord out[SENSOR_PIPELINE_MAX_BATCH];
+};
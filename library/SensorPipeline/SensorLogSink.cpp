@@ -0,0 +1,67 @@
+#include "SensorLogSink.h"
+#include "esp_log.h"
+
+#include <math.h>
+#include <time.h>
+
+static const char *TAG = "SensorLog";
+
+SensorLogSink::SensorLogSink(SensorRing* ring) : ring(ring), reader(-1), task_handle(nullptr) {}
+
+esp_err_t SensorLogSink::init() {
+    reader = ring->addReader(true);
+    if (reader < 0) {
+        ESP_LOGE(TAG, "No reader left in the sensor ring");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(logTask, "sensorLogTask", SENSOR_LOG_SINK_STACK, this, SENSOR_LOG_SINK_PRIORITY, &task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create log task");
+        task_handle = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+    ring->setReaderTask(reader, task_handle);
+    return ESP_OK;
+}
+
+uint32_t SensorLogSink::getDropped() const {
+    if (reader < 0) {
+        return 0;
+    }
+    fanout_reader_stats_t stats;
+    ring->getReaderStats(reader, &stats);
+    return stats.overruns;
+}
+
+void SensorLogSink::logTask(void* arg) {
+    SensorLogSink* self = static_cast<SensorLogSink*>(arg);
+    uint32_t reported_dropped = 0;
+
+    while (1) {
+        self->ring->waitForData(self->reader, portMAX_DELAY);
+        const SensorRecord* rec = nullptr;
+        // One record per claim, so the ring can move a slow console on between lines
+        while (self->ring->peek(self->reader, &rec) > 0) {
+            // A slot without a value shows as nan
+            float status = 0, humidity = NAN, temperature = NAN;
+            sensorRecordGetValue(rec, 0, &status);
+            sensorRecordGetValue(rec, 1, &humidity);
+            sensorRecordGetValue(rec, 2, &temperature);
+            int64_t timestamp_ms = sensorRecordGetTimestamp(rec);
+            uint8_t slave_id = rec->slave_id;
+            self->ring->release(self->reader, 1);
+
+            time_t seconds = (time_t)(timestamp_ms / 1000);
+            struct tm time;
+            gmtime_r(&seconds, &time);
+            ESP_LOGI(TAG, "Data from slave %d: status=%d, humidity=%.2f, temp=%.2f at %02d:%02d:%02d.%03d",
+                     slave_id, (int)status, humidity, temperature,
+                     time.tm_hour, time.tm_min, time.tm_sec, (int)(timestamp_ms % 1000));
+        }
+
+        uint32_t dropped = self->getDropped();
+        if (dropped != reported_dropped) {
+            ESP_LOGW(TAG, "%u records not printed, console too slow", (unsigned)(dropped - reported_dropped));
+            reported_dropped = dropped;
+        }
+    }
+}
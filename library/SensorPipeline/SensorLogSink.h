@@ -0,0 +1,41 @@
+/**
+ * @file SensorLogSink.h
+ * @brief Debug reader that prints sensor records from a low-priority task.
+ *
+ * The sink reads the shared sensor ring in place as a spilling reader, on a
+ * task below the gateway tasks; nothing is copied for it. When the console
+ * cannot keep up the ring moves the sink past records instead of holding up
+ * the Modbus polling, and those records go unprinted. They are still stored and
+ * uplinked by the consumer stage.
+ */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#include "SensorPipeline.h"
+
+#define SENSOR_LOG_SINK_STACK       3072
+#define SENSOR_LOG_SINK_PRIORITY    1
+
+class SensorLogSink {
+public:
+    explicit SensorLogSink(SensorRing* ring);
+
+    // Join the ring and start the print task, before the producer starts
+    esp_err_t init();
+
+    // Records not printed because the console fell behind
+    uint32_t getDropped() const;
+
+    // The sink's reader id in the ring, -1 before init()
+    int getReader() const { return reader; }
+
+private:
+    static void logTask(void* arg);
+
+    SensorRing* ring;
+    int reader;
+    TaskHandle_t task_handle;
+};
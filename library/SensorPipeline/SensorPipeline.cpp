@@ -0,0 +1,69 @@
+#include "SensorPipeline.h"
+#include "esp_log.h"
+
+static const char *TAG = "SensorPipeline";
+
+SensorPipeline::SensorPipeline(SensorRing* ring, size_t max_batch)
+    : ring(ring), reader(ring->addReader(false)), max_batch(max_batch > 0 ? max_batch : 1), sinks(),
+      num_sinks(0), stats() {
+    portMUX_INITIALIZE(&lock);
+}
+
+bool SensorPipeline::addSink(SensorSink* sink) {
+    if (sink == nullptr || num_sinks >= SENSOR_PIPELINE_MAX_SINKS) {
+        ESP_LOGE(TAG, "Cannot add sink, %d already registered", (int)num_sinks);
+        return false;
+    }
+    sinks[num_sinks++] = sink;
+    return true;
+}
+
+void SensorPipeline::run() {
+    if (reader < 0) {
+        ESP_LOGE(TAG, "No reader left in the sensor ring");
+        vTaskDelete(NULL);
+    }
+    ring->setReaderTask(reader, xTaskGetCurrentTaskHandle());
+    while (1) {
+        if (ring->waitForData(reader, portMAX_DELAY)) {
+            portENTER_CRITICAL(&lock);
+            stats.wakeups++;
+            portEXIT_CRITICAL(&lock);
+            drain();
+        }
+    }
+}
+
+size_t SensorPipeline::drain() {
+    size_t drained = 0;
+    while (reader >= 0) {
+        const SensorRecord* records = nullptr;
+        size_t count = ring->peek(reader, &records);
+        if (count == 0) {
+            break;
+        }
+        if (count > max_batch) {
+            count = max_batch;
+        }
+        for (size_t i = 0; i < num_sinks; i++) {
+            sinks[i]->write(records, count);
+        }
+        ring->release(reader, count);
+        drained += count;
+
+        portENTER_CRITICAL(&lock);
+        stats.batches++;
+        stats.records += (uint32_t)count;
+        if (count > stats.max_batch) {
+            stats.max_batch = (uint32_t)count;
+        }
+        portEXIT_CRITICAL(&lock);
+    }
+    return drained;
+}
+
+void SensorPipeline::getStats(sensor_pipeline_stats_t* out) {
+    portENTER_CRITICAL(&lock);
+    *out = stats;
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file SensorPipeline.h
+ * @brief Consumer stage that drains the sensor ring in batches into sinks.
+ *
+ * The Modbus poll tasks write each record once into the sensor ring, a
+ * FanoutRing shared by every consumer, taking turns as its one producer. The stage is one of its holding
+ * readers: it sleeps until the ring has data, then takes up to a batch of
+ * records at a time and hands them to every registered sink in place. The
+ * slots are released only after all sinks have seen them, so a sink must copy
+ * what it wants to keep. Sinks run on the stage's task and should be quick.
+ * Anything slow (console, network) reads the ring on its own task as a
+ * spilling reader instead, like SensorLogSink, and is moved on rather than
+ * holding up the Modbus polling when it falls a ring behind.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+
+#include "SensorRecord.h"
+#include "FanoutRing.h"
+
+// Records from the Modbus poll tasks to the consumers, a power of two
+#define SENSOR_RING_LENGTH          64
+
+// Tasks reading the sensor ring: the consumer stage and SensorLogSink
+#define SENSOR_RING_READERS         2
+
+// Most records handed to the sinks per call
+#define SENSOR_PIPELINE_MAX_BATCH   16
+
+#define SENSOR_PIPELINE_MAX_SINKS   4
+
+typedef FanoutRing<SensorRecord, SENSOR_RING_LENGTH, SENSOR_RING_READERS> SensorRing;
+
+class SensorSink {
+public:
+    virtual ~SensorSink() {}
+
+    // Records are only valid for the duration of the call
+    virtual void write(const SensorRecord* records, size_t count) = 0;
+};
+
+typedef struct {
+    uint32_t wakeups;           // Times the stage woke up with data
+    uint32_t batches;           // Batches handed to the sinks
+    uint32_t records;           // Records handed to the sinks
+    uint32_t max_batch;         // Largest batch
+} sensor_pipeline_stats_t;
+
+class SensorPipeline {
+public:
+    // Adds the stage to the ring as a holding reader, before the producer starts
+    explicit SensorPipeline(SensorRing* ring, size_t max_batch = SENSOR_PIPELINE_MAX_BATCH);
+
+    // false if the sink table is full
+    bool addSink(SensorSink* sink);
+
+    /**
+     * @brief Run the stage on the calling task, never returns.
+     *
+     * The calling task is woken by the ring for the stage's reader.
+     */
+    void run();
+
+    /**
+     * @brief Hand everything currently in the ring to the sinks.
+     *
+     * @return Number of records drained.
+     */
+    size_t drain();
+
+    void getStats(sensor_pipeline_stats_t* stats);
+
+    // The stage's reader id in the ring, -1 if the ring had no reader left
+    int getReader() const { return reader; }
+
+private:
+    SensorRing* ring;
+    int reader;
+    size_t max_batch;
+    SensorSink* sinks[SENSOR_PIPELINE_MAX_SINKS];
+    size_t num_sinks;
+
+    portMUX_TYPE lock;
+    sensor_pipeline_stats_t stats;
+};
@@ -0,0 +1,83 @@
+#include "SensorRecord.h"
+
+#include <math.h>
+#include <string.h>
+
+void sensorRecordInit(SensorRecord* record, uint8_t slave_id, uint8_t tag_id, int64_t timestamp_ms) {
+    memset(record, 0, sizeof(*record));
+    record->version = SENSOR_RECORD_VERSION;
+    record->slave_id = slave_id;
+    record->tag_id = tag_id;
+
+    uint64_t timestamp = (uint64_t)timestamp_ms;
+    for (int i = 0; i < 6; i++) {
+        record->timestamp_ms[i] = (uint8_t)(timestamp >> (8 * i));
+    }
+}
+
+bool sensorRecordIsValid(const SensorRecord* record) {
+    return record != NULL && record->version == SENSOR_RECORD_VERSION;
+}
+
+int64_t sensorRecordGetTimestamp(const SensorRecord* record) {
+    uint64_t timestamp = 0;
+    for (int i = 0; i < 6; i++) {
+        timestamp |= (uint64_t)record->timestamp_ms[i] << (8 * i);
+    }
+    return (int64_t)timestamp;
+}
+
+sensor_value_type_t sensorRecordGetType(const SensorRecord* record, int slot) {
+    if (slot < 0 || slot >= SENSOR_RECORD_VALUES) {
+        return SENSOR_VALUE_NONE;
+    }
+    return (sensor_value_type_t)((record->value_types >> (2 * slot)) & 0x03);
+}
+
+bool sensorRecordSetValue(SensorRecord* record, int slot, sensor_value_type_t type, float value) {
+    if (slot < 0 || slot >= SENSOR_RECORD_VALUES) {
+        return false;
+    }
+
+    if (isnan(value)) {
+        // A reading the sensor could not take has no value, the slot stays unused
+        record->values[slot] = 0;
+        record->value_types = (uint8_t)(record->value_types & ~(0x03 << (2 * slot)));
+        return false;
+    }
+
+    float scaled = (type == SENSOR_VALUE_CENTI) ? value * 100.0f : value;
+    float low = (type == SENSOR_VALUE_U16) ? 0.0f : -32768.0f;
+    float high = (type == SENSOR_VALUE_U16) ? 65535.0f : 32767.0f;
+    bool in_range = true;
+
+    scaled = roundf(scaled);
+    if (scaled < low) {
+        scaled = low;
+        in_range = false;
+    } else if (scaled > high) {
+        scaled = high;
+        in_range = false;
+    }
+
+    // U16 words are kept as their bit pattern in the int16 slot
+    record->values[slot] = (type == SENSOR_VALUE_U16) ? (int16_t)(uint16_t)scaled : (int16_t)scaled;
+    record->value_types = (uint8_t)((record->value_types & ~(0x03 << (2 * slot))) | ((type & 0x03) << (2 * slot)));
+    return in_range;
+}
+
+bool sensorRecordGetValue(const SensorRecord* record, int slot, float* value) {
+    switch (sensorRecordGetType(record, slot)) {
+        case SENSOR_VALUE_U16:
+            *value = (float)(uint16_t)record->values[slot];
+            return true;
+        case SENSOR_VALUE_I16:
+            *value = (float)record->values[slot];
+            return true;
+        case SENSOR_VALUE_CENTI:
+            *value = (float)record->values[slot] / 100.0f;
+            return true;
+        default:
+            return false;
+    }
+}
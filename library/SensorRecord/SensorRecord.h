@@ -0,0 +1,94 @@
+/**
+ * @file SensorRecord.h
+ * @brief Compact, versioned sensor record shared by the sensor ring, storage and uplink.
+ *
+ * One record is a timestamped sample of one tag group of one slave: up to
+ * three typed 16-bit values (status words, signed counts, or fixed-point
+ * readings in hundredths). The layout is packed and little-endian so it can be
+ * copied byte for byte into flash or an uplink frame. Conversion to calendar
+ * time and to floating point happens only where records are shown.
+ *
+ * Layout, version 1 (16 bytes):
+ *
+ *     0   version          SENSOR_RECORD_VERSION
+ *     1   slave_id         Modbus slave address
+ *     2   timestamp_ms     48-bit milliseconds since the Unix epoch (UTC)
+ *     8   tag_id           Tag group, defines what each value slot means
+ *     9   value_types      2 bits per slot, slot 0 in the low bits
+ *     10  values[3]        int16 per slot
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SENSOR_RECORD_VERSION   1
+#define SENSOR_RECORD_VALUES    3
+
+typedef enum {
+    SENSOR_VALUE_NONE = 0,      // Slot unused
+    SENSOR_VALUE_U16,           // Unsigned word, e.g. a status register
+    SENSOR_VALUE_I16,           // Signed count
+    SENSOR_VALUE_CENTI          // Fixed point, hundredths (-327.68 .. 327.67)
+} sensor_value_type_t;
+
+// Tag groups. The group fixes the meaning of the value slots.
+typedef enum {
+    SENSOR_TAG_CLIMATE = 1      // [0] device status, [1] humidity %RH, [2] temperature C
+} sensor_tag_t;
+
+/*
+ * Rollups (SensorRollup) of tag groups 1 to 3 have a tag id of their own:
+ * bit 7 set, the statistic in bits 4-6, the resolution index in bits 2-3
+ * and the source tag group in bits 0-1. The value slots keep the meaning
+ * and type of the source slots, except for counts, which are U16. The
+ * timestamp is the start of the window.
+ */
+typedef enum {
+    SENSOR_STAT_MIN = 0,
+    SENSOR_STAT_MAX,
+    SENSOR_STAT_MEAN,
+    SENSOR_STAT_LAST,
+    SENSOR_STAT_STDDEV,         // Sample standard deviation
+    SENSOR_STAT_COUNT,          // Samples per slot
+    SENSOR_STAT_NUM
+} sensor_stat_t;
+
+#define SENSOR_TAG_ROLLUP               0x80
+#define SENSOR_TAG_ROLLUP_MAX_SOURCE    3
+#define SENSOR_ROLLUP_TAG(stat, resolution, tag) \
+    (uint8_t)(SENSOR_TAG_ROLLUP | ((stat) & 0x07) << 4 | ((resolution) & 0x03) << 2 | ((tag) & 0x03))
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t slave_id;
+    uint8_t timestamp_ms[6];
+    uint8_t tag_id;
+    uint8_t value_types;
+    int16_t values[SENSOR_RECORD_VALUES];
+} SensorRecord;
+
+static_assert(sizeof(SensorRecord) == 16, "SensorRecord layout changed, bump SENSOR_RECORD_VERSION");
+
+// Start a record with all value slots unused
+void sensorRecordInit(SensorRecord* record, uint8_t slave_id, uint8_t tag_id, int64_t timestamp_ms);
+
+// Whether the record has a layout this firmware understands
+bool sensorRecordIsValid(const SensorRecord* record);
+
+int64_t sensorRecordGetTimestamp(const SensorRecord* record);
+
+sensor_value_type_t sensorRecordGetType(const SensorRecord* record, int slot);
+
+/**
+ * @brief Store a value in a slot.
+ *
+ * The value is rounded to the resolution of the type and saturated to its range.
+ * NaN is not stored, the slot is left unused (SENSOR_VALUE_NONE).
+ *
+ * @return false if the slot is out of range, the value is NaN or it had to be saturated.
+ */
+bool sensorRecordSetValue(SensorRecord* record, int slot, sensor_value_type_t type, float value);
+
+// Value of a slot in engineering units, false if the slot is unused
+bool sensorRecordGetValue(const SensorRecord* record, int slot, float* value);
@@ -0,0 +1,231 @@
+#include "SensorRollup.h"
+#include "esp_log.h"
+
+#include <math.h>
+
+static const char *TAG = "SensorRollup";
+
+// Longest window, keeps the sample count of a 1 s poll within 16 bits
+#define MAX_RESOLUTION_S    (18 * 3600)
+
+// Slot value in its own domain, U16 words are unsigned
+static int32_t slotValue(const SensorRecord* record, int slot) {
+    if (sensorRecordGetType(record, slot) == SENSOR_VALUE_U16) {
+        return (uint16_t)record->values[slot];
+    }
+    return record->values[slot];
+}
+
+static int16_t clampValue(int64_t value, sensor_value_type_t type) {
+    int64_t low = type == SENSOR_VALUE_U16 ? 0 : INT16_MIN;
+    int64_t high = type == SENSOR_VALUE_U16 ? UINT16_MAX : INT16_MAX;
+    value = value < low ? low : (value > high ? high : value);
+    return type == SENSOR_VALUE_U16 ? (int16_t)(uint16_t)value : (int16_t)value;
+}
+
+// sum / count rounded half away from zero
+static int64_t roundedMean(int64_t sum, uint16_t count) {
+    return sum >= 0 ? (sum + count / 2) / count : -((-sum + count / 2) / count);
+}
+
+SensorRollup::SensorRollup(SensorSink* output, size_t max_series)
+    : output(output), config(SENSOR_ROLLUP_DEFAULT_CONFIG()), max_series(max_series), latest_ms(0), out(),
+      out_count(0), stats() {
+    portMUX_INITIALIZE(&lock);
+}
+
+esp_err_t SensorRollup::init(const sensor_rollup_config_t* cfg) {
+    if (cfg->num_resolutions > SENSOR_ROLLUP_MAX_RESOLUTIONS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < cfg->num_resolutions; i++) {
+        if (cfg->resolutions_s[i] == 0 || cfg->resolutions_s[i] > MAX_RESOLUTION_S) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    config = *cfg;
+    series.clear();
+    series.reserve(max_series);
+    ESP_LOGI(TAG, "%d resolutions, %d series at most, raw tags 0x%x", (int)config.num_resolutions,
+             (int)max_series, (unsigned)config.raw_tags);
+    return ESP_OK;
+}
+
+SensorRollup::Series* SensorRollup::findSeries(const SensorRecord* record) {
+    for (Series& s : series) {
+        if (s.slave_id == record->slave_id && s.tag_id == record->tag_id) {
+            return &s;
+        }
+    }
+    if (series.size() >= max_series) {
+        return nullptr;
+    }
+    Series s = {};
+    s.slave_id = record->slave_id;
+    s.tag_id = record->tag_id;
+    for (Window& window : s.windows) {
+        window.start_ms = -1;
+    }
+    series.push_back(s);
+    portENTER_CRITICAL(&lock);
+    stats.series = (uint32_t)series.size();
+    portEXIT_CRITICAL(&lock);
+    return &series.back();
+}
+
+void SensorRollup::write(const SensorRecord* records, size_t count) {
+    uint32_t raw = 0, overflows = 0;
+    for (size_t i = 0; i < count; i++) {
+        const SensorRecord* record = &records[i];
+        int64_t timestamp = sensorRecordGetTimestamp(record);
+        latest_ms = timestamp > latest_ms ? timestamp : latest_ms;
+
+        bool rollup = sensorRecordIsValid(record) && config.num_resolutions > 0 && record->tag_id > 0 &&
+                      record->tag_id <= SENSOR_TAG_ROLLUP_MAX_SOURCE;
+        Series* s = rollup ? findSeries(record) : nullptr;
+        if (s != nullptr) {
+            add(s, record);
+        } else if (rollup) {
+            overflows++;
+        }
+        if (s == nullptr || (record->tag_id < 32 && (config.raw_tags & SENSOR_ROLLUP_TAG_BIT(record->tag_id)))) {
+            emit(record);
+            raw++;
+        }
+    }
+
+    // Windows of series that have gone quiet
+    for (Series& s : series) {
+        for (size_t r = 0; r < config.num_resolutions; r++) {
+            const Window& window = s.windows[r];
+            int64_t end = window.start_ms + (int64_t)config.resolutions_s[r] * 1000;
+            if (window.start_ms >= 0 && end + config.grace_ms <= latest_ms) {
+                close(&s, r);
+            }
+        }
+    }
+    flushOutput();
+
+    portENTER_CRITICAL(&lock);
+    bool first_overflow = overflows > 0 && stats.series_overflows == 0;
+    stats.records_in += (uint32_t)count;
+    stats.records_raw += raw;
+    stats.series_overflows += overflows;
+    portEXIT_CRITICAL(&lock);
+    if (first_overflow) {
+        ESP_LOGW(TAG, "Series table full (%d), passing records on raw", (int)max_series);
+    }
+}
+
+void SensorRollup::add(Series* s, const SensorRecord* record) {
+    int64_t timestamp = sensorRecordGetTimestamp(record);
+    for (size_t r = 0; r < config.num_resolutions; r++) {
+        Window* window = &s->windows[r];
+        int64_t length = (int64_t)config.resolutions_s[r] * 1000;
+        // Past the end, before the start (clock stepped back) or a different layout: start afresh
+        if (window->start_ms >= 0 && (timestamp >= window->start_ms + length || timestamp < window->start_ms ||
+                                      record->value_types != window->value_types)) {
+            close(s, r);
+        }
+        if (window->start_ms < 0) {
+            window->start_ms = timestamp - timestamp % length;
+            window->value_types = record->value_types;
+            for (Slot& slot : window->slots) {
+                slot = Slot();
+            }
+        }
+        for (int i = 0; i < SENSOR_RECORD_VALUES; i++) {
+            Slot* slot = &window->slots[i];
+            if (sensorRecordGetType(record, i) == SENSOR_VALUE_NONE || slot->count == UINT16_MAX) {
+                continue;
+            }
+            int32_t value = slotValue(record, i);
+            if (slot->count == 0) {
+                slot->min = value;
+                slot->max = value;
+            } else {
+                slot->min = value < slot->min ? value : slot->min;
+                slot->max = value > slot->max ? value : slot->max;
+            }
+            slot->last = value;
+            slot->sum += value;
+            slot->count++;
+            float delta = (float)value - slot->mean;
+            slot->mean += delta / slot->count;
+            slot->m2 += delta * ((float)value - slot->mean);
+        }
+    }
+}
+
+void SensorRollup::close(Series* s, size_t r) {
+    Window* window = &s->windows[r];
+    for (int stat = 0; stat < SENSOR_STAT_NUM; stat++) {
+        if (!(config.stats & SENSOR_ROLLUP_STAT_BIT(stat))) {
+            continue;
+        }
+        SensorRecord record;
+        sensorRecordInit(&record, s->slave_id, SENSOR_ROLLUP_TAG(stat, r, s->tag_id), window->start_ms);
+        for (int i = 0; i < SENSOR_RECORD_VALUES; i++) {
+            const Slot* slot = &window->slots[i];
+            sensor_value_type_t type = (sensor_value_type_t)((window->value_types >> (2 * i)) & 0x03);
+            if (type == SENSOR_VALUE_NONE || slot->count == 0) {
+                continue;
+            }
+            int64_t value = 0;
+            switch (stat) {
+                case SENSOR_STAT_MIN:    value = slot->min; break;
+                case SENSOR_STAT_MAX:    value = slot->max; break;
+                case SENSOR_STAT_MEAN:   value = roundedMean(slot->sum, slot->count); break;
+                case SENSOR_STAT_LAST:   value = slot->last; break;
+                case SENSOR_STAT_STDDEV:
+                    value = slot->count > 1 ? llroundf(sqrtf(slot->m2 / (slot->count - 1))) : 0;
+                    break;
+                default:
+                    type = SENSOR_VALUE_U16;
+                    value = slot->count;
+                    break;
+            }
+            record.values[i] = clampValue(value, type);
+            record.value_types |= (uint8_t)(type << (2 * i));
+        }
+        emit(&record);
+        portENTER_CRITICAL(&lock);
+        stats.records_out++;
+        portEXIT_CRITICAL(&lock);
+    }
+    window->start_ms = -1;
+    portENTER_CRITICAL(&lock);
+    stats.windows++;
+    portEXIT_CRITICAL(&lock);
+}
+
+void SensorRollup::emit(const SensorRecord* record) {
+    if (out_count == SENSOR_PIPELINE_MAX_BATCH) {
+        flushOutput();
+    }
+    out[out_count++] = *record;
+}
+
+void SensorRollup::flushOutput() {
+    if (out_count > 0 && output != nullptr) {
+        output->write(out, out_count);
+    }
+    out_count = 0;
+}
+
+void SensorRollup::flush() {
+    for (Series& s : series) {
+        for (size_t r = 0; r < config.num_resolutions; r++) {
+            if (s.windows[r].start_ms >= 0) {
+                close(&s, r);
+            }
+        }
+    }
+    flushOutput();
+}
+
+void SensorRollup::getStats(sensor_rollup_stats_t* out_stats) {
+    portENTER_CRITICAL(&lock);
+    *out_stats = stats;
+    portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,127 @@
+/**
+ * @file SensorRollup.h
+ * @brief Pipeline stage that turns raw records into windowed rollups.
+ *
+ * Every slave and tag group is a series. For each series and configured
+ * resolution the stage keeps one open window per value slot: count, sum,
+ * min, max, last and the running variance (Welford). The state does not grow
+ * with the samples. Windows are aligned to multiples of the resolution in
+ * epoch time.
+ *
+ * A window closes when a record of its series falls past its end, or once
+ * any record is later than its end by the grace time, so a slave that went
+ * quiet still gets its last window out. A closed window is written to the
+ * output sink as one record per configured statistic (SensorRecord.h,
+ * SENSOR_ROLLUP_TAG); slots that had no samples are left unused.
+ *
+ * Records of the tag groups in raw_tags are also passed on as they are.
+ * Records the stage cannot roll up (a tag group above
+ * SENSOR_TAG_ROLLUP_MAX_SOURCE, rollups themselves, or a series beyond the
+ * series table) are always passed on raw.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#include "SensorPipeline.h"
+#include "SensorRecord.h"
+
+#define SENSOR_ROLLUP_MAX_RESOLUTIONS   4
+#define SENSOR_ROLLUP_MAX_SERIES        64      // Default series table size
+#define SENSOR_ROLLUP_GRACE_MS          5000
+
+#define SENSOR_ROLLUP_STAT_BIT(stat)    (1u << (stat))
+#define SENSOR_ROLLUP_DEFAULT_STATS     (SENSOR_ROLLUP_STAT_BIT(SENSOR_STAT_MIN) | \
+                                         SENSOR_ROLLUP_STAT_BIT(SENSOR_STAT_MAX) | \
+                                         SENSOR_ROLLUP_STAT_BIT(SENSOR_STAT_MEAN) | \
+                                         SENSOR_ROLLUP_STAT_BIT(SENSOR_STAT_LAST))
+
+// Bit of a tag group in raw_tags
+#define SENSOR_ROLLUP_TAG_BIT(tag)      (1u << (tag))
+
+typedef struct {
+    uint32_t resolutions_s[SENSOR_ROLLUP_MAX_RESOLUTIONS];  // Window lengths, the index goes in the tag id
+    size_t num_resolutions;
+    uint32_t stats;                     // SENSOR_ROLLUP_STAT_BIT() of the statistics to emit
+    uint32_t raw_tags;                  // SENSOR_ROLLUP_TAG_BIT() of the tag groups also passed on raw
+    uint32_t grace_ms;                  // Close a window this long after its end without a record of its own
+} sensor_rollup_config_t;
+
+#define SENSOR_ROLLUP_DEFAULT_CONFIG() {            \
+    .resolutions_s = {60, 900},                     \
+    .num_resolutions = 2,                           \
+    .stats = SENSOR_ROLLUP_DEFAULT_STATS,           \
+    .raw_tags = 0,                                  \
+    .grace_ms = SENSOR_ROLLUP_GRACE_MS,             \
+}
+
+typedef struct {
+    uint32_t records_in;
+    uint32_t records_raw;       // Passed on unchanged
+    uint32_t windows;           // Windows closed
+    uint32_t records_out;       // Rollup records written
+    uint32_t series;            // Series in the table
+    uint32_t series_overflows;  // Records passed on raw because the table was full
+} sensor_rollup_stats_t;
+
+class SensorRollup : public SensorSink {
+public:
+    // output receives the rollups and the raw records passed on
+    explicit SensorRollup(SensorSink* output, size_t max_series = SENSOR_ROLLUP_MAX_SERIES);
+
+    // ESP_ERR_INVALID_ARG for a resolution of 0 or over 18 h, or more than SENSOR_ROLLUP_MAX_RESOLUTIONS
+    esp_err_t init(const sensor_rollup_config_t* config);
+
+    void write(const SensorRecord* records, size_t count) override;
+
+    // Close every open window, e.g. before a planned restart. Call it from the task that writes.
+    void flush();
+
+    void getStats(sensor_rollup_stats_t* stats);
+
+private:
+    struct Slot {
+        uint16_t count;
+        int32_t min;
+        int32_t max;
+        int32_t last;
+        int64_t sum;
+        float mean;             // Welford running mean and sum of squared deviations
+        float m2;
+    };
+
+    struct Window {
+        int64_t start_ms;       // -1 while closed
+        uint8_t value_types;
+        Slot slots[SENSOR_RECORD_VALUES];
+    };
+
+    struct Series {
+        uint8_t slave_id;
+        uint8_t tag_id;
+        Window windows[SENSOR_ROLLUP_MAX_RESOLUTIONS];
+    };
+
+    Series* findSeries(const SensorRecord* record);
+    void add(Series* series, const SensorRecord* record);
+    void close(Series* series, size_t resolution);
+    void emit(const SensorRecord* record);
+    void flushOutput();
+
+    SensorSink* output;
+    sensor_rollup_config_t config;
+    std::vector<Series> series;
+    size_t max_series;
+    int64_t latest_ms;          // Latest record timestamp seen
+
+    SensorRecord out[SENSOR_PIPELINE_MAX_BATCH];
+    size_t out_count;
+
+    portMUX_TYPE lock;
+    sensor_rollup_stats_t stats;
+};
@@ -0,0 +1,383 @@
+#include "SeriesBlock.h"
+
+#include <string.h>
+
+#define NO_WINDOW 0xff
+
+// Bits needed to write n, the selector width with n known series
+static int selectorBits(size_t n) {
+    int bits = 0;
+    while (n >> bits) {
+        bits++;
+    }
+    return bits;
+}
+
+static int leadingZeros16(uint16_t x) {
+    return __builtin_clz((unsigned)x) - (int)(8 * sizeof(unsigned) - 16);
+}
+
+static int trailingZeros16(uint16_t x) {
+    return __builtin_ctz((unsigned)x);
+}
+
+static int64_t signExtend(uint64_t value, int bits) {
+    uint64_t sign = 1ull << (bits - 1);
+    return (int64_t)((value ^ sign) - sign);
+}
+
+// ---- Encoder ----
+
+SeriesEncoder::SeriesEncoder()
+    : buf(nullptr), capacity_bits(0), bit_pos(0), overflow(true), series(), num_series(0), num_records(0) {}
+
+void SeriesEncoder::begin(uint8_t* out, size_t capacity) {
+    buf = out;
+    // The header holds the size in 16 bits
+    capacity_bits = (capacity < UINT16_MAX ? capacity : UINT16_MAX) * 8;
+    bit_pos = sizeof(series_block_header_t) * 8;
+    overflow = capacity < sizeof(series_block_header_t);
+    num_series = 0;
+    num_records = 0;
+}
+
+void SeriesEncoder::putBits(uint64_t value, int bits) {
+    if (overflow || bit_pos + (size_t)bits > capacity_bits) {
+        overflow = true;
+        return;
+    }
+    while (bits > 0) {
+        size_t byte = bit_pos >> 3;
+        int room = 8 - (int)(bit_pos & 7);
+        int take = bits < room ? bits : room;
+        uint8_t chunk = (uint8_t)((value >> (bits - take)) & ((1u << take) - 1));
+        // Keep only the bits already written, a rolled back append may have left more
+        uint8_t current = (uint8_t)(buf[byte] & (uint8_t)(0xff00 >> (8 - room)));
+        buf[byte] = (uint8_t)(current | (chunk << (room - take)));
+        bit_pos += (size_t)take;
+        bits -= take;
+    }
+}
+
+void SeriesEncoder::putTimestamp(Series* s, int64_t timestamp) {
+    int64_t delta = timestamp - s->timestamp;
+    int64_t dod = delta - s->delta;
+    if (dod == 0) {
+        putBits(0x0, 1);
+    } else if (dod >= -64 && dod <= 63) {
+        putBits(0x2, 2);
+        putBits((uint64_t)dod & 0x7f, 7);
+    } else if (dod >= -256 && dod <= 255) {
+        putBits(0x6, 3);
+        putBits((uint64_t)dod & 0x1ff, 9);
+    } else if (dod >= -2048 && dod <= 2047) {
+        putBits(0xe, 4);
+        putBits((uint64_t)dod & 0xfff, 12);
+    } else {
+        putBits(0xf, 4);
+        putBits((uint64_t)dod, 64);
+    }
+    s->timestamp = timestamp;
+    s->delta = delta;
+}
+
+void SeriesEncoder::putValue(Series* s, int slot, uint16_t value) {
+    uint16_t x = (uint16_t)(value ^ s->values[slot]);
+    s->values[slot] = value;
+    if (x == 0) {
+        putBits(0x0, 1);
+        return;
+    }
+    int leading = leadingZeros16(x);
+    int trailing = trailingZeros16(x);
+    if (s->leading[slot] != NO_WINDOW && leading >= s->leading[slot] && trailing >= s->trailing[slot]) {
+        putBits(0x2, 2);
+        putBits(x >> s->trailing[slot], 16 - s->leading[slot] - s->trailing[slot]);
+        return;
+    }
+    int length = 16 - leading - trailing;
+    putBits(0x3, 2);
+    putBits((uint64_t)leading, 4);
+    putBits((uint64_t)(length - 1), 4);
+    putBits(x >> trailing, length);
+    s->leading[slot] = (uint8_t)leading;
+    s->trailing[slot] = (uint8_t)trailing;
+}
+
+bool SeriesEncoder::append(const SensorRecord* record) {
+    if (overflow || num_records == UINT16_MAX) {
+        return false;
+    }
+    size_t index = 0;
+    while (index < num_series &&
+           !(series[index].slave_id == record->slave_id && series[index].tag_id == record->tag_id &&
+             series[index].value_types == record->value_types && series[index].version == record->version)) {
+        index++;
+    }
+    size_t saved_pos = bit_pos;
+    int width = selectorBits(num_series);
+
+    if (index == num_series) {
+        if (num_series == SERIES_BLOCK_MAX_SERIES) {
+            return false;
+        }
+        // A further series of a slave starts from the latest one of that slave,
+        // the first one starts with the whole record
+        size_t base = num_series;
+        while (base > 0 && !(series[base - 1].slave_id == record->slave_id &&
+                             series[base - 1].version == record->version)) {
+            base--;
+        }
+        putBits(num_series, width);
+        Series* s = &series[num_series];
+        if (base > 0) {
+            *s = series[base - 1];
+            s->tag_id = record->tag_id;
+            s->value_types = record->value_types;
+            s->delta = 0;
+            putBits(0x1, 1);
+            putBits(base - 1, selectorBits(num_series - 1));
+            putBits(record->tag_id, 8);
+            putBits(record->value_types, 8);
+            putTimestamp(s, sensorRecordGetTimestamp(record));
+            for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+                putValue(s, slot, (uint16_t)record->values[slot]);
+            }
+            s->delta = 0;
+        } else {
+            putBits(0x0, 1);
+            const uint8_t* bytes = (const uint8_t*)record;
+            for (size_t i = 0; i < sizeof(SensorRecord); i++) {
+                putBits(bytes[i], 8);
+            }
+            s->version = record->version;
+            s->slave_id = record->slave_id;
+            s->tag_id = record->tag_id;
+            s->value_types = record->value_types;
+            s->timestamp = sensorRecordGetTimestamp(record);
+            s->delta = 0;
+            for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+                s->values[slot] = (uint16_t)record->values[slot];
+                s->leading[slot] = NO_WINDOW;
+                s->trailing[slot] = 0;
+            }
+        }
+        if (overflow) {
+            bit_pos = saved_pos;
+            overflow = false;
+            return false;
+        }
+        num_series++;
+    } else {
+        Series* s = &series[index];
+        Series saved = *s;
+        putBits(index, width);
+        putTimestamp(s, sensorRecordGetTimestamp(record));
+        for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+            putValue(s, slot, (uint16_t)record->values[slot]);
+        }
+        if (overflow) {
+            *s = saved;
+            bit_pos = saved_pos;
+            overflow = false;
+            return false;
+        }
+    }
+    num_records++;
+    return true;
+}
+
+size_t SeriesEncoder::finish() {
+    if (buf == nullptr || capacity_bits < sizeof(series_block_header_t) * 8) {
+        return 0;
+    }
+    series_block_header_t header;
+    header.size = (uint16_t)size();
+    header.count = (uint16_t)num_records;
+    memcpy(buf, &header, sizeof(header));
+    return header.size;
+}
+
+// ---- Decoder ----
+
+SeriesDecoder::SeriesDecoder()
+    : buf(nullptr), size_bits(0), bit_pos(0), version(SERIES_BLOCK_VERSION), series(), num_series(0),
+      num_records(0), decoded(0) {}
+
+bool SeriesDecoder::begin(const uint8_t* in, size_t len, int layout) {
+    series_block_header_t header;
+    buf = in;
+    version = layout;
+    num_series = 0;
+    num_records = 0;
+    decoded = 0;
+    size_bits = 0;
+    if (len < sizeof(header) || version < 1 || version > SERIES_BLOCK_VERSION) {
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.size < sizeof(header) || header.size > len) {
+        return false;
+    }
+    size_bits = (size_t)header.size * 8;
+    bit_pos = sizeof(header) * 8;
+    num_records = header.count;
+    return true;
+}
+
+bool SeriesDecoder::getBits(int bits, uint64_t* value) {
+    if (bit_pos + (size_t)bits > size_bits) {
+        return false;
+    }
+    uint64_t result = 0;
+    while (bits > 0) {
+        int room = 8 - (int)(bit_pos & 7);
+        int take = bits < room ? bits : room;
+        uint8_t chunk = (uint8_t)((buf[bit_pos >> 3] >> (room - take)) & ((1u << take) - 1));
+        result = (result << take) | chunk;
+        bit_pos += (size_t)take;
+        bits -= take;
+    }
+    *value = result;
+    return true;
+}
+
+bool SeriesDecoder::getTimestamp(Series* s) {
+    uint64_t bit, raw;
+    int64_t dod = 0;
+    int prefix = 0;
+    while (prefix < 4) {
+        if (!getBits(1, &bit)) {
+            return false;
+        }
+        if (bit == 0) {
+            break;
+        }
+        prefix++;
+    }
+    static const int widths[] = {0, 7, 9, 12, 64};
+    if (prefix > 0) {
+        if (!getBits(widths[prefix], &raw)) {
+            return false;
+        }
+        dod = prefix == 4 ? (int64_t)raw : signExtend(raw, widths[prefix]);
+    }
+    s->delta += dod;
+    s->timestamp += s->delta;
+    return true;
+}
+
+bool SeriesDecoder::getValue(Series* s, int slot) {
+    uint64_t control, raw;
+    if (!getBits(1, &control)) {
+        return false;
+    }
+    if (control == 0) {
+        return true;
+    }
+    if (!getBits(1, &control)) {
+        return false;
+    }
+    uint16_t x;
+    if (control == 0) {
+        if (s->leading[slot] == NO_WINDOW) {
+            return false;
+        }
+        if (!getBits(16 - s->leading[slot] - s->trailing[slot], &raw)) {
+            return false;
+        }
+        x = (uint16_t)(raw << s->trailing[slot]);
+    } else {
+        uint64_t leading, length;
+        if (!getBits(4, &leading) || !getBits(4, &length)) {
+            return false;
+        }
+        length += 1;
+        if (leading + length > 16 || !getBits((int)length, &raw)) {
+            return false;
+        }
+        int trailing = 16 - (int)leading - (int)length;
+        x = (uint16_t)(raw << trailing);
+        s->leading[slot] = (uint8_t)leading;
+        s->trailing[slot] = (uint8_t)trailing;
+    }
+    s->last.values[slot] = (int16_t)((uint16_t)s->last.values[slot] ^ x);
+    return true;
+}
+
+bool SeriesDecoder::getRecord(Series* s) {
+    if (!getTimestamp(s)) {
+        return false;
+    }
+    for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+        if (!getValue(s, slot)) {
+            return false;
+        }
+    }
+    // Rewrite the 48-bit timestamp, the rest of the header stays as it was
+    uint64_t timestamp = (uint64_t)s->timestamp;
+    for (int i = 0; i < 6; i++) {
+        s->last.timestamp_ms[i] = (uint8_t)(timestamp >> (8 * i));
+    }
+    return true;
+}
+
+bool SeriesDecoder::next(SensorRecord* record) {
+    if (decoded >= num_records) {
+        return false;
+    }
+    uint64_t index;
+    if (!getBits(selectorBits(num_series), &index) || index > num_series) {
+        return false;
+    }
+    Series* s;
+    if (index == num_series) {
+        if (num_series == SERIES_BLOCK_MAX_SERIES) {
+            return false;
+        }
+        s = &series[num_series];
+        uint64_t derived = 0;
+        if (version >= 2 && !getBits(1, &derived)) {
+            return false;
+        }
+        if (derived) {
+            uint64_t base, tag_id, value_types;
+            if (num_series == 0 || !getBits(selectorBits(num_series - 1), &base) || base >= num_series ||
+                !getBits(8, &tag_id) || !getBits(8, &value_types)) {
+                return false;
+            }
+            *s = series[base];
+            s->last.tag_id = (uint8_t)tag_id;
+            s->last.value_types = (uint8_t)value_types;
+            s->delta = 0;
+            if (!getRecord(s)) {
+                return false;
+            }
+            s->delta = 0;
+        } else {
+            uint8_t* bytes = (uint8_t*)&s->last;
+            for (size_t i = 0; i < sizeof(SensorRecord); i++) {
+                uint64_t byte;
+                if (!getBits(8, &byte)) {
+                    return false;
+                }
+                bytes[i] = (uint8_t)byte;
+            }
+            s->timestamp = sensorRecordGetTimestamp(&s->last);
+            s->delta = 0;
+            for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+                s->leading[slot] = NO_WINDOW;
+                s->trailing[slot] = 0;
+            }
+        }
+        num_series++;
+    } else {
+        s = &series[index];
+        if (!getRecord(s)) {
+            return false;
+        }
+    }
+    *record = s->last;
+    decoded++;
+    return true;
+}
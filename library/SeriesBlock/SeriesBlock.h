@@ -0,0 +1,160 @@
+/**
+ * @file SeriesBlock.h
+ * @brief Compressed blocks of sensor records, coded Gorilla-style per series.
+ *
+ * A series is the records of one slave and tag group with the same value
+ * types. Within a block every series is coded against its own previous
+ * record: the timestamp as the change of its delta (delta-of-delta), each
+ * value as the XOR with the previous value of the slot, leaving out the
+ * leading and trailing zero bits of the XOR. Slowly changing readings polled
+ * at a steady interval cost a few bits per record instead of 16 bytes.
+ *
+ * The values are the 16-bit words of SensorRecord, fixed point for readings,
+ * so a block decodes bit for bit to the records that went in. Every block
+ * decodes on its own. The first record of a slave in a block is stored whole;
+ * a further series of the same slave, e.g. another statistic of the same
+ * rollup window, starts from the latest series of that slave instead, so
+ * rollups cost a few bytes per statistic rather than a whole record each.
+ *
+ * Layout, version 2, a 4-byte header followed by a bit stream, most
+ * significant bit first:
+ *
+ *     0   size             uint16, bytes in the block, header included
+ *     2   count            uint16, records
+ *     4   records          per record a series selector, then
+ *                          new series:   '0' + the 16-byte record, or
+ *                                        '1' + the index of the series it starts
+ *                                        from + 8 bits tag id + 8 bits value
+ *                                        types, timestamp code, three value codes
+ *                          known series: timestamp code, three value codes
+ *
+ * Selector: the index of the series in order of first appearance, in as many
+ * bits as it takes to write the number of known series n; n itself starts a
+ * new series. The index of the series a new one starts from takes as many
+ * bits as it takes to write n - 1. A new series takes over the value windows
+ * of the one it starts from, and its timestamp is coded as if that series had
+ * a delta of 0; after its first record its delta is 0 either way.
+ *
+ * Version 1 blocks have no '0' or '1' after the selector of a new series,
+ * every new series is a whole record. They are still decoded.
+ *
+ * Timestamp code, D = delta-of-delta in ms:
+ *     '0' D = 0, '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '1111' + 64 bits
+ *
+ * Value code, X = XOR with the previous value:
+ *     '0' X = 0
+ *     '10' + the bits of X inside the previous window of the slot
+ *     '11' + 4 bits leading zeros + 4 bits length - 1 + the meaningful bits of X
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "SensorRecord.h"
+
+#define SERIES_BLOCK_MAX_SERIES     16
+
+// Layout the encoder writes
+#define SERIES_BLOCK_VERSION        2
+
+typedef struct __attribute__((packed)) {
+    uint16_t size;
+    uint16_t count;
+} series_block_header_t;
+
+// Most bytes one record can take: selector, 64-bit timestamp code, three 16-bit value codes
+#define SERIES_BLOCK_RECORD_MAX     19
+
+// Buffer size that always holds a block of count records
+#define SERIES_BLOCK_MAX_SIZE(count) \
+    (sizeof(series_block_header_t) + (size_t)(count) * SERIES_BLOCK_RECORD_MAX + 1)
+
+class SeriesEncoder {
+public:
+    SeriesEncoder();
+
+    // Start a block in buf, at most capacity bytes long and never over 64 KiB
+    void begin(uint8_t* buf, size_t capacity);
+
+    /**
+     * @brief Add a record to the block.
+     *
+     * @return false if it does not fit in the capacity or the series table;
+     *         the block is then unchanged.
+     */
+    bool append(const SensorRecord* record);
+
+    // Write the header, returns the size of the block in bytes
+    size_t finish();
+
+    size_t count() const { return num_records; }
+
+    // Bytes the block takes so far, header included
+    size_t size() const { return (bit_pos + 7) / 8; }
+
+private:
+    struct Series {
+        uint8_t version;
+        uint8_t slave_id;
+        uint8_t tag_id;
+        uint8_t value_types;
+        int64_t timestamp;
+        int64_t delta;
+        uint16_t values[SENSOR_RECORD_VALUES];
+        uint8_t leading[SENSOR_RECORD_VALUES];     // XOR window, 0xff before the first one
+        uint8_t trailing[SENSOR_RECORD_VALUES];
+    };
+
+    void putBits(uint64_t value, int bits);
+    void putTimestamp(Series* series, int64_t timestamp);
+    void putValue(Series* series, int slot, uint16_t value);
+
+    uint8_t* buf;
+    size_t capacity_bits;
+    size_t bit_pos;
+    bool overflow;
+    Series series[SERIES_BLOCK_MAX_SERIES];
+    size_t num_series;
+    size_t num_records;
+};
+
+class SeriesDecoder {
+public:
+    SeriesDecoder();
+
+    // false if buf does not start with a block of the layout version that fits in len bytes
+    bool begin(const uint8_t* buf, size_t len, int version = SERIES_BLOCK_VERSION);
+
+    size_t count() const { return num_records; }
+
+    // Size of the block from its header
+    size_t size() const { return size_bits / 8; }
+
+    // Next record, false after the last one or if the block is corrupt
+    bool next(SensorRecord* record);
+
+private:
+    struct Series {
+        SensorRecord last;
+        int64_t timestamp;
+        int64_t delta;
+        uint8_t leading[SENSOR_RECORD_VALUES];
+        uint8_t trailing[SENSOR_RECORD_VALUES];
+    };
+
+    bool getBits(int bits, uint64_t* value);
+    bool getTimestamp(Series* series);
+    bool getValue(Series* series, int slot);
+    // Timestamp and value codes of a record of a known series
+    bool getRecord(Series* series);
+
+    const uint8_t* buf;
+    size_t size_bits;
+    size_t bit_pos;
+    int version;
+    Series series[SERIES_BLOCK_MAX_SERIES];
+    size_t num_series;
+    size_t num_records;
+    size_t decoded;
+};
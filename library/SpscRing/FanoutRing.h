@@ -0,0 +1,279 @@
+/**
+ * @file FanoutRing.h
+ * @brief Lock-free ring of fixed-size items with one producer and several readers.
+ *
+ * The producer writes each item once, in place, as with SpscRing. Every
+ * reader has its own cursor and reads the items in place; a slot is free
+ * again once every reader has released it, so its reference count is the
+ * number of cursors that have not passed it yet. Nothing is copied per
+ * reader.
+ *
+ * A reader is either holding or spilling. When the ring is full, a holding
+ * reader makes the producer wait (reserve returns 0) as with SpscRing. A
+ * spilling reader that falls a whole ring behind is moved forward instead,
+ * past the oldest quarter of the ring, and those items are counted as
+ * overruns: the producer is never held up by it, and the reader catches up
+ * from wherever the items were also stored. The producer can only move a
+ * reader between peeks, never while it is reading slots in place, so a slow
+ * spilling reader should release as it goes.
+ *
+ * Readers are added before the producer starts. Exactly one task may call
+ * the producer side and one task each reader's side. The indices run freely
+ * through 31 bits and wrap through the power-of-two capacity.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct {
+    uint32_t published;         // Items made visible to the readers
+    uint32_t full;              // Reserve calls that found no free slot
+    uint32_t high_water;        // Most items held at once by the slowest reader
+} fanout_ring_stats_t;
+
+typedef struct {
+    uint32_t consumed;          // Items released by the reader
+    uint32_t overruns;          // Items a spilling reader was moved past
+    uint32_t wakeups;           // Notifications sent to the reader
+    uint32_t lag;               // Items published and not yet released
+    uint32_t max_lag;
+} fanout_reader_stats_t;
+
+template <typename T, size_t N, size_t R>
+class FanoutRing {
+    static_assert(N >= 4 && (N & (N - 1)) == 0, "FanoutRing capacity must be a power of two");
+    static_assert(R >= 1, "FanoutRing needs a reader");
+
+    static constexpr uint32_t INDEX_MASK = 0x7fffffff;
+    static constexpr uint32_t HOLD = 0x80000000;    // Reader is between peek and release
+
+public:
+    FanoutRing() : head(0), num_readers(0), published(0), full(0), high_water(0), readers() {}
+
+    static constexpr size_t capacity() { return N; }
+
+    /**
+     * @brief Add a reader, starting at the next item published.
+     *
+     * @param spill Move the reader on instead of holding up the producer.
+     * @param task  Woken by publish when the reader has caught up, NULL to poll.
+     * @return The reader id, -1 if all R readers are taken.
+     */
+    int addReader(bool spill, TaskHandle_t task = nullptr) {
+        if (num_readers >= R) {
+            return -1;
+        }
+        Reader* reader = &readers[num_readers];
+        reader->state.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        reader->spill = spill;
+        reader->task.store(task, std::memory_order_relaxed);
+        return (int)num_readers++;
+    }
+
+    // Task woken by publish for reader id, e.g. when it is only known once the task runs.
+    // Safe while the producer runs; waitForData() checks for data before it sleeps.
+    void setReaderTask(int id, TaskHandle_t task) { readers[id].task.store(task, std::memory_order_release); }
+
+    size_t getReaderCount() const { return num_readers; }
+
+    // ---- Producer side ----
+
+    /**
+     * @brief Free slots the producer may write, starting at *slots.
+     *
+     * Only the contiguous run up to the end of the storage is returned.
+     * Moves spilling readers on when they are all that keeps the ring full.
+     *
+     * @return Number of writable slots, 0 if a holding reader keeps the ring full.
+     */
+    size_t reserve(T** slots) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        size_t used = this->used(h);
+        if (used == N) {
+            for (size_t i = 0; i < num_readers; i++) {
+                overrun(&readers[i], h);
+            }
+            used = this->used(h);
+        }
+        if (used == N) {
+            full.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        size_t index = h & (N - 1);
+        size_t run = N - index;
+        *slots = &items[index];
+        return N - used < run ? N - used : run;
+    }
+
+    // Single free slot, nullptr if the ring is full
+    T* reserve() {
+        T* slot = nullptr;
+        return reserve(&slot) > 0 ? slot : nullptr;
+    }
+
+    // Make the first count reserved slots visible to every reader
+    void publish(size_t count) {
+        if (count == 0) {
+            return;
+        }
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t next = (h + (uint32_t)count) & INDEX_MASK;
+        head.store(next, std::memory_order_seq_cst);
+        published.fetch_add((uint32_t)count, std::memory_order_relaxed);
+
+        // Pairs with the cursor store in release(): either the reader sees the
+        // new head before it sleeps, or this sees it had caught up
+        uint32_t most = 0;
+        for (size_t i = 0; i < num_readers; i++) {
+            Reader* reader = &readers[i];
+            uint32_t cursor = reader->state.load(std::memory_order_seq_cst) & INDEX_MASK;
+            // Against the new head, the reader may already be reading past the old one
+            uint32_t lag = (next - cursor) & INDEX_MASK;
+            most = lag > most ? lag : most;
+            if (lag > reader->max_lag.load(std::memory_order_relaxed)) {
+                reader->max_lag.store(lag, std::memory_order_relaxed);
+            }
+            TaskHandle_t task = reader->task.load(std::memory_order_acquire);
+            if (cursor == h && task != nullptr) {
+                reader->wakeups.fetch_add(1, std::memory_order_relaxed);
+                xTaskNotifyGive(task);
+            }
+        }
+        if (most > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(most, std::memory_order_relaxed);
+        }
+    }
+
+    // ---- Reader side ----
+
+    /**
+     * @brief Items reader id may read in place, starting at *first.
+     *
+     * The slots stay the reader's until release(); the producer neither
+     * rewrites nor skips them meanwhile.
+     *
+     * @return Number of readable items, 0 if the reader has caught up.
+     */
+    size_t peek(int id, const T** first) {
+        Reader* reader = &readers[id];
+        uint32_t state = reader->state.load(std::memory_order_acquire);
+        while (1) {
+            uint32_t cursor = state & INDEX_MASK;
+            size_t available = (head.load(std::memory_order_acquire) - cursor) & INDEX_MASK;
+            if (available == 0) {
+                return 0;
+            }
+            // Claim the slots, unless the producer moved the cursor on meanwhile
+            if ((state & HOLD) ||
+                reader->state.compare_exchange_weak(state, cursor | HOLD, std::memory_order_acq_rel)) {
+                size_t index = cursor & (N - 1);
+                size_t run = N - index;
+                *first = &items[index];
+                return available < run ? available : run;
+            }
+        }
+    }
+
+    // Hand the first count peeked slots back, also ends the claim of peek()
+    void release(int id, size_t count) {
+        Reader* reader = &readers[id];
+        uint32_t cursor = reader->state.load(std::memory_order_relaxed) & INDEX_MASK;
+        reader->state.store((cursor + (uint32_t)count) & INDEX_MASK, std::memory_order_seq_cst);
+        reader->consumed.fetch_add((uint32_t)count, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Block the reader's task until there is something to read.
+     *
+     * Needs the calling task set for the reader.
+     *
+     * @return false if the reader has still caught up after the timeout.
+     */
+    bool waitForData(int id, TickType_t ticks) {
+        while (isEmpty(id)) {
+            if (ulTaskNotifyTake(pdTRUE, ticks) == 0) {
+                return !isEmpty(id);
+            }
+        }
+        return true;
+    }
+
+    bool isEmpty(int id) const {
+        return head.load(std::memory_order_seq_cst) ==
+               (readers[id].state.load(std::memory_order_relaxed) & INDEX_MASK);
+    }
+
+    // Items the reader has not released yet
+    size_t lag(int id) const {
+        return (head.load(std::memory_order_acquire) - readers[id].state.load(std::memory_order_acquire)) &
+               INDEX_MASK;
+    }
+
+    void getStats(fanout_ring_stats_t* stats) const {
+        stats->published = published.load(std::memory_order_relaxed);
+        stats->full = full.load(std::memory_order_relaxed);
+        stats->high_water = high_water.load(std::memory_order_relaxed);
+    }
+
+    void getReaderStats(int id, fanout_reader_stats_t* stats) const {
+        const Reader* reader = &readers[id];
+        stats->consumed = reader->consumed.load(std::memory_order_relaxed);
+        stats->overruns = reader->overruns.load(std::memory_order_relaxed);
+        stats->wakeups = reader->wakeups.load(std::memory_order_relaxed);
+        stats->lag = (uint32_t)lag(id);
+        stats->max_lag = reader->max_lag.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Reader {
+        Reader() : state(0), spill(false), task(nullptr), consumed(0), overruns(0), wakeups(0), max_lag(0) {}
+
+        // Cursor and HOLD, on a cache line of its own
+        alignas(64) std::atomic<uint32_t> state;
+        bool spill;
+        std::atomic<TaskHandle_t> task;     // Set by the reader's task, read by publish
+        std::atomic<uint32_t> consumed;
+        std::atomic<uint32_t> overruns;
+        std::atomic<uint32_t> wakeups;
+        std::atomic<uint32_t> max_lag;
+    };
+
+    // Items behind head for the slowest reader
+    size_t used(uint32_t h) const {
+        size_t most = 0;
+        for (size_t i = 0; i < num_readers; i++) {
+            size_t lag = (h - readers[i].state.load(std::memory_order_acquire)) & INDEX_MASK;
+            most = lag > most ? lag : most;
+        }
+        return most;
+    }
+
+    // Move a spilling reader that is a whole ring behind past the oldest quarter
+    void overrun(Reader* reader, uint32_t h) {
+        uint32_t state = reader->state.load(std::memory_order_acquire);
+        if (!reader->spill || (state & HOLD) || ((h - state) & INDEX_MASK) != N) {
+            return;
+        }
+        if (reader->state.compare_exchange_strong(state, (state + N / 4) & INDEX_MASK,
+                                                  std::memory_order_acq_rel)) {
+            reader->overruns.fetch_add(N / 4, std::memory_order_relaxed);
+        }
+    }
+
+    // Producer index and producer-written state share a cache line,
+    // each reader's state is on its own
+    alignas(64) std::atomic<uint32_t> head;
+    size_t num_readers;
+    std::atomic<uint32_t> published;
+    std::atomic<uint32_t> full;
+    std::atomic<uint32_t> high_water;
+
+    Reader readers[R];
+
+    T items[N];
+};
@@ -0,0 +1,213 @@
+/**
+ * @file SpscRing.h
+ * @brief Lock-free single-producer, single-consumer ring of fixed-size items.
+ *
+ * The producer reserves free slots, writes the items in place and publishes
+ * them; the consumer peeks at published items, reads them in place and
+ * releases the slots. Both sides may work on several slots at once, so a batch
+ * costs one pair of atomic index updates instead of a copy and a critical
+ * section per item as with a FreeRTOS queue.
+ *
+ * Exactly one task may call the producer side (reserve, publish) and exactly
+ * one the consumer side (peek, release, waitForData). The indices run freely
+ * and wrap through the power-of-two capacity.
+ *
+ * The consumer task can block in waitForData. The producer sends it a task
+ * notification only when a publish takes the ring from empty to non-empty, so
+ * a busy consumer is never woken per item.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct {
+    uint32_t published;         // Items made visible to the consumer
+    uint32_t consumed;          // Items released by the consumer
+    uint32_t full;              // Reserve calls that found no free slot
+    uint32_t wakeups;           // Notifications sent to the consumer
+    uint32_t high_water;        // Most items in the ring at once
+} spsc_ring_stats_t;
+
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : head(0), consumer(nullptr), published(0), full(0), wakeups(0), high_water(0),
+                 tail(0), consumed(0) {}
+
+    static constexpr size_t capacity() { return N; }
+
+    // Task woken by publish, NULL to poll without notifications
+    void setConsumer(TaskHandle_t task) { consumer = task; }
+
+    // ---- Producer side ----
+
+    /**
+     * @brief Free slots the producer may write, starting at *slots.
+     *
+     * Only the contiguous run up to the end of the storage is returned; call
+     * again after publishing to get the slots past the wrap.
+     *
+     * @return Number of writable slots, 0 if the ring is full.
+     */
+    size_t reserve(T** slots) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        size_t free_slots = N - (size_t)(h - t);
+        size_t index = h & (N - 1);
+        size_t run = N - index;
+        if (free_slots == 0) {
+            full.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        *slots = &items[index];
+        return free_slots < run ? free_slots : run;
+    }
+
+    // Single free slot, nullptr if the ring is full
+    T* reserve() {
+        T* slot = nullptr;
+        return reserve(&slot) > 0 ? slot : nullptr;
+    }
+
+    // Make the first count reserved slots visible to the consumer
+    void publish(size_t count) {
+        if (count == 0) {
+            return;
+        }
+        uint32_t h = head.load(std::memory_order_relaxed);
+        head.store(h + (uint32_t)count, std::memory_order_seq_cst);
+
+        // Pairs with the tail store in release(): either the consumer sees the
+        // new head before it sleeps, or this sees the ring was empty
+        uint32_t t = tail.load(std::memory_order_seq_cst);
+        uint32_t used = h + (uint32_t)count - t;
+        published.fetch_add((uint32_t)count, std::memory_order_relaxed);
+        if (used > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(used, std::memory_order_relaxed);
+        }
+        if (t == h && consumer != nullptr) {
+            wakeups.fetch_add(1, std::memory_order_relaxed);
+            xTaskNotifyGive(consumer);
+        }
+    }
+
+    // Copy one item in, false if the ring is full
+    bool push(const T& item) {
+        T* slot = reserve();
+        if (slot == nullptr) {
+            return false;
+        }
+        *slot = item;
+        publish(1);
+        return true;
+    }
+
+    // ---- Consumer side ----
+
+    /**
+     * @brief Published items the consumer may read, starting at *first.
+     *
+     * Like reserve(), only the contiguous run up to the end of the storage is
+     * returned.
+     *
+     * @return Number of readable items, 0 if the ring is empty.
+     */
+    size_t peek(const T** first) const {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        size_t available = (size_t)(h - t);
+        size_t index = t & (N - 1);
+        size_t run = N - index;
+        if (available == 0) {
+            return 0;
+        }
+        *first = &items[index];
+        return available < run ? available : run;
+    }
+
+    // Hand the first count peeked slots back to the producer
+    void release(size_t count) {
+        if (count == 0) {
+            return;
+        }
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        tail.store(t + (uint32_t)count, std::memory_order_seq_cst);
+        consumed.fetch_add((uint32_t)count, std::memory_order_relaxed);
+    }
+
+    // Copy up to max items out, returns how many
+    size_t pop(T* out, size_t max) {
+        size_t copied = 0;
+        while (copied < max) {
+            const T* first = nullptr;
+            size_t available = peek(&first);
+            if (available == 0) {
+                break;
+            }
+            if (available > max - copied) {
+                available = max - copied;
+            }
+            for (size_t i = 0; i < available; i++) {
+                out[copied + i] = first[i];
+            }
+            release(available);
+            copied += available;
+        }
+        return copied;
+    }
+
+    /**
+     * @brief Block the consumer task until an item is published.
+     *
+     * Needs setConsumer() with the calling task.
+     *
+     * @return false if the ring is still empty after the timeout.
+     */
+    bool waitForData(TickType_t ticks) {
+        while (isEmpty()) {
+            if (ulTaskNotifyTake(pdTRUE, ticks) == 0) {
+                return !isEmpty();
+            }
+        }
+        return true;
+    }
+
+    bool isEmpty() const {
+        return head.load(std::memory_order_seq_cst) == tail.load(std::memory_order_relaxed);
+    }
+
+    // Items in the ring, exact only on the producer or consumer task
+    size_t size() const {
+        return (size_t)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+    }
+
+    void getStats(spsc_ring_stats_t* stats) const {
+        stats->published = published.load(std::memory_order_relaxed);
+        stats->consumed = consumed.load(std::memory_order_relaxed);
+        stats->full = full.load(std::memory_order_relaxed);
+        stats->wakeups = wakeups.load(std::memory_order_relaxed);
+        stats->high_water = high_water.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Producer index and producer-written state share a cache line,
+    // the consumer's are on the next one
+    alignas(64) std::atomic<uint32_t> head;
+    TaskHandle_t consumer;
+    std::atomic<uint32_t> published;
+    std::atomic<uint32_t> full;
+    std::atomic<uint32_t> wakeups;
+    std::atomic<uint32_t> high_water;
+
+    alignas(64) std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> consumed;
+
+    T items[N];
+};
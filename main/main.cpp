@@ -2,64 +2,153 @@
  * @file main.cpp
  * @brief ESP-IDF IoT Gateway for PAKTANI IOT.
  *        A Modbus Master that connects to WiFi, polls Modbus slaves,
- *        and stores sensor data (with RTC timestamp) in a FIFO queue.
+ *        stores sensor data (with RTC timestamp) in a flash log and
+ *        forwards it to an MQTT broker.
  */
 
+ #include <math.h>
  #include <stdio.h>
  #include <string.h>
  #include <time.h>
+ #include <vector>
  
  #include "freertos/FreeRTOS.h"
  #include "freertos/task.h"
- #include "freertos/queue.h"
+ #include "freertos/semphr.h"
  #include "sdkconfig.h"
  #include "esp_log.h"
+ #include "nvs_flash.h"
  
  #include "Wifi.h"
- #include "DS3231.h"
+ #include "ds3231.h"
+ #include "RtcClock.h"
  #include "I2CMaster.h"
  #include "Modbus.h"
+ #include "ModbusBus.h"
+ #include "ModbusReadPlan.h"
+ #include "ModbusScheduler.h"
+ #include "ModbusHealth.h"
+ #include "ModbusDeadband.h"
+ #include "ModbusShadow.h"
+ #include "ModbusSegment.h"
+ #include "ModbusProfiles.h"
+ #include "ModbusTcpServer.h"
  #include "Gpio.h"
+ #include "SensorRecord.h"
+ #include "SensorPipeline.h"
+ #include "SensorLogSink.h"
+ #include "SensorFilterSink.h"
+ #include "FlashLog.h"
+ #include "FlashLogSink.h"
+ #include "MqttUplink.h"
+ #include "SensorRollup.h"
  
  // Tag for logging
  #define TAG "MAIN"
 
  #define CONFIG_MB_UART_BAUD_RATE 115200
+
+ // GPIO wired to the DS3231 INT/SQW output, GPIO_NUM_NC if it is not connected
+ #define RTC_SQW_GPIO GPIO_NUM_4
+ 
+ // Broker the records and the flash log backlog are forwarded to
+ #define MQTT_BROKER_URI "mqtt://broker.local"
+ #define MQTT_TOPIC "paktani/gateway/records"
+ 
+ // Print every record from a low-priority task, 0 to keep the console free
+ #define SENSOR_DEBUG_LOG 1
+ 
+ // Tag groups stored and sent raw next to their 1 and 15 minute rollups,
+ // e.g. SENSOR_ROLLUP_TAG_BIT(SENSOR_TAG_CLIMATE)
+ #define SENSOR_ROLLUP_RAW_TAGS 0
+ 
+ // RS-485 segments polled side by side, one per UART. esp-modbus runs a single
+ // controller, so the second segment needs the in-tree RTU master.
+ #define MODBUS_SEGMENTS (MB_BUS_NATIVE_RTU ? 2 : 1)
+
+ // Task layout. The network side shares core 0 with the Wi-Fi driver and lwIP;
+ // the Modbus segments get core 1, each poll task with its bus task one priority above.
+ #define WIFI_TASK_CORE          0
+ #define WIFI_TASK_PRIORITY      5
+ #define UPLINK_TASK_CORE        0
+ #define UPLINK_TASK_PRIORITY    MQTT_UPLINK_PRIORITY
+ #define STORAGE_TASK_CORE       0
+ #define STORAGE_TASK_PRIORITY   1
+ #define MODBUS_TASK_CORE        1
+ #define MODBUS_TASK_PRIORITY    MB_SEGMENT_TASK_PRIORITY
+
+ // UART pins of the segments, the RS-485 transceivers switch direction on their own.
+ // GPIO6-11 are the SPI flash on the ESP32 and GPIO2 and GPIO4 carry the LED and RTC SQW;
+ // the strapping pins (0, 2, 5, 12, 15) are best left alone too.
+ #define MODBUS_SEGMENT0_TX_GPIO 17
+ #define MODBUS_SEGMENT0_RX_GPIO 16
+ #define MODBUS_SEGMENT1_TX_GPIO 25
+ #define MODBUS_SEGMENT1_RX_GPIO 26
+ 
+ // Slaves to poll, each an instance of one of the device types; from NVS or default_slaves
+ ModbusProfiles modbusProfiles(device_types, num_device_types);
+
+ // Last polled registers of every slave, for readers that must not wait for the bus
+ ModbusShadow modbusShadow;
+
+ // One bus, read plan and poll task per segment
+ ModbusSegment modbusSegments[MODBUS_SEGMENTS] = {
+     { &modbusShadow, UART_NUM_1, MB_DEV_SPEED, MODBUS_SEGMENT0_TX_GPIO, MODBUS_SEGMENT0_RX_GPIO, -1 },
+ #if MODBUS_SEGMENTS > 1
+     { &modbusShadow, UART_NUM_2, MB_DEV_SPEED, MODBUS_SEGMENT1_TX_GPIO, MODBUS_SEGMENT1_RX_GPIO, -1 },
+ #endif
+ };
+
+ // Timestamps come from esp_timer, kept on the RTC by the clock task
+ I2CMaster i2cMaster(I2C_NUM_0);
+ DS3231 rtc(&i2cMaster);
+ RtcClock rtcClock(&rtc, RTC_SQW_GPIO);
+ 
+ // SCADA and HMI reads over Modbus TCP are answered from the shadow, writes go to the bus
+ ModbusTcpServer modbusTcpServer(&modbusShadow);
+ bool modbusTcpServerReady = false;
+ 
+ // Raw records whose readings stay inside their deadbands are not stored or sent.
+ // The rollups see every sample and always pass.
+ ModbusDeadband modbusDeadband;
+ static bool reportRecord(const SensorRecord* record, void* arg);
+ 
+ // Sensor records from the Modbus segments, written once and read in place by every consumer
+ SensorRing sensorRing;
+
+ // The ring takes one producer, the poll tasks of the segments take turns
+ SemaphoreHandle_t sensorRingProducer = NULL;
  
- // Size of the FIFO queue for sensor data
- #define SENSOR_QUEUE_LENGTH 50
+ // Consumer stage run by the storage task, and the optional debug log reading the ring on its own task
+ SensorPipeline sensorPipeline(&sensorRing);
+ SensorLogSink sensorLogSink(&sensorRing);
  
- // Structure to hold sensor data with timestamp
- typedef struct {
-     struct tm timestamp;  // RTC timestamp
-     uint8_t slave_id;     // Modbus slave ID
-     uint16_t dev_status;  // Device status (1 register)
-     float humidity;       // Humidity (converted from 2 registers)
-     float temperature;    // Temperature (converted from 2 registers)
- } SensorRecord;
+ // Backlog in the "sensorlog" flash partition until the data reaches the cloud, compressed
+ FlashLog flashLog(FLASH_LOG_PARTITION_LABEL, true);
+ FlashLogSink flashLogSink(&flashLog, SENSOR_ROLLUP_RAW_TAGS ? FLASH_LOG_FLUSH_MS : FLASH_LOG_ROLLUP_FLUSH_MS);
+ bool flashLogMounted = false;
  
- // Global FIFO queue handle for sensor data
- QueueHandle_t sensorDataQueue = NULL;
+ // Deadbands on what leaves the rollup stage for the flash log
+ SensorFilterSink deadbandSink(&flashLogSink, reportRecord);
+
+ // Rolls the records up into windows ahead of the flash log
+ SensorRollup sensorRollup(&deadbandSink);
+ 
+ // Sends new records live and the backlog within a bandwidth budget, started once the network stack is up
+ MqttUplink mqttUplink(&flashLog);
+ bool mqttUplinkReady = false;
  
  // Global flag for WiFi connection status (can trigger mode change)
  volatile bool wifiConnected = false;
  
  // Forward declarations of tasks
  void wifiTask(void *pvParameters);
- void modbusTask(void *pvParameters);
+ void storageTask(void *pvParameters);
  void ledTask(void *pvParameters);
  
  // Global LED instance (using GPIO2 as example)
  Gpio led(GPIO_NUM_2, GPIO_MODE_OUTPUT);
  
- // Helper function: Convert two 16-bit registers to float (IEEE 754, big-endian)
- float convertRegistersToFloat(uint16_t high, uint16_t low) {
-     uint32_t combined = ((uint32_t)high << 16) | low;
-     float value;
-     memcpy(&value, &combined, sizeof(value));
-     return value;
- }
- 
  // Task to initialize and maintain WiFi connection
  void wifiTask(void *pvParameters) {
      Wifi wifi;
@@ -70,6 +159,15 @@
      if (!wifi.init()) {
          ESP_LOGE(TAG, "WiFi initialization failed");
      }
+ 
+     // The MQTT client reconnects by itself whenever the link comes back
+     if (mqttUplinkReady && mqttUplink.start() != ESP_OK) {
+         ESP_LOGE(TAG, "MQTT client failed to start");
+     }
+     // Listens on any address, clients reach it as soon as the station has one
+     if (modbusTcpServerReady && modbusTcpServer.start() != ESP_OK) {
+         ESP_LOGE(TAG, "Modbus TCP server failed to start");
+     }
      if (!wifi.connect()) {
          ESP_LOGE(TAG, "WiFi connection failed");
          wifiConnected = false;
@@ -89,79 +187,110 @@
      }
  }
  
- // Task to poll Modbus slaves, get RTC time, and store the data in a FIFO queue
- void modbusTask(void *pvParameters) {
-     // Initialize the I2C master and RTC (DS3231)
-     I2CMaster i2c_master(I2C_NUM_0);
-     DS3231 rtc(&i2c_master);
-     if (rtc.init() != ESP_OK) {
-         ESP_LOGE(TAG, "RTC initialization failed");
+ // Runs on the poll task of a segment after each slave: build its record in the sensor ring
+ static void recordSlave(ModbusSegment* segment, uint8_t slave_id, esp_err_t err, void* arg) {
+     const mb_device_type_t* type = modbusProfiles.getType(slave_id);
+     if (type == NULL || type->type_id != DEVICE_TYPE_CLIMATE) {
+         return;
      }
- 
-     ModbusRTU modbus1(MB_DEVICE_ADDR1, UART_NUM_1, MB_DEV_SPEED, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
-     ModbusRTU modbus2(MB_DEVICE_ADDR2, UART_NUM_1, MB_DEV_SPEED, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
-     ModbusRTU modbus3(MB_DEVICE_ADDR3, UART_NUM_1, MB_DEV_SPEED, UART_PARITY_DISABLE, MB_MODE_RTU, 17, 16, -1);
- 
-     // Initialize each Modbus interface
-     if (!modbus1.init()) {
-         ESP_LOGE(TAG, "Modbus init failed for slave 1");
+     int64_t timestamp_ms = rtcClock.nowMs();
+
+     // Status, humidity and temperature, decoded by the sensor's register map
+     const uint16_t* regs = segment->getPlan().getRegisters(slave_id, MB_PARAM_HOLDING, ClimateSensorMap::start,
+                                                            ClimateSensorMap::span);
+     if (regs == NULL) {
+         ESP_LOGE(TAG, "Modbus read failed for slave %d: %s", slave_id, esp_err_to_name(err));
+         return;
      }
-     if (!modbus2.init()) {
-         ESP_LOGE(TAG, "Modbus init failed for slave 2");
+     auto [status, humidity, temperature] = ClimateSensorMap::decode(regs);
+
+     // Build the record directly in its ring slot, a slot left unpublished stays free
+     xSemaphoreTake(sensorRingProducer, portMAX_DELAY);
+     SensorRecord* record = sensorRing.reserve();
+     if (record == NULL) {
+         ESP_LOGW(TAG, "Sensor data ring full, record dropped");
+     } else {
+         sensorRecordInit(record, slave_id, SENSOR_TAG_CLIMATE, timestamp_ms);
+         // A failed reading is NaN and leaves its slot unused, never a saturated value
+         bool stored = sensorRecordSetValue(record, 0, SENSOR_VALUE_U16, status);
+         stored = sensorRecordSetValue(record, 1, SENSOR_VALUE_CENTI, humidity) && stored;
+         stored = sensorRecordSetValue(record, 2, SENSOR_VALUE_CENTI, temperature) && stored;
+         if (!stored) {
+             ESP_LOGD(TAG, "Slave %d has readings without a value or out of range", slave_id);
+         }
+         sensorRing.publish(1);
+         ESP_LOGD(TAG, "Recorded data from slave %d", slave_id);
      }
-     if (!modbus3.init()) {
-         ESP_LOGE(TAG, "Modbus init failed for slave 3");
+     xSemaphoreGive(sensorRingProducer);
+ }
+
+ // Runs on the storage task for each record on its way to the flash log: raw climate
+ // records go only when a reading moved past its deadband or a heartbeat is due
+ static bool reportRecord(const SensorRecord* record, void* arg) {
+     if (record->tag_id != SENSOR_TAG_CLIMATE) {
+         return true;
      }
- 
-     uint16_t response[5]; // To hold the five registers read from a slave
-     SensorRecord record;
-     struct tm currentTime;
- 
-     while (1) {
-         // Loop over each modbus slave
-         for (int i = 0; i < 3; i++) {
-             ModbusRTU* modbus = NULL;
-             uint8_t slave_id = 0;
-             if (i == 0) {
-                 modbus = &modbus1;
-                 slave_id = MB_DEVICE_ADDR1;
-             } else if (i == 1) {
-                 modbus = &modbus2;
-                 slave_id = MB_DEVICE_ADDR2;
-             } else if (i == 2) {
-                 modbus = &modbus3;
-                 slave_id = MB_DEVICE_ADDR3;
-             }
- 
-             // Get current time from the RTC
-             if (rtc.getTime(&currentTime) != ESP_OK) {
-                 ESP_LOGE(TAG, "Failed to get RTC time");
-             }
- 
-             // Read 5 holding registers starting at address 8:
-             // [0]: device status, [1-2]: humidity, [3-4]: temperature.
-             if (modbus->readHoldingRegisters(8, 5, response)) {
-                 record.slave_id = slave_id;
-                 record.timestamp = currentTime;
-                 record.dev_status = response[0];
-                 record.humidity = convertRegistersToFloat(response[1], response[2]);
-                 record.temperature = convertRegistersToFloat(response[3], response[4]);
- 
-                 // Enqueue the sensor record into the FIFO queue
-                 if (xQueueSend(sensorDataQueue, &record, 0) != pdPASS) {
-                     ESP_LOGW(TAG, "Sensor data queue full, record dropped");
-                 } else {
-                     ESP_LOGI(TAG, "Recorded data from slave %d", slave_id);
-                 }
-             } else {
-                 ESP_LOGE(TAG, "Modbus read failed for slave %d", slave_id);
+     const uint16_t cids[] = { modbusProfiles.getCid(record->slave_id, CLIMATE_PARAM_STATUS),
+                               modbusProfiles.getCid(record->slave_id, CLIMATE_PARAM_HUMIDITY),
+                               modbusProfiles.getCid(record->slave_id, CLIMATE_PARAM_TEMPERATURE) };
+     float values[SENSOR_RECORD_VALUES];
+     for (int slot = 0; slot < SENSOR_RECORD_VALUES; slot++) {
+         if (!sensorRecordGetValue(record, slot, &values[slot])) {
+             values[slot] = NAN;
+         }
+     }
+     if (!modbusDeadband.filter(cids, values, SENSOR_RECORD_VALUES, sensorRecordGetTimestamp(record))) {
+         ESP_LOGD(TAG, "Slave %d within its deadbands", record->slave_id);
+         return false;
+     }
+     return true;
+ }
+
+ // Plan and start the polling of every segment that has slaves. Slaves of a
+ // segment this build does not have are polled on the first one.
+ static void startModbusSegments() {
+     size_t num_slaves = modbusProfiles.getNumSlaves();
+     for (int s = 0; s < MODBUS_SEGMENTS; s++) {
+         std::vector<mb_segment_slave_t> segment_slaves;
+         for (size_t i = 0; i < num_slaves; i++) {
+             const mb_profile_slave_t& slave = modbusProfiles.getSlave(i);
+             int segment = slave.segment < MODBUS_SEGMENTS ? slave.segment : 0;
+             if (segment == s) {
+                 segment_slaves.push_back({ slave.slave_addr, slave.period_ms, slave.priority, slave.jitter_ms });
              }
- 
-             vTaskDelay(POLL_TIMEOUT_TICS);
          }
-         vTaskDelay(1000 / portTICK_PERIOD_MS);
+         size_t count = segment_slaves.size();
+         if (count == 0) {
+             continue;
+         }
+
+         mb_segment_config_t config = MB_SEGMENT_DEFAULT_CONFIG();
+         config.profiles = &modbusProfiles;
+         config.slaves = segment_slaves.data();
+         config.num_slaves = count;
+         config.core_id = MODBUS_TASK_CORE;
+         config.priority = MODBUS_TASK_PRIORITY;
+         ModbusSegment& segment = modbusSegments[s];
+         if (segment.init(&config) != ESP_OK) {
+             ESP_LOGE(TAG, "Modbus segment on UART%d unavailable", (int)segment.getPort());
+             continue;
+         }
+
+         // Writes from Modbus TCP go to the segment of their slave
+         for (size_t i = 0; i < count; i++) {
+             modbusTcpServer.setBus(segment.getBus(), segment_slaves[i].slave_addr);
+         }
+         segment.setPollCallback(recordSlave, NULL);
+         if (segment.start() != ESP_OK) {
+             ESP_LOGE(TAG, "Modbus segment on UART%d failed to start", (int)segment.getPort());
+         }
      }
  }
+
+ // The consumer stage drains the sensor ring in batches into the rollup and the flash log
+ void storageTask(void *pvParameters) {
+     sensorPipeline.run();
+ }
  
  // Task to toggle LED for visual feedback
  void ledTask(void *pvParameters) {
@@ -176,24 +305,77 @@
      // Initialize the LED
      led.init();
  
-     // Create the sensor data FIFO queue
-     sensorDataQueue = xQueueCreate(SENSOR_QUEUE_LENGTH, sizeof(SensorRecord));
-     if (sensorDataQueue == NULL) {
-         ESP_LOGE(TAG, "Failed to create sensor data queue");
-     }
- 
-     // Create the WiFi, Modbus, and LED tasks
-     xTaskCreate(wifiTask, "wifiTask", 4096, NULL, 5, NULL);
-     xTaskCreate(modbusTask, "modbusTask", 8192, NULL, 5, NULL);
-     xTaskCreate(ledTask, "ledTask", 2048, NULL, 5, NULL);
- 
-     SensorRecord rec;
-     while (1) {
-         if (xQueueReceive(sensorDataQueue, &rec, portMAX_DELAY) == pdPASS) {
-             ESP_LOGI(TAG, "Data from slave %d: status=%d, humidity=%.2f, temp=%.2f at %02d:%02d:%02d",
-                      rec.slave_id, rec.dev_status, rec.humidity, rec.temperature,
-                      rec.timestamp.tm_hour, rec.timestamp.tm_min, rec.timestamp.tm_sec);
+     // Sinks for the consumer stage, formatting is left to the debug sink
+     flashLogMounted = flashLog.mount() == ESP_OK;
+     if (flashLogMounted) {
+         // Only rollups, and the raw records of the selected tag groups, are kept
+         sensor_rollup_config_t rollup_config = SENSOR_ROLLUP_DEFAULT_CONFIG();
+         rollup_config.raw_tags = SENSOR_ROLLUP_RAW_TAGS;
+         if (sensorRollup.init(&rollup_config) == ESP_OK) {
+             sensorPipeline.addSink(&sensorRollup);
+         } else {
+             ESP_LOGE(TAG, "Rollup configuration rejected, logging raw records");
+             sensorPipeline.addSink(&deadbandSink);
+         }
+
+         // The uplink replays the log and gets new records live through the sink's tap
+         mqtt_uplink_config_t uplink_config = MQTT_UPLINK_DEFAULT_CONFIG();
+         uplink_config.broker_uri = MQTT_BROKER_URI;
+         uplink_config.topic = MQTT_TOPIC;
+         uplink_config.core_id = UPLINK_TASK_CORE;
+         uplink_config.priority = UPLINK_TASK_PRIORITY;
+         mqttUplinkReady = mqttUplink.init(&uplink_config) == ESP_OK;
+         if (mqttUplinkReady) {
+             flashLogSink.setTap(&mqttUplink);
+         } else {
+             ESP_LOGE(TAG, "MQTT uplink initialization failed");
          }
+     } else {
+         ESP_LOGE(TAG, "Flash log unavailable, records are not backed up");
+     }
+     // Unit ids are the slave addresses on the RS-485 segments
+     mb_tcp_server_config_t tcp_config = MB_TCP_SERVER_DEFAULT_CONFIG();
+     modbusTcpServerReady = modbusTcpServer.init(&tcp_config) == ESP_OK;
+     if (SENSOR_DEBUG_LOG && sensorLogSink.init() != ESP_OK) {
+         ESP_LOGE(TAG, "Sensor debug log unavailable");
+     }
+
+     // Initialize the I2C master and RTC (DS3231), then the clock on top of them
+     if (rtc.init() != ESP_OK) {
+         ESP_LOGE(TAG, "RTC initialization failed");
+     }
+     if (rtcClock.init() != ESP_OK) {
+         ESP_LOGE(TAG, "RTC clock initialization failed");
      }
+
+     // Device profiles stored in NVS, or the compiled-in slaves when there are none
+     esp_err_t err = nvs_flash_init();
+     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+         nvs_flash_erase();
+         err = nvs_flash_init();
+     }
+     if (err == ESP_OK) {
+         err = modbusProfiles.loadFromNvs(MB_PROFILE_NVS_NAMESPACE, MB_PROFILE_NVS_KEY);
+     }
+     if (err != ESP_OK) {
+         ESP_LOGW(TAG, "No device profiles in NVS (%s), polling the default slaves", esp_err_to_name(err));
+         modbusProfiles.setSlaves(default_slaves, num_default_slaves);
+     }
+
+     // The shadow covers every CID of the profiles, each segment fills in its own slaves
+     ModbusReadPlan plan;
+     if (!plan.build(modbusProfiles) || !modbusShadow.init(plan)) {
+         ESP_LOGE(TAG, "Modbus register shadow unavailable");
+     }
+     if (!modbusDeadband.init(modbusProfiles)) {
+         ESP_LOGE(TAG, "Deadband table rejected, every record is reported");
+     }
+     sensorRingProducer = xSemaphoreCreateMutex();
+
+     // Create the WiFi, storage and LED tasks, then the poll tasks of the segments
+     xTaskCreatePinnedToCore(wifiTask, "wifiTask", 4096, NULL, WIFI_TASK_PRIORITY, NULL, WIFI_TASK_CORE);
+     xTaskCreatePinnedToCore(storageTask, "storageTask", 4096, NULL, STORAGE_TASK_PRIORITY, NULL, STORAGE_TASK_CORE);
+     xTaskCreate(ledTask, "ledTask", 2048, NULL, 5, NULL);
+     startModbusSegments();
  }
  
\ No newline at end of file